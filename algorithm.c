@@ -6,10 +6,10 @@
 #include <string.h>
 
 algorithm_t algos[] = {
-    { "scrypt",      ALGO_SCRYPT,     "scrypt(1024, 1, 1)", sha256d, sha256d, scanhash_scrypt, scrypthash, NULL, init_scrypt_contexts, NULL },
-    { "scrypt-jane", ALGO_SCRYPTJANE, "scrypt-jane", sha256d, sha256d, scanhash_scrypt_jane, scrypt_janehash, NULL, init_scrypt_jane_contexts, NULL },
+    { "scrypt",      ALGO_SCRYPT,     "scrypt(1024, 1, 1)", sha256d, sha256d, scanhash_scrypt, scrypthash, NULL, init_scrypt_contexts, free_scrypt_contexts },
+    { "scrypt-jane", ALGO_SCRYPTJANE, "scrypt-jane", sha256d, sha256d, scanhash_scrypt_jane, scrypt_janehash, NULL, init_scrypt_jane_contexts, free_scrypt_jane_contexts },
     { "dscrypt",     ALGO_DCRYPT,     "dcrypt", sha256d, sha256d, scanhash_dcrypt, dcrypthash, NULL, init_dcrypt_contexts, NULL },
-    { "argon2",      ALGO_ARGON2,     "argon2", sha256, sha256d, scanhash_argon2, argon2hash, NULL, NULL, NULL },
+    { "argon2",      ALGO_ARGON2,     "argon2", sha256, sha256d, scanhash_argon2, argon2hash, NULL, init_argon2_contexts, free_argon2_contexts },
     { "yescrypt",    ALGO_YESCRYPT,   "yescrypt", sha256d, sha256d, scanhash_yescrypt, yescrypthash, NULL, NULL, NULL },
     { "sha256d",     ALGO_SHA256D,    "SHA-256d", sha256d, sha256d, scanhash_sha256d, NULL, NULL, NULL, NULL },
     { "blake",       ALGO_BLAKE,      "Blake", sha256d, sha256d, scanhash_blake, blakehash, NULL, init_blake_contexts, NULL },
@@ -35,22 +35,22 @@ algorithm_t algos[] = {
     { "timetravel10",ALGO_TIMETRAVEL10,"TimeTravel10", sha256d, sha256d, scanhash_timetravel10, timetravel10hash, NULL, init_timetravel10_contexts, NULL },
     { "sib",         ALGO_SIB,        "Sib", sha256d, sha256d, scanhash_sib, sibhash, NULL, init_sib_contexts, NULL },
     { "veltor",      ALGO_VELTOR,     "Veltor", sha256d, sha256d, scanhash_veltor, veltorhash, NULL, init_veltor_contexts, NULL },
-    { "x11",         ALGO_X11,        "X11", sha256d, sha256d, scanhash_x11, x11hash, NULL, init_x11_contexts, NULL },
+    { "x11",         ALGO_X11,        "X11", sha256d, sha256d, NULL, x11hash, NULL, init_x11_contexts, NULL, x11hash_batch },
     { "x13",         ALGO_X13,        "X13", sha256d, sha256d, scanhash_x13, x13hash, NULL, init_x13_contexts, NULL },
     { "x14",         ALGO_X14,        "X14", sha256d, sha256d, scanhash_x14, x14hash, NULL, init_x14_contexts, NULL },
     { "x15",         ALGO_X15,        "X15", sha256d, sha256d, scanhash_x15, x15hash, NULL, init_x15_contexts, NULL },
     { "xevan",       ALGO_XEVAN,      "Xevan", sha256d, sha256d, scanhash_xevan, xevanhash, NULL, init_xevan_contexts, NULL },
-    { "lyra2re",     ALGO_LYRA2RE,    "Lyra2RE", sha256d, sha256d, scanhash_lyra2re, lyra2rehash, NULL, init_lyra2re_contexts, NULL },
-    { "lyra2rev2",   ALGO_LYRA2REV2,  "Lyra2RE rev2", sha256d, sha256d, scanhash_lyra2rev2, lyra2rev2hash, NULL, init_lyra2rev2_contexts, NULL },
-    { "xzc",         ALGO_XZC,        "Xzc", sha256d, sha256d, scanhash_xzc, xzchash, xzc_prepare_work, NULL, NULL },
+    { "lyra2re",     ALGO_LYRA2RE,    "Lyra2RE", sha256d, sha256d, scanhash_lyra2re, lyra2rehash, NULL, init_lyra2re_contexts, free_lyra2re_contexts },
+    { "lyra2rev2",   ALGO_LYRA2REV2,  "Lyra2RE rev2", sha256d, sha256d, scanhash_lyra2rev2, lyra2rev2hash, NULL, init_lyra2rev2_contexts, free_lyra2rev2_contexts },
+    { "xzc",         ALGO_XZC,        "Xzc", sha256d, sha256d, scanhash_xzc, xzchash, xzc_prepare_work, NULL, free_xzc_contexts },
     { "groestl",     ALGO_GROESTL,    "Groestl", sha256, sha256, scanhash_groestl, groestlhash, NULL, init_groestl_contexts, NULL },
     { "myr-groestl", ALGO_MYRGROESTL, "Myriadcoin-groestl", sha256, sha256, scanhash_myriadcoin_groestl, myriadcoin_groestlhash, NULL, init_myriadcoin_groestl_contexts, NULL },
     { "myr-groestl2", ALGO_MYRGROESTL,"Myriadcoin-groestl", sha256d, sha256d, scanhash_myriadcoin_groestl, myriadcoin_groestlhash, NULL, init_myriadcoin_groestl_contexts, NULL },
-    { "pluck",       ALGO_PLUCK,      "pluck(128)", sha256d, sha256d, scanhash_pluck, pluckhash, NULL, init_pluck_contexts, NULL },
+    { "pluck",       ALGO_PLUCK,      "pluck(128)", sha256d, sha256d, scanhash_pluck, pluckhash, NULL, init_pluck_contexts, free_pluck_contexts },
     { "whirlcoin",   ALGO_WHIRL,      "WhirlCoin", sha256d, sha256d, scanhash_whirlcoin, whirlcoinhash, NULL, init_whirlcoin_contexts, NULL },
     { "whirlpoolx",  ALGO_WHIRLPOOLX, "WhirlpoolX", sha256d, sha256d, scanhash_whirlpoolx, whirlpoolxhash, NULL, init_whirlpoolx_contexts, NULL },
 
-    { "cryptonight", ALGO_CRYPTONIGHT, "cryptonight", sha256d, sha256d, scanhash_cryptonight, NULL, NULL, NULL, NULL },
+    { "cryptonight", ALGO_CRYPTONIGHT, "cryptonight", sha256d, sha256d, scanhash_cryptonight, NULL, NULL, init_cryptonight_contexts, free_cryptonight_contexts },
 
     // Terminator (do not remove)
     { NULL, ALGO_UNK, NULL, NULL, NULL, NULL }
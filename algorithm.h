@@ -12,6 +12,13 @@ extern void name ## _prepare_work(struct stratum_job *job); \
 extern void init_ ## name ## _contexts(); \
 extern void free_ ## name ## _contexts();
 
+/* optional N-lane kernel: hashes lanes 80-byte headers in one call */
+#define HASHBATCH(name) \
+extern void name ## hash_batch(void *output[], const void *const input[], int lanes);
+
+/* lanes fed per hash_batch call by the generic scanhash driver */
+#define HASH_BATCH_MAX 16
+
 typedef enum {
     ALGO_UNK,
     ALGO_SCRYPT,      /* scrypt(1024,1,1) */
@@ -84,7 +91,6 @@ SCANHASH(fresh);
 SCANHASH(lbry);
 SCANHASH(sib);
 SCANHASH(veltor);
-SCANHASH(x11);
 SCANHASH(x13);
 SCANHASH(x14);
 SCANHASH(x15);
@@ -105,6 +111,11 @@ SCANHASH(lbry);
 SCANHASH(whirlcoin);
 SCANHASH(whirlpoolx);
 
+/* x11 scans through scanhash_generic(), it has no scanhash of its own */
+extern void x11hash(void* output, const void* input);
+extern void init_x11_contexts();
+HASHBATCH(x11);
+
 typedef struct _algorithm_t {
     const char* name; /* Human-readable identifier */
     algorithm_type_t type; //algorithm type
@@ -118,6 +129,9 @@ typedef struct _algorithm_t {
     void (*prepare_work)(struct stratum_job *job);
     void (*init_contexts)(void *params);
     void (*free_contexts)(void *params);
+    /* when scanhash is NULL, cpu-miner.c runs its own nonce loop over
+     * hash_batch, or simplehash one nonce at a time */
+    void (*hash_batch)(void *output[], const void *const input[], int lanes);
 } algorithm_t;
 
 #endif /* ALGORITHM_H */
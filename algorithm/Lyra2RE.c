@@ -19,6 +19,7 @@ typedef struct {
 	sph_keccak256_context	keccak;
 	sph_skein256_context	skein;
 	sph_groestl256_context	groestl;
+	uint64_t		*matrix;	/* LYRA2 memory, reused across hashes */
 } lyra2rehash_context_holder;
 
 /* no need to copy, because close reinit the context */
@@ -30,6 +31,13 @@ void init_lyra2re_contexts(void *dummy)
 	sph_keccak256_init(&ctx.keccak);
 	sph_skein256_init(&ctx.skein);
 	sph_groestl256_init(&ctx.groestl);
+	ctx.matrix = amalloc(64, LYRA2_MATRIX_SIZE(8, 8));
+}
+
+void free_lyra2re_contexts(void *dummy)
+{
+	afree(ctx.matrix);
+	ctx.matrix = NULL;
 }
 
 void lyra2rehash(void *output, const void *input)
@@ -45,7 +53,10 @@ void lyra2rehash(void *output, const void *input)
 	sph_keccak256 (&ctx.keccak,hashA, 32);
 	sph_keccak256_close(&ctx.keccak, hashB);
 
-	LYRA2((void*)hashA, 32, (const void*)hashB, 32, (const void*)hashB, 32, 1, 8, 8, BLOCK_LEN_BLAKE2_SAFE_BYTES);
+	if (ctx.matrix)
+		LYRA2_mem((void*)hashA, 32, (const void*)hashB, 32, (const void*)hashB, 32, 1, 8, 8, BLOCK_LEN_BLAKE2_SAFE_BYTES, ctx.matrix);
+	else
+		LYRA2((void*)hashA, 32, (const void*)hashB, 32, (const void*)hashB, 32, 1, 8, 8, BLOCK_LEN_BLAKE2_SAFE_BYTES);
 
 	sph_skein256 (&ctx.skein, hashA, 32);
 	sph_skein256_close(&ctx.skein, hashB);
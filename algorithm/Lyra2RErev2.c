@@ -21,6 +21,7 @@ typedef struct {
 	sph_cubehash256_context	cubehash;
 	sph_skein256_context	skein;
 	sph_bmw256_context	bmw;
+	uint64_t		*matrix;	/* LYRA2 memory, reused across hashes */
 } lyra2rev2hash_context_holder;
 
 /* no need to copy, because close reinit the context */
@@ -33,6 +34,13 @@ void init_lyra2rev2_contexts(void *dummy)
 	sph_cubehash256_init(&ctx.cubehash);
 	sph_skein256_init(&ctx.skein);
 	sph_bmw256_init(&ctx.bmw);
+	ctx.matrix = amalloc(64, LYRA2_MATRIX_SIZE(4, 4));
+}
+
+void free_lyra2rev2_contexts(void *dummy)
+{
+	afree(ctx.matrix);
+	ctx.matrix = NULL;
 }
 
 void lyra2rev2hash(void *output, const void *input)
@@ -51,7 +59,10 @@ void lyra2rev2hash(void *output, const void *input)
 	sph_cubehash256(&ctx.cubehash, hashB, 32);
 	sph_cubehash256_close(&ctx.cubehash, hashA);
 
-	LYRA2(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4, BLOCK_LEN_BLAKE2_SAFE_INT64);
+	if (ctx.matrix)
+		LYRA2_mem(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4, BLOCK_LEN_BLAKE2_SAFE_INT64, ctx.matrix);
+	else
+		LYRA2(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4, BLOCK_LEN_BLAKE2_SAFE_INT64);
 
 
 	sph_skein256 (&ctx.skein, hashB, 32);
@@ -20,6 +20,32 @@
 #include "scryptjane/scrypt-jane-romix.h"
 #include "scryptjane/scrypt-jane-test-vectors.h"
 
+/* scrypt rounds around argon2 use N = 2^(m_costs/2 + 1), m_costs = 16 */
+#define ARGON2_SCRYPT_V_SIZE ((1 << (16 / 2 + 1)) * SCRYPT_BLOCK_BYTES * SCRYPT_R * 2)
+
+typedef struct {
+	uint8_t *V;
+	uint8_t YX[(SCRYPT_P + 1) * SCRYPT_BLOCK_BYTES * SCRYPT_R * 2] __attribute__((aligned(64)));
+} argon2hash_context_holder;
+
+static THREADLOCAL argon2hash_context_holder ctx;
+
+void init_argon2_contexts(void *dummy)
+{
+	ctx.V = scratchpad_alloc(ARGON2_SCRYPT_V_SIZE, "argon2");
+	if (!ctx.V) {
+		applog(LOG_ERR, "argon2 buffer allocation failed");
+		pthread_mutex_lock(&applog_lock);
+		exit(1);
+	}
+}
+
+void free_argon2_contexts(void *dummy)
+{
+	scratchpad_free(ctx.V, ARGON2_SCRYPT_V_SIZE);
+	ctx.V = NULL;
+}
+
 void
 scrypt(const uint8_t *password, size_t password_len, const uint8_t *salt, size_t salt_len, uint32_t N, uint8_t *out, size_t bytes, uint8_t *X, uint8_t *Y, uint8_t *V, uint32_t r, uint32_t p)
 {
@@ -76,23 +102,17 @@ void argon2hash(void *output, const void *input)
 	unsigned int Nfactor = m_costs/2;
 	const uint32_t r = SCRYPT_R;
 	const uint32_t p = SCRYPT_P;
-	scrypt_aligned_alloc YX, V;
 	uint8_t *X, *Y;
 	uint32_t N, chunk_bytes, i;
 
 	N = (1 << (Nfactor + 1));
 	chunk_bytes = SCRYPT_BLOCK_BYTES * r * 2;
-	V = scrypt_alloc((uint64_t)N * chunk_bytes);
-	YX = scrypt_alloc((p + 1) * chunk_bytes);
 
 	/* 1: X = PBKDF2(password, salt) */
-	Y = YX.ptr;
+	Y = ctx.YX;
 	X = Y + chunk_bytes;
 
-	argon2_hash(output, input, t_costs, m_costs, N, X, Y, V.ptr, p, r);
-
-	scrypt_free(&V);
-	scrypt_free(&YX);
+	argon2_hash(output, input, t_costs, m_costs, N, X, Y, ctx.V, p, r);
 }
 
 int scanhash_argon2(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
@@ -105,7 +125,6 @@ int scanhash_argon2(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	uint32_t hash64[8] __attribute__((aligned(32)));
 	uint32_t endiandata[32];
 
-	scrypt_aligned_alloc YX, V;
 	uint8_t *X, *Y;
 	uint32_t N, chunk_bytes;
 	unsigned int t_costs = 2;
@@ -145,10 +164,8 @@ int scanhash_argon2(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 
 	N = (1 << (Nfactor + 1));
 	chunk_bytes = SCRYPT_BLOCK_BYTES * r * 2;
-	V = scrypt_alloc((uint64_t)N * chunk_bytes);
-	YX = scrypt_alloc((p + 1) * chunk_bytes);
 
-	Y = YX.ptr;
+	Y = ctx.YX;
 	X = Y + chunk_bytes;
 
 #ifdef DEBUG_ALGO
@@ -160,13 +177,11 @@ int scanhash_argon2(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			do {
 				pdata[19] = ++n;
 				be32enc(&endiandata[19], n);
-				argon2_hash(hash64, endiandata, t_costs, m_costs, N, X, Y, V.ptr, p, r);
+				argon2_hash(hash64, endiandata, t_costs, m_costs, N, X, Y, ctx.V, p, r);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
 					pdata[19] = n;
-					scrypt_free(&V);
-					scrypt_free(&YX);
 					return 1;
 				}
 #else
@@ -175,8 +190,6 @@ int scanhash_argon2(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 					printf("[%d]",thr_id);
 					if (fulltest(hash64, ptarget)) {
 						*hashes_done = n - first_nonce + 1;
-						scrypt_free(&V);
-						scrypt_free(&YX);
 						return true;
 					}
 				}
@@ -186,9 +199,6 @@ int scanhash_argon2(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 		}
 	}
 
-	scrypt_free(&V);
-	scrypt_free(&YX);
-
 	*hashes_done = n - first_nonce + 1;
 	pdata[19] = n;
 	return 0;
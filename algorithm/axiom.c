@@ -24,18 +24,18 @@ static THREADLOCAL axiomhash_context_holder ctx;
 void init_axiom_contexts(void *dummy)
 {
 	mshabal_init(&ctx.shabal, 256);
-	ctx.hash1 = amalloc(128, 65536 * 32);
-	ctx.hash2 = amalloc(128, 65536 * 32);
-	ctx.hash3 = amalloc(128, 65536 * 32);
-	ctx.hash4 = amalloc(128, 65536 * 32);
+	ctx.hash1 = scratchpad_alloc(65536 * 32, "axiom");
+	ctx.hash2 = scratchpad_alloc(65536 * 32, "axiom");
+	ctx.hash3 = scratchpad_alloc(65536 * 32, "axiom");
+	ctx.hash4 = scratchpad_alloc(65536 * 32, "axiom");
 }
 
 void free_axiom_contexts(void *dummy)
 {
-	afree(ctx.hash1);
-	afree(ctx.hash2);
-	afree(ctx.hash3);
-	afree(ctx.hash4);
+	scratchpad_free(ctx.hash1, 65536 * 32);
+	scratchpad_free(ctx.hash2, 65536 * 32);
+	scratchpad_free(ctx.hash3, 65536 * 32);
+	scratchpad_free(ctx.hash4, 65536 * 32);
 }
 
 void axiomhash(void *output, const void *input)
@@ -137,6 +137,9 @@ int scanhash_axiom(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 		if (Htarg <= htmax[m]) {
 			uint32_t mask = masks[m];
 			do {
+				/* lanes past max_nonce are hashed but not checked */
+				const uint32_t lanes = max_nonce - n < 4 ? max_nonce - n + 1 : 4;
+
 				be32enc(&endiandata_1[19], n);
 				be32enc(&endiandata_2[19], n + 1);
 				be32enc(&endiandata_3[19], n + 2);
@@ -149,17 +152,17 @@ int scanhash_axiom(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 					pdata[19] = n;
 					return true;
 				}
-				if ((!(hash64_2[7] & mask)) && fulltest(hash64_2, ptarget)) {
+				if (lanes >= 2 && (!(hash64_2[7] & mask)) && fulltest(hash64_2, ptarget)) {
 					*hashes_done = n - first_nonce + 2;
 					pdata[19] = n + 1;
 					return true;
 				}
-				if ((!(hash64_3[7] & mask)) && fulltest(hash64_3, ptarget)) {
+				if (lanes >= 3 && (!(hash64_3[7] & mask)) && fulltest(hash64_3, ptarget)) {
 					*hashes_done = n - first_nonce + 3;
 					pdata[19] = n + 2;
 					return true;
 				}
-				if ((!(hash64_4[7] & mask)) && fulltest(hash64_4, ptarget)) {
+				if (lanes >= 4 && (!(hash64_4[7] & mask)) && fulltest(hash64_4, ptarget)) {
 					*hashes_done = n - first_nonce + 4;
 					pdata[19] = n + 3;
 					return true;
@@ -174,7 +177,7 @@ int scanhash_axiom(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 						return true;
 					}
 				}
-				if (!(hash64_2[7] & mask)) {
+				if (lanes >= 2 && !(hash64_2[7] & mask)) {
 					printf("[%d]2",thr_id);
 					if (fulltest(hash64_2, ptarget)) {
 						*hashes_done = n - first_nonce + 2;
@@ -182,7 +185,7 @@ int scanhash_axiom(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 						return true;
 					}
 				}
-				if (!(hash64_3[7] & mask)) {
+				if (lanes >= 3 && !(hash64_3[7] & mask)) {
 					printf("[%d]3",thr_id);
 					if (fulltest(hash64_3, ptarget)) {
 						*hashes_done = n - first_nonce + 3;
@@ -190,7 +193,7 @@ int scanhash_axiom(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 						return true;
 					}
 				}
-				if (!(hash64_4[7] & mask)) {
+				if (lanes >= 4 && !(hash64_4[7] & mask)) {
 					printf("[%d]4",thr_id);
 					if (fulltest(hash64_4, ptarget)) {
 						*hashes_done = n - first_nonce + 4;
@@ -207,6 +210,8 @@ int scanhash_axiom(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 		}
 	}
 
+	if (n > max_nonce)
+		n = max_nonce;
 	*hashes_done = n - first_nonce + 1;
 	pdata[19] = n;
 	return 0;
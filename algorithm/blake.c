@@ -9,6 +9,7 @@
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
 	sph_blake256_context	blake;
+	sph_blake256_context	blake_mid;	/* blake fed with the header up to the nonce */
 } blakehash_context_holder;
 
 static THREADLOCAL blakehash_context_holder ctx;
@@ -18,21 +19,37 @@ void init_blake_contexts()
 	sph_blake256_init(&ctx.blake);
 }
 
-void blakehash(void *output, const void *input)
+/* the rest of blakehash, once the whole header went into ctx.blake */
+static void blakehash_close(void *output)
 {
 	uint32_t hash[16];
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
 
-	sph_blake256 (&ctx.blake, input, 80);
 	sph_blake256_close (&ctx.blake, hash);
 
 	memcpy(output, hash, 32);
 }
 
+void blakehash(void *output, const void *input)
+{
+	sph_blake256(&ctx.blake, input, 80);
+	blakehash_close(output);
+}
+
 int scanhash_blake(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	uint32_t max_nonce, uint64_t *hashes_done)
 {
+#ifdef HAVE_BLAKE256_8WAY
+	if (blake256_use_8way())
+		return scanhash_blake256_8way(thr_id, pdata, ptarget,
+			max_nonce, hashes_done, 14);
+#endif
+#ifdef HAVE_BLAKE256_4WAY
+	if (blake256_use_4way())
+		return scanhash_blake256_4way(thr_id, pdata, ptarget,
+			max_nonce, hashes_done, 14);
+#endif
 	uint32_t n = pdata[19] - 1;
 	const uint32_t first_nonce = pdata[19];
 	const uint32_t Htarg = ptarget[7];
@@ -61,6 +78,10 @@ int scanhash_blake(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	for (int kk=0; kk < 32; kk++) {
 		be32enc(&endiandata[kk], ((uint32_t*)pdata)[kk]);
 	};
+
+	/* only the nonce changes below, absorb the rest once */
+	memcpy(&ctx.blake_mid, &ctx.blake, sizeof(ctx.blake));
+	sph_blake256(&ctx.blake_mid, endiandata, 76);
 #ifdef DEBUG_ALGO
 	printf("[%d] Htarg=%X\n", thr_id, Htarg);
 #endif
@@ -70,7 +91,9 @@ int scanhash_blake(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			do {
 				pdata[19] = ++n;
 				be32enc(&endiandata[19], n);
-				blakehash(hash64, &endiandata);
+				memcpy(&ctx.blake, &ctx.blake_mid, sizeof(ctx.blake));
+				sph_blake256(&ctx.blake, &endiandata[19], 4);
+				blakehash_close(hash64);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 {
@@ -0,0 +1,140 @@
+/*
+ * Lane-parallel Blake-256 over an 80-byte block header.
+ *
+ * This file is included from blake256-mway.c once per lane count, with
+ * BW_LANES and BW(name) defined, and is not meant to be compiled
+ * independently. Every vector element holds the same state word for a
+ * different nonce; lane l hashes nonce + l. Only the last chaining
+ * word is produced, which is all scanhash needs to reject a nonce;
+ * candidates are rehashed in full with blake256_80_hash().
+ */
+
+typedef uint32_t BW(v32) __attribute__ ((vector_size (BW_LANES * 4)));
+typedef uint16_t BW(v16) __attribute__ ((vector_size (BW_LANES * 4)));
+typedef uint8_t BW(v8) __attribute__ ((vector_size (BW_LANES * 4)));
+
+#define V32          BW(v32)
+#define SPLAT(c)     (((V32){ 0 }) + (uint32_t)(c))
+#define ROR(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define BW_G(a, b, c, d, s0, s1)   do { \
+		V[a] += V[b] + (M[s0] ^ bw_cst[s1]); \
+		V[d] = BW_ROR16(V[d] ^ V[a]); \
+		V[c] += V[d]; \
+		V[b] = ROR(V[b] ^ V[c], 12); \
+		V[a] += V[b] + (M[s1] ^ bw_cst[s0]); \
+		V[d] = BW_ROR8(V[d] ^ V[a]); \
+		V[c] += V[d]; \
+		V[b] = ROR(V[b] ^ V[c], 7); \
+	} while (0)
+
+#define BW_ROUND(r)   do { \
+		const unsigned char *s = bw_sigma[(r) % 10]; \
+		BW_G(0, 4,  8, 12, s[ 0], s[ 1]); \
+		BW_G(1, 5,  9, 13, s[ 2], s[ 3]); \
+		BW_G(2, 6, 10, 14, s[ 4], s[ 5]); \
+		BW_G(3, 7, 11, 15, s[ 6], s[ 7]); \
+		BW_G(0, 5, 10, 15, s[ 8], s[ 9]); \
+		BW_G(1, 6, 11, 12, s[10], s[11]); \
+		BW_G(2, 7,  8, 13, s[12], s[13]); \
+		BW_G(3, 4,  9, 14, s[14], s[15]); \
+	} while (0)
+
+static void
+BW(blake256_80)(uint32_t *h7, const blake256_80_ctx *ctx, uint32_t nonce)
+{
+	V32 M[16], V[16], t;
+	int i;
+
+	for (i = 0; i < 16; i ++) {
+		M[i] = SPLAT(ctx->m[i]);
+		V[i] = SPLAT(ctx->v[i]);
+	}
+	for (i = 0; i < BW_LANES; i ++)
+		M[3][i] = nonce + i;
+
+	/* round 0: G(1, 5, 9, 13) is the first to see the nonce */
+	V[1] += V[5] + (M[3] ^ bw_cst[2]);
+	V[13] = BW_ROR8(V[13] ^ V[1]);
+	V[9] += V[13];
+	V[5] = ROR(V[5] ^ V[9], 7);
+	BW_G(0, 5, 10, 15,  8,  9);
+	BW_G(1, 6, 11, 12, 10, 11);
+	BW_G(2, 7,  8, 13, 12, 13);
+	BW_G(3, 4,  9, 14, 14, 15);
+
+	BW_ROUND(1);
+	BW_ROUND(2);
+	BW_ROUND(3);
+	BW_ROUND(4);
+	BW_ROUND(5);
+	BW_ROUND(6);
+	if (ctx->rounds == 14) {
+		BW_ROUND(7);
+		BW_ROUND(8);
+		BW_ROUND(9);
+		BW_ROUND(10);
+		BW_ROUND(11);
+		BW_ROUND(12);
+		BW_ROUND(13);
+	} else {
+		BW_ROUND(7);
+	}
+
+	/* the last round only matters through V7 and V15 */
+	t = V[7] ^ V[15] ^ ctx->h[7];
+	for (i = 0; i < BW_LANES; i ++)
+		h7[i] = t[i];
+}
+
+int BW(scanhash_blake256)(int thr_id, uint32_t *pdata,
+	const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done,
+	int rounds)
+{
+	blake256_80_ctx ctx;
+	uint32_t h7[BW_LANES], hash[8];
+	const uint32_t first_nonce = pdata[19];
+	const uint32_t Htarg = ptarget[7];
+	uint64_t n = first_nonce;
+	int i;
+
+	blake256_80_prepare(&ctx, pdata, rounds);
+
+	while (n + BW_LANES - 1 <= max_nonce && !work_restart[thr_id].restart) {
+		BW(blake256_80)(h7, &ctx, (uint32_t) n);
+		for (i = 0; i < BW_LANES; i++) {
+			if (swab32(h7[i]) > Htarg)
+				continue;
+			blake256_80_hash(hash, &ctx, (uint32_t) n + i);
+			if (fulltest(hash, ptarget)
+					&& !scan_found(thr_id, pdata, (uint32_t) n + i)) {
+				pdata[19] = (uint32_t) n + i;
+				*hashes_done = n + i - first_nonce + 1;
+				return 1;
+			}
+		}
+		n += BW_LANES;
+	}
+
+	/* less than a full vector left before max_nonce */
+	while (n <= max_nonce && !work_restart[thr_id].restart) {
+		blake256_80_hash(hash, &ctx, (uint32_t) n);
+		if (hash[7] <= Htarg && fulltest(hash, ptarget)
+				&& !scan_found(thr_id, pdata, (uint32_t) n)) {
+			pdata[19] = (uint32_t) n;
+			*hashes_done = n - first_nonce + 1;
+			return 1;
+		}
+		n++;
+	}
+
+	*hashes_done = n - first_nonce;
+	pdata[19] = (uint32_t) n - 1;
+	return 0;
+}
+
+#undef V32
+#undef SPLAT
+#undef ROR
+#undef BW_G
+#undef BW_ROUND
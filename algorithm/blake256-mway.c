@@ -0,0 +1,201 @@
+/*
+ * Multi-nonce Blake-256 for the blake / blakecoin scanners.
+ *
+ * The first 64 bytes of the header and the nonce-free part of the
+ * first round of the second block are computed once per scan by
+ * blake256_80_prepare(); the lane kernels then only run the rest of
+ * the second block. The round code lives in blake256-mway-helper.c
+ * and is built with GCC vector extensions, 4 lanes with the default
+ * target flags (SSE2/NEON) and 8 lanes with AVX2 enabled through a
+ * target pragma, selected at runtime.
+ */
+
+#include "cpuminer-config.h"
+#include "miner.h"
+
+#include <string.h>
+#include <stdint.h>
+
+typedef struct {
+	uint32_t h[8];   /* chaining value after the first 64 bytes */
+	uint32_t v[16];  /* second block state, round 0 done up to the nonce */
+	uint32_t m[16];  /* second block, m[3] is the nonce */
+	int rounds;
+} blake256_80_ctx;
+
+static const uint32_t bw_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint32_t bw_cst[16] = {
+	0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344,
+	0xA4093822, 0x299F31D0, 0x082EFA98, 0xEC4E6C89,
+	0x452821E6, 0x38D01377, 0xBE5466CF, 0x34E90C6C,
+	0xC0AC29B7, 0xC97C50DD, 0x3F84D5B5, 0xB5470917
+};
+
+static const unsigned char bw_sigma[10][16] = {
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+};
+
+#define ROTR32(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define GS(a, b, c, d, s0, s1)   do { \
+		v[a] += v[b] + (m[s0] ^ bw_cst[s1]); \
+		v[d] = ROTR32(v[d] ^ v[a], 16); \
+		v[c] += v[d]; \
+		v[b] = ROTR32(v[b] ^ v[c], 12); \
+		v[a] += v[b] + (m[s1] ^ bw_cst[s0]); \
+		v[d] = ROTR32(v[d] ^ v[a], 8); \
+		v[c] += v[d]; \
+		v[b] = ROTR32(v[b] ^ v[c], 7); \
+	} while (0)
+
+/* pdata holds the header as blake reads it, i.e. big-endian words */
+static void blake256_80_prepare(blake256_80_ctx *ctx, const uint32_t *pdata, int rounds)
+{
+	uint32_t v[16], m[16];
+	int i, r;
+
+	/* first block, counter 512 */
+	memcpy(m, pdata, 64);
+	memcpy(v, bw_iv, 32);
+	for (i = 0; i < 8; i++)
+		v[8 + i] = bw_cst[i];
+	v[12] ^= 512;
+	v[13] ^= 512;
+	for (r = 0; r < rounds; r++) {
+		const unsigned char *s = bw_sigma[r % 10];
+		GS(0, 4,  8, 12, s[ 0], s[ 1]);
+		GS(1, 5,  9, 13, s[ 2], s[ 3]);
+		GS(2, 6, 10, 14, s[ 4], s[ 5]);
+		GS(3, 7, 11, 15, s[ 6], s[ 7]);
+		GS(0, 5, 10, 15, s[ 8], s[ 9]);
+		GS(1, 6, 11, 12, s[10], s[11]);
+		GS(2, 7,  8, 13, s[12], s[13]);
+		GS(3, 4,  9, 14, s[14], s[15]);
+	}
+	for (i = 0; i < 8; i++)
+		ctx->h[i] = bw_iv[i] ^ v[i] ^ v[8 + i];
+
+	/* second block: 16 header bytes and the padding, counter 640 */
+	memset(m, 0, sizeof(m));
+	memcpy(m, pdata + 16, 16);
+	m[4] = 0x80000000;
+	m[13] = 1;
+	m[15] = 640;
+	memcpy(ctx->m, m, sizeof(m));
+	ctx->rounds = rounds;
+
+	/* round 0 up to the nonce: three column steps and half of a fourth */
+	memcpy(v, ctx->h, 32);
+	for (i = 0; i < 8; i++)
+		v[8 + i] = bw_cst[i];
+	v[12] ^= 640;
+	v[13] ^= 640;
+	GS(0, 4,  8, 12, 0, 1);
+	GS(2, 6, 10, 14, 4, 5);
+	GS(3, 7, 11, 15, 6, 7);
+	v[1] += v[5] + (m[2] ^ bw_cst[3]);
+	v[13] = ROTR32(v[13] ^ v[1], 16);
+	v[9] += v[13];
+	v[5] = ROTR32(v[5] ^ v[9], 12);
+	memcpy(ctx->v, v, sizeof(v));
+}
+
+/* full hash for one nonce, in the byte order blakehash() returns */
+static void blake256_80_hash(uint32_t *hash, const blake256_80_ctx *ctx,
+	uint32_t nonce)
+{
+	uint32_t v[16], m[16];
+	int i, r;
+
+	memcpy(v, ctx->v, sizeof(v));
+	memcpy(m, ctx->m, sizeof(m));
+	m[3] = nonce;
+	v[1] += v[5] + (m[3] ^ bw_cst[2]);
+	v[13] = ROTR32(v[13] ^ v[1], 8);
+	v[9] += v[13];
+	v[5] = ROTR32(v[5] ^ v[9], 7);
+	GS(0, 5, 10, 15,  8,  9);
+	GS(1, 6, 11, 12, 10, 11);
+	GS(2, 7,  8, 13, 12, 13);
+	GS(3, 4,  9, 14, 14, 15);
+	for (r = 1; r < ctx->rounds; r++) {
+		const unsigned char *s = bw_sigma[r % 10];
+		GS(0, 4,  8, 12, s[ 0], s[ 1]);
+		GS(1, 5,  9, 13, s[ 2], s[ 3]);
+		GS(2, 6, 10, 14, s[ 4], s[ 5]);
+		GS(3, 7, 11, 15, s[ 6], s[ 7]);
+		GS(0, 5, 10, 15, s[ 8], s[ 9]);
+		GS(1, 6, 11, 12, s[10], s[11]);
+		GS(2, 7,  8, 13, s[12], s[13]);
+		GS(3, 4,  9, 14, s[14], s[15]);
+	}
+	for (i = 0; i < 8; i++)
+		hash[i] = swab32(ctx->h[i] ^ v[i] ^ v[8 + i]);
+}
+
+#undef GS
+
+#ifdef HAVE_BLAKE256_4WAY
+
+/* SSE2 has no byte shuffle, rotate by 16 as a 16-bit word swap */
+#define BW_ROR16(x)   ((__typeof__(x))__builtin_shuffle((BW(v16))(x), \
+		(BW(v16)){ 1, 0, 3, 2, 5, 4, 7, 6 }))
+#define BW_ROR8(x)    (((x) >> 8) | ((x) << 24))
+
+#define BW_LANES   4
+#define BW(x)      x ## _4way
+#include "blake256-mway-helper.c"
+#undef BW_LANES
+#undef BW
+#undef BW_ROR16
+#undef BW_ROR8
+
+int blake256_use_4way()
+{
+	return !!(opt_kernels & KERNEL_4WAY);
+}
+
+#endif
+
+#ifdef HAVE_BLAKE256_8WAY
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#define BW_ROR16(x)   ((__typeof__(x))__builtin_shuffle((BW(v8))(x), \
+		(BW(v8)){ 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, \
+		18, 19, 16, 17, 22, 23, 20, 21, 26, 27, 24, 25, 30, 31, 28, 29 }))
+#define BW_ROR8(x)    ((__typeof__(x))__builtin_shuffle((BW(v8))(x), \
+		(BW(v8)){ 1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12, \
+		17, 18, 19, 16, 21, 22, 23, 20, 25, 26, 27, 24, 29, 30, 31, 28 }))
+
+#define BW_LANES   8
+#define BW(x)      x ## _8way
+#include "blake256-mway-helper.c"
+#undef BW_LANES
+#undef BW
+#undef BW_ROR16
+#undef BW_ROR8
+
+#pragma GCC pop_options
+
+int blake256_use_8way()
+{
+	__builtin_cpu_init();
+	return (opt_kernels & KERNEL_8WAY) && __builtin_cpu_supports("avx2");
+}
+
+#endif
@@ -103,32 +103,68 @@ static inline void xor_blocks_dst(const uint8_t* a, const uint8_t* b, uint8_t* d
 }
 
 struct cryptonight_ctx {
-	uint8_t long_state[MEMORY] __attribute((aligned(16)));
-	union cn_slow_hash_state state;
+	uint8_t *long_state;	/* MEMORY bytes, see scratchpad_alloc() */
+	/* read 16 bytes at a time by xor_blocks_dst() */
+	union cn_slow_hash_state state __attribute__((aligned(16)));
 	uint8_t text[INIT_SIZE_BYTE] __attribute((aligned(16)));
 	uint8_t a[AES_BLOCK_SIZE] __attribute__((aligned(16)));
 	uint8_t b[AES_BLOCK_SIZE] __attribute__((aligned(16)));
 	uint8_t c[AES_BLOCK_SIZE] __attribute__((aligned(16)));
-	oaes_ctx* aes_ctx;
+	uint32_t found[HASH_SIZE / 4];
 };
 
+/* scratchpad is kept for the life of the mining thread */
+static THREADLOCAL struct cryptonight_ctx *persistentctx;
+
+void init_cryptonight_contexts(void *dummy)
+{
+	if (persistentctx)
+		return;
+	persistentctx = (struct cryptonight_ctx*) amalloc(64, sizeof(struct cryptonight_ctx));
+	if (persistentctx)
+		persistentctx->long_state = scratchpad_alloc(MEMORY, "cryptonight");
+	if (!persistentctx || !persistentctx->long_state) {
+		applog(LOG_ERR, "cryptonight scratchpad allocation failed");
+		pthread_mutex_lock(&applog_lock);
+		exit(1);
+	}
+}
+
+void free_cryptonight_contexts(void *dummy)
+{
+	if (!persistentctx)
+		return;
+	scratchpad_free(persistentctx->long_state, MEMORY);
+	afree(persistentctx);
+	persistentctx = NULL;
+}
+
+/* hash of the last share found by scanhash_cryptonight on this thread */
+void cryptonight_last_hash(void *output)
+{
+	if (persistentctx)
+		memcpy(output, persistentctx->found, 32);
+}
+
 void cryptonight_hash_ctx(void* output, const void* input, size_t len, struct cryptonight_ctx* ctx) {
-	hash_process(&ctx->state.hs, (const uint8_t*) input, len);
-	ctx->aes_ctx = (oaes_ctx*) oaes_alloc();
+	uint8_t expkey[OAES_EXP_DATA_LEN(AES_KEY_SIZE)] __attribute__((aligned(16)));
+	uint8_t *long_state = ctx->long_state;
 	size_t i, j;
+
+	hash_process(&ctx->state.hs, (const uint8_t*) input, len);
 	memcpy(ctx->text, ctx->state.init, INIT_SIZE_BYTE);
 
-	oaes_key_import_data(ctx->aes_ctx, ctx->state.hs.b, AES_KEY_SIZE);
+	oaes_key_expand_data(ctx->state.hs.b, AES_KEY_SIZE, expkey);
 	for (i = 0; likely(i < MEMORY); i += INIT_SIZE_BYTE) {
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 0], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 1], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 2], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 3], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 4], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 5], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 6], ctx->aes_ctx->key->exp_data);
-		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 7], ctx->aes_ctx->key->exp_data);
-		memcpy(&ctx->long_state[i], ctx->text, INIT_SIZE_BYTE);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 0], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 1], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 2], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 3], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 4], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 5], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 6], expkey);
+		aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 7], expkey);
+		memcpy(&long_state[i], ctx->text, INIT_SIZE_BYTE);
 	}
 
 	xor_blocks_dst(&ctx->state.k[0], &ctx->state.k[32], ctx->a);
@@ -141,68 +177,79 @@ void cryptonight_hash_ctx(void* output, const void* input, size_t len, struct cr
 		 */
 		/* Iteration 1 */
 		j = e2i(ctx->a);
-		aesb_single_round(&ctx->long_state[j], ctx->c, ctx->a);
-		xor_blocks_dst(ctx->c, ctx->b, &ctx->long_state[j]);
+		aesb_single_round(&long_state[j], ctx->c, ctx->a);
+		xor_blocks_dst(ctx->c, ctx->b, &long_state[j]);
 		/* Iteration 2 */
-		mul_sum_xor_dst(ctx->c, ctx->a, &ctx->long_state[e2i(ctx->c)]);
+		mul_sum_xor_dst(ctx->c, ctx->a, &long_state[e2i(ctx->c)]);
 		/* Iteration 3 */
 		j = e2i(ctx->a);
-		aesb_single_round(&ctx->long_state[j], ctx->b, ctx->a);
-		xor_blocks_dst(ctx->b, ctx->c, &ctx->long_state[j]);
+		aesb_single_round(&long_state[j], ctx->b, ctx->a);
+		xor_blocks_dst(ctx->b, ctx->c, &long_state[j]);
 		/* Iteration 4 */
-		mul_sum_xor_dst(ctx->b, ctx->a, &ctx->long_state[e2i(ctx->b)]);
+		mul_sum_xor_dst(ctx->b, ctx->a, &long_state[e2i(ctx->b)]);
 	}
 
 	memcpy(ctx->text, ctx->state.init, INIT_SIZE_BYTE);
-	oaes_key_import_data(ctx->aes_ctx, &ctx->state.hs.b[32], AES_KEY_SIZE);
+	oaes_key_expand_data(&ctx->state.hs.b[32], AES_KEY_SIZE, expkey);
 	for (i = 0; likely(i < MEMORY); i += INIT_SIZE_BYTE) {
-		xor_blocks(&ctx->text[0 * AES_BLOCK_SIZE], &ctx->long_state[i + 0 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[0 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[1 * AES_BLOCK_SIZE], &ctx->long_state[i + 1 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[1 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[2 * AES_BLOCK_SIZE], &ctx->long_state[i + 2 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[2 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[3 * AES_BLOCK_SIZE], &ctx->long_state[i + 3 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[3 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[4 * AES_BLOCK_SIZE], &ctx->long_state[i + 4 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[4 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[5 * AES_BLOCK_SIZE], &ctx->long_state[i + 5 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[5 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[6 * AES_BLOCK_SIZE], &ctx->long_state[i + 6 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[6 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[7 * AES_BLOCK_SIZE], &ctx->long_state[i + 7 * AES_BLOCK_SIZE]);
-		aesb_pseudo_round_mut(&ctx->text[7 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
+		xor_blocks(&ctx->text[0 * AES_BLOCK_SIZE], &long_state[i + 0 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[0 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[1 * AES_BLOCK_SIZE], &long_state[i + 1 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[1 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[2 * AES_BLOCK_SIZE], &long_state[i + 2 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[2 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[3 * AES_BLOCK_SIZE], &long_state[i + 3 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[3 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[4 * AES_BLOCK_SIZE], &long_state[i + 4 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[4 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[5 * AES_BLOCK_SIZE], &long_state[i + 5 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[5 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[6 * AES_BLOCK_SIZE], &long_state[i + 6 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[6 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[7 * AES_BLOCK_SIZE], &long_state[i + 7 * AES_BLOCK_SIZE]);
+		aesb_pseudo_round_mut(&ctx->text[7 * AES_BLOCK_SIZE], expkey);
 	}
 	memcpy(ctx->state.init, ctx->text, INIT_SIZE_BYTE);
 	hash_permutation(&ctx->state.hs);
 	/*memcpy(hash, &state, 32);*/
 	extra_hashes[ctx->state.hs.b[0] & 3](&ctx->state, 200, output);
-	oaes_free((OAES_CTX **) &ctx->aes_ctx);
 }
 
 void cryptonight_hash(void* output, const void* input, size_t len) {
 	struct cryptonight_ctx *ctx = (struct cryptonight_ctx*)malloc(sizeof(struct cryptonight_ctx));
+	if (ctx)
+		ctx->long_state = (uint8_t*)malloc(MEMORY);
+	if (!ctx || !ctx->long_state) {
+		/* a hash no target takes */
+		applog(LOG_ERR, "cryptonight_hash OOM");
+		memset(output, 0xff, HASH_SIZE);
+		free(ctx);
+		return;
+	}
 	cryptonight_hash_ctx(output, input, len, ctx);
+	free(ctx->long_state);
 	free(ctx);
 }
 
 void cryptonight_hash_ctx_aes_ni(void* output, const void* input, size_t len, struct cryptonight_ctx* ctx) {
-	hash_process(&ctx->state.hs, (const uint8_t*) input, len);
-	ctx->aes_ctx = (oaes_ctx*) oaes_alloc();
+	uint8_t expkey[OAES_EXP_DATA_LEN(AES_KEY_SIZE)] __attribute__((aligned(16)));
+	uint8_t *long_state = ctx->long_state;
 	size_t i, j;
+
+	hash_process(&ctx->state.hs, (const uint8_t*) input, len);
 	memcpy(ctx->text, ctx->state.init, INIT_SIZE_BYTE);
 
-	oaes_key_import_data(ctx->aes_ctx, ctx->state.hs.b, AES_KEY_SIZE);
+	oaes_key_expand_data(ctx->state.hs.b, AES_KEY_SIZE, expkey);
 	for (i = 0; likely(i < MEMORY); i += INIT_SIZE_BYTE) {
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 0], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 1], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 2], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 3], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 4], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 5], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 6], ctx->aes_ctx->key->exp_data);
-		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 7], ctx->aes_ctx->key->exp_data);
-		memcpy(&ctx->long_state[i], ctx->text, INIT_SIZE_BYTE);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 0], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 1], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 2], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 3], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 4], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 5], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 6], expkey);
+		fast_aesb_pseudo_round_mut(&ctx->text[AES_BLOCK_SIZE * 7], expkey);
+		memcpy(&long_state[i], ctx->text, INIT_SIZE_BYTE);
 	}
 
 	xor_blocks_dst(&ctx->state.k[0], &ctx->state.k[32], ctx->a);
@@ -215,43 +262,42 @@ void cryptonight_hash_ctx_aes_ni(void* output, const void* input, size_t len, st
 		 */
 		/* Iteration 1 */
 		j = e2i(ctx->a);
-		fast_aesb_single_round(&ctx->long_state[j], ctx->c, ctx->a);
-		xor_blocks_dst(ctx->c, ctx->b, &ctx->long_state[j]);
+		fast_aesb_single_round(&long_state[j], ctx->c, ctx->a);
+		xor_blocks_dst(ctx->c, ctx->b, &long_state[j]);
 		/* Iteration 2 */
-		mul_sum_xor_dst(ctx->c, ctx->a, &ctx->long_state[e2i(ctx->c)]);
+		mul_sum_xor_dst(ctx->c, ctx->a, &long_state[e2i(ctx->c)]);
 		/* Iteration 3 */
 		j = e2i(ctx->a);
-		fast_aesb_single_round(&ctx->long_state[j], ctx->b, ctx->a);
-		xor_blocks_dst(ctx->b, ctx->c, &ctx->long_state[j]);
+		fast_aesb_single_round(&long_state[j], ctx->b, ctx->a);
+		xor_blocks_dst(ctx->b, ctx->c, &long_state[j]);
 		/* Iteration 4 */
-		mul_sum_xor_dst(ctx->b, ctx->a, &ctx->long_state[e2i(ctx->b)]);
+		mul_sum_xor_dst(ctx->b, ctx->a, &long_state[e2i(ctx->b)]);
 	}
 
 	memcpy(ctx->text, ctx->state.init, INIT_SIZE_BYTE);
-	oaes_key_import_data(ctx->aes_ctx, &ctx->state.hs.b[32], AES_KEY_SIZE);
+	oaes_key_expand_data(&ctx->state.hs.b[32], AES_KEY_SIZE, expkey);
 	for (i = 0; likely(i < MEMORY); i += INIT_SIZE_BYTE) {
-		xor_blocks(&ctx->text[0 * AES_BLOCK_SIZE], &ctx->long_state[i + 0 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[0 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[1 * AES_BLOCK_SIZE], &ctx->long_state[i + 1 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[1 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[2 * AES_BLOCK_SIZE], &ctx->long_state[i + 2 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[2 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[3 * AES_BLOCK_SIZE], &ctx->long_state[i + 3 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[3 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[4 * AES_BLOCK_SIZE], &ctx->long_state[i + 4 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[4 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[5 * AES_BLOCK_SIZE], &ctx->long_state[i + 5 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[5 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[6 * AES_BLOCK_SIZE], &ctx->long_state[i + 6 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[6 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
-		xor_blocks(&ctx->text[7 * AES_BLOCK_SIZE], &ctx->long_state[i + 7 * AES_BLOCK_SIZE]);
-		fast_aesb_pseudo_round_mut(&ctx->text[7 * AES_BLOCK_SIZE], ctx->aes_ctx->key->exp_data);
+		xor_blocks(&ctx->text[0 * AES_BLOCK_SIZE], &long_state[i + 0 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[0 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[1 * AES_BLOCK_SIZE], &long_state[i + 1 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[1 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[2 * AES_BLOCK_SIZE], &long_state[i + 2 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[2 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[3 * AES_BLOCK_SIZE], &long_state[i + 3 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[3 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[4 * AES_BLOCK_SIZE], &long_state[i + 4 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[4 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[5 * AES_BLOCK_SIZE], &long_state[i + 5 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[5 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[6 * AES_BLOCK_SIZE], &long_state[i + 6 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[6 * AES_BLOCK_SIZE], expkey);
+		xor_blocks(&ctx->text[7 * AES_BLOCK_SIZE], &long_state[i + 7 * AES_BLOCK_SIZE]);
+		fast_aesb_pseudo_round_mut(&ctx->text[7 * AES_BLOCK_SIZE], expkey);
 	}
 	memcpy(ctx->state.init, ctx->text, INIT_SIZE_BYTE);
 	hash_permutation(&ctx->state.hs);
 	/*memcpy(hash, &state, 32);*/
 	extra_hashes[ctx->state.hs.b[0] & 3](&ctx->state, 200, output);
-	oaes_free((OAES_CTX **) &ctx->aes_ctx);
 }
 
 int scanhash_cryptonight(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
@@ -262,7 +308,8 @@ int scanhash_cryptonight(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	const uint32_t Htarg = ptarget[7];
 	uint32_t hash[HASH_SIZE / 4] __attribute__((aligned(32)));
 
-	struct cryptonight_ctx *ctx = (struct cryptonight_ctx*)malloc(sizeof(struct cryptonight_ctx));
+	init_cryptonight_contexts(NULL);
+	struct cryptonight_ctx *ctx = persistentctx;
 
 	if (aes_ni_supported) {
 		do {
@@ -270,23 +317,22 @@ int scanhash_cryptonight(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			cryptonight_hash_ctx_aes_ni(hash, pdata, 76, ctx);
 			if (unlikely(hash[7] < ptarget[7])) {
 				*hashes_done = n - first_nonce + 1;
-				free(ctx);
+				memcpy(ctx->found, hash, 32);
 				return true;
 			}
-		} while (likely((n <= max_nonce && !work_restart[thr_id].restart)));
+		} while (likely((n < max_nonce && !work_restart[thr_id].restart)));
 	} else {
 		do {
 			*nonceptr = ++n;
 			cryptonight_hash_ctx(hash, pdata, 76, ctx);
 			if (unlikely(hash[7] < ptarget[7])) {
 				*hashes_done = n - first_nonce + 1;
-				free(ctx);
+				memcpy(ctx->found, hash, 32);
 				return true;
 			}
-		} while (likely((n <= max_nonce && !work_restart[thr_id].restart)));
+		} while (likely((n < max_nonce && !work_restart[thr_id].restart)));
 	}
 
-	free(ctx);
 	*hashes_done = n - first_nonce + 1;
 	return 0;
 }
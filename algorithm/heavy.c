@@ -62,7 +62,7 @@ void heavy_hash(void* output, const void* input, int len)
 	SHA256_CTX sha256;
 	SHA256_Init(&sha256);
 	SHA256_Update(&sha256, input, len);
-	SHA256_Update(&sha256, hash1, sizeof(hash1));
+	SHA256_Update(&sha256, hash1, HEFTY1_DIGEST_BYTES);
 	SHA256_Final((unsigned char*)hash2, &sha256);
 
 	/* Additional security: Do not rely on a single cryptographic hash
@@ -72,15 +72,15 @@ void heavy_hash(void* output, const void* input, int len)
 	 */
 
 	sph_keccak512(&ctx.keccak, input, len);
-	sph_keccak512(&ctx.keccak, hash1, sizeof(hash1));
+	sph_keccak512(&ctx.keccak, hash1, HEFTY1_DIGEST_BYTES);
 	sph_keccak512_close(&ctx.keccak, hash3);
 
 	sph_groestl512(&ctx.groestl, input, len);
-	sph_groestl512(&ctx.groestl, hash1, sizeof(hash1));
+	sph_groestl512(&ctx.groestl, hash1, HEFTY1_DIGEST_BYTES);
 	sph_groestl512_close(&ctx.groestl, hash4);
 
 	sph_blake512(&ctx.blake, input, len);
-	sph_blake512(&ctx.blake, hash1, sizeof(hash1));
+	sph_blake512(&ctx.blake, hash1, HEFTY1_DIGEST_BYTES);
 	sph_blake512_close(&ctx.blake, hash5);
 
 	combine_hashes((uint32_t *)output, hash2, hash3, hash4, hash5);
@@ -130,7 +130,7 @@ int scanhash_heavy(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			uint32_t mask = masks[m];
 			do {
 				pdata[19] = ++n;
-				heavyhash(hash64, &pdata);
+				heavyhash(hash64, pdata);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
@@ -176,7 +176,7 @@ static THREADLOCAL pluckhash_context_holder ctx;
 void init_pluck_contexts(void *dummy)
 {
         ctx.n = *(int *)dummy;
-        ctx.scratchbuf = malloc(ctx.n * 1024);
+        ctx.scratchbuf = scratchpad_alloc(ctx.n * 1024, "pluck");
         if (!ctx.scratchbuf) {
                 applog(LOG_ERR, "pluck buffer allocation failed");
                 pthread_mutex_lock(&applog_lock);
@@ -184,6 +184,12 @@ void init_pluck_contexts(void *dummy)
         }
 }
 
+void free_pluck_contexts(void *dummy)
+{
+        scratchpad_free(ctx.scratchbuf, ctx.n * 1024);
+        ctx.scratchbuf = NULL;
+}
+
 
 //computes a single sha256 hash
 void sha256_hash(unsigned char *hash, const unsigned char *data, int len)
@@ -14,6 +14,7 @@
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
 	sph_luffa512_context	luffa;
+	sph_luffa512_context	luffa_mid;	/* luffa fed with the header up to the nonce */
 	sph_cubehash512_context	cubehash;
 	sph_shavite512_context	shavite;
 	sph_simd512_context	simd;
@@ -32,7 +33,8 @@ void init_qubit_contexts()
 	sph_echo512_init (&ctx.echo);
 }
 
-void qubithash(void *state, const void *input)
+/* the rest of qubithash, once the whole header went into ctx.luffa */
+static void qubithash_close(void *state)
 {
 	uint32_t hash[16];
 	uint32_t mask = 8;
@@ -40,7 +42,6 @@ void qubithash(void *state, const void *input)
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
 
-	sph_luffa512(&ctx.luffa, input, 80);
 	sph_luffa512_close (&ctx.luffa, hash);
 
 
@@ -59,6 +60,12 @@ void qubithash(void *state, const void *input)
 	memcpy(state, hash, 32);
 }
 
+void qubithash(void *state, const void *input)
+{
+	sph_luffa512(&ctx.luffa, input, 80);
+	qubithash_close(state);
+}
+
 int scanhash_qubit(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	uint32_t max_nonce, uint64_t *hashes_done)
 {
@@ -90,6 +97,10 @@ int scanhash_qubit(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	for (int kk=0; kk < 32; kk++) {
 		be32enc(&endiandata[kk], ((uint32_t*)pdata)[kk]);
 	};
+
+	/* only the nonce changes below, absorb the rest once */
+	memcpy(&ctx.luffa_mid, &ctx.luffa, sizeof(ctx.luffa));
+	sph_luffa512(&ctx.luffa_mid, endiandata, 76);
 #ifdef DEBUG_ALGO
 	printf("[%d] Htarg=%X\n", thr_id, Htarg);
 #endif
@@ -99,7 +110,9 @@ int scanhash_qubit(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			do {
 				pdata[19] = ++n;
 				be32enc(&endiandata[19], n);
-				qubithash(hash64, &endiandata);
+				memcpy(&ctx.luffa, &ctx.luffa_mid, sizeof(ctx.luffa));
+				sph_luffa512(&ctx.luffa, &endiandata[19], 4);
+				qubithash_close(hash64);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
@@ -52,6 +52,9 @@ inline int min ( int a, int b ) { return a < b ? a : b; }
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
 	int time;
+	uint8_t *V;	/* grows with N, kept for the life of the thread */
+	uint64_t Vsize;
+	uint8_t YX[(SCRYPT_P + 1) * SCRYPT_BLOCK_BYTES * SCRYPT_R * 2] __attribute__((aligned(64)));
 } scrypt_janehash_context_holder;
 
 /* no need to copy, because close reinit the context */
@@ -62,6 +65,32 @@ void init_scrypt_jane_contexts(void *dummy)
 	ctx.time = *(int *)dummy;
 }
 
+void free_scrypt_jane_contexts(void *dummy)
+{
+	scratchpad_free(ctx.V, ctx.Vsize);
+	ctx.V = NULL;
+	ctx.Vsize = 0;
+}
+
+static uint8_t *scrypt_jane_V(uint64_t size)
+{
+	if (size > ctx.Vsize) {
+		scratchpad_free(ctx.V, ctx.Vsize);
+		ctx.Vsize = 0;
+		if (size > (size_t)-1) {
+			applog(LOG_ERR, "scrypt-jane: not enough address space on this CPU to allocate required memory");
+			exit(1);
+		}
+		ctx.V = scratchpad_alloc((size_t)size, "scrypt-jane");
+		if (!ctx.V) {
+			applog(LOG_ERR, "scrypt-jane: out of memory");
+			exit(1);
+		}
+		ctx.Vsize = size;
+	}
+	return ctx.V;
+}
+
 scrypt_aligned_alloc
 scrypt_alloc(uint64_t size) {
 	static const size_t max_alloc = (size_t)-1;
@@ -147,11 +176,9 @@ unsigned char GetNfactor(unsigned int nTimestamp) {
 }
 
 void scrypt_janehash(void *output, const void *input) {
-	scrypt_aligned_alloc YX, V;
-	uint8_t *X, *Y;
+	uint8_t *X, *Y, *V;
 	uint32_t N, chunk_bytes;
 	const uint32_t r = SCRYPT_R;
-	const uint32_t p = SCRYPT_P;
 
 	int Nfactor = GetNfactor(((uint32_t*)input)[17]);
 	if (Nfactor > scrypt_maxN) {
@@ -161,16 +188,12 @@ void scrypt_janehash(void *output, const void *input) {
 	N = (1 << (Nfactor + 1));
 
 	chunk_bytes = SCRYPT_BLOCK_BYTES * r * 2;
-	V = scrypt_alloc((uint64_t)N * chunk_bytes);
-	YX = scrypt_alloc((p + 1) * chunk_bytes);
+	V = scrypt_jane_V((uint64_t)N * chunk_bytes);
 
-	Y = YX.ptr;
+	Y = ctx.YX;
 	X = Y + chunk_bytes;
 
-	scrypt_N_1_1((unsigned char *)input, 80, (unsigned char *)input, 80, N, (unsigned char *)output, 32, X, Y, V.ptr);
-
-	scrypt_free(&V);
-	scrypt_free(&YX);
+	scrypt_N_1_1((unsigned char *)input, 80, (unsigned char *)input, 80, N, (unsigned char *)output, 32, X, Y, V);
 }
 
 int scanhash_scrypt_jane(int thr_id, uint32_t *pdata,
@@ -184,11 +207,9 @@ int scanhash_scrypt_jane(int thr_id, uint32_t *pdata,
 	uint32_t hash64[8] __attribute__((aligned(32)));
 	uint32_t endiandata[32];
 
-	scrypt_aligned_alloc YX, V;
-	uint8_t *X, *Y;
+	uint8_t *X, *Y, *V;
 	uint32_t N, chunk_bytes;
 	const uint32_t r = SCRYPT_R;
-	const uint32_t p = SCRYPT_P;
 	int i;
 
 	uint64_t htmax[] = {
@@ -228,10 +249,9 @@ int scanhash_scrypt_jane(int thr_id, uint32_t *pdata,
 	N = (1 << (Nfactor + 1));
 
 	chunk_bytes = SCRYPT_BLOCK_BYTES * r * 2;
-	V = scrypt_alloc((uint64_t)N * chunk_bytes);
-	YX = scrypt_alloc((p + 1) * chunk_bytes);
+	V = scrypt_jane_V((uint64_t)N * chunk_bytes);
 
-	Y = YX.ptr;
+	Y = ctx.YX;
 	X = Y + chunk_bytes;
 
 #ifdef DEBUG_ALGO
@@ -242,13 +262,11 @@ int scanhash_scrypt_jane(int thr_id, uint32_t *pdata,
 			uint32_t mask = masks[m];
 			do {
 				endiandata[19] = ++n;
-				scrypt_N_1_1((unsigned char *)endiandata, 80, (unsigned char *)endiandata, 80, N, (unsigned char *)hash64, 32, X, Y, V.ptr);
+				scrypt_N_1_1((unsigned char *)endiandata, 80, (unsigned char *)endiandata, 80, N, (unsigned char *)hash64, 32, X, Y, V);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
 					pdata[19] = n;
-					scrypt_free(&V);
-					scrypt_free(&YX);
 					return 1;
 				}
 #else
@@ -266,9 +284,6 @@ int scanhash_scrypt_jane(int thr_id, uint32_t *pdata,
 		}
 	}
 
-	scrypt_free(&V);
-	scrypt_free(&YX);
-
 	*hashes_done = n - first_nonce + 1;
 	pdata[19] = n;
 	return 0;
@@ -397,6 +397,109 @@ static inline void PBKDF2_SHA256_128_32_8way(uint32_t *tstate,
 
 #endif /* HAVE_SHA256_8WAY */
 
+#ifdef HAVE_SHA256_16WAY
+
+static inline void HMAC_SHA256_80_init_16way(const uint32_t *key,
+	uint32_t *tstate, uint32_t *ostate)
+{
+	uint32_t ihash[16 * 8] __attribute__((aligned(64)));
+	uint32_t pad[16 * 16] __attribute__((aligned(64)));
+	int i;
+	
+	/* tstate is assumed to contain the midstate of key */
+	memcpy(pad, key + 16 * 16, 16 * 16);
+	for (i = 0; i < 16; i++)
+		pad[16 * 4 + i] = 0x80000000;
+	memset(pad + 16 * 5, 0x00, 16 * 40);
+	for (i = 0; i < 16; i++)
+		pad[16 * 15 + i] = 0x00000280;
+	sha256_transform_16way(tstate, pad, 0);
+	memcpy(ihash, tstate, 16 * 32);
+	
+	sha256_init_16way(ostate);
+	for (i = 0; i < 16 * 8; i++)
+		pad[i] = ihash[i] ^ 0x5c5c5c5c;
+	for (; i < 16 * 16; i++)
+		pad[i] = 0x5c5c5c5c;
+	sha256_transform_16way(ostate, pad, 0);
+	
+	sha256_init_16way(tstate);
+	for (i = 0; i < 16 * 8; i++)
+		pad[i] = ihash[i] ^ 0x36363636;
+	for (; i < 16 * 16; i++)
+		pad[i] = 0x36363636;
+	sha256_transform_16way(tstate, pad, 0);
+}
+
+static inline void PBKDF2_SHA256_80_128_16way(const uint32_t *tstate,
+	const uint32_t *ostate, const uint32_t *salt, uint32_t *output)
+{
+	uint32_t istate[16 * 8] __attribute__((aligned(64)));
+	uint32_t ostate2[16 * 8] __attribute__((aligned(64)));
+	uint32_t ibuf[16 * 16] __attribute__((aligned(64)));
+	uint32_t obuf[16 * 16] __attribute__((aligned(64)));
+	int i, j;
+	
+	memcpy(istate, tstate, 16 * 32);
+	sha256_transform_16way(istate, salt, 0);
+	
+	memcpy(ibuf, salt + 16 * 16, 16 * 16);
+	for (i = 0; i < 16; i++)
+		ibuf[16 * 5 + i] = 0x80000000;
+	memset(ibuf + 16 * 6, 0x00, 16 * 36);
+	for (i = 0; i < 16; i++)
+		ibuf[16 * 15 + i] = 0x000004a0;
+	
+	for (i = 0; i < 16; i++)
+		obuf[16 * 8 + i] = 0x80000000;
+	memset(obuf + 16 * 9, 0x00, 16 * 24);
+	for (i = 0; i < 16; i++)
+		obuf[16 * 15 + i] = 0x00000300;
+	
+	for (i = 0; i < 4; i++) {
+		memcpy(obuf, istate, 16 * 32);
+		for (j = 0; j < 16; j++)
+			ibuf[16 * 4 + j] = i + 1;
+		sha256_transform_16way(obuf, ibuf, 0);
+		
+		memcpy(ostate2, ostate, 16 * 32);
+		sha256_transform_16way(ostate2, obuf, 0);
+		for (j = 0; j < 16 * 8; j++)
+			output[16 * 8 * i + j] = swab32(ostate2[j]);
+	}
+}
+
+static inline void PBKDF2_SHA256_128_32_16way(uint32_t *tstate,
+	uint32_t *ostate, const uint32_t *salt, uint32_t *output)
+{
+	uint32_t buf[16 * 16] __attribute__((aligned(64)));
+	int i;
+	
+	sha256_transform_16way(tstate, salt, 1);
+	sha256_transform_16way(tstate, salt + 16 * 16, 1);
+	/* same padding block as finalblk_8way */
+	memset(buf, 0x00, sizeof(buf));
+	for (i = 0; i < 16; i++) {
+		buf[16 * 0 + i] = 0x00000001;
+		buf[16 * 1 + i] = 0x80000000;
+		buf[16 * 15 + i] = 0x00000620;
+	}
+	sha256_transform_16way(tstate, buf, 0);
+	
+	memcpy(buf, tstate, 16 * 32);
+	for (i = 0; i < 16; i++)
+		buf[16 * 8 + i] = 0x80000000;
+	memset(buf + 16 * 9, 0x00, 16 * 24);
+	for (i = 0; i < 16; i++)
+		buf[16 * 15 + i] = 0x00000300;
+	sha256_transform_16way(ostate, buf, 0);
+	
+	for (i = 0; i < 16 * 8; i++)
+		output[i] = swab32(ostate[i]);
+}
+
+#endif /* HAVE_SHA256_16WAY */
+
 
 #if defined(USE_ASM) && defined(__x86_64__)
 
@@ -411,6 +514,11 @@ void scrypt_core_3way(uint32_t *X, uint32_t *V, int N);
 #define HAVE_SCRYPT_6WAY 1
 void scrypt_core_6way(uint32_t *X, uint32_t *V, int N);
 #endif
+#if defined(HAVE_SHA256_16WAY)
+/* gathers index V with 32-bit word offsets of 512 * j */
+#define HAVE_SCRYPT_16WAY 1
+#define SCRYPT_16WAY_MAX_N (1 << 22)
+#endif
 
 #elif defined(USE_ASM) && defined(__i386__)
 
@@ -524,9 +632,20 @@ static inline void scrypt_core(uint32_t *X, uint32_t *V, int N)
 #define scrypt_best_throughput() 1
 #endif
 
+static size_t scrypt_buffer_size(int N)
+{
+	return (size_t)N * SCRYPT_MAX_WAYS * 128 + 63;
+}
+
 unsigned char *scrypt_buffer_alloc(int N)
 {
-	return malloc((size_t)N * SCRYPT_MAX_WAYS * 128 + 63);
+	return scratchpad_alloc(scrypt_buffer_size(N), "scrypt");
+}
+
+void free_scrypt_contexts(void *dummy)
+{
+	scratchpad_free(ctx.scratchbuf, scrypt_buffer_size(ctx.n));
+	ctx.scratchbuf = NULL;
 }
 
 static void scrypt_1024_1_1_256(const uint32_t *input, uint32_t *output,
@@ -713,6 +832,151 @@ static void scrypt_1024_1_1_256_24way(const uint32_t *input,
 }
 #endif /* HAVE_SCRYPT_6WAY */
 
+#ifdef HAVE_SCRYPT_16WAY
+
+#include <immintrin.h>
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+/*
+ * 16-way Salsa20/8 on the lane-interleaved layout produced by the 16-way
+ * PBKDF2 (word i of lane k at 16 * i + k), so no transposition is needed
+ * around scrypt_core_16way().  V uses the same layout, and the data
+ * dependent reads of the second loop are done with one gather per word.
+ */
+
+#define SALSA16_R(a, b, c, n) \
+	a = _mm512_xor_si512(a, _mm512_rol_epi32(_mm512_add_epi32(b, c), n))
+
+static inline void xor_salsa8_16way(__m512i B[16], const __m512i Bx[16])
+{
+	__m512i x00,x01,x02,x03,x04,x05,x06,x07,x08,x09,x10,x11,x12,x13,x14,x15;
+	int i;
+
+	x00 = (B[ 0] = _mm512_xor_si512(B[ 0], Bx[ 0]));
+	x01 = (B[ 1] = _mm512_xor_si512(B[ 1], Bx[ 1]));
+	x02 = (B[ 2] = _mm512_xor_si512(B[ 2], Bx[ 2]));
+	x03 = (B[ 3] = _mm512_xor_si512(B[ 3], Bx[ 3]));
+	x04 = (B[ 4] = _mm512_xor_si512(B[ 4], Bx[ 4]));
+	x05 = (B[ 5] = _mm512_xor_si512(B[ 5], Bx[ 5]));
+	x06 = (B[ 6] = _mm512_xor_si512(B[ 6], Bx[ 6]));
+	x07 = (B[ 7] = _mm512_xor_si512(B[ 7], Bx[ 7]));
+	x08 = (B[ 8] = _mm512_xor_si512(B[ 8], Bx[ 8]));
+	x09 = (B[ 9] = _mm512_xor_si512(B[ 9], Bx[ 9]));
+	x10 = (B[10] = _mm512_xor_si512(B[10], Bx[10]));
+	x11 = (B[11] = _mm512_xor_si512(B[11], Bx[11]));
+	x12 = (B[12] = _mm512_xor_si512(B[12], Bx[12]));
+	x13 = (B[13] = _mm512_xor_si512(B[13], Bx[13]));
+	x14 = (B[14] = _mm512_xor_si512(B[14], Bx[14]));
+	x15 = (B[15] = _mm512_xor_si512(B[15], Bx[15]));
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		SALSA16_R(x04, x00, x12,  7);	SALSA16_R(x09, x05, x01,  7);
+		SALSA16_R(x14, x10, x06,  7);	SALSA16_R(x03, x15, x11,  7);
+		
+		SALSA16_R(x08, x04, x00,  9);	SALSA16_R(x13, x09, x05,  9);
+		SALSA16_R(x02, x14, x10,  9);	SALSA16_R(x07, x03, x15,  9);
+		
+		SALSA16_R(x12, x08, x04, 13);	SALSA16_R(x01, x13, x09, 13);
+		SALSA16_R(x06, x02, x14, 13);	SALSA16_R(x11, x07, x03, 13);
+		
+		SALSA16_R(x00, x12, x08, 18);	SALSA16_R(x05, x01, x13, 18);
+		SALSA16_R(x10, x06, x02, 18);	SALSA16_R(x15, x11, x07, 18);
+		
+		/* Operate on rows. */
+		SALSA16_R(x01, x00, x03,  7);	SALSA16_R(x06, x05, x04,  7);
+		SALSA16_R(x11, x10, x09,  7);	SALSA16_R(x12, x15, x14,  7);
+		
+		SALSA16_R(x02, x01, x00,  9);	SALSA16_R(x07, x06, x05,  9);
+		SALSA16_R(x08, x11, x10,  9);	SALSA16_R(x13, x12, x15,  9);
+		
+		SALSA16_R(x03, x02, x01, 13);	SALSA16_R(x04, x07, x06, 13);
+		SALSA16_R(x09, x08, x11, 13);	SALSA16_R(x14, x13, x12, 13);
+		
+		SALSA16_R(x00, x03, x02, 18);	SALSA16_R(x05, x04, x07, 18);
+		SALSA16_R(x10, x09, x08, 18);	SALSA16_R(x15, x14, x13, 18);
+	}
+	B[ 0] = _mm512_add_epi32(B[ 0], x00);
+	B[ 1] = _mm512_add_epi32(B[ 1], x01);
+	B[ 2] = _mm512_add_epi32(B[ 2], x02);
+	B[ 3] = _mm512_add_epi32(B[ 3], x03);
+	B[ 4] = _mm512_add_epi32(B[ 4], x04);
+	B[ 5] = _mm512_add_epi32(B[ 5], x05);
+	B[ 6] = _mm512_add_epi32(B[ 6], x06);
+	B[ 7] = _mm512_add_epi32(B[ 7], x07);
+	B[ 8] = _mm512_add_epi32(B[ 8], x08);
+	B[ 9] = _mm512_add_epi32(B[ 9], x09);
+	B[10] = _mm512_add_epi32(B[10], x10);
+	B[11] = _mm512_add_epi32(B[11], x11);
+	B[12] = _mm512_add_epi32(B[12], x12);
+	B[13] = _mm512_add_epi32(B[13], x13);
+	B[14] = _mm512_add_epi32(B[14], x14);
+	B[15] = _mm512_add_epi32(B[15], x15);
+}
+
+#undef SALSA16_R
+
+static void scrypt_core_16way(uint32_t *X, uint32_t *V, int N)
+{
+	__m512i B[32];
+	__m512i lane, mask, idx;
+	int i, k;
+	
+	for (k = 0; k < 32; k++)
+		B[k] = _mm512_load_si512(X + 16 * k);
+	for (i = 0; i < N; i++) {
+		for (k = 0; k < 32; k++)
+			_mm512_store_si512(V + 16 * (32 * i + k), B[k]);
+		xor_salsa8_16way(&B[0], &B[16]);
+		xor_salsa8_16way(&B[16], &B[0]);
+	}
+	lane = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+	                         7,  6,  5,  4,  3,  2, 1, 0);
+	mask = _mm512_set1_epi32(N - 1);
+	for (i = 0; i < N; i++) {
+		/* word k of lane l lives at V[512 * j + 16 * k + l] */
+		idx = _mm512_add_epi32(_mm512_slli_epi32(
+			_mm512_and_si512(B[16], mask), 9), lane);
+		for (k = 0; k < 32; k++)
+			B[k] = _mm512_xor_si512(B[k],
+				_mm512_i32gather_epi32(idx, V + 16 * k, 4));
+		xor_salsa8_16way(&B[0], &B[16]);
+		xor_salsa8_16way(&B[16], &B[0]);
+	}
+	for (k = 0; k < 32; k++)
+		_mm512_store_si512(X + 16 * k, B[k]);
+}
+
+#pragma GCC pop_options
+
+static void scrypt_1024_1_1_256_16way(const uint32_t *input,
+	uint32_t *output, uint32_t *midstate, unsigned char *scratchpad, int N)
+{
+	uint32_t tstate[16 * 8] __attribute__((aligned(64)));
+	uint32_t ostate[16 * 8] __attribute__((aligned(64)));
+	uint32_t W[16 * 32] __attribute__((aligned(64)));
+	uint32_t *V;
+	int i, k;
+	
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	
+	for (i = 0; i < 20; i++)
+		for (k = 0; k < 16; k++)
+			W[16 * i + k] = input[k * 20 + i];
+	for (i = 0; i < 8; i++)
+		for (k = 0; k < 16; k++)
+			tstate[16 * i + k] = midstate[i];
+	HMAC_SHA256_80_init_16way(W, tstate, ostate);
+	PBKDF2_SHA256_80_128_16way(tstate, ostate, W, W);
+	scrypt_core_16way(W, V, N);
+	PBKDF2_SHA256_128_32_16way(tstate, ostate, W, W);
+	for (i = 0; i < 8; i++)
+		for (k = 0; k < 16; k++)
+			output[k * 8 + i] = W[16 * i + k];
+}
+#endif /* HAVE_SCRYPT_16WAY */
+
 void scrypthash(void *output, const void *input) {
 	uint32_t midstate[8];
 	sha256_init(midstate);
@@ -729,12 +993,23 @@ int scanhash_scrypt(int thr_id, uint32_t *pdata,
 	uint32_t n = pdata[19] - 1;
 	const uint32_t Htarg = ptarget[7];
 	int throughput = scrypt_best_throughput();
-	int i;
+	int i, lanes;
 	
+#ifdef HAVE_SCRYPT_6WAY
+	if (throughput == 6 && !(opt_kernels & KERNEL_8WAY))
+		throughput = 3;
+#endif
+	if (!(opt_kernels & KERNEL_4WAY))
+		throughput = 1;
 #ifdef HAVE_SHA256_4WAY
-	if (sha256_use_4way())
+	if ((opt_kernels & KERNEL_4WAY) && sha256_use_4way())
 		throughput *= 4;
 #endif
+#ifdef HAVE_SCRYPT_16WAY
+	if ((opt_kernels & KERNEL_16WAY) && ctx.n <= SCRYPT_16WAY_MAX_N
+		&& sha256_use_16way())
+		throughput = 16;
+#endif
 	
 	for (i = 0; i < throughput; i++)
 		memcpy(data + i * 20, pdata, 80);
@@ -745,6 +1020,12 @@ int scanhash_scrypt(int thr_id, uint32_t *pdata,
 	do {
 		for (i = 0; i < throughput; i++)
 			data[i * 20 + 19] = ++n;
+		/* the last batch may run past max_nonce, drop those lanes */
+		lanes = throughput;
+		if (n > max_nonce) {
+			lanes -= n - max_nonce;
+			n = max_nonce;
+		}
 		
 #if defined(HAVE_SHA256_4WAY)
 		if (throughput == 4)
@@ -756,6 +1037,11 @@ int scanhash_scrypt(int thr_id, uint32_t *pdata,
 			scrypt_1024_1_1_256_12way(data, hash, midstate, ctx.scratchbuf, ctx.n);
 		else
 #endif
+#if defined(HAVE_SCRYPT_16WAY)
+		if (throughput == 16)
+			scrypt_1024_1_1_256_16way(data, hash, midstate, ctx.scratchbuf, ctx.n);
+		else
+#endif
 #if defined(HAVE_SCRYPT_6WAY)
 		if (throughput == 24)
 			scrypt_1024_1_1_256_24way(data, hash, midstate, ctx.scratchbuf, ctx.n);
@@ -768,8 +1054,9 @@ int scanhash_scrypt(int thr_id, uint32_t *pdata,
 #endif
 		scrypt_1024_1_1_256(data, hash, midstate, ctx.scratchbuf, ctx.n);
 		
-		for (i = 0; i < throughput; i++) {
-			if (unlikely(hash[i * 8 + 7] <= Htarg && fulltest(hash + i * 8, ptarget))) {
+		for (i = 0; i < lanes; i++) {
+			if (unlikely(hash[i * 8 + 7] <= Htarg && fulltest(hash + i * 8, ptarget))
+					&& !scan_found(thr_id, pdata, data[i * 20 + 19])) {
 				*hashes_done = n - pdata[19] + 1;
 				pdata[19] = data[i * 20 + 19];
 				return 1;
@@ -73,6 +73,248 @@ void sha256_init(uint32_t *state)
 	    S[(70 - i) % 8], S[(71 - i) % 8], \
 	    W[i] + sha256_k[i])
 
+/*
+ * Dedicated SHA-256 instructions: SHA-NI on x86, the ARMv8 cryptography
+ * extensions on AArch64.  Both are built with target pragmas and picked
+ * at runtime by sha256_use_hw(); sha256_transform() and everything built
+ * on it (sha256d, merkle roots, the scalar HMAC/PBKDF2) then use them.
+ * The 2-way variant interleaves two independent blocks to hide the
+ * latency of the round instructions.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && \
+	(defined(__x86_64__) || defined(__i386__))
+
+#define HAVE_SHA256_HW 1
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+static int sha256_use_hw()
+{
+	static int use_hw = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (use_hw >= 0)
+		return use_hw && (opt_kernels & KERNEL_SHA);
+	use_hw = 0;
+	/* Check for SSSE3 and SSE4.1 support */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+		|| (ecx & 0x00080200) != 0x00080200)
+		return 0;
+	/* Check for SHA support */
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (!(ebx & 0x20000000))
+		return 0;
+	use_hw = 1;
+	return !!(opt_kernels & KERNEL_SHA);
+}
+
+#pragma GCC push_options
+#pragma GCC target("sha,sse4.1")
+
+/* state words are kept as ABEF / CDGH, the operand order of sha256rnds2 */
+#define HW_LOAD_STATE(S0, S1, state) \
+	do { \
+		__m128i abcd_ = _mm_loadu_si128((const __m128i *)(state)); \
+		__m128i efgh_ = _mm_loadu_si128((const __m128i *)(state) + 1); \
+		abcd_ = _mm_shuffle_epi32(abcd_, 0xb1); \
+		efgh_ = _mm_shuffle_epi32(efgh_, 0x1b); \
+		S0 = _mm_alignr_epi8(abcd_, efgh_, 8); \
+		S1 = _mm_blend_epi16(efgh_, abcd_, 0xf0); \
+	} while (0)
+
+#define HW_STORE_STATE(state, S0, S1) \
+	do { \
+		__m128i feba_ = _mm_shuffle_epi32(S0, 0x1b); \
+		__m128i dchg_ = _mm_shuffle_epi32(S1, 0xb1); \
+		_mm_storeu_si128((__m128i *)(state), \
+			_mm_blend_epi16(feba_, dchg_, 0xf0)); \
+		_mm_storeu_si128((__m128i *)(state) + 1, \
+			_mm_alignr_epi8(dchg_, feba_, 8)); \
+	} while (0)
+
+#define HW_LOAD_MSG(M, block, i, swap) \
+	do { \
+		M = _mm_loadu_si128((const __m128i *)(block) + (i)); \
+		if (swap) \
+			M = _mm_shuffle_epi8(M, _mm_set_epi64x( \
+				0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL)); \
+	} while (0)
+
+#define HW_ADD(a, b)  _mm_add_epi32(a, b)
+
+#define HW_RND4(S0, S1, M, k) \
+	do { \
+		__m128i msg_ = _mm_add_epi32(M, \
+			_mm_loadu_si128((const __m128i *)(sha256_k + (k)))); \
+		S1 = _mm_sha256rnds2_epu32(S1, S0, msg_); \
+		S0 = _mm_sha256rnds2_epu32(S0, S1, _mm_shuffle_epi32(msg_, 0x0e)); \
+	} while (0)
+
+/* M0 = W[t-16..t-13] becomes W[t..t+3] */
+#define HW_MSG(M0, M1, M2, M3) \
+	M0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(M0, M1), \
+		_mm_alignr_epi8(M3, M2, 4)), M3)
+
+typedef __m128i sha256_hw_t;
+
+#elif defined(__GNUC__) && !defined(__clang__) && \
+	defined(__aarch64__) && defined(__linux__)
+
+#define HAVE_SHA256_HW 1
+
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+
+static int sha256_use_hw()
+{
+	static int use_hw = -1;
+
+	if (use_hw < 0)
+		use_hw = !!(getauxval(AT_HWCAP) & HWCAP_SHA2);
+	return use_hw && (opt_kernels & KERNEL_SHA);
+}
+
+#pragma GCC push_options
+#pragma GCC target("+crypto")
+#include <arm_neon.h>
+
+/* state words are kept as ABCD / EFGH */
+#define HW_LOAD_STATE(S0, S1, state) \
+	do { \
+		S0 = vld1q_u32(state); \
+		S1 = vld1q_u32((state) + 4); \
+	} while (0)
+
+#define HW_STORE_STATE(state, S0, S1) \
+	do { \
+		vst1q_u32(state, S0); \
+		vst1q_u32((state) + 4, S1); \
+	} while (0)
+
+#define HW_LOAD_MSG(M, block, i, swap) \
+	do { \
+		M = vld1q_u32((block) + 4 * (i)); \
+		if (swap) \
+			M = vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(M))); \
+	} while (0)
+
+#define HW_ADD(a, b)  vaddq_u32(a, b)
+
+#define HW_RND4(S0, S1, M, k) \
+	do { \
+		uint32x4_t msg_ = vaddq_u32(M, vld1q_u32(sha256_k + (k))); \
+		uint32x4_t abcd_ = S0; \
+		S0 = vsha256hq_u32(S0, S1, msg_); \
+		S1 = vsha256h2q_u32(S1, abcd_, msg_); \
+	} while (0)
+
+/* M0 = W[t-16..t-13] becomes W[t..t+3] */
+#define HW_MSG(M0, M1, M2, M3) \
+	M0 = vsha256su1q_u32(vsha256su0q_u32(M0, M1), M2, M3)
+
+typedef uint32x4_t sha256_hw_t;
+
+#endif
+
+#ifdef HAVE_SHA256_HW
+
+#define HW_RND16(S0, S1, M0, M1, M2, M3, k) \
+	do { \
+		HW_MSG(M0, M1, M2, M3); HW_RND4(S0, S1, M0, (k) +  0); \
+		HW_MSG(M1, M2, M3, M0); HW_RND4(S0, S1, M1, (k) +  4); \
+		HW_MSG(M2, M3, M0, M1); HW_RND4(S0, S1, M2, (k) +  8); \
+		HW_MSG(M3, M0, M1, M2); HW_RND4(S0, S1, M3, (k) + 12); \
+	} while (0)
+
+static void sha256_transform_hw(uint32_t *state, const uint32_t *block,
+	int swap)
+{
+	sha256_hw_t S0, S1, T0, T1, M0, M1, M2, M3;
+
+	HW_LOAD_STATE(S0, S1, state);
+	T0 = S0;
+	T1 = S1;
+	HW_LOAD_MSG(M0, block, 0, swap);
+	HW_LOAD_MSG(M1, block, 1, swap);
+	HW_LOAD_MSG(M2, block, 2, swap);
+	HW_LOAD_MSG(M3, block, 3, swap);
+
+	HW_RND4(S0, S1, M0, 0);
+	HW_RND4(S0, S1, M1, 4);
+	HW_RND4(S0, S1, M2, 8);
+	HW_RND4(S0, S1, M3, 12);
+	HW_RND16(S0, S1, M0, M1, M2, M3, 16);
+	HW_RND16(S0, S1, M0, M1, M2, M3, 32);
+	HW_RND16(S0, S1, M0, M1, M2, M3, 48);
+
+	S0 = HW_ADD(S0, T0);
+	S1 = HW_ADD(S1, T1);
+	HW_STORE_STATE(state, S0, S1);
+}
+
+#define HW_RND4_2WAY(k, i) \
+	do { \
+		HW_RND4(SA0, SA1, MA ## i, k); \
+		HW_RND4(SB0, SB1, MB ## i, k); \
+	} while (0)
+
+#define HW_RND16_2WAY(k) \
+	do { \
+		HW_MSG(MA0, MA1, MA2, MA3); HW_MSG(MB0, MB1, MB2, MB3); \
+		HW_RND4_2WAY((k) +  0, 0); \
+		HW_MSG(MA1, MA2, MA3, MA0); HW_MSG(MB1, MB2, MB3, MB0); \
+		HW_RND4_2WAY((k) +  4, 1); \
+		HW_MSG(MA2, MA3, MA0, MA1); HW_MSG(MB2, MB3, MB0, MB1); \
+		HW_RND4_2WAY((k) +  8, 2); \
+		HW_MSG(MA3, MA0, MA1, MA2); HW_MSG(MB3, MB0, MB1, MB2); \
+		HW_RND4_2WAY((k) + 12, 3); \
+	} while (0)
+
+/* two independent sha256_transform(state, block, 0) */
+static void sha256_transform_hw_2way(uint32_t *stateA, const uint32_t *blockA,
+	uint32_t *stateB, const uint32_t *blockB)
+{
+	sha256_hw_t SA0, SA1, TA0, TA1, MA0, MA1, MA2, MA3;
+	sha256_hw_t SB0, SB1, TB0, TB1, MB0, MB1, MB2, MB3;
+
+	HW_LOAD_STATE(SA0, SA1, stateA);
+	HW_LOAD_STATE(SB0, SB1, stateB);
+	TA0 = SA0;
+	TA1 = SA1;
+	TB0 = SB0;
+	TB1 = SB1;
+	HW_LOAD_MSG(MA0, blockA, 0, 0);
+	HW_LOAD_MSG(MA1, blockA, 1, 0);
+	HW_LOAD_MSG(MA2, blockA, 2, 0);
+	HW_LOAD_MSG(MA3, blockA, 3, 0);
+	HW_LOAD_MSG(MB0, blockB, 0, 0);
+	HW_LOAD_MSG(MB1, blockB, 1, 0);
+	HW_LOAD_MSG(MB2, blockB, 2, 0);
+	HW_LOAD_MSG(MB3, blockB, 3, 0);
+
+	HW_RND4_2WAY(0, 0);
+	HW_RND4_2WAY(4, 1);
+	HW_RND4_2WAY(8, 2);
+	HW_RND4_2WAY(12, 3);
+	HW_RND16_2WAY(16);
+	HW_RND16_2WAY(32);
+	HW_RND16_2WAY(48);
+
+	SA0 = HW_ADD(SA0, TA0);
+	SA1 = HW_ADD(SA1, TA1);
+	SB0 = HW_ADD(SB0, TB0);
+	SB1 = HW_ADD(SB1, TB1);
+	HW_STORE_STATE(stateA, SA0, SA1);
+	HW_STORE_STATE(stateB, SB0, SB1);
+}
+
+#pragma GCC pop_options
+
+#endif /* HAVE_SHA256_HW */
+
 #ifndef EXTERN_SHA256
 
 /*
@@ -86,6 +328,13 @@ void sha256_transform(uint32_t *state, const uint32_t *block, int swap)
 	uint32_t t0, t1;
 	int i;
 
+#ifdef HAVE_SHA256_HW
+	if (sha256_use_hw()) {
+		sha256_transform_hw(state, block, swap);
+		return;
+	}
+#endif
+
 	/* 1. Prepare message schedule W. */
 	if (swap) {
 		for (i = 0; i < 16; i++)
@@ -196,12 +445,13 @@ static void sha256d_80_swap(uint32_t *hash, const uint32_t *data)
 		hash[i] = swab32(hash[i]);
 }
 
-void sha256(unsigned char *hash, const unsigned char *data, int len)
+/* hash the last len bytes of a total byte message into S, with padding */
+static void sha256_final(uint32_t *S, const unsigned char *data, int len,
+	int total)
 {
-	uint32_t S[16], T[16];
+	uint32_t T[16];
 	int i, r;
 
-	sha256_init(S);
 	for (r = len; r > -9; r -= 64) {
 		if (r < 64)
 			memset(T, 0, 64);
@@ -211,36 +461,82 @@ void sha256(unsigned char *hash, const unsigned char *data, int len)
 		for (i = 0; i < 16; i++)
 			T[i] = be32dec(T + i);
 		if (r < 56)
-			T[15] = 8 * len;
+			T[15] = 8 * total;
 		sha256_transform(S, T, 0);
 	}
+}
+
+static void sha256d_second(unsigned char *hash, uint32_t *S)
+{
+	uint32_t T[8];
+	int i;
+
+	memcpy(S + 8, sha256d_hash1 + 8, 32);
+	sha256_init(T);
+	sha256_transform(T, S, 0);
+	for (i = 0; i < 8; i++)
+		be32enc((uint32_t *)hash + i, T[i]);
+}
+
+void sha256(unsigned char *hash, const unsigned char *data, int len)
+{
+	uint32_t S[8];
+	int i;
+
+	sha256_init(S);
+	sha256_final(S, data, len, len);
 	for (i = 0; i < 8; i++)
 		be32enc((uint32_t *)hash + i, S[i]);
 }
 
 void sha256d(unsigned char *hash, const unsigned char *data, int len)
 {
-	uint32_t S[16], T[16];
-	int i, r;
+	uint32_t S[16];
 
 	sha256_init(S);
-	for (r = len; r > -9; r -= 64) {
-		if (r < 64)
-			memset(T, 0, 64);
-		memcpy(T, data + len - r, r > 64 ? 64 : (r < 0 ? 0 : r));
-		if (r >= 0 && r < 64)
-			((unsigned char *)T)[r] = 0x80;
+	sha256_final(S, data, len, len);
+	sha256d_second(hash, S);
+}
+
+/*
+ * State after the first blocks 64-byte blocks of data. Messages which
+ * share that prefix (a coinbase up to its extranonce2) can then be
+ * finished with sha256_resume() / sha256d_resume().
+ */
+void sha256_midstate(uint32_t *state, const unsigned char *data, int blocks)
+{
+	uint32_t T[16];
+	int i;
+
+	sha256_init(state);
+	for (; blocks > 0; blocks--, data += 64) {
 		for (i = 0; i < 16; i++)
-			T[i] = be32dec(T + i);
-		if (r < 56)
-			T[15] = 8 * len;
-		sha256_transform(S, T, 0);
+			T[i] = be32dec((const uint32_t *)data + i);
+		sha256_transform(state, T, 0);
 	}
-	memcpy(S + 8, sha256d_hash1 + 8, 32);
-	sha256_init(T);
-	sha256_transform(T, S, 0);
+}
+
+/* hash of a message whose first done bytes went into midstate */
+void sha256_resume(unsigned char *hash, const uint32_t *midstate, int done,
+	const unsigned char *data, int len)
+{
+	uint32_t S[8];
+	int i;
+
+	memcpy(S, midstate, 32);
+	sha256_final(S, data, len, done + len);
 	for (i = 0; i < 8; i++)
-		be32enc((uint32_t *)hash + i, T[i]);
+		be32enc((uint32_t *)hash + i, S[i]);
+}
+
+void sha256d_resume(unsigned char *hash, const uint32_t *midstate, int done,
+	const unsigned char *data, int len)
+{
+	uint32_t S[16];
+
+	memcpy(S, midstate, 32);
+	sha256_final(S, data, len, done + len);
+	sha256d_second(hash, S);
 }
 
 static inline void sha256d_preextend(uint32_t *W)
@@ -500,7 +796,7 @@ static inline int scanhash_sha256d_4way(int thr_id, uint32_t *pdata,
 	uint32_t n = pdata[19] - 1;
 	const uint32_t first_nonce = pdata[19];
 	const uint32_t Htarg = ptarget[7];
-	int i, j;
+	int i, j, lanes;
 	
 	memcpy(data, pdata + 16, 64);
 	sha256d_preextend(data);
@@ -522,14 +818,21 @@ static inline int scanhash_sha256d_4way(int thr_id, uint32_t *pdata,
 	do {
 		for (i = 0; i < 4; i++)
 			data[4 * 3 + i] = ++n;
+		/* the last vector may run past max_nonce, drop those lanes */
+		lanes = 4;
+		if (n > max_nonce) {
+			lanes -= n - max_nonce;
+			n = max_nonce;
+		}
 		
 		sha256d_ms_4way(hash, data, midstate, prehash);
 		
-		for (i = 0; i < 4; i++) {
+		for (i = 0; i < lanes; i++) {
 			if (swab32(hash[4 * 7 + i]) <= Htarg) {
 				pdata[19] = data[4 * 3 + i];
 				sha256d_80_swap(hash, pdata);
-				if (fulltest(hash, ptarget)) {
+				if (fulltest(hash, ptarget)
+						&& !scan_found(thr_id, pdata, pdata[19])) {
 					*hashes_done = n - first_nonce + 1;
 					return 1;
 				}
@@ -559,7 +862,7 @@ static inline int scanhash_sha256d_8way(int thr_id, uint32_t *pdata,
 	uint32_t n = pdata[19] - 1;
 	const uint32_t first_nonce = pdata[19];
 	const uint32_t Htarg = ptarget[7];
-	int i, j;
+	int i, j, lanes;
 	
 	memcpy(data, pdata + 16, 64);
 	sha256d_preextend(data);
@@ -581,14 +884,21 @@ static inline int scanhash_sha256d_8way(int thr_id, uint32_t *pdata,
 	do {
 		for (i = 0; i < 8; i++)
 			data[8 * 3 + i] = ++n;
+		/* the last vector may run past max_nonce, drop those lanes */
+		lanes = 8;
+		if (n > max_nonce) {
+			lanes -= n - max_nonce;
+			n = max_nonce;
+		}
 		
 		sha256d_ms_8way(hash, data, midstate, prehash);
 		
-		for (i = 0; i < 8; i++) {
+		for (i = 0; i < lanes; i++) {
 			if (swab32(hash[8 * 7 + i]) <= Htarg) {
 				pdata[19] = data[8 * 3 + i];
 				sha256d_80_swap(hash, pdata);
-				if (fulltest(hash, ptarget)) {
+				if (fulltest(hash, ptarget)
+						&& !scan_found(thr_id, pdata, pdata[19])) {
 					*hashes_done = n - first_nonce + 1;
 					return 1;
 				}
@@ -603,8 +913,283 @@ static inline int scanhash_sha256d_8way(int thr_id, uint32_t *pdata,
 
 #endif /* HAVE_SHA256_8WAY */
 
-int scanhash_sha256d(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
-	uint32_t max_nonce, uint64_t *hashes_done)
+#ifdef HAVE_SHA256_16WAY
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/*
+ * 16-way AVX-512F SHA-256.  Each zmm register holds the same state or
+ * message word of 16 independent hashes, laid out like the 4-way and
+ * 8-way code (word i of lane k at index 16 * i + k).  The code is built
+ * with a target pragma so the rest of the binary keeps the default flags;
+ * sha256_use_16way() tells whether the running cpu and OS support it.
+ */
+
+int sha256_use_16way()
+{
+	static int use_16way = -1;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (use_16way >= 0)
+		return use_16way;
+	use_16way = 0;
+	/* Check for AVX and OSXSAVE support */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+		|| (ecx & 0x18000000) != 0x18000000)
+		return 0;
+	/* Check for AVX-512F support */
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	if (!(ebx & 0x00010000))
+		return 0;
+	/* Check for XMM, YMM, opmask and ZMM state support */
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	if ((eax & 0xe6) != 0xe6)
+		return 0;
+	use_16way = 1;
+	return 1;
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+#define add16(a, b)       _mm512_add_epi32(a, b)
+#define add16_3(a, b, c)  add16(add16(a, b), c)
+#define xor16_3(a, b, c)  _mm512_ternarylogic_epi32(a, b, c, 0x96)
+
+#define Ch16(x, y, z)     _mm512_ternarylogic_epi32(x, y, z, 0xca)
+#define Maj16(x, y, z)    _mm512_ternarylogic_epi32(x, y, z, 0xe8)
+#define S0_16(x)          xor16_3(_mm512_ror_epi32(x, 2), \
+                            _mm512_ror_epi32(x, 13), _mm512_ror_epi32(x, 22))
+#define S1_16(x)          xor16_3(_mm512_ror_epi32(x, 6), \
+                            _mm512_ror_epi32(x, 11), _mm512_ror_epi32(x, 25))
+#define s0_16(x)          xor16_3(_mm512_ror_epi32(x, 7), \
+                            _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x, 3))
+#define s1_16(x)          xor16_3(_mm512_ror_epi32(x, 17), \
+                            _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10))
+
+#define RND16(a, b, c, d, e, f, g, h, k) \
+	do { \
+		t0 = add16_3(h, S1_16(e), add16(Ch16(e, f, g), k)); \
+		t1 = add16(S0_16(a), Maj16(a, b, c)); \
+		d = add16(d, t0); \
+		h = add16(t0, t1); \
+	} while (0)
+
+#define RNDr16(S, W, i) \
+	RND16(S[(64 - (i)) % 8], S[(65 - (i)) % 8], \
+	      S[(66 - (i)) % 8], S[(67 - (i)) % 8], \
+	      S[(68 - (i)) % 8], S[(69 - (i)) % 8], \
+	      S[(70 - (i)) % 8], S[(71 - (i)) % 8], \
+	      add16(W[i], _mm512_set1_epi32(sha256_k[i])))
+
+#define RNDr16_8(S, W, i) \
+	do { \
+		RNDr16(S, W, i + 0); RNDr16(S, W, i + 1); \
+		RNDr16(S, W, i + 2); RNDr16(S, W, i + 3); \
+		RNDr16(S, W, i + 4); RNDr16(S, W, i + 5); \
+		RNDr16(S, W, i + 6); RNDr16(S, W, i + 7); \
+	} while (0)
+
+#define EXPAND16(W, i) \
+	W[i] = add16(add16(s1_16(W[i - 2]), W[i - 7]), \
+	             add16(s0_16(W[i - 15]), W[i - 16]))
+
+static inline __m512i swab32_16way(__m512i x)
+{
+	return _mm512_ternarylogic_epi32(_mm512_ror_epi32(x, 8),
+		_mm512_rol_epi32(x, 8), _mm512_set1_epi32(0xff00ff00), 0xe4);
+}
+
+void sha256_init_16way(uint32_t *state)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		_mm512_storeu_si512(state + 16 * i, _mm512_set1_epi32(sha256_h[i]));
+}
+
+void sha256_transform_16way(uint32_t *state, const uint32_t *block, int swap)
+{
+	__m512i W[64];
+	__m512i S[8];
+	__m512i t0, t1;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		W[i] = _mm512_loadu_si512(block + 16 * i);
+		if (swap)
+			W[i] = swab32_16way(W[i]);
+	}
+	for (i = 16; i < 64; i++)
+		EXPAND16(W, i);
+
+	for (i = 0; i < 8; i++)
+		S[i] = _mm512_loadu_si512(state + 16 * i);
+
+	RNDr16_8(S, W,  0);
+	RNDr16_8(S, W,  8);
+	RNDr16_8(S, W, 16);
+	RNDr16_8(S, W, 24);
+	RNDr16_8(S, W, 32);
+	RNDr16_8(S, W, 40);
+	RNDr16_8(S, W, 48);
+	RNDr16_8(S, W, 56);
+
+	for (i = 0; i < 8; i++)
+		_mm512_storeu_si512(state + 16 * i,
+			add16(S[i], _mm512_loadu_si512(state + 16 * i)));
+}
+
+/*
+ * Same shortcuts as sha256d_ms(): data holds the pre-extended words of
+ * the second block (nonce in word 3) and prehash the state after round 2.
+ * Only hash[7] is fully computed.
+ */
+static void sha256d_ms_16way(uint32_t *hash, const uint32_t *data,
+	const uint32_t *midstate, const uint32_t *prehash)
+{
+	__m512i W[64];
+	__m512i S[8];
+	__m512i t0, t1;
+	int i;
+
+	for (i = 0; i < 32; i++)
+		W[i] = _mm512_load_si512(data + 16 * i);
+
+	W[18] = add16(W[18], s0_16(W[3]));
+	W[19] = add16(W[19], W[3]);
+	W[20] = add16(W[20], s1_16(W[18]));
+	W[21] = s1_16(W[19]);
+	W[22] = add16(W[22], s1_16(W[20]));
+	W[23] = add16(W[23], s1_16(W[21]));
+	W[24] = add16(W[24], s1_16(W[22]));
+	W[25] = add16(s1_16(W[23]), W[18]);
+	W[26] = add16(s1_16(W[24]), W[19]);
+	W[27] = add16(s1_16(W[25]), W[20]);
+	W[28] = add16(s1_16(W[26]), W[21]);
+	W[29] = add16(s1_16(W[27]), W[22]);
+	W[30] = add16_3(W[30], s1_16(W[28]), W[23]);
+	W[31] = add16_3(W[31], s1_16(W[29]), W[24]);
+	for (i = 32; i < 64; i++)
+		EXPAND16(W, i);
+
+	for (i = 0; i < 8; i++)
+		S[i] = _mm512_load_si512(prehash + 16 * i);
+
+	RNDr16(S, W, 3);
+	RNDr16(S, W, 4);
+	RNDr16(S, W, 5);
+	RNDr16(S, W, 6);
+	RNDr16(S, W, 7);
+	RNDr16_8(S, W,  8);
+	RNDr16_8(S, W, 16);
+	RNDr16_8(S, W, 24);
+	RNDr16_8(S, W, 32);
+	RNDr16_8(S, W, 40);
+	RNDr16_8(S, W, 48);
+	RNDr16_8(S, W, 56);
+
+	/* second hash, the message is the first hash plus constant padding */
+	for (i = 0; i < 8; i++)
+		W[i] = add16(S[i], _mm512_load_si512(midstate + 16 * i));
+	for (i = 8; i < 16; i++)
+		W[i] = _mm512_set1_epi32(sha256d_hash1[i]);
+	for (i = 16; i < 61; i++)
+		EXPAND16(W, i);
+
+	for (i = 0; i < 8; i++)
+		S[i] = _mm512_set1_epi32(sha256_h[i]);
+
+	RNDr16_8(S, W,  0);
+	RNDr16_8(S, W,  8);
+	RNDr16_8(S, W, 16);
+	RNDr16_8(S, W, 24);
+	RNDr16_8(S, W, 32);
+	RNDr16_8(S, W, 40);
+	RNDr16_8(S, W, 48);
+	RNDr16(S, W, 56);
+
+	S[2] = add16_3(S[2], add16(S[6], S1_16(S[3])),
+		add16_3(Ch16(S[3], S[4], S[5]), W[57], _mm512_set1_epi32(sha256_k[57])));
+	S[1] = add16_3(S[1], add16(S[5], S1_16(S[2])),
+		add16_3(Ch16(S[2], S[3], S[4]), W[58], _mm512_set1_epi32(sha256_k[58])));
+	S[0] = add16_3(S[0], add16(S[4], S1_16(S[1])),
+		add16_3(Ch16(S[1], S[2], S[3]), W[59], _mm512_set1_epi32(sha256_k[59])));
+	S[7] = add16_3(S[7], add16(S[3], S1_16(S[0])),
+		add16_3(Ch16(S[0], S[1], S[2]), W[60],
+			_mm512_set1_epi32(sha256_k[60] + sha256_h[7])));
+
+	_mm512_store_si512(hash + 16 * 7, S[7]);
+}
+
+#pragma GCC pop_options
+
+static inline int scanhash_sha256d_16way(int thr_id, uint32_t *pdata,
+	const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done)
+{
+	uint32_t data[16 * 64] __attribute__((aligned(64)));
+	uint32_t hash[16 * 8] __attribute__((aligned(64)));
+	uint32_t midstate[16 * 8] __attribute__((aligned(64)));
+	uint32_t prehash[16 * 8] __attribute__((aligned(64)));
+	uint32_t n = pdata[19] - 1;
+	const uint32_t first_nonce = pdata[19];
+	const uint32_t Htarg = ptarget[7];
+	int i, j, lanes;
+	
+	memcpy(data, pdata + 16, 64);
+	sha256d_preextend(data);
+	for (i = 31; i >= 0; i--)
+		for (j = 0; j < 16; j++)
+			data[i * 16 + j] = data[i];
+	
+	sha256_init(midstate);
+	sha256_transform(midstate, pdata, 0);
+	memcpy(prehash, midstate, 32);
+	sha256d_prehash(prehash, pdata + 16);
+	for (i = 7; i >= 0; i--) {
+		for (j = 0; j < 16; j++) {
+			midstate[i * 16 + j] = midstate[i];
+			prehash[i * 16 + j] = prehash[i];
+		}
+	}
+	
+	do {
+		for (i = 0; i < 16; i++)
+			data[16 * 3 + i] = ++n;
+		/* the last vector may run past max_nonce, drop those lanes */
+		lanes = 16;
+		if (n > max_nonce) {
+			lanes -= n - max_nonce;
+			n = max_nonce;
+		}
+		
+		sha256d_ms_16way(hash, data, midstate, prehash);
+		
+		for (i = 0; i < lanes; i++) {
+			if (swab32(hash[16 * 7 + i]) <= Htarg) {
+				pdata[19] = data[16 * 3 + i];
+				sha256d_80_swap(hash, pdata);
+				if (fulltest(hash, ptarget)
+						&& !scan_found(thr_id, pdata, pdata[19])) {
+					*hashes_done = n - first_nonce + 1;
+					return 1;
+				}
+			}
+		}
+	} while (n < max_nonce && !work_restart[thr_id].restart);
+	
+	*hashes_done = n - first_nonce + 1;
+	pdata[19] = n;
+	return 0;
+}
+
+#endif /* HAVE_SHA256_16WAY */
+
+static int scanhash_sha256d_lanes(int thr_id, uint32_t *pdata,
+	const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done)
 {
 	uint32_t data[64] __attribute__((aligned(128)));
 	uint32_t hash[8] __attribute__((aligned(32)));
@@ -614,13 +1199,18 @@ int scanhash_sha256d(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	const uint32_t first_nonce = pdata[19];
 	const uint32_t Htarg = ptarget[7];
 	
+#ifdef HAVE_SHA256_16WAY
+	if ((opt_kernels & KERNEL_16WAY) && sha256_use_16way())
+		return scanhash_sha256d_16way(thr_id, pdata, ptarget,
+			max_nonce, hashes_done);
+#endif
 #ifdef HAVE_SHA256_8WAY
-	if (sha256_use_8way())
+	if ((opt_kernels & KERNEL_8WAY) && sha256_use_8way())
 		return scanhash_sha256d_8way(thr_id, pdata, ptarget,
 			max_nonce, hashes_done);
 #endif
 #ifdef HAVE_SHA256_4WAY
-	if (sha256_use_4way())
+	if ((opt_kernels & KERNEL_4WAY) && sha256_use_4way())
 		return scanhash_sha256d_4way(thr_id, pdata, ptarget,
 			max_nonce, hashes_done);
 #endif
@@ -639,7 +1229,8 @@ int scanhash_sha256d(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 		if (unlikely(swab32(hash[7]) <= Htarg)) {
 			pdata[19] = data[3];
 			sha256d_80_swap(hash, pdata);
-			if (fulltest(hash, ptarget)) {
+			if (fulltest(hash, ptarget)
+					&& !scan_found(thr_id, pdata, pdata[19])) {
 				*hashes_done = n - first_nonce + 1;
 				return 1;
 			}
@@ -650,3 +1241,136 @@ int scanhash_sha256d(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	pdata[19] = n;
 	return 0;
 }
+
+#ifdef HAVE_SHA256_HW
+
+static inline int scanhash_sha256d_hw(int thr_id, uint32_t *pdata,
+	const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done)
+{
+	uint32_t data[2][16] __attribute__((aligned(16)));
+	uint32_t S[2][16] __attribute__((aligned(16)));
+	uint32_t hash[2][8] __attribute__((aligned(16)));
+	uint32_t midstate[8] __attribute__((aligned(16)));
+	uint32_t n = pdata[19] - 1;
+	const uint32_t first_nonce = pdata[19];
+	const uint32_t Htarg = ptarget[7];
+	int i, lanes;
+	
+	memcpy(data[0], pdata + 16, 64);
+	memcpy(data[1], pdata + 16, 64);
+	memcpy(S[0] + 8, sha256d_hash1 + 8, 32);
+	memcpy(S[1] + 8, sha256d_hash1 + 8, 32);
+	
+	sha256_init(midstate);
+	sha256_transform(midstate, pdata, 0);
+	
+	do {
+		/* an odd nonce left before max_nonce goes alone, lane 1 idles */
+		data[0][3] = ++n;
+		lanes = n < max_nonce ? 2 : 1;
+		data[1][3] = lanes == 2 ? ++n : n;
+		memcpy(S[0], midstate, 32);
+		memcpy(S[1], midstate, 32);
+		sha256_transform_hw_2way(S[0], data[0], S[1], data[1]);
+		sha256_init(hash[0]);
+		sha256_init(hash[1]);
+		sha256_transform_hw_2way(hash[0], S[0], hash[1], S[1]);
+		
+		for (i = 0; i < lanes; i++) {
+			if (unlikely(swab32(hash[i][7]) <= Htarg)) {
+				pdata[19] = data[i][3];
+				sha256d_80_swap(hash[i], pdata);
+				if (fulltest(hash[i], ptarget)
+						&& !scan_found(thr_id, pdata, pdata[19])) {
+					*hashes_done = n - first_nonce + 1;
+					return 1;
+				}
+			}
+		}
+	} while (likely(n < max_nonce && !work_restart[thr_id].restart));
+	
+	*hashes_done = n - first_nonce + 1;
+	pdata[19] = n;
+	return 0;
+}
+
+/* 0 unknown, 1 no, 2 yes, per set of enabled kernels (opt_kernels) */
+static signed char use_hw[KERNEL_ALL + 1];
+
+static double sha256d_scan_rate(
+	int (*scan)(int, uint32_t *, const uint32_t *, uint32_t, uint64_t *))
+{
+	uint32_t pdata[32], target[8];
+	uint64_t hashes_done = 0;
+	struct timeval tv_start, tv_end, diff;
+	
+	memset(pdata, 0, sizeof(pdata));
+	pdata[20] = 0x80000000;
+	pdata[31] = 0x00000280;
+	memset(target, 0, sizeof(target));
+	work_restart[0].restart = 0;
+	gettimeofday(&tv_start, NULL);
+	scan(0, pdata, target, 1U << 18, &hashes_done);
+	gettimeofday(&tv_end, NULL);
+	timeval_subtract(&diff, &tv_end, &tv_start);
+	return hashes_done / (diff.tv_sec + diff.tv_usec * 1e-6 + 1e-6);
+}
+
+static int sha256d_use_hw(void)
+{
+	const int kernels = opt_kernels & KERNEL_ALL;
+	
+	if (!sha256_use_hw())
+		return 0;
+	/* only the selftest gets here uncalibrated, on its one thread */
+	if (unlikely(!use_hw[kernels]))
+		sha256d_calibrate();
+	return use_hw[kernels] - 1;
+}
+
+#endif /* HAVE_SHA256_HW */
+
+/*
+ * SHA-NI beats the lane-parallel SIMD kernels on some cpus (AMD Zen) and
+ * loses to them on others (wide AVX2/AVX-512 Intel parts), so a short run
+ * of both is timed and the faster one kept for the current opt_kernels.
+ * Call it before the miner threads start, with work_restart allocated:
+ * it scans as thread 0, and runs timed side by side or cut short by a
+ * work restart would not measure the kernels.
+ */
+void sha256d_calibrate(void)
+{
+#ifdef HAVE_SHA256_HW
+	const int kernels = opt_kernels & KERNEL_ALL;
+	double hw_rate = 0., lanes_rate = 0., rate;
+	int i;
+	
+	if (!sha256_use_hw() || use_hw[kernels])
+		return;
+	for (i = 0; i < 2; i++) {
+		rate = sha256d_scan_rate(scanhash_sha256d_hw);
+		if (rate > hw_rate)
+			hw_rate = rate;
+		rate = sha256d_scan_rate(scanhash_sha256d_lanes);
+		if (rate > lanes_rate)
+			lanes_rate = rate;
+	}
+	work_restart[0].restart = 0;
+	use_hw[kernels] = 1 + (hw_rate > lanes_rate);
+	if (opt_debug)
+		applog(LOG_DEBUG, "sha256d: SHA extensions %.0f kH/s, SIMD %.0f kH/s",
+			hw_rate * 1e-3, lanes_rate * 1e-3);
+#endif
+}
+
+int scanhash_sha256d(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
+	uint32_t max_nonce, uint64_t *hashes_done)
+{
+#ifdef HAVE_SHA256_HW
+	if (sha256d_use_hw())
+		return scanhash_sha256d_hw(thr_id, pdata, ptarget,
+			max_nonce, hashes_done);
+#endif
+	return scanhash_sha256d_lanes(thr_id, pdata, ptarget,
+		max_nonce, hashes_done);
+}
@@ -11,6 +11,7 @@
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
 	sph_skein512_context	skein;
+	sph_skein512_context	skein_mid;	/* skein fed with the header up to the nonce */
 } skeinhash_context_holder;
 
 /* no need to copy, because close reinit the context */
@@ -21,7 +22,8 @@ void init_skein_contexts(void *dummy)
 	sph_skein512_init(&ctx.skein);
 }
 
-void skeinhash(void *output, const void *input)
+/* the rest of skeinhash, once the whole header went into ctx.skein */
+static void skeinhash_close(void *output)
 {
 	uint32_t mask = 8;
 	uint32_t zero = 0;
@@ -31,7 +33,6 @@ void skeinhash(void *output, const void *input)
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
 
-	sph_skein512(&ctx.skein, input, 80);
 	sph_skein512_close(&ctx.skein, hash);
 
 	SHA256_CTX sha256;
@@ -42,6 +43,12 @@ void skeinhash(void *output, const void *input)
 	memcpy(output, hash, 32);
 }
 
+void skeinhash(void *output, const void *input)
+{
+	sph_skein512(&ctx.skein, input, 80);
+	skeinhash_close(output);
+}
+
 int scanhash_skein(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	uint32_t max_nonce, uint64_t *hashes_done)
 {
@@ -73,6 +80,10 @@ int scanhash_skein(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	for (int kk=0; kk < 32; kk++) {
 		be32enc(&endiandata[kk], ((uint32_t*)pdata)[kk]);
 	};
+
+	/* only the nonce changes below, absorb the rest once */
+	memcpy(&ctx.skein_mid, &ctx.skein, sizeof(ctx.skein));
+	sph_skein512(&ctx.skein_mid, endiandata, 76);
 #ifdef DEBUG_ALGO
 	printf("[%d] Htarg=%X\n", thr_id, Htarg);
 #endif
@@ -82,7 +93,9 @@ int scanhash_skein(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			do {
 				pdata[19] = ++n;
 				be32enc(&endiandata[19], n);
-				skeinhash(hash64, &endiandata);
+				memcpy(&ctx.skein, &ctx.skein_mid, sizeof(ctx.skein));
+				sph_skein512(&ctx.skein, &endiandata[19], 4);
+				skeinhash_close(hash64);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
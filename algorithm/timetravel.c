@@ -35,6 +35,8 @@ typedef struct {
 
 /* no need to copy, because close reinit the context */
 static THREADLOCAL timetravelhash_context_holder ctx;
+/* ctx with the first stage fed with the header up to the nonce */
+static THREADLOCAL timetravelhash_context_holder ctx_mid;
 
 void init_timetravel_contexts(void *dummy)
 {
@@ -53,53 +55,90 @@ void init_timetravel_contexts(void *dummy)
 #define HASH_FUNC_COUNT 8                   // Machinecoin: HASH_FUNC_COUNT of 11
 #define HASH_FUNC_COUNT_PERMUTATIONS 40320  // Machinecoin: HASH_FUNC_COUNT! 
 
-void timetravelhash(void *output, const void *input)
+static uint32_t timetravel_permutation(const void *input)
 {
-	uint32_t hash[16], i;
 	uint32_t time = ((uint32_t *)input)[17];
-	uint32_t permutation = permutations[(time - 1389040865) % 40320];
+	return permutations[(time - HASH_FUNC_BASE_TIMESTAMP) % HASH_FUNC_COUNT_PERMUTATIONS];
+}
+
+/* feed data to the first stage of the permutation */
+static void timetravel_update_first(timetravelhash_context_holder *c,
+	uint32_t permutation, const void *data, size_t len)
+{
+	switch (permutation & 0xf) {
+
+		case 0:
+			sph_blake512(&c->blake, data, len);
+			break;
+
+		case 1:
+			sph_bmw512(&c->bmw, data, len);
+			break;
+
+		case 2:
+			sph_groestl512(&c->groestl, data, len);
+			break;
+
+		case 3:
+			sph_skein512(&c->skein, data, len);
+			break;
+
+		case 4:
+			sph_jh512(&c->jh, data, len);
+			break;
+
+		case 5:
+			sph_keccak512(&c->keccak, data, len);
+			break;
+
+		case 6:
+			sph_luffa512(&c->luffa, data, len);
+			break;
+
+		case 7:
+			sph_cubehash512(&c->cubehash, data, len);
+			break;
+	}
+}
+
+/* the rest of timetravelhash, once the whole header went into the first stage */
+static void timetravelhash_close(void *output, uint32_t permutation)
+{
+	uint32_t hash[16], i;
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
 
 	switch (permutation & 0xf) {
 
 		case 0:
-			sph_blake512(&ctx.blake, input, 80);
 			sph_blake512_close(&ctx.blake, hash);
 			break;
 
 		case 1:
-			sph_bmw512(&ctx.bmw, input, 80);
 			sph_bmw512_close(&ctx.bmw, hash);
 			break;
 
 		case 2:
-			sph_groestl512(&ctx.groestl, input, 80);
 			sph_groestl512_close(&ctx.groestl, hash);
 			break;
 
 		case 3:
-			sph_skein512(&ctx.skein, input, 80);
 			sph_skein512_close(&ctx.skein, hash);
 			break;
 
 		case 4:
-			sph_jh512(&ctx.jh, input, 80);
 			sph_jh512_close(&ctx.jh, hash);
 			break;
 
 		case 5:
-			sph_keccak512(&ctx.keccak, input, 80);
 			sph_keccak512_close(&ctx.keccak, hash);
 			break;
 
 		case 6:
-			sph_luffa512(&ctx.luffa, input, 80);
 			sph_luffa512_close(&ctx.luffa, hash);
 			break;
 
 		case 7:
-			sph_cubehash512(&ctx.cubehash, input, 80);
 			sph_cubehash512_close(&ctx.cubehash, hash);
 			break;
 	}
@@ -152,6 +191,14 @@ void timetravelhash(void *output, const void *input)
 	memcpy(output, hash, 32);
 }
 
+void timetravelhash(void *output, const void *input)
+{
+	uint32_t permutation = timetravel_permutation(input);
+
+	timetravel_update_first(&ctx, permutation, input, 80);
+	timetravelhash_close(output, permutation);
+}
+
 int scanhash_timetravel(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	uint32_t max_nonce, uint64_t *hashes_done)
 {
@@ -161,6 +208,7 @@ int scanhash_timetravel(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 
 	uint32_t hash64[8] __attribute__((aligned(32)));
 	uint32_t endiandata[32];
+	uint32_t permutation;
 
 	uint64_t htmax[] = {
 		0,
@@ -187,6 +235,11 @@ int scanhash_timetravel(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	for (int kk=0; kk < 32; kk++) {
 		be32enc(&endiandata[kk], ((uint32_t*)pdata)[kk]);
 	};
+
+	/* only the nonce changes below, absorb the rest once */
+	permutation = timetravel_permutation(endiandata);
+	memcpy(&ctx_mid, &ctx, sizeof(ctx));
+	timetravel_update_first(&ctx_mid, permutation, endiandata, 76);
 #ifdef DEBUG_ALGO
 	printf("[%d] Htarg=%X\n", thr_id, Htarg);
 #endif
@@ -196,7 +249,9 @@ int scanhash_timetravel(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			do {
 				pdata[19] = ++n;
 				be32enc(&endiandata[19], n);
-				timetravelhash(hash64, &endiandata);
+				memcpy(&ctx, &ctx_mid, sizeof(ctx));
+				timetravel_update_first(&ctx, permutation, &endiandata[19], 4);
+				timetravelhash_close(hash64, permutation);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
@@ -13,6 +13,7 @@
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
 	sph_skein512_context	skein;
+	sph_skein512_context	skein_mid;	/* skein fed with the header up to the nonce */
 	sph_gost512_context	gost;
 	sph_shavite512_context	shavite;
 	sph_shabal512_context	shabal;
@@ -29,13 +30,13 @@ void init_veltor_contexts(void *dummy)
 	sph_shabal512_init(&ctx.shabal);
 }
 
-void veltorhash(void *output, const void *input)
+/* the rest of veltorhash, once the whole header went into ctx.skein */
+static void veltorhash_close(void *output)
 {
 	uint32_t hash[16];
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
 
-	sph_skein512(&ctx.skein, input, 80);
 	sph_skein512_close(&ctx.skein, hash);
 
 	sph_shavite512(&ctx.shavite, hash, 64);
@@ -50,6 +51,12 @@ void veltorhash(void *output, const void *input)
 	memcpy(output, hash, 32);
 }
 
+void veltorhash(void *output, const void *input)
+{
+	sph_skein512(&ctx.skein, input, 80);
+	veltorhash_close(output);
+}
+
 int scanhash_veltor(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	uint32_t max_nonce, uint64_t *hashes_done)
 {
@@ -81,6 +88,10 @@ int scanhash_veltor(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 	for (int kk=0; kk < 32; kk++) {
 		be32enc(&endiandata[kk], ((uint32_t*)pdata)[kk]);
 	};
+
+	/* only the nonce changes below, absorb the rest once */
+	memcpy(&ctx.skein_mid, &ctx.skein, sizeof(ctx.skein));
+	sph_skein512(&ctx.skein_mid, endiandata, 76);
 #ifdef DEBUG_ALGO
 	printf("[%d] Htarg=%X\n", thr_id, Htarg);
 #endif
@@ -90,7 +101,9 @@ int scanhash_veltor(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
 			do {
 				pdata[19] = ++n;
 				be32enc(&endiandata[19], n);
-				veltorhash(hash64, &endiandata);
+				memcpy(&ctx.skein, &ctx.skein_mid, sizeof(ctx.skein));
+				sph_skein512(&ctx.skein, &endiandata[19], 4);
+				veltorhash_close(hash64);
 #ifndef DEBUG_ALGO
 				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
 					*hashes_done = n - first_nonce + 1;
@@ -16,6 +16,7 @@
 #include "sha3/sph_shavite.h"
 #include "sha3/sph_simd.h"
 #include "sha3/sph_echo.h"
+#include "sha3/sph_mway.h"
 
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
@@ -35,6 +36,20 @@ typedef struct {
 /* no need to copy, because close reinit the context */
 static THREADLOCAL x11hash_context_holder ctx;
 
+/* lane-parallel kernels picked for this cpu, NULL = scalar only */
+static THREADLOCAL const mway_kernels *x11_mway;
+
+/* --profile stages, PROF_ALGO + X11_* */
+enum {
+	X11_BLAKE, X11_BMW, X11_GROESTL, X11_SKEIN, X11_JH, X11_KECCAK,
+	X11_LUFFA, X11_CUBEHASH, X11_SHAVITE, X11_SIMD, X11_ECHO
+};
+static const char *const x11_stages[] = {
+	"blake", "bmw", "groestl", "skein", "jh", "keccak",
+	"luffa", "cubehash", "shavite", "simd", "echo"
+};
+#define X11_LAP(stage, t)	prof_lap(PROF_ALGO + (stage), t)
+
 void init_x11_contexts(void *dummy)
 {
 	sph_blake512_init(&ctx.blake);
@@ -48,113 +63,126 @@ void init_x11_contexts(void *dummy)
 	sph_shavite512_init(&ctx.shavite);
 	sph_simd512_init(&ctx.simd);
 	sph_echo512_init(&ctx.echo);
+
+	x11_mway = mway_select((opt_kernels & KERNEL_8WAY) ? 8 :
+		(opt_kernels & KERNEL_4WAY) ? 4 : 1);
+	prof_algo_stages(x11_stages, ARRAY_SIZE(x11_stages));
 }
 
 void x11hash(void *output, const void *input)
 {
 	uint32_t hash[16];
+	uint64_t t = prof_begin();
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
 
 	sph_blake512(&ctx.blake, input, 80);
 	sph_blake512_close(&ctx.blake, hash);
+	X11_LAP(X11_BLAKE, &t);
 
 	sph_bmw512(&ctx.bmw, hash, 64);
 	sph_bmw512_close(&ctx.bmw, hash);
+	X11_LAP(X11_BMW, &t);
 
 	sph_groestl512(&ctx.groestl, hash, 64);
 	sph_groestl512_close(&ctx.groestl, hash);
+	X11_LAP(X11_GROESTL, &t);
 
 	sph_skein512(&ctx.skein, hash, 64);
 	sph_skein512_close(&ctx.skein, hash);
+	X11_LAP(X11_SKEIN, &t);
 
 	sph_jh512(&ctx.jh, hash, 64);
 	sph_jh512_close(&ctx.jh, hash);
+	X11_LAP(X11_JH, &t);
 
 	sph_keccak512(&ctx.keccak, hash, 64);
 	sph_keccak512_close(&ctx.keccak, hash);
+	X11_LAP(X11_KECCAK, &t);
 
 	sph_luffa512(&ctx.luffa, hash, 64);
 	sph_luffa512_close(&ctx.luffa, hash);
+	X11_LAP(X11_LUFFA, &t);
 
 	sph_cubehash512(&ctx.cubehash, hash, 64);
 	sph_cubehash512_close(&ctx.cubehash, hash);
+	X11_LAP(X11_CUBEHASH, &t);
 
 	sph_shavite512(&ctx.shavite, hash, 64);
 	sph_shavite512_close(&ctx.shavite, hash);
+	X11_LAP(X11_SHAVITE, &t);
 
 	sph_simd512(&ctx.simd, hash, 64);
 	sph_simd512_close(&ctx.simd, hash);
+	X11_LAP(X11_SIMD, &t);
 
 	sph_echo512(&ctx.echo, hash, 64);
 	sph_echo512_close(&ctx.echo, hash);
+	X11_LAP(X11_ECHO, &t);
 
 	memcpy(output, hash, 32);
 }
 
-int scanhash_x11(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
-	uint32_t max_nonce, uint64_t *hashes_done)
+/*
+ * Hash mk->lanes headers at once. The vector stages run word-sliced,
+ * groestl/shavite/simd/echo (table or AES driven) stay scalar per lane.
+ */
+static void x11hash_mway(const mway_kernels *mk, uint64_t hash[][8],
+	const void *const in[])
 {
-	uint32_t n = pdata[19] - 1;
-	const uint32_t first_nonce = pdata[19];
-	const uint32_t Htarg = ptarget[7];
-
-	uint32_t hash64[8] __attribute__((aligned(32)));
-	uint32_t endiandata[32];
-
-	uint64_t htmax[] = {
-		0,
-		0xF,
-		0xFF,
-		0xFFF,
-		0xFFFF,
-		0x10000000
-	};
-	uint32_t masks[] = {
-		0xFFFFFFFF,
-		0xFFFFFFF0,
-		0xFFFFFF00,
-		0xFFFFF000,
-		0xFFFF0000,
-		0
-	};
-
-	// we need bigendian data...
-	for (int kk=0; kk < 32; kk++) {
-		be32enc(&endiandata[kk], ((uint32_t*)pdata)[kk]);
-	};
-#ifdef DEBUG_ALGO
-	printf("[%d] Htarg=%X\n", thr_id, Htarg);
-#endif
-	for (int m=0; m < sizeof(masks); m++) {
-		if (Htarg <= htmax[m]) {
-			uint32_t mask = masks[m];
-			do {
-				pdata[19] = ++n;
-				be32enc(&endiandata[19], n);
-				x11hash(hash64, &endiandata);
-#ifndef DEBUG_ALGO
-				if ((!(hash64[7] & mask)) && fulltest(hash64, ptarget)) {
-					*hashes_done = n - first_nonce + 1;
-					return true;
-				}
-#else
-				if (!(n % 0x1000) && !thr_id) printf(".");
-				if (!(hash64[7] & mask)) {
-					printf("[%d]",thr_id);
-					if (fulltest(hash64, ptarget)) {
-						*hashes_done = n - first_nonce + 1;
-						return true;
-					}
-				}
-#endif
-			} while (n < max_nonce && !work_restart[thr_id].restart);
-			// see blake.c if else to understand the loop on htmax => mask
-			break;
-		}
+	uint64_t t = prof_begin();
+	int l;
+
+	mk->blake512_80(hash, in);
+	X11_LAP(X11_BLAKE, &t);
+	mk->bmw512(hash);
+	X11_LAP(X11_BMW, &t);
+
+	for (l = 0; l < mk->lanes; l++) {
+		sph_groestl512(&ctx.groestl, hash[l], 64);
+		sph_groestl512_close(&ctx.groestl, hash[l]);
 	}
+	X11_LAP(X11_GROESTL, &t);
+
+	mk->skein512(hash);
+	X11_LAP(X11_SKEIN, &t);
+	mk->jh512(hash);
+	X11_LAP(X11_JH, &t);
+	mk->keccak512(hash);
+	X11_LAP(X11_KECCAK, &t);
+	mk->luffa512(hash);
+	X11_LAP(X11_LUFFA, &t);
+	mk->cubehash512(hash);
+	X11_LAP(X11_CUBEHASH, &t);
+
+	for (l = 0; l < mk->lanes; l++) {
+		sph_shavite512(&ctx.shavite, hash[l], 64);
+		sph_shavite512_close(&ctx.shavite, hash[l]);
+		X11_LAP(X11_SHAVITE, &t);
+
+		sph_simd512(&ctx.simd, hash[l], 64);
+		sph_simd512_close(&ctx.simd, hash[l]);
+		X11_LAP(X11_SIMD, &t);
+
+		sph_echo512(&ctx.echo, hash[l], 64);
+		sph_echo512_close(&ctx.echo, hash[l]);
+		X11_LAP(X11_ECHO, &t);
+	}
+}
 
-	*hashes_done = n - first_nonce + 1;
-	pdata[19] = n;
-	return 0;
+void x11hash_batch(void *output[], const void *const input[], int lanes)
+{
+	uint64_t hash[MWAY_MAX_LANES][8] __attribute__((aligned(32)));
+	const mway_kernels *mk = x11_mway;
+	int l = 0, k;
+
+	if (mk) {
+		for (; l + mk->lanes <= lanes; l += mk->lanes) {
+			x11hash_mway(mk, hash, input + l);
+			for (k = 0; k < mk->lanes; k++)
+				memcpy(output[l + k], hash[k], 32);
+		}
+	}
+	for (; l < lanes; l++)
+		x11hash(output[l], input[l]);
 }
@@ -12,6 +12,8 @@
 /* Move init out of loop, so init once externally, and then use one single memcpy with that bigger memory block */
 typedef struct {
     uint32_t height;
+    uint32_t matrix_rows;	/* rows ctx.matrix can hold */
+    uint64_t *matrix;	/* LYRA2 memory, grown with the block height */
 } xzchash_context_holder;
 
 /* no need to copy, because close reinit the context */
@@ -21,6 +23,13 @@ void init_xzc_contexts(void *dummy)
 {
     ctx.height = 0;
 }
+
+void free_xzc_contexts(void *dummy)
+{
+	afree(ctx.matrix);
+	ctx.matrix = NULL;
+	ctx.matrix_rows = 0;
+}
 /**
  * Extract bloc height     L H... here len=3, height=0x1333e8
  * "...0000000000ffffffff2703e83313062f503253482f043d61105408"
@@ -61,7 +70,17 @@ void xzchash(void *output, const void *input)
 	uint32_t hash[16];
 
 	memset(hash, 0, 16 * sizeof(uint32_t));
-	LYRA2((void*)hash, 32, input, 80, input, 80, 2, ctx.height, 256, BLOCK_LEN_BLAKE2_SAFE_INT64);
+
+	/* nRows follows the block height, only reallocate when it grows */
+	if (ctx.height > ctx.matrix_rows) {
+		afree(ctx.matrix);
+		ctx.matrix = amalloc(64, LYRA2_MATRIX_SIZE(ctx.height, 256));
+		ctx.matrix_rows = ctx.matrix ? ctx.height : 0;
+	}
+	if (ctx.matrix)
+		LYRA2_mem((void*)hash, 32, input, 80, input, 80, 2, ctx.height, 256, BLOCK_LEN_BLAKE2_SAFE_INT64, ctx.matrix);
+	else
+		LYRA2((void*)hash, 32, input, 80, input, 80, 2, ctx.height, 256, BLOCK_LEN_BLAKE2_SAFE_INT64);
 
 	memcpy(output, hash, 32);
 }
@@ -0,0 +1,564 @@
+/*
+ * --api-bind: a small HTTP server for monitoring and control, one request
+ * per connection. It only reads miner_status_read() snapshots and the per
+ * thread hashrates, so a slow or busy client never holds up mining.
+ *
+ *   GET  /stats              JSON stats
+ *   GET  /metrics            Prometheus text exposition
+ *   POST /pause, /resume     park all the miners, or let them go
+ *   POST /threads?n=N        mine with the first N threads only
+ *   POST /pool?url=URL       mine on URL, added to the pools if new
+ *
+ * The POST verbs need --api-control=TOKEN and the header X-Miner-Token
+ * with that token. A browser only sends such a header after a CORS
+ * preflight, which is never answered, and requests with an Origin header
+ * are refused outright, so a web page cannot drive the miner.
+ */
+
+#include "cpuminer-config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#include <jansson.h>
+#include <curl/curl.h>
+#include "compat.h"
+#include "miner.h"
+
+#ifdef WIN32
+#define api_close(s) closesocket(s)
+typedef SOCKET api_socket_t;
+#else
+#define api_close(s) close(s)
+#define INVALID_SOCKET (-1)
+typedef int api_socket_t;
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define API_REQ_MAX 4096
+
+#define API_JSON "application/json"
+#define API_TEXT "text/plain; version=0.0.4"
+
+/* upper bounds of the histogram buckets, the last one is +Inf */
+static const uint64_t met_bounds[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+	250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+#define MET_BUCKETS (sizeof(met_bounds) / sizeof(met_bounds[0]) + 1)
+
+struct met_hist {
+	uint64_t sum;
+	uint64_t bucket[MET_BUCKETS];
+};
+
+struct met_shard {
+	struct met_hist hist[MET_HISTS];
+	uint64_t hashes;
+} __attribute__((aligned(64)));
+
+static struct met_shard *met_shards;
+static int met_nshards;
+static THREADLOCAL struct met_shard *met_self;
+
+void metrics_init(int threads)
+{
+	met_shards = calloc(threads, sizeof(*met_shards));
+	if (met_shards)
+		met_nshards = threads;
+}
+
+/* the calling thread records into shard id from now on */
+void metrics_thread(int id)
+{
+	if (id >= 0 && id < met_nshards)
+		met_self = &met_shards[id];
+}
+
+/* only the owning thread writes a shard, the API may see it torn */
+void metrics_observe(int hist, uint64_t usec)
+{
+	struct met_shard *m = met_self;
+	struct met_hist *h;
+	unsigned i;
+
+	if (unlikely(!m))
+		return;
+	h = &m->hist[hist];
+	for (i = 0; i < MET_BUCKETS - 1 && usec > met_bounds[i]; i++)
+		;
+	h->bucket[i]++;
+	h->sum += usec;
+}
+
+void metrics_hashes(uint64_t hashes)
+{
+	if (likely(met_self))
+		met_self->hashes += hashes;
+}
+
+struct api_buf {
+	char *s;
+	size_t len, size;
+};
+
+static void api_printf(struct api_buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->s + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
+		if (n < 0)
+			return;
+		if (b->len + n < b->size) {
+			b->len += n;
+			return;
+		}
+		b->size = (b->len + n + 1) * 2;
+		b->s = realloc(b->s, b->size);
+		if (!b->s) {
+			b->len = b->size = 0;
+			return;
+		}
+	}
+}
+
+/* one histogram, summed over the shards first..last-1 */
+static void api_hist(struct api_buf *b, const char *name, const char *label,
+		int hist, int first, int last)
+{
+	uint64_t bucket[MET_BUCKETS] = { 0 }, sum = 0, count = 0;
+	unsigned i;
+	int j;
+
+	for (j = first; j < last; j++) {
+		const struct met_hist *h = &met_shards[j].hist[hist];
+		for (i = 0; i < MET_BUCKETS; i++)
+			bucket[i] += h->bucket[i];
+		sum += h->sum;
+	}
+	for (i = 0; i < MET_BUCKETS; i++) {
+		count += bucket[i];
+		if (i < MET_BUCKETS - 1)
+			api_printf(b, "%s_bucket{%s%sle=\"%g\"} %" PRIu64 "\n", name,
+				label, *label ? "," : "", met_bounds[i] * 1e-6, count);
+		else
+			api_printf(b, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name,
+				label, *label ? "," : "", count);
+	}
+	api_printf(b, "%s_sum%s%s%s %.6f\n", name, *label ? "{" : "", label,
+		*label ? "}" : "", sum * 1e-6);
+	api_printf(b, "%s_count%s%s%s %" PRIu64 "\n", name, *label ? "{" : "",
+		label, *label ? "}" : "", count);
+}
+
+static char *api_metrics(void)
+{
+	struct api_buf b = { NULL, 0, 0 };
+	struct miner_status st;
+	char label[32];
+	int i;
+
+	miner_status_read(&st);
+
+	api_printf(&b, "# HELP minerd_hashrate Hashes per second of the last scan.\n"
+		"# TYPE minerd_hashrate gauge\n");
+	for (i = 0; i < opt_n_threads; i++)
+		api_printf(&b, "minerd_hashrate{thread=\"%d\"} %.2f\n", i,
+			miner_thr_hashrate(i));
+	api_printf(&b, "# HELP minerd_hashes_total Hashes computed.\n"
+		"# TYPE minerd_hashes_total counter\n");
+	for (i = 0; i < opt_n_threads && i < met_nshards; i++)
+		api_printf(&b, "minerd_hashes_total{thread=\"%d\"} %" PRIu64 "\n",
+			i, met_shards[i].hashes);
+	api_printf(&b, "# HELP minerd_scan_seconds Duration of one scanhash call.\n"
+		"# TYPE minerd_scan_seconds histogram\n");
+	for (i = 0; i < opt_n_threads && i < met_nshards; i++) {
+		snprintf(label, sizeof(label), "thread=\"%d\"", i);
+		api_hist(&b, "minerd_scan_seconds", label, MET_SCAN, i, i + 1);
+	}
+	if (met_nshards) {
+		api_printf(&b, "# HELP minerd_restart_latency_seconds Time from a "
+			"clean job arriving to all active threads mining it.\n"
+			"# TYPE minerd_restart_latency_seconds histogram\n");
+		api_hist(&b, "minerd_restart_latency_seconds", "", MET_RESTART,
+			0, met_nshards);
+		api_printf(&b, "# HELP minerd_share_latency_seconds Time from "
+			"finding a share to the pool's answer.\n"
+			"# TYPE minerd_share_latency_seconds histogram\n");
+		api_hist(&b, "minerd_share_latency_seconds", "", MET_SHARE,
+			0, met_nshards);
+	}
+	api_printf(&b, "# HELP minerd_shares_total Shares answered by the pool.\n"
+		"# TYPE minerd_shares_total counter\n"
+		"minerd_shares_total{result=\"accepted\"} %lu\n"
+		"minerd_shares_total{result=\"rejected\"} %lu\n",
+		st.accepted, st.rejected);
+	api_printf(&b, "# HELP minerd_difficulty Share difficulty of the current job.\n"
+		"# TYPE minerd_difficulty gauge\n"
+		"minerd_difficulty %g\n", st.diff);
+	api_printf(&b, "# HELP minerd_active_threads Threads not parked from the API.\n"
+		"# TYPE minerd_active_threads gauge\n"
+		"minerd_active_threads %d\n", st.paused ? 0 : st.active_threads);
+	api_printf(&b, "# HELP minerd_uptime_seconds Seconds since start.\n"
+		"# TYPE minerd_uptime_seconds gauge\n"
+		"minerd_uptime_seconds %ld\n", (long) (time(NULL) - st.start_time));
+	return b.s;
+}
+
+static void api_send(api_socket_t c, int code, const char *reason,
+		const char *type, const char *body)
+{
+	char hdr[256];
+	size_t len = strlen(body);
+	int n;
+
+	n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %d %s\r\n"
+		"Content-Type: %s\r\n"
+		"Content-Length: %lu\r\n"
+		"Connection: close\r\n\r\n", code, reason, type,
+		(unsigned long) len);
+	if (send(c, hdr, n, MSG_NOSIGNAL) == n && len)
+		send(c, body, len, MSG_NOSIGNAL);
+}
+
+static void api_send_json(api_socket_t c, int code, const char *reason,
+		json_t *val)
+{
+	char *s = json_dumps(val, JSON_INDENT(1));
+
+	api_send(c, code, reason, API_JSON, s ? s : "{}");
+	free(s);
+	json_decref(val);
+}
+
+static void api_error(api_socket_t c, int code, const char *reason,
+		const char *msg)
+{
+	json_t *val = json_object();
+
+	json_object_set_new(val, "error", json_string(msg));
+	api_send_json(c, code, reason, val);
+}
+
+/* value of the query parameter name, percent decoded into buf */
+static bool api_query(const char *query, const char *name, char *buf,
+		size_t size)
+{
+	size_t nlen = strlen(name), i = 0;
+	const char *p = query;
+
+	while (p && *p) {
+		if (!strncmp(p, name, nlen) && p[nlen] == '=') {
+			for (p += nlen + 1; *p && *p != '&'; p++) {
+				int ch = *p;
+				if (ch == '+')
+					ch = ' ';
+				else if (ch == '%' && isxdigit((unsigned char) p[1])
+						&& isxdigit((unsigned char) p[2])) {
+					char hex[3] = { p[1], p[2], 0 };
+					ch = (int) strtol(hex, NULL, 16);
+					p += 2;
+				}
+				if (i + 1 >= size)
+					return false;
+				buf[i++] = (char) ch;
+			}
+			buf[i] = '\0';
+			return i > 0;
+		}
+		p = strchr(p, '&');
+		if (p)
+			p++;
+	}
+	return false;
+}
+
+static json_t *api_stats(void)
+{
+	struct miner_status st;
+	json_t *val, *threads;
+	double hashrate = 0.;
+	time_t now = time(NULL);
+	int i;
+
+	miner_status_read(&st);
+
+	threads = json_array();
+	for (i = 0; i < opt_n_threads; i++) {
+		json_t *thr = json_object();
+		double rate = miner_thr_hashrate(i);
+
+		hashrate += rate;
+		json_object_set_new(thr, "id", json_integer(i));
+		json_object_set_new(thr, "hashrate", json_real(rate));
+		json_object_set_new(thr, "active",
+			!st.paused && i < st.active_threads ? json_true() : json_false());
+		json_array_append_new(threads, thr);
+	}
+
+	val = json_object();
+	json_object_set_new(val, "version", json_string(PACKAGE_STRING));
+	json_object_set_new(val, "algo", json_string(st.algo));
+	json_object_set_new(val, "uptime", json_integer(now - st.start_time));
+	json_object_set_new(val, "hashrate", json_real(hashrate));
+	json_object_set_new(val, "threads", threads);
+	json_object_set_new(val, "accepted", json_integer(st.accepted));
+	json_object_set_new(val, "rejected", json_integer(st.rejected));
+	json_object_set_new(val, "latency_last_ms", json_real(st.latency_last));
+	json_object_set_new(val, "latency_avg_ms", json_real(st.latency_count ?
+		st.latency_sum / st.latency_count : 0.));
+	json_object_set_new(val, "diff", json_real(st.diff));
+	json_object_set_new(val, "pool", json_string(st.pool));
+	json_object_set_new(val, "job_id", json_string(st.job_id));
+	json_object_set_new(val, "job_age",
+		json_integer(st.job_time ? now - st.job_time : -1));
+	json_object_set_new(val, "paused", st.paused ? json_true() : json_false());
+	json_object_set_new(val, "active_threads", json_integer(st.active_threads));
+	return val;
+}
+
+/* true if the header lines have the header name, its value (cut to fit)
+ * in buf */
+static bool api_header(const char *headers, const char *name, char *buf,
+		size_t size)
+{
+	size_t nlen = strlen(name), i = 0;
+	const char *p = headers;
+
+	while (p && *p) {
+		if (!strncasecmp(p, name, nlen) && p[nlen] == ':') {
+			for (p += nlen + 1; *p == ' ' || *p == '\t'; p++)
+				;
+			for (; *p && *p != '\r' && *p != '\n'; p++)
+				if (i + 1 < size)
+					buf[i++] = *p;
+			while (i && (buf[i - 1] == ' ' || buf[i - 1] == '\t'))
+				i--;
+			buf[i] = '\0';
+			return true;
+		}
+		p = strchr(p, '\n');
+		if (p)
+			p++;
+	}
+	return false;
+}
+
+/* in time independent of where a and b differ */
+static bool api_token_equal(const char *a, const char *b)
+{
+	size_t alen = strlen(a), blen = strlen(b), i;
+	unsigned char diff = alen != blen;
+
+	for (i = 0; i < blen; i++)
+		diff |= (unsigned char) a[i % (alen + 1)] ^ (unsigned char) b[i];
+	return !diff;
+}
+
+static void api_control(api_socket_t c, const char *path, const char *query,
+		const char *headers)
+{
+	json_t *val;
+	char arg[256];
+
+	if (!opt_api_control) {
+		api_error(c, 403, "Forbidden", "control disabled, see --api-control");
+		return;
+	}
+	if (!api_header(headers, "X-Miner-Token", arg, sizeof(arg))
+			|| !api_token_equal(arg, opt_api_control)) {
+		api_error(c, 403, "Forbidden", "X-Miner-Token missing or wrong");
+		return;
+	}
+	if (!strcmp(path, "/pause"))
+		miner_pause(true);
+	else if (!strcmp(path, "/resume"))
+		miner_pause(false);
+	else if (!strcmp(path, "/threads")) {
+		if (!api_query(query, "n", arg, sizeof(arg))
+				|| !miner_set_threads(atoi(arg))) {
+			api_error(c, 400, "Bad Request", "n must be 1 to --threads");
+			return;
+		}
+	} else if (!strcmp(path, "/pool")) {
+		if (!api_query(query, "url", arg, sizeof(arg))
+				|| !miner_switch_pool(arg)) {
+			api_error(c, 400, "Bad Request",
+				"url must be stratum+tcp:// and stratum in use");
+			return;
+		}
+	} else {
+		api_error(c, 404, "Not Found", "unknown path");
+		return;
+	}
+	val = json_object();
+	json_object_set_new(val, "result", json_true());
+	api_send_json(c, 200, "OK", val);
+}
+
+static void api_request(api_socket_t c)
+{
+	char req[API_REQ_MAX + 1], *method, *path, *query, *end, *headers;
+	char origin[2];
+	size_t len = 0;
+
+	/* the request line, and the headers for the control token */
+	while (len < API_REQ_MAX) {
+		int n = recv(c, req + len, API_REQ_MAX - len, 0);
+		if (n <= 0)
+			return;
+		len += n;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = '\0';
+
+	headers = strchr(req, '\n');
+	headers = headers ? headers + 1 : req + len;
+	if (api_header(headers, "Origin", origin, sizeof(origin))) {
+		api_error(c, 403, "Forbidden", "cross-origin requests are refused");
+		return;
+	}
+
+	method = req;
+	path = strchr(method, ' ');
+	if (!path) {
+		api_error(c, 400, "Bad Request", "malformed request");
+		return;
+	}
+	*path++ = '\0';
+	end = strpbrk(path, " \r\n");
+	if (end)
+		*end = '\0';
+	query = strchr(path, '?');
+	if (query)
+		*query++ = '\0';
+
+	if (opt_protocol)
+		applog(LOG_DEBUG, "API: %s %s", method, path);
+
+	if (!strcmp(path, "/stats") || !strcmp(path, "/")) {
+		if (strcmp(method, "GET"))
+			api_error(c, 405, "Method Not Allowed", "use GET");
+		else
+			api_send_json(c, 200, "OK", api_stats());
+	} else if (!strcmp(path, "/metrics")) {
+		if (strcmp(method, "GET"))
+			api_error(c, 405, "Method Not Allowed", "use GET");
+		else {
+			char *text = api_metrics();
+			api_send(c, 200, "OK", API_TEXT, text ? text : "");
+			free(text);
+		}
+	} else if (!strcmp(method, "POST"))
+		api_control(c, path, query, headers);
+	else if (!strcmp(path, "/pause") || !strcmp(path, "/resume")
+			|| !strcmp(path, "/threads") || !strcmp(path, "/pool"))
+		api_error(c, 405, "Method Not Allowed", "use POST");
+	else
+		api_error(c, 404, "Not Found", "unknown path");
+}
+
+/* parse [IP:]PORT, the address defaults to loopback only; also for
+ * --proxy-listen */
+bool api_parse_bind(const char *s, struct sockaddr_in *sin)
+{
+	char host[64] = "127.0.0.1";
+	const char *colon = strrchr(s, ':');
+	long port;
+	char *ep;
+
+	if (colon) {
+		if ((size_t) (colon - s) >= sizeof(host))
+			return false;
+		memcpy(host, s, colon - s);
+		host[colon - s] = '\0';
+		s = colon + 1;
+	}
+	port = strtol(s, &ep, 10);
+	if (*ep || port < 1 || port > 65535)
+		return false;
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons((unsigned short) port);
+	sin->sin_addr.s_addr = inet_addr(host);
+	return sin->sin_addr.s_addr != INADDR_NONE
+		|| !strcmp(host, "255.255.255.255");
+}
+
+void *api_thread(void *userdata)
+{
+	struct thr_info *mythr = userdata;
+	struct sockaddr_in sin;
+	api_socket_t sock;
+	int one = 1;
+
+	prof_thread(mythr->id, "api");
+	metrics_thread(mythr->id);
+
+	if (!api_parse_bind(opt_api_bind, &sin)) {
+		applog(LOG_ERR, "API: invalid --api-bind '%s'", opt_api_bind);
+		return NULL;
+	}
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET) {
+		applog(LOG_ERR, "API: socket() failed");
+		return NULL;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *) &one,
+		sizeof(one));
+	if (bind(sock, (struct sockaddr *) &sin, sizeof(sin)) < 0
+			|| listen(sock, 8) < 0) {
+		applog(LOG_ERR, "API: cannot listen on %s", opt_api_bind);
+		api_close(sock);
+		return NULL;
+	}
+	applog(LOG_INFO, "API listening on %s:%d%s", inet_ntoa(sin.sin_addr),
+		ntohs(sin.sin_port), opt_api_control ? ", control enabled" : "");
+
+	while (1) {
+		api_socket_t c = accept(sock, NULL, NULL);
+#ifdef WIN32
+		DWORD tv = 5000;
+#else
+		struct timeval tv = { 5, 0 };
+#endif
+
+		/* out of descriptors (EMFILE) accept() fails right away, and
+		 * keeps failing for a while */
+		if (c == INVALID_SOCKET) {
+			sleep(1);
+			continue;
+		}
+		/* a client which never sends must not stall the next ones */
+		setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv,
+			sizeof(tv));
+		api_request(c);
+		api_close(c);
+	}
+
+	return NULL;
+}
@@ -19,6 +19,7 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <math.h>
 #include <time.h>
 #ifdef WIN32
 #include <windows.h>
@@ -48,7 +49,7 @@ BOOL WINAPI ConsoleHandler(DWORD);
 #define JSON_BUF_LEN 345
 
 enum workio_commands {
-    WC_GET_WORK, WC_SUBMIT_WORK,
+    WC_GET_WORK, WC_SUBMIT_WORK, WC_DRAIN_SHARES,
 };
 
 struct workio_cmd {
@@ -60,6 +61,7 @@ struct workio_cmd {
 };
 
 bool opt_debug = false;
+bool opt_hugepages = false;
 bool opt_protocol = false;
 static bool opt_benchmark = false;
 bool opt_redirect = true;
@@ -81,8 +83,11 @@ static json_t *opt_config;
 static const bool opt_time = true;
 static algorithm_t opt_algo;
 static int opt_scrypt_n = 1024;
-static int opt_n_threads = 0;
-static int opt_affinity = -1;
+int opt_n_threads = 0;
+static uint64_t opt_affinity = 0;
+static int *cpu_order;      /* cpu of each thread, modulo cpu_order_len */
+static int cpu_order_len;
+static bool opt_cpu_list = false;
 int opt_priority = 0;
 int num_cpus;
 static char *rpc_url;
@@ -96,13 +101,24 @@ static int work_thr_id;
 int longpoll_thr_id = -1;
 int stratum_thr_id = -1;
 struct work_restart *work_restart = NULL;
-static struct stratum_ctx stratum;
 static char rpc2_id[64] = "";
 static char *rpc2_blob = NULL;
 static int rpc2_bloblen = 0;
 static uint32_t rpc2_target = 0;
 static char *rpc2_job_id = NULL;
 bool aes_ni_supported = false;
+int opt_kernels = KERNEL_ALL;
+static char *opt_bench_algos;
+static char *opt_bench_threads;
+static char *opt_bench_kernels;
+static int opt_bench_time = 5;
+static int opt_bench_warmup = 1;
+static bool opt_bench_csv = false;
+bool opt_profile = false;
+static char *opt_selftest;
+char *opt_api_bind;
+char *opt_api_control = NULL;
+char *opt_proxy_listen;
 
 double opt_diff_factor = 1.0;
 pthread_mutex_t applog_lock;
@@ -133,7 +149,8 @@ Options:\n\
 ";
 static char const usage2[] =
         "\
-  -o, --url=URL         URL of mining server\n\
+  -o, --url=URL         URL of mining server, more stratum ones are failover\n\
+                          pools in order of preference\n\
   -O, --userpass=U:P    username:password pair for mining server\n\
   -u, --user=USERNAME   username for mining server\n\
   -p, --pass=PASSWORD   password for mining server\n\
@@ -165,9 +182,35 @@ static char const usage2[] =
 #endif
         "\
       --benchmark       run in offline benchmark mode\n\
+      --bench-suite=ALGOS  benchmark a comma separated list of algorithms\n\
+                          (or all) and print the results, then exit\n\
+      --bench-threads=LIST  thread counts to run, e.g. 1,2,4-8\n\
+                          (default: 1 and --threads)\n\
+      --bench-kernels=LIST  kernel variants to run: auto, scalar, 4way,\n\
+                          8way, noaes, nosha (default: auto)\n\
+      --bench-time=N    measured seconds per run (default: 5)\n\
+      --bench-warmup=N  seconds run before measuring (default: 1)\n\
+      --bench-format=F  bench suite output, json or csv (default: json)\n\
       --cputest         debug hashes from cpu algorithms\n\
+      --selftest=ALGOS  check a comma separated list of algorithms (or all)\n\
+                          against known answers, and each kernel variant\n\
+                          against the scalar one, then exit\n\
       --cpu-affinity    set process affinity to cpu core(s), mask 0x3 for cores 0 and 1\n\
+      --cpu-list=LIST   bind thread N to the Nth cpu of LIST, e.g. 0,2,4-7\n\
+                          (default: one thread per physical core first)\n\
       --cpu-priority    set process priority (default: 0 idle, 2 normal to 5 highest)\n\
+      --hugepages       back algo scratchpads with reserved huge pages\n\
+                          (default: transparent huge pages when enabled)\n\
+      --profile         time scanhash, work lock waits, job building and\n\
+                          submits per thread, logged on SIGUSR1 and at exit\n\
+      --api-bind=[IP:]PORT  serve stats as JSON over HTTP on IP:PORT\n\
+                          (default IP: 127.0.0.1), GET /stats and /metrics\n\
+      --api-control=TOKEN  also accept POST /pause, /resume, /threads?n=N\n\
+                          and /pool?url=URL on the API, from requests with\n\
+                          the header X-Miner-Token: TOKEN\n\
+      --proxy-listen=[IP:]PORT  serve stratum on IP:PORT to the other miners\n\
+                          of the host, on this one's pool session, each with\n\
+                          its own extranonce2 range (default IP: 127.0.0.1)\n\
   -c, --config=FILE     load a JSON-format configuration file\n\
   -V, --version         display version information and exit\n\
   -h, --help            display this help text and exit\n\
@@ -184,30 +227,43 @@ static char const short_options[] =
 
 static struct option const options[] = {
         { "algo", 1, NULL, 'a' },
+        { "api-bind", 1, NULL, 1032 },
+        { "api-control", 1, NULL, 1033 },
 #ifndef WIN32
         { "background", 0, NULL, 'B' },
 #endif
+        { "bench-format", 1, NULL, 1029 },
+        { "bench-kernels", 1, NULL, 1026 },
+        { "bench-suite", 1, NULL, 1024 },
+        { "bench-threads", 1, NULL, 1025 },
+        { "bench-time", 1, NULL, 1027 },
+        { "bench-warmup", 1, NULL, 1028 },
         { "benchmark", 0, NULL, 1005 },
         { "cert", 1, NULL, 1001 },
         { "config", 1, NULL, 'c' },
         { "cputest", 0, NULL, 1006 },
         { "cpu-affinity", 1, NULL, 1020 },
+        { "cpu-list", 1, NULL, 1023 },
         { "cpu-priority", 1, NULL, 1021 },
         { "debug", 0, NULL, 'D' },
         { "diff-factor", 1, NULL, 'd' },
         { "diff-multiplier", 1, NULL, 'm' },
         { "extranonce-subscribe", 0, NULL, 1016 },
         { "help", 0, NULL, 'h' },
+        { "hugepages", 0, NULL, 1022 },
         { "no-longpoll", 0, NULL, 1003 },
         { "no-redirect", 0, NULL, 1009 },
         { "no-stratum", 0, NULL, 1007 },
         { "pass", 1, NULL, 'p' },
+        { "profile", 0, NULL, 1031 },
         { "protocol-dump", 0, NULL, 'P' },
         { "proxy", 1, NULL, 'x' },
+        { "proxy-listen", 1, NULL, 1034 },
         { "quiet", 0, NULL, 'q' },
         { "retries", 1, NULL, 'r' },
         { "retry-pause", 1, NULL, 'R' },
         { "scantime", 1, NULL, 's' },
+        { "selftest", 1, NULL, 1030 },
 #ifdef HAVE_SYSLOG_H
         { "syslog", 0, NULL, 'S' },
 #endif
@@ -220,16 +276,248 @@ static struct option const options[] = {
         { 0, 0, 0, 0 }
 };
 
+/* producer side copy of the current work, see work_publish() */
 static struct work g_work;
 static time_t g_work_time;
+static double g_work_diff = 1.0;
+static uint64_t g_work_recv;    /* for the next work_publish(), 0 is now */
+static bool g_work_clean;
 static pthread_mutex_t g_work_lock;
 
+/* lock g_work_lock, --profile records the wait */
+static inline void work_lock(void) {
+    uint64_t t = prof_begin();
+
+    pthread_mutex_lock(&g_work_lock);
+    prof_end(PROF_WORK_LOCK, t);
+}
+
 static bool rpc2_login(CURL *curl);
 static void workio_cmd_free(struct workio_cmd *wc);
 
+/*
+ * What the API reports, see miner_status_read(). Writers hold status_lock
+ * and make g_status_seq odd while they update g_status, so the reader
+ * never takes a lock the miners or the network threads wait on.
+ */
+static struct miner_status g_status;
+static uint32_t g_status_seq;
+static pthread_mutex_t status_lock;
+
+static inline void status_write_begin(void) {
+    pthread_mutex_lock(&status_lock);
+    __atomic_store_n(&g_status_seq, g_status_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void status_write_end(void) {
+    __atomic_store_n(&g_status_seq, g_status_seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&status_lock);
+}
+
+void miner_status_read(struct miner_status *st) {
+    uint32_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&g_status_seq, __ATOMIC_ACQUIRE)) & 1)
+            ;
+        memcpy(st, &g_status, sizeof(*st));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&g_status_seq, __ATOMIC_RELAXED) != seq);
+}
+
+double miner_thr_hashrate(int thr_id) {
+    double v;
+
+    __atomic_load(&thr_hashrates[thr_id], &v, __ATOMIC_RELAXED);
+    return v;
+}
+
+static void status_set_pool(const char *url) {
+    status_write_begin();
+    snprintf(g_status.pool, sizeof(g_status.pool), "%s", url ? url : "");
+    status_write_end();
+}
+
+/* share difficulty of a 256 bit little endian target */
+static double target_to_diff(const uint32_t *target) {
+    double t = 0.;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        t = t * 4294967296. + target[i];
+    return t ? ldexp(0xffff, 208) / t : 0.;
+}
+
+/* found times of the shares waiting for an answer, under stats_lock */
+#define SHARE_LAT_MAX 64
+static uint64_t share_sent[SHARE_LAT_MAX];
+static int share_sent_head, share_sent_count;
+
+static void share_sent_push(uint64_t found) {
+    pthread_mutex_lock(&stats_lock);
+    if (share_sent_count == SHARE_LAT_MAX) {
+        share_sent_head = (share_sent_head + 1) % SHARE_LAT_MAX;
+        share_sent_count--;
+    }
+    share_sent[(share_sent_head + share_sent_count++) % SHARE_LAT_MAX] =
+            found ? found : metrics_usec();
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* the share pushed last never went out */
+static void share_sent_drop(void) {
+    pthread_mutex_lock(&stats_lock);
+    if (share_sent_count)
+        share_sent_count--;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Pool failover. Every stratum --url is a pool, the first one preferred.
+ * The pool thread connects, subscribes and authorizes them all in the
+ * background and hands each one over READY; the stratum thread then reads
+ * every ready pool through one stratum_poll, so a standby always has a
+ * current job and switching to it is just publishing that job. A READY
+ * pool belongs to the stratum thread, any other to the pool thread, and
+ * the state only changes under pool_lock.
+ */
+#define POOL_MAX STRATUM_POLL_MAX
+#define POOL_TICK 100       /* ms between stratum thread checks */
+#define POOL_IDLE 120       /* s a pool may stay silent */
+#define POOL_EWMA 8         /* share answers in the health averages */
+#define POOL_SLOW 2.        /* s of share latency that starts to count */
+#define POOL_HOLD 300       /* s an unhealthy pool is passed over */
+
+enum pool_state {
+    POOL_DOWN,
+    POOL_READY,
+    POOL_DEAD,  /* out of --retries */
+};
+
+struct pool {
+    struct stratum_ctx ctx;     /* ctx.url is the pool's */
+    char *user, *pass;          /* NULL: the global ones */
+    int state;
+    time_t retry;               /* POOL_DOWN: next connect */
+    int failures;
+    /* health, see pool_score() */
+    double accept, latency;
+    int results;
+    time_t hold;
+    uint64_t last_recv;
+};
+
+static struct pool pools[POOL_MAX];
+static int n_pools, n_urls;
+static int pool_cur = -1;       /* mining on, written by the stratum thread */
+static int pool_pref = -1;      /* API: before the list order */
+static pthread_mutex_t pool_lock;
+static pthread_cond_t pool_cond;
+
+/* before the threads start, or under pool_lock */
+static int pool_add(const char *url) {
+    struct pool *p;
+
+    if (n_pools == POOL_MAX)
+        return -1;
+    p = &pools[n_pools];
+    p->ctx.url = strdup(url);
+    pthread_mutex_init(&p->ctx.sock_lock, NULL);
+    pthread_mutex_init(&p->ctx.work_lock, NULL);
+    p->state = POOL_DOWN;
+    __atomic_store_n(&n_pools, n_pools + 1, __ATOMIC_RELEASE);
+    return n_pools - 1;
+}
+
+static inline const char *pool_user(const struct pool *p) {
+    return p->user ? p->user : rpc_user;
+}
+
+static inline const char *pool_pass(const struct pool *p) {
+    return p->pass ? p->pass : rpc_pass;
+}
+
+/* the index of the pool of sctx, ctx is the first member */
+static inline int pool_of(struct stratum_ctx *sctx) {
+    return (int) ((struct pool *) sctx - pools);
+}
+
+/* the pool to submit to, NULL while there is none */
+static struct stratum_ctx *pool_ctx(void) {
+    int i = __atomic_load_n(&pool_cur, __ATOMIC_ACQUIRE);
+
+    if (i < 0 || __atomic_load_n(&pools[i].state, __ATOMIC_ACQUIRE) != POOL_READY)
+        return NULL;
+    return &pools[i].ctx;
+}
+
+/* share acceptance, discounted when the answers are slow */
+static double pool_score(const struct pool *p) {
+    double s = p->accept;
+
+    if (p->latency > POOL_SLOW)
+        s *= POOL_SLOW / p->latency;
+    return s;
+}
+
+static bool pool_healthy(const struct pool *p) {
+    return p->results < POOL_EWMA || pool_score(p) >= .5;
+}
+
+/* stratum thread: the current pool answered a share after lat us */
+static void pool_share_result(bool accepted, uint64_t lat) {
+    struct pool *p;
+
+    if (pool_cur < 0)
+        return;
+    p = &pools[pool_cur];
+    p->accept += ((accepted ? 1. : 0.) - p->accept) / POOL_EWMA;
+    if (lat)
+        p->latency += (lat * 1e-6 - p->latency) / POOL_EWMA;
+    p->results++;
+}
+
+
+
+#define CPU_LIST_MAX 1024
+
+/* parse a cpu list such as "0,2,4-7" into cpus[], returns the count or -1 */
+static int parse_cpu_list(const char *s, int *cpus, int max) {
+    int n = 0;
+
+    while (*s) {
+        char *end;
+        long first = strtol(s, &end, 10), last;
+        if (end == s || first < 0)
+            return -1;
+        last = first;
+        s = end;
+        if (*s == '-') {
+            last = strtol(s + 1, &end, 10);
+            if (end == s + 1 || last < first)
+                return -1;
+            s = end;
+        }
+        for (; first <= last; first++) {
+            if (n == max)
+                return n;
+            cpus[n++] = (int) first;
+        }
+        while (*s == ',' || *s == ' ' || *s == '\n')
+            s++;
+    }
+    return n;
+}
 
 #ifdef __linux /* Linux specific policy and affinity management */
 #include <sched.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+
+/* one past the highest cpu id affine_to_cpu() can take */
+#define CPU_ID_LIMIT CPU_SETSIZE
 
 static inline void drop_policy(void) {
     struct sched_param param;
@@ -242,23 +530,159 @@ static inline void drop_policy(void) {
 #endif
 }
 
-static void affine_to_cpu_mask(int id, uint8_t mask) {
-    cpu_set_t set;
-    CPU_ZERO(&set);
-    for (uint8_t i = 0; i < num_cpus; i++) {
-        // cpu mask
-        if (mask & (1<<i)) { CPU_SET(i, &set); }
-    }
+static void affine_to_cpu_set(int id, cpu_set_t *set) {
     if (id == -1) {
         // process affinity
-        sched_setaffinity(0, sizeof(&set), &set);
+        sched_setaffinity(0, sizeof(*set), set);
     } else {
         // thread only
-        pthread_setaffinity_np(thr_info[id].pth, sizeof(&set), &set);
+        pthread_setaffinity_np(thr_info[id].pth, sizeof(*set), set);
+    }
+}
+
+static void affine_to_cpu_mask(int id, uint64_t mask) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < num_cpus && i < 64; i++) {
+        // cpu mask
+        if (mask & (1ULL << i)) { CPU_SET(i, &set); }
+    }
+    affine_to_cpu_set(id, &set);
+}
+
+static void affine_to_cpu(int id, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    affine_to_cpu_set(id, &set);
+}
+
+struct cpu_topo {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int smt;    /* index among the core's hardware threads */
+    int rank;   /* index of the core within its node */
+};
+
+static int sysfs_read(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (!fgets(buf, len, f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int sysfs_cpu_int(int cpu, const char *attr, int def) {
+    char path[128], buf[32];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, attr);
+    if (sysfs_read(path, buf, sizeof(buf)))
+        return def;
+    return atoi(buf);
+}
+
+static int topo_cmp_core(const void *a, const void *b) {
+    const struct cpu_topo *x = a, *y = b;
+    if (x->node != y->node) return x->node - y->node;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int topo_cmp_place(const void *a, const void *b) {
+    const struct cpu_topo *x = a, *y = b;
+    if (x->smt != y->smt) return x->smt - y->smt;
+    if (x->rank != y->rank) return x->rank - y->rank;
+    if (x->node != y->node) return x->node - y->node;
+    return x->cpu - y->cpu;
+}
+
+/*
+ * Order the online cpus for thread placement: one hardware thread of
+ * every physical core first, cores taken round-robin over the memory
+ * nodes, then the SMT siblings in the same order.
+ */
+static int build_cpu_order(int *order, int max) {
+    struct cpu_topo *topo;
+    char buf[4096], path[sizeof("/sys/devices/system/node//cpulist") + NAME_MAX];
+    int cpus[CPU_SETSIZE];
+    int n, i, j, nodes = 0, cores = 0;
+    struct dirent *de;
+    DIR *dir;
+
+    if (sysfs_read("/sys/devices/system/cpu/online", buf, sizeof(buf)) ||
+            (n = parse_cpu_list(buf, cpus, CPU_SETSIZE)) <= 0)
+        return 0;
+
+    topo = calloc(n, sizeof(*topo));
+    if (!topo)
+        return 0;
+    for (i = 0; i < n; i++) {
+        topo[i].cpu = cpus[i];
+        topo[i].package = sysfs_cpu_int(cpus[i], "topology/physical_package_id", 0);
+        topo[i].core = sysfs_cpu_int(cpus[i], "topology/core_id", cpus[i]);
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpus[i]);
+        if (!sysfs_read(path, buf, sizeof(buf))) {
+            int sib[CPU_SETSIZE], ns = parse_cpu_list(buf, sib, CPU_SETSIZE);
+            for (j = 0; j < ns; j++)
+                if (sib[j] == cpus[i])
+                    topo[i].smt = j;
+        }
+    }
+
+    /* machines without NUMA have no node directory: everything is node 0 */
+    dir = opendir("/sys/devices/system/node");
+    while (dir && (de = readdir(dir))) {
+        int node, nc;
+        if (strncmp(de->d_name, "node", 4) || !isdigit(de->d_name[4]))
+            continue;
+        node = atoi(de->d_name + 4);
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", de->d_name);
+        if (sysfs_read(path, buf, sizeof(buf)))
+            continue;
+        nc = parse_cpu_list(buf, cpus, CPU_SETSIZE);
+        for (j = 0; j < nc; j++)
+            for (i = 0; i < n; i++)
+                if (topo[i].cpu == cpus[j])
+                    topo[i].node = node;
+        nodes++;
+    }
+    if (dir)
+        closedir(dir);
+
+    qsort(topo, n, sizeof(*topo), topo_cmp_core);
+    for (i = 0, j = -1; i < n; i++) {
+        if (!i || topo[i].node != topo[i-1].node)
+            j = -1;
+        if (!i || topo[i].node != topo[i-1].node ||
+                topo[i].package != topo[i-1].package || topo[i].core != topo[i-1].core) {
+            j++;
+            cores++;
+        }
+        topo[i].rank = j;
     }
+    qsort(topo, n, sizeof(*topo), topo_cmp_place);
+
+    if (n > max)
+        n = max;
+    for (i = 0; i < n; i++)
+        order[i] = topo[i].cpu;
+    free(topo);
+
+    if (opt_debug)
+        applog(LOG_DEBUG, "CPU topology: %d cpus, %d cores, %d node(s)",
+                n, cores, nodes ? nodes : 1);
+    return n;
 }
 #elif defined(__FreeBSD__) /* FreeBSD specific policy and affinity management */
 #include <sys/cpuset.h>
+#define CPU_ID_LIMIT CPU_SETSIZE
 static inline void drop_policy(void) { }
 
 static inline void affine_to_cpu(int id, int cpu)
@@ -268,17 +692,39 @@ static inline void affine_to_cpu(int id, int cpu)
     CPU_SET(cpu, &set);
     cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_TID, -1, sizeof(cpuset_t), &set);
 }
+
+static void affine_to_cpu_mask(int id, uint64_t mask)
+{
+    cpuset_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < num_cpus && i < 64; i++) {
+        if (mask & (1ULL << i)) { CPU_SET(i, &set); }
+    }
+    cpuset_setaffinity(CPU_LEVEL_WHICH, id == -1 ? CPU_WHICH_PID : CPU_WHICH_TID,
+            -1, sizeof(cpuset_t), &set);
+}
+
+static int build_cpu_order(int *order, int max) { return 0; }
 #elif defined(WIN32) /* Windows */
+#define CPU_ID_LIMIT ((int) (8 * sizeof(DWORD_PTR)))
 static inline void drop_policy(void) { }
-static void affine_to_cpu_mask(int id, uint8_t mask) {
+static void affine_to_cpu_mask(int id, uint64_t mask) {
     if (id == -1)
-        SetProcessAffinityMask(GetCurrentProcess(), mask);
+        SetProcessAffinityMask(GetCurrentProcess(), (DWORD_PTR) mask);
     else
-        SetThreadAffinityMask(GetCurrentThread(), mask);
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) mask);
 }
+static void affine_to_cpu(int id, int cpu) {
+    if (cpu < (int) (8 * sizeof(DWORD_PTR)))
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu);
+}
+static int build_cpu_order(int *order, int max) { return 0; }
 #else
+#define CPU_ID_LIMIT CPU_LIST_MAX
 static inline void drop_policy(void) { }
-static void affine_to_cpu_mask(int id, uint8_t mask) { }
+static void affine_to_cpu_mask(int id, uint64_t mask) { }
+static void affine_to_cpu(int id, int cpu) { }
+static int build_cpu_order(int *order, int max) { return 0; }
 #endif
 
 json_t *json_rpc2_call_recur(CURL *curl, const char *url,
@@ -359,6 +805,187 @@ static inline void work_copy(struct work *dest, const struct work *src) {
     }
 }
 
+/*
+ * Work is handed to the miner threads through immutable snapshots.
+ * Producers (stratum, longpoll, getwork) update g_work under g_work_lock
+ * and publish a copy; miners compare g_work_seq with the sequence they
+ * are working on and only copy the newest snapshot when it moved, so the
+ * scan loop never takes a lock. Each miner announces the sequence it
+ * holds in thr_work_seq, and a snapshot is freed once all of them have
+ * moved past it. A miner that exits leaves THR_WORK_NONE there.
+ */
+struct work_snapshot {
+    uint32_t seq;
+    time_t time;
+    struct work work;
+    struct work_snapshot *older;
+    /* nonce dispenser, miners take chunks with a fetch-add */
+    uint64_t nonce_next;
+    /* stratum: lets each miner build a header with its own extranonce2 */
+    struct coinbase_tmpl *tmpl;
+    /* metrics: when the job came in, and for a clean job the active
+     * miners yet to move to it */
+    uint64_t recv;
+    int pending;
+};
+
+/* highest nonce handed out, the last vector of a wide scanner computes
+ * (and drops) a few lanes past it, they must not wrap */
+#define NONCE_LIMIT 0xffffffe0U
+
+static struct work_snapshot *g_work_head;
+static uint32_t g_work_seq;
+static uint32_t *thr_work_seq;
+#define THR_WORK_NONE UINT32_MAX
+/* next extranonce2 to give out for the current stratum job */
+static uint32_t g_xnonce2_next;
+
+static struct coinbase_tmpl *stratum_coinbase_tmpl(struct stratum_ctx *sctx) {
+    struct coinbase_tmpl *t;
+
+    pthread_mutex_lock(&sctx->work_lock);
+    t = coinbase_tmpl_new(&sctx->job, sctx->xnonce2_size,
+            opt_algo.gen_hash, opt_algo.gen_hash2);
+    if (t)
+        t->xnonce2_skip = proxy_prefix_size(sctx->xnonce2_size);
+    pthread_mutex_unlock(&sctx->work_lock);
+    return t;
+}
+
+/* give work the extranonce2 xn and the merkle root that goes with it;
+ * false when xn is past the extranonce2 range of the job, a counter that
+ * wrapped would hand out headers already mined */
+static bool work_set_xnonce2(struct work *work, const struct coinbase_tmpl *t,
+        uint32_t xn) {
+    unsigned char merkle_root[64];
+    size_t bytes = t->xnonce2_size - t->xnonce2_skip, i;
+
+    if (bytes < 4 && xn >> (8 * bytes)) {
+        if (xn == 1U << (8 * bytes))
+            applog(LOG_WARNING, "extranonce2 range of %d bytes used up, "
+                    "waiting for a new job", (int) bytes);
+        return false;
+    }
+    for (i = 0; i < t->xnonce2_size; i++) {
+        size_t j = i - t->xnonce2_skip;
+        work->xnonce2[i] = i >= t->xnonce2_skip && j < 4 ?
+                (unsigned char) (xn >> (8 * j)) : 0;
+    }
+    coinbase_tmpl_merkle(t, work->xnonce2, merkle_root);
+    for (i = 0; i < 8; i++)
+        work->data[9 + i] = be32dec((uint32_t *) merkle_root + i);
+    return true;
+}
+
+
+/* same header apart from the nonce */
+static inline bool work_same_header(const struct work *a, const struct work *b) {
+    if (jsonrpc_2)
+        return !memcmp(a->data, b->data, 39) &&
+                !memcmp(((uint8_t*) a->data) + 43, ((uint8_t*) b->data) + 43, 33);
+    return !memcmp(a->data, b->data, 76);
+}
+
+/* caller holds g_work_lock */
+static void work_publish(void) {
+    struct work_snapshot *snap, *old, **p;
+    struct stratum_ctx *sctx;
+    uint32_t min_seq;
+    int i;
+
+    snap = calloc(1, sizeof(*snap));
+    if (unlikely(!snap)) {
+        applog(LOG_ERR, "work_publish OOM");
+        return;
+    }
+    snap->seq = g_work_seq + 1;
+    /* 0 is a miner which holds nothing yet, THR_WORK_NONE one gone */
+    if (unlikely(!snap->seq || snap->seq == THR_WORK_NONE))
+        snap->seq = 1;
+    snap->time = g_work_time;
+    work_copy(&snap->work, &g_work);
+    snap->older = g_work_head;
+    if (have_stratum && !jsonrpc_2 && (sctx = pool_ctx()))
+        snap->tmpl = stratum_coinbase_tmpl(sctx);
+    snap->recv = g_work_recv ? g_work_recv : metrics_usec();
+    if (g_work_clean && !__atomic_load_n(&g_status.paused, __ATOMIC_RELAXED))
+        snap->pending = __atomic_load_n(&g_status.active_threads,
+                __ATOMIC_RELAXED);
+    g_work_recv = 0;
+    g_work_clean = false;
+    /* same header (new target, longpoll refresh): carry on with the nonces
+     * left, and make the old dispenser look empty to send its users here */
+    if (g_work_head && work_same_header(&g_work_head->work, &g_work))
+        snap->nonce_next = __atomic_exchange_n(&g_work_head->nonce_next,
+                (uint64_t) NONCE_LIMIT + 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&g_xnonce2_next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&g_work_head, snap, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_work_seq, snap->seq, __ATOMIC_RELEASE);
+
+    status_write_begin();
+    snprintf(g_status.job_id, sizeof(g_status.job_id), "%s",
+            g_work.job_id ? g_work.job_id : "");
+    if (have_stratum && !jsonrpc_2)
+        g_status.diff = g_work_diff;
+    else if (jsonrpc_2)
+        g_status.diff = g_work.target[7] ?
+                ((double) 0xffffffff) / g_work.target[7] : 0.;
+    else
+        g_status.diff = target_to_diff(g_work.target);
+    g_status.job_time = g_work_time;
+    status_write_end();
+
+    /* reclaim the snapshots no miner can still be reading */
+    min_seq = snap->seq;
+    for (i = 0; i < opt_n_threads; i++) {
+        uint32_t seq = __atomic_load_n(&thr_work_seq[i], __ATOMIC_ACQUIRE);
+        if (seq == THR_WORK_NONE)
+            continue;
+        if (!seq)
+            return; /* may be copying any of them right now */
+        if ((int32_t) (seq - min_seq) < 0)
+            min_seq = seq;
+    }
+    for (p = &snap->older; *p; ) {
+        old = *p;
+        if ((int32_t) (old->seq - min_seq) < 0) {
+            *p = old->older;
+            work_free(&old->work);
+            free(old->tmpl);
+            free(old);
+        } else
+            p = &old->older;
+    }
+}
+
+/*
+ * Size of the next chunk from a dispenser shared by sharers threads: what
+ * the thread can scan in the time asked for, but no more than a share of
+ * what is left (guided scheduling), so all threads run out of space
+ * together.
+ */
+static inline uint64_t nonce_chunk(uint64_t *dispenser, uint64_t want,
+        int sharers) {
+    uint64_t next = __atomic_load_n(dispenser, __ATOMIC_RELAXED);
+    uint64_t share;
+
+    if (next >= NONCE_LIMIT)
+        return 1;
+    share = (NONCE_LIMIT - next) / (2 * sharers);
+    if (want > share)
+        want = share;
+    return want ? want : 1;
+}
+
+/* newest snapshot if it differs from the one thr_id holds, else NULL */
+static inline struct work_snapshot *work_latest(int thr_id) {
+    if (__atomic_load_n(&g_work_seq, __ATOMIC_ACQUIRE) == thr_work_seq[thr_id])
+        return NULL;
+    return __atomic_load_n(&g_work_head, __ATOMIC_ACQUIRE);
+}
+
+
 static bool jobj_binary(const json_t *obj, const char *key, void *buf,
         size_t buflen) {
     const char *hexstr;
@@ -530,17 +1157,39 @@ bool rpc2_login_decode(const json_t *val) {
     err_out: return false;
 }
 
-static void share_result(int result, struct work *work, const char *reason) {
+/* the latency of the share in us, 0 if it was not timed */
+static uint64_t share_result(int result, struct work *work, const char *reason) {
     char s[345];
     double hashrate;
     int i;
 
+    uint64_t now = metrics_usec(), lat = 0;
+    bool timed = false;
+
     hashrate = 0.;
     pthread_mutex_lock(&stats_lock);
     for (i = 0; i < opt_n_threads; i++)
         hashrate += thr_hashrates[i];
     result ? accepted_count++ : rejected_count++;
+    if (share_sent_count) {
+        /* pools answer in order */
+        lat = now - share_sent[share_sent_head];
+        share_sent_head = (share_sent_head + 1) % SHARE_LAT_MAX;
+        share_sent_count--;
+        timed = true;
+    }
+    status_write_begin();
+    g_status.accepted = accepted_count;
+    g_status.rejected = rejected_count;
+    if (timed) {
+        g_status.latency_last = lat * 1e-3;
+        g_status.latency_sum += g_status.latency_last;
+        g_status.latency_count++;
+    }
+    status_write_end();
     pthread_mutex_unlock(&stats_lock);
+    if (timed)
+        metrics_observe(MET_SHARE, lat);
 
     switch (opt_algo.type) {
     case ALGO_CRYPTONIGHT:
@@ -571,86 +1220,130 @@ static void share_result(int result, struct work *work, const char *reason) {
 
     if (opt_debug && reason)
         applog(LOG_DEBUG, "DEBUG: reject reason: %s", reason);
+    return lat;
+}
+
+/* append the n bytes of src at p, returns the new end */
+static inline char *line_put(char *p, const char *src, size_t n) {
+    memcpy(p, src, n);
+    return p + n;
+}
+#define LINE_PUT(p, lit) line_put(p, lit, sizeof(lit) - 1)
+
+/* stratum: the submit line for work in s[JSON_BUF_LEN], returns its length
+ * or 0 when it does not fit */
+static size_t stratum_submit_line(const struct work *work, char *s) {
+    uint32_t ntime, nonce;
+    const char *user;
+    size_t user_len, job_len;
+    char *p = s;
+    int n;
+
+    if (jsonrpc_2) {
+        char noncestr[9], hashhex[65];
+        char hash[32];
+        if (work->hash_valid)
+            memcpy(hash, work->hash, 32);
+        else
+            cryptonight_hash(hash, work->data, 76);
+        bin2hex_buf(noncestr, ((const unsigned char*)work->data) + 39, 4);
+        bin2hex_buf(hashhex, (const unsigned char *) hash, 32);
+        /* no terminator: stratum_send_line() and the share batch add it */
+        n = snprintf(s, JSON_BUF_LEN,
+                "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":1}",
+                rpc2_id, work->job_id, noncestr, hashhex);
+        return n > 0 && n < JSON_BUF_LEN ? n : 0;
+    }
+
+    if (opt_algo.type == ALGO_LBRY) {
+        le32enc(&ntime, work->data[25]);
+        le32enc(&nonce, work->data[27]);
+    } else if (opt_algo.type == ALGO_SCRYPTJANE) {
+        le32enc(&ntime, work->data[17]);
+        be32enc(&nonce, work->data[19]);
+    } else {
+        le32enc(&ntime, work->data[17]);
+        le32enc(&nonce, work->data[19]);
+    }
+
+    /* built in place, one pass and no allocation per share */
+    user = pool_user(&pools[work->pool]);
+    user_len = strlen(user);
+    job_len = strlen(work->job_id);
+    if (user_len + job_len + 2 * work->xnonce2_len + 96 > JSON_BUF_LEN) {
+        applog(LOG_ERR, "stratum submit line too long");
+        return 0;
+    }
+    p = LINE_PUT(p, "{\"method\": \"mining.submit\", \"params\": [\"");
+    p = line_put(p, user, user_len);
+    p = LINE_PUT(p, "\", \"");
+    p = line_put(p, work->job_id, job_len);
+    p = LINE_PUT(p, "\", \"");
+    p = bin2hex_buf(p, work->xnonce2, work->xnonce2_len);
+    p = LINE_PUT(p, "\", \"");
+    p = bin2hex_buf(p, (const unsigned char *) &ntime, 4);
+    p = LINE_PUT(p, "\", \"");
+    p = bin2hex_buf(p, (const unsigned char *) &nonce, 4);
+    p = LINE_PUT(p, "\"], \"id\":4}");
+    *p = '\0';
+    return p - s;
+}
+
+/* pass if the previous hash is not the current previous hash, or the job
+ * is from a pool we have left */
+static inline bool share_stale(const struct work *work) {
+    if ((!submit_old && memcmp(work->data + 1, g_work.data + 1, 32))
+            || (have_stratum && work->pool != g_work.pool)) {
+        if (opt_debug)
+            applog(LOG_DEBUG, "DEBUG: stale work detected, discarding");
+        return true;
+    }
+    return false;
 }
 
 static bool submit_upstream_work(CURL *curl, struct work *work) {
-    char *str = NULL;
     json_t *val, *res, *reason;
-    char s[JSON_BUF_LEN];
+    char s[JSON_BUF_LEN], *p;
     int i;
     bool rc = false;
 
-    /* pass if the previous hash is not the current previous hash */
-    if (!submit_old && memcmp(work->data + 1, g_work.data + 1, 32)) {
-        if (opt_debug)
-            applog(LOG_DEBUG, "DEBUG: stale work detected, discarding");
+    if (share_stale(work))
         return true;
-    }
 
     if (have_stratum) {
-        uint32_t ntime, nonce;
-        char *ntimestr, *noncestr, *xnonce2str;
+        struct stratum_ctx *sctx = pool_ctx();
 
-        if (jsonrpc_2) {
-            noncestr = bin2hex(((const unsigned char*)work->data) + 39, 4);
-            char hash[32];
-            switch(opt_algo.type) {
-            case ALGO_CRYPTONIGHT:
-            default:
-                cryptonight_hash(hash, work->data, 76);
-            }
-            char *hashhex = bin2hex(hash, 32);
-            snprintf(s, JSON_BUF_LEN,
-                    "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":1}\r\n",
-                    rpc2_id, work->job_id, noncestr, hashhex);
-            free(hashhex);
-        } else {
-            if (opt_algo.type == ALGO_LBRY) {
-                le32enc(&ntime, work->data[25]);
-                le32enc(&nonce, work->data[27]);
-            } else if (opt_algo.type == ALGO_SCRYPTJANE) {
-                le32enc(&ntime, work->data[17]);
-                be32enc(&nonce, work->data[19]);
-            } else {
-                le32enc(&ntime, work->data[17]);
-                le32enc(&nonce, work->data[19]);
-            }
-            ntimestr = bin2hex((const unsigned char *) (&ntime), 4);
-            noncestr = bin2hex((const unsigned char *) (&nonce), 4);
-            xnonce2str = bin2hex(work->xnonce2, work->xnonce2_len);
-            snprintf(s, JSON_BUF_LEN,
-                    "{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":4}",
-                    rpc_user, work->job_id, xnonce2str, ntimestr, noncestr);
-            free(ntimestr);
-            free(xnonce2str);
-        }
-        free(noncestr);
+        /* a line that does not fit never will, drop the share */
+        if (!stratum_submit_line(work, s))
+            return true;
 
-        if (unlikely(!stratum_send_line(&stratum, s))) {
+        share_sent_push(work->found);
+        if (unlikely(!sctx || !stratum_send_line(sctx, s))) {
             applog(LOG_ERR, "submit_upstream_work stratum_send_line failed");
+            share_sent_drop();
             goto out;
         }
     } else {
         /* build JSON-RPC request */
         if(jsonrpc_2) {
-            char *noncestr = bin2hex(((const unsigned char*)work->data) + 39, 4);
+            char noncestr[9], hashhex[65];
             char hash[32];
-            switch(opt_algo.type) {
-            case ALGO_CRYPTONIGHT:
-            default:
+            if (work->hash_valid)
+                memcpy(hash, work->hash, 32);
+            else
                 cryptonight_hash(hash, work->data, 76);
-            }
-            char *hashhex = bin2hex(hash, 32);
+            bin2hex_buf(noncestr, ((const unsigned char*)work->data) + 39, 4);
+            bin2hex_buf(hashhex, (const unsigned char *) hash, 32);
             snprintf(s, JSON_BUF_LEN,
                     "{\"method\": \"submit\", \"params\": {\"id\": \"%s\", \"job_id\": \"%s\", \"nonce\": \"%s\", \"result\": \"%s\"}, \"id\":1}\r\n",
                     rpc2_id, work->job_id, noncestr, hashhex);
-            free(noncestr);
-            free(hashhex);
 
             /* issue JSON-RPC request */
+            share_sent_push(work->found);
             val = json_rpc2_call(curl, rpc_url, rpc_userpass, s, NULL, 0);
             if (unlikely(!val)) {
                 applog(LOG_ERR, "submit_upstream_work json_rpc_call failed");
+                share_sent_drop();
                 goto out;
             }
             res = json_object_get(val, "result");
@@ -670,19 +1363,16 @@ static bool submit_upstream_work(CURL *curl, struct work *work) {
             if (opt_algo.type == ALGO_SCRYPTJANE) {
                     be32enc(&work->data[19], work->data[19]);
             }
-            str = bin2hex((unsigned char *) work->data, 128);
-            if (unlikely(!str)) {
-                applog(LOG_ERR, "submit_upstream_work OOM");
-                goto out;
-            }
-            snprintf(s, JSON_BUF_LEN,
-                    "{\"method\": \"getwork\", \"params\": [ \"%s\" ], \"id\":1}\r\n",
-                    str);
+            p = LINE_PUT(s, "{\"method\": \"getwork\", \"params\": [ \"");
+            p = bin2hex_buf(p, (unsigned char *) work->data, 128);
+            strcpy(p, "\" ], \"id\":1}\r\n");
 
             /* issue JSON-RPC request */
+            share_sent_push(work->found);
             val = json_rpc_call(curl, rpc_url, rpc_userpass, s, NULL, 0);
             if (unlikely(!val)) {
                 applog(LOG_ERR, "submit_upstream_work json_rpc_call failed");
+                share_sent_drop();
                 goto out;
             }
             res = json_object_get(val, "result");
@@ -696,7 +1386,7 @@ static bool submit_upstream_work(CURL *curl, struct work *work) {
 
     rc = true;
 
-    out: free(str);
+    out:
     return rc;
 }
 
@@ -769,9 +1459,13 @@ static bool rpc2_login(CURL *curl) {
 
     json_t *job = json_object_get(result, "job");
 
+    work_lock();
     if(!rpc2_job_decode(job, &g_work)) {
+        pthread_mutex_unlock(&g_work_lock);
         goto end;
     }
+    work_publish();
+    pthread_mutex_unlock(&g_work_lock);
 
     if (opt_debug && rc) {
         timeval_subtract(&diff, &tv_end, &tv_start);
@@ -831,11 +1525,17 @@ static bool workio_get_work(struct workio_cmd *wc, CURL *curl) {
     return true;
 }
 
-static bool workio_submit_work(struct workio_cmd *wc, CURL *curl) {
+static bool workio_submit_work(struct work *work, CURL *curl) {
     int failures = 0;
 
     /* submit solution to bitcoin via JSON-RPC */
-    while (!submit_upstream_work(curl, wc->u.work)) {
+    for (;;) {
+        uint64_t t = prof_begin();
+        bool ok = submit_upstream_work(curl, work);
+
+        prof_end(PROF_SUBMIT, t);
+        if (ok)
+            break;
         if (unlikely((opt_retries >= 0) && (++failures > opt_retries))) {
             applog(LOG_ERR, "...terminating workio thread");
             return false;
@@ -872,11 +1572,168 @@ static bool workio_login(CURL *curl) {
     return true;
 }
 
+/*
+ * Shares go from each miner to the workio thread through the miner's own
+ * single producer, single consumer ring, instead of a heap copy of the
+ * work queued per share. The miner keeps scanning; one WC_DRAIN_SHARES
+ * in the workio queue stands for all the shares pushed since it was
+ * taken, and workio_drain_shares() sends the stratum ones in batches.
+ */
+#define SHARE_RING 64   /* power of 2 */
+#define SHARE_BATCH_MAX 16
+
+struct share {
+    uint32_t data[32];
+    uint32_t target[8];
+    uint32_t hash[8];
+    bool hash_valid;
+    uint64_t found;
+    int pool;
+    size_t xnonce2_len;
+    unsigned char xnonce2[32];
+    char job_id[64];
+};
+
+struct share_ring {
+    uint32_t head __attribute__((aligned(64)));     /* miner */
+    uint32_t tail __attribute__((aligned(64)));     /* workio thread */
+    struct share slot[SHARE_RING];
+};
+
+static struct share_ring *share_rings;
+static int share_drain_queued;
+static struct workio_cmd wc_drain = { WC_DRAIN_SHARES };
+
+/* queue a share of work from thread thr_id, false if it must go the slow way */
+static bool share_push(int thr_id, const struct work *work) {
+    struct share_ring *r = &share_rings[thr_id];
+    uint32_t head = r->head;
+    struct share *sh;
+    size_t len = work->job_id ? strlen(work->job_id) : 0;
+
+    if (unlikely(head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= SHARE_RING
+            || len >= sizeof(sh->job_id)
+            || work->xnonce2_len > sizeof(sh->xnonce2)))
+        return false;
+    sh = &r->slot[head & (SHARE_RING - 1)];
+    memcpy(sh->data, work->data, sizeof(sh->data));
+    memcpy(sh->target, work->target, sizeof(sh->target));
+    memcpy(sh->hash, work->hash, sizeof(sh->hash));
+    sh->hash_valid = work->hash_valid;
+    sh->found = work->found;
+    sh->pool = work->pool;
+    sh->xnonce2_len = work->xnonce2_len;
+    if (work->xnonce2_len)
+        memcpy(sh->xnonce2, work->xnonce2, work->xnonce2_len);
+    memcpy(sh->job_id, work->job_id ? work->job_id : "", len + 1);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    if (!__atomic_exchange_n(&share_drain_queued, 1, __ATOMIC_ACQ_REL)
+            && !tq_push(thr_info[work_thr_id].q, &wc_drain)) {
+        __atomic_store_n(&share_drain_queued, 0, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/* the work of a share, pointing into the ring slot */
+static void share_work(struct share *sh, struct work *work) {
+    memset(work, 0, sizeof(*work));
+    memcpy(work->data, sh->data, sizeof(work->data));
+    memcpy(work->target, sh->target, sizeof(work->target));
+    memcpy(work->hash, sh->hash, sizeof(work->hash));
+    work->hash_valid = sh->hash_valid;
+    work->found = sh->found;
+    work->pool = sh->pool;
+    work->job_id = sh->job_id;
+    work->xnonce2 = sh->xnonce2;
+    work->xnonce2_len = sh->xnonce2_len;
+}
+
+/* send the n lines of batch in one write, retrying like workio_submit_work() */
+static bool workio_send_batch(char *batch, size_t len, int n,
+        const uint64_t *found) {
+    int failures = 0, i;
+
+    batch[len - 1] = '\0';     /* stratum_send_line() adds the last '\n' */
+    for (;;) {
+        uint64_t t = prof_begin();
+        struct stratum_ctx *sctx;
+        bool ok;
+
+        for (i = 0; i < n; i++)
+            share_sent_push(found[i]);
+        sctx = pool_ctx();
+        ok = sctx && stratum_send_line(sctx, batch);
+        prof_end(PROF_SUBMIT, t);
+        if (ok)
+            return true;
+        applog(LOG_ERR, "submit_upstream_work stratum_send_line failed");
+        for (i = 0; i < n; i++)
+            share_sent_drop();
+        if (unlikely((opt_retries >= 0) && (++failures > opt_retries))) {
+            applog(LOG_ERR, "...terminating workio thread");
+            return false;
+        }
+        applog(LOG_ERR, "...retry after %d seconds", opt_fail_pause);
+        sleep(opt_fail_pause);
+        batch[len - 1] = '\0';
+    }
+}
+
+static bool workio_drain_shares(CURL *curl) {
+    static char *batch;
+    uint64_t found[SHARE_BATCH_MAX];
+    size_t len = 0, m;
+    int i, n = 0;
+
+    if (!batch) {
+        batch = malloc(SHARE_BATCH_MAX * (JSON_BUF_LEN + 1) + 1);
+        if (!batch)
+            return false;
+    }
+
+    /* pushes from now on queue another drain */
+    __atomic_exchange_n(&share_drain_queued, 0, __ATOMIC_ACQ_REL);
+    for (i = 0; i < opt_n_threads; i++) {
+        struct share_ring *r = &share_rings[i];
+        uint32_t tail = r->tail;
+
+        while (tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+            struct share *sh = &r->slot[tail & (SHARE_RING - 1)];
+            struct work work;
+
+            share_work(sh, &work);
+            if (!have_stratum) {
+                if (!workio_submit_work(&work, curl))
+                    return false;
+            } else if (!share_stale(&work)
+                    && (m = stratum_submit_line(&work, batch + len))) {
+                len += m;
+                batch[len++] = '\n';
+                found[n++] = work.found;
+            }
+            __atomic_store_n(&r->tail, ++tail, __ATOMIC_RELEASE);
+
+            if (n == SHARE_BATCH_MAX) {
+                if (!workio_send_batch(batch, len, n, found))
+                    return false;
+                len = n = 0;
+            }
+        }
+    }
+    if (n && !workio_send_batch(batch, len, n, found))
+        return false;
+    return true;
+}
+
 static void *workio_thread(void *userdata) {
     struct thr_info *mythr = userdata;
     CURL *curl;
     bool ok = true;
 
+    prof_thread(mythr->id, "workio");
+    metrics_thread(mythr->id);
     curl = curl_easy_init();
     if (unlikely(!curl)) {
         applog(LOG_ERR, "CURL initialization failed");
@@ -903,7 +1760,10 @@ static void *workio_thread(void *userdata) {
             ok = workio_get_work(wc, curl);
             break;
         case WC_SUBMIT_WORK:
-            ok = workio_submit_work(wc, curl);
+            ok = workio_submit_work(wc->u.work, curl);
+            break;
+        case WC_DRAIN_SHARES:
+            ok = workio_drain_shares(curl);
             break;
 
         default: /* should never happen */
@@ -911,7 +1771,8 @@ static void *workio_thread(void *userdata) {
             break;
         }
 
-        workio_cmd_free(wc);
+        if (wc != &wc_drain)
+            workio_cmd_free(wc);
     }
 
     tq_freeze(mythr->q);
@@ -988,6 +1849,7 @@ static bool submit_work(struct thr_info *thr, const struct work *work_in) {
 
 static void stratum_gen_work(struct stratum_ctx *sctx, struct work *work) {
     unsigned char merkle_root[64];
+    uint64_t t0 = prof_begin();
     int i;
 
     pthread_mutex_lock(&sctx->work_lock);
@@ -1011,9 +1873,7 @@ static void stratum_gen_work(struct stratum_ctx *sctx, struct work *work) {
             opt_algo.gen_hash2(merkle_root, merkle_root, 64);
         }
 
-        /* Increment extranonce2 */
-        for (i = 0; i < sctx->xnonce2_size && !++sctx->job.xnonce2[i]; i++)
-            ;
+        /* the miners put in their own extranonce2, see work_set_xnonce2() */
 
         /* Assemble block header */
         memset(work->data, 0, 128);
@@ -1071,21 +1931,105 @@ static void stratum_gen_work(struct stratum_ctx *sctx, struct work *work) {
                 work_set_target(work, sctx->job.diff / opt_diff_factor);
         }
     }
+    prof_end(PROF_GEN_WORK, t0);
 }
 
-static void *miner_thread(void *userdata) {
-    struct thr_info *mythr = userdata;
-    int thr_id = mythr->id;
-    struct work work = { { 0 } };
-    uint32_t max_nonce;
-    uint32_t end_nonce = 0xffffffffU / opt_n_threads * (thr_id + 1) - 0x20;
-    double olddiff = 1.0;
-    char s[16];
-    int i;
+/* the work the calling miner scans, for the scanners using scan_found() */
+static THREADLOCAL struct work *scan_work;
 
-    /* Set worker threads to nice 19 and then preferentially to SCHED_IDLE
-     * and if that fails, then SCHED_BATCH. No need for this to be an
-     * error if it fails */
+/* queue nonce of the work being scanned (pdata) as a share and let the
+ * scanner carry on, false if it has to return the nonce the usual way */
+bool scan_found(int thr_id, const uint32_t *pdata, uint32_t nonce) {
+    struct work *work = scan_work;
+    uint32_t saved;
+    bool ok;
+
+    if (!work || pdata != work->data)
+        return false;
+    saved = work->data[19];
+    work->data[19] = nonce;
+    work->found = metrics_usec();
+    ok = share_push(thr_id, work);
+    work->data[19] = saved;
+    return ok;
+}
+
+/*
+ * Nonce loop for algorithms that only export a hash function (scanhash
+ * NULL in algos[]). Headers are fed HASH_BATCH_MAX at a time through
+ * hash_batch, or one by one through simplehash, and the whole batch is
+ * checked against the target word before the full compare. The last
+ * batch is cut at max_nonce, the next nonces are another miner's.
+ */
+static int scanhash_generic(int thr_id, uint32_t *pdata,
+        const uint32_t *ptarget, uint32_t max_nonce, uint64_t *hashes_done)
+{
+    uint32_t endiandata[HASH_BATCH_MAX][20] __attribute__((aligned(64)));
+    uint32_t hash[HASH_BATCH_MAX][8] __attribute__((aligned(64)));
+    void *output[HASH_BATCH_MAX];
+    const void *input[HASH_BATCH_MAX];
+    const uint32_t first_nonce = pdata[19];
+    const uint32_t Htarg = ptarget[7];
+    const int lanes = opt_algo.hash_batch ? HASH_BATCH_MAX : 1;
+    uint64_t left = max_nonce >= first_nonce ?
+            (uint64_t) max_nonce - first_nonce + 1 : 1;
+    uint32_t n = first_nonce;
+    int i, k;
+
+    for (i = 0; i < lanes; i++) {
+        for (k = 0; k < 19; k++)
+            be32enc(&endiandata[i][k], pdata[k]);
+        input[i] = endiandata[i];
+        output[i] = hash[i];
+    }
+
+    do {
+        const int count = left < (uint64_t) lanes ? (int) left : lanes;
+        uint32_t hits = 0;
+
+        for (i = 0; i < count; i++)
+            be32enc(&endiandata[i][19], n + i);
+        if (opt_algo.hash_batch)
+            opt_algo.hash_batch(output, input, count);
+        else
+            opt_algo.simplehash(hash[0], endiandata[0]);
+
+        for (i = 0; i < count; i++)
+            hits |= (uint32_t) (hash[i][7] <= Htarg) << i;
+        while (unlikely(hits)) {
+            i = __builtin_ctz(hits);
+            hits &= hits - 1;
+            if (fulltest(hash[i], ptarget) && !scan_found(thr_id, pdata, n + i)) {
+                pdata[19] = n + i;
+                *hashes_done = n + i - first_nonce + 1;
+                return 1;
+            }
+        }
+        n += count;
+        left -= count;
+    } while (left && !work_restart[thr_id].restart);
+
+    *hashes_done = n - first_nonce;
+    pdata[19] = n - 1;
+    return 0;
+}
+
+static void *miner_thread(void *userdata) {
+    struct thr_info *mythr = userdata;
+    int thr_id = mythr->id;
+    struct work work = { { 0 } };
+    uint32_t max_nonce;
+    uint32_t chunk_end = 0;
+    uint64_t start, chunk, own_next = 0;
+    bool exhausted = false;
+    struct work_snapshot *snap, *cur = NULL;
+    time_t work_time = 0;
+    char s[16];
+    int i;
+
+    /* Set worker threads to nice 19 and then preferentially to SCHED_IDLE
+     * and if that fails, then SCHED_BATCH. No need for this to be an
+     * error if it fails */
     if (!opt_benchmark && opt_priority == 0) {
         setpriority(PRIO_PROCESS, 0, 19);
         drop_policy();
@@ -1122,14 +2066,14 @@ static void *miner_thread(void *userdata) {
 
     /* Cpu thread affinity */
     if (num_cpus > 1) {
-	if (opt_affinity == -1 && opt_n_threads > 1) {
+	if (opt_cpu_list || (!opt_affinity && opt_n_threads > 1)) {
+	    int cpu = cpu_order[thr_id % cpu_order_len];
 	    if (opt_debug)
-		applog(LOG_DEBUG, "Binding thread %d to cpu %d (mask %x)", thr_id,
-			thr_id % num_cpus, (1 << (thr_id % num_cpus)));
-	    affine_to_cpu_mask(thr_id, 1 << (thr_id % num_cpus));
-	} else if (opt_affinity != -1) {
+		applog(LOG_DEBUG, "Binding thread %d to cpu %d", thr_id, cpu);
+	    affine_to_cpu(thr_id, cpu);
+	} else if (opt_affinity) {
 	    if (opt_debug)
-		applog(LOG_DEBUG, "Binding thread %d to cpu mask %x", thr_id,
+		applog(LOG_DEBUG, "Binding thread %d to cpu mask %" PRIx64, thr_id,
 			opt_affinity);
 	    affine_to_cpu_mask(thr_id, opt_affinity);
 	}
@@ -1138,59 +2082,113 @@ static void *miner_thread(void *userdata) {
     if (opt_algo.init_contexts) opt_algo.init_contexts(&opt_scrypt_n);
     uint32_t *nonceptr = (uint32_t*) (((char*)work.data) + (jsonrpc_2 ? 39 : (opt_algo.type == ALGO_LBRY ? 108 : 76)));
 
+    prof_thread(thr_id, "miner");
+    metrics_thread(thr_id);
+    if (!opt_benchmark)
+        scan_work = &work;
+
     while (1) {
-        uint64_t hashes_done;
+        uint64_t hashes_done, prof_start;
         struct timeval tv_start, tv_end, diff;
         int64_t max64;
         int rc;
 
-        if (have_stratum) {
-            while (!jsonrpc_2 && time(NULL) >= g_work_time + 120)
-                sleep(1);
-            pthread_mutex_lock(&g_work_lock);
-            if (((*nonceptr) >= end_nonce
-           	    && !(jsonrpc_2 ? memcmp(work.data, g_work.data, 39) ||
-           	            memcmp(((uint8_t*) work.data) + 43, ((uint8_t*) g_work.data) + 43, 33)
-           	      : memcmp(work.data, g_work.data, 76))) || stratum.job.diff != olddiff) {
-                stratum_gen_work(&stratum, &g_work);
-                if (opt_algo.prepare_work) opt_algo.prepare_work(&stratum.job);
-                olddiff = stratum.job.diff;
-           }
-        } else {
-            /* obtain new work from internal workio thread */
-            pthread_mutex_lock(&g_work_lock);
-            if ((!have_stratum
-                    && (!have_longpoll
-                            || time(NULL ) >= g_work_time + LP_SCANTIME * 3 / 4
-                            || *nonceptr >= end_nonce))) {
-                if (unlikely(!get_work(mythr, &g_work))) {
-                    applog(LOG_ERR, "work retrieval failed, exiting "
-                            "mining thread %d", mythr->id);
-                    pthread_mutex_unlock(&g_work_lock);
-                    goto out;
-                }
-                g_work_time = have_stratum ? 0 : time(NULL );
-            }
-            if (have_stratum) {
-                pthread_mutex_unlock(&g_work_lock);
-                continue;
+        if (!have_stratum && (!have_longpoll
+                || time(NULL) >= work_time + LP_SCANTIME * 3 / 4
+                || exhausted)) {
+            /* obtain new work from internal workio thread; not under
+             * g_work_lock, the workio thread may need it (rpc2 login) */
+            struct work fresh = { { 0 } };
+
+            if (unlikely(!get_work(mythr, &fresh))) {
+                applog(LOG_ERR, "work retrieval failed, exiting "
+                        "mining thread %d", mythr->id);
+                goto out;
             }
-        }
-        if (jsonrpc_2 ? memcmp(work.data, g_work.data, 39) || memcmp(((uint8_t*) work.data) + 43, ((uint8_t*) g_work.data) + 43, 33) : memcmp(work.data, g_work.data, 76)) {
+            work_lock();
+            work_free(&g_work);
+            g_work = fresh;
+            g_work_time = time(NULL);
+            work_publish();
+            pthread_mutex_unlock(&g_work_lock);
+        } else if (exhausted && cur && cur->tmpl) {
+            /* our own header is used up, move to the next extranonce2,
+             * or stay used up until the next job when there is none */
+            if (work_set_xnonce2(&work, cur->tmpl,
+                    __atomic_fetch_add(&g_xnonce2_next, 1, __ATOMIC_RELAXED))) {
+                own_next = 0;
+                *nonceptr = chunk_end = 0;
+            } else
+                sleep(1);
+        } else if (exhausted)
+            sleep(1);   /* nothing to roll, wait for the next job */
+        exhausted = false;
+
+        /* clear before looking, so a restart raced with it is not lost */
+        __atomic_store_n(&work_restart[thr_id].restart, 0, __ATOMIC_SEQ_CST);
+        snap = work_latest(thr_id);
+        if (snap) {
+            /* a republished header keeps our header and the chunk we were
+             * handed, only the target changes */
+            bool same = cur && work_same_header(&cur->work, &snap->work);
+            unsigned char *xnonce2 = work.xnonce2;
+            uint32_t data[32];
+
+            memcpy(data, work.data, sizeof(data));
+            work.xnonce2 = NULL;
             work_free(&work);
-            work_copy(&work, &g_work);
+            work_copy(&work, &snap->work);
             nonceptr = (uint32_t*) (((char*)work.data) + (jsonrpc_2 ? 39 : (opt_algo.type == ALGO_LBRY ? 108 : 76)));
-            *nonceptr = 0xffffffffU / opt_n_threads * thr_id;
-        } else
+            if (same) {
+                memcpy(work.data, data, sizeof(data));
+                if (xnonce2)
+                    memcpy(work.xnonce2, xnonce2, work.xnonce2_len);
+            } else {
+                own_next = 0;
+                *nonceptr = chunk_end = 0;
+                if (snap->tmpl && !work_set_xnonce2(&work, snap->tmpl,
+                        __atomic_fetch_add(&g_xnonce2_next, 1, __ATOMIC_RELAXED)))
+                    own_next = NONCE_LIMIT;     /* nothing left to mine */
+            }
+            free(xnonce2);
+            cur = snap;
+            work_time = snap->time;
+            __atomic_store_n(&thr_work_seq[thr_id], snap->seq, __ATOMIC_RELEASE);
+            /* the last active miner onto a clean job times the restart */
+            if (snap->pending && thr_id < __atomic_load_n(&g_status.active_threads,
+                    __ATOMIC_RELAXED)
+                    && !__atomic_sub_fetch(&snap->pending, 1, __ATOMIC_RELAXED))
+                metrics_observe(MET_RESTART, metrics_usec() - snap->recv);
+        }
+
+        if (!cur || (have_stratum && !work_time)) {
+            /* no job from the pool yet, or not connected */
+            sleep(1);
+            continue;
+        }
+
+        if (thr_id >= __atomic_load_n(&g_status.active_threads, __ATOMIC_RELAXED)
+                || __atomic_load_n(&g_status.paused, __ATOMIC_RELAXED)) {
+            /* parked from the API: keep following the work, don't scan */
+            pthread_mutex_lock(&stats_lock);
+            thr_hashrates[thr_id] = 0.;
+            pthread_mutex_unlock(&stats_lock);
+            sleep(1);
+            continue;
+        }
+
+        if (*nonceptr < chunk_end) {
+            /* resume after a share, the rest of the chunk is still ours */
             ++(*nonceptr);
-        pthread_mutex_unlock(&g_work_lock);
-        work_restart[thr_id].restart = 0;
+            max_nonce = chunk_end;
+            goto scan;
+        }
 
         /* adjust max_nonce to meet target scan time */
         if (have_stratum)
             max64 = LP_SCANTIME;
         else
-            max64 = g_work_time + (have_longpoll ? LP_SCANTIME : opt_scantime)
+            max64 = work_time + (have_longpoll ? LP_SCANTIME : opt_scantime)
                     - time(NULL );
         max64 *= thr_hashrates[thr_id];
         if (max64 <= 0) {
@@ -1243,17 +2241,40 @@ static void *miner_thread(void *userdata) {
                 break;
             }
         }
-        if (*nonceptr + max64 > end_nonce)
-            max_nonce = end_nonce;
+        /* with its own extranonce2 the whole nonce space is ours */
+        if (cur->tmpl) {
+            chunk = max64;
+            start = own_next;
+            own_next += chunk;
+        } else {
+            chunk = nonce_chunk(&cur->nonce_next, max64, opt_n_threads);
+            start = __atomic_fetch_add(&cur->nonce_next, chunk, __ATOMIC_RELAXED);
+        }
+        if (start >= NONCE_LIMIT) {
+            /* unless a new snapshot is already out, roll the work */
+            exhausted = !work_latest(thr_id);
+            continue;
+        }
+        *nonceptr = (uint32_t) start;
+        if (start + chunk - 1 > NONCE_LIMIT)
+            chunk_end = NONCE_LIMIT;
         else
-            max_nonce = *nonceptr + max64;
+            chunk_end = (uint32_t) (start + chunk - 1);
+        max_nonce = chunk_end;
 
+scan:
         hashes_done = 0;
         gettimeofday(&tv_start, NULL );
+        prof_start = prof_begin();
 
         /* scan nonces for a proof-of-work hash */
-        rc = opt_algo.scanhash(thr_id, work.data, work.target,
+        if (opt_algo.scanhash)
+            rc = opt_algo.scanhash(thr_id, work.data, work.target,
+                    max_nonce, &hashes_done);
+        else
+            rc = scanhash_generic(thr_id, work.data, work.target,
                     max_nonce, &hashes_done);
+        prof_end(PROF_SCANHASH, prof_start);
 
         /* record scanhash elapsed time */
         gettimeofday(&tv_end, NULL);
@@ -1264,6 +2285,8 @@ static void *miner_thread(void *userdata) {
                 hashes_done / (diff.tv_sec + diff.tv_usec * 1e-6);
             pthread_mutex_unlock(&stats_lock);
         }
+        metrics_observe(MET_SCAN, diff.tv_sec * 1000000ULL + diff.tv_usec);
+        metrics_hashes(hashes_done);
         if (!opt_quiet) {
             switch(opt_algo.type) {
             case ALGO_CRYPTONIGHT:
@@ -1311,12 +2334,24 @@ static void *miner_thread(void *userdata) {
             }
         }
 
+        if (rc)
+            work.found = metrics_usec();
+
+        /* keep the winning hash so the submit path doesn't redo it */
+        if (rc && opt_algo.type == ALGO_CRYPTONIGHT) {
+            cryptonight_last_hash(work.hash);
+            work.hash_valid = true;
+        }
+
         /* if nonce found, submit work */
-        if (rc && !opt_benchmark && !submit_work(mythr, &work))
+        if (rc && !opt_benchmark && !share_push(thr_id, &work)
+                && !submit_work(mythr, &work))
             break;
     }
 
     out: if (opt_algo.free_contexts) opt_algo.free_contexts(&opt_scrypt_n);
+    /* don't hold back the reclaim of snapshots in work_publish() */
+    __atomic_store_n(&thr_work_seq[thr_id], THR_WORK_NONE, __ATOMIC_RELEASE);
     tq_freeze(mythr->q);
 
     return NULL ;
@@ -1329,12 +2364,87 @@ static void restart_threads(void) {
         work_restart[i].restart = 1;
 }
 
+/* API control: park all the miners, or let them go again */
+void miner_pause(bool pause) {
+    status_write_begin();
+    __atomic_store_n(&g_status.paused, pause, __ATOMIC_RELAXED);
+    status_write_end();
+    applog(LOG_NOTICE, pause ? "Mining paused" : "Mining resumed");
+    restart_threads();
+}
+
+/* API control: mine with threads 0..n-1 only, the others are parked */
+bool miner_set_threads(int n) {
+    if (n < 1 || n > opt_n_threads)
+        return false;
+    status_write_begin();
+    __atomic_store_n(&g_status.active_threads, n, __ATOMIC_RELAXED);
+    status_write_end();
+    applog(LOG_NOTICE, "Mining with %d of %d threads", n, opt_n_threads);
+    restart_threads();
+    return true;
+}
+
+/* API control: mine on url, one of the pools or a new one for the list */
+bool miner_switch_pool(const char *url) {
+    int i;
+
+    if (!have_stratum || strncasecmp(url, "stratum+tcp://", 14))
+        return false;
+    pthread_mutex_lock(&pool_lock);
+    for (i = 0; i < n_pools && strcmp(pools[i].ctx.url, url); i++)
+        ;
+    /* JSON-RPC 2.0 keeps its session in globals, one pool only */
+    if (i == n_pools && (jsonrpc_2 || pool_add(url) < 0))
+        i = -1;
+    if (i >= 0) {
+        pool_pref = i;
+        if (pools[i].state == POOL_DEAD) {
+            pools[i].state = POOL_DOWN;
+            pools[i].failures = 0;
+            pools[i].retry = 0;
+        }
+        pthread_cond_signal(&pool_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return i >= 0;
+}
+
+/* proxy: the session of the pool mining on, false while there is none */
+bool miner_pool_session(int *pool, char **xnonce1, int *xnonce2_size,
+        const char **user) {
+    struct stratum_ctx *sctx = pool_ctx();
+
+    if (!sctx || jsonrpc_2)
+        return false;
+    pthread_mutex_lock(&sctx->work_lock);
+    *xnonce1 = sctx->xnonce1 ? bin2hex(sctx->xnonce1, sctx->xnonce1_size) : NULL;
+    *xnonce2_size = (int) sctx->xnonce2_size;
+    pthread_mutex_unlock(&sctx->work_lock);
+    if (!*xnonce1)
+        return false;
+    *pool = pool_of(sctx);
+    *user = pool_user(&pools[*pool]);
+    return true;
+}
+
+/* proxy: send lines to pool, unless we have left it since */
+bool miner_pool_send(int pool, char *lines) {
+    struct stratum_ctx *sctx = pool_ctx();
+
+    if (!sctx || pool_of(sctx) != pool)
+        return false;
+    return stratum_send_line(sctx, lines);
+}
+
 static void *longpoll_thread(void *userdata) {
     struct thr_info *mythr = userdata;
     CURL *curl = NULL;
     char *copy_start, *hdr_path = NULL, *lp_url = NULL;
     bool need_slash = false;
 
+    prof_thread(mythr->id, "longpoll");
+    metrics_thread(mythr->id);
     curl = curl_easy_init();
     if (unlikely(!curl)) {
         applog(LOG_ERR, "CURL initialization failed");
@@ -1368,6 +2478,7 @@ static void *longpoll_thread(void *userdata) {
 
     while (1) {
         json_t *val, *soval;
+        uint64_t recv_time;
         int err;
 
         if(jsonrpc_2) {
@@ -1383,6 +2494,7 @@ static void *longpoll_thread(void *userdata) {
         } else {
             val = json_rpc_call(curl, rpc_url, rpc_userpass, rpc_req, &err, JSON_RPC_LONGPOLL);
         }
+        recv_time = metrics_usec();
         if (have_stratum) {
             if (val)
                 json_decref(val);
@@ -1394,7 +2506,7 @@ static void *longpoll_thread(void *userdata) {
                         "submitold");
                 submit_old = soval ? json_is_true(soval) : false;
             }
-            pthread_mutex_lock(&g_work_lock);
+            work_lock();
             char *start_job_id = strdup(g_work.job_id);
             if (work_decode(json_object_get(val, "result"), &g_work)) {
                 if (strcmp(start_job_id, g_work.job_id)) {
@@ -1402,15 +2514,20 @@ static void *longpoll_thread(void *userdata) {
                     if (opt_debug)
                         applog(LOG_DEBUG, "DEBUG: got new work");
                     time(&g_work_time);
+                    g_work_recv = recv_time;
+                    g_work_clean = true;
+                    work_publish();
                     restart_threads();
-                }
+                } else
+                    work_publish();
             }
             free(start_job_id);
             pthread_mutex_unlock(&g_work_lock);
             json_decref(val);
         } else {
-            pthread_mutex_lock(&g_work_lock);
+            work_lock();
             g_work_time -= LP_SCANTIME;
+            work_publish();
             pthread_mutex_unlock(&g_work_lock);
             if (err == CURLE_OPERATION_TIMEDOUT) {
                 restart_threads();
@@ -1435,24 +2552,17 @@ static void *longpoll_thread(void *userdata) {
     return NULL ;
 }
 
-static bool stratum_handle_response(char *buf) {
-    json_t *val, *err_val, *res_val, *id_val;
-    json_error_t err;
-    bool ret = false;
+static bool stratum_handle_response(json_t *val) {
+    json_t *err_val, *res_val, *id_val;
     bool valid = false;
-
-    val = JSON_LOADS(buf, &err);
-    if (!val) {
-        applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
-        goto out;
-    }
+    uint64_t lat;
 
     res_val = json_object_get(val, "result");
     err_val = json_object_get(val, "error");
     id_val = json_object_get(val, "id");
 
     if (!id_val || json_is_null(id_val) || !res_val)
-        goto out;
+        return false;
 
     if(jsonrpc_2) {
         json_t *status = json_object_get(res_val, "status");
@@ -1466,90 +2576,327 @@ static bool stratum_handle_response(char *buf) {
         valid = json_is_true(res_val);
     }
 
-    share_result(valid, NULL,
+    lat = share_result(valid, NULL,
             err_val ? (jsonrpc_2 ? json_string_value(err_val) : json_string_value(json_array_get(err_val, 1))) : NULL );
+    pool_share_result(valid, lat);
 
-    ret = true;
-    out: if (val)
-        json_decref(val);
+    return true;
+}
+
+/*
+ * Connects the pools that are down, one at a time, and hands them to the
+ * stratum thread. A pool that fails is tried again after --retry-pause,
+ * and left after --retries failures in a row; once all of them are left
+ * the miner gives up, as it did with a single pool.
+ */
+static void *pool_thread(void *userdata) {
+    struct thr_info *mythr = userdata;
+
+    prof_thread(mythr->id, "pool");
+    metrics_thread(mythr->id);
+
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        time_t now = time(NULL), next = now + 60;
+        struct pool *p = NULL;
+        int i, dead = 0;
+        uint64_t t;
+        bool ok;
+
+        for (i = 0; i < n_pools; i++) {
+            if (pools[i].state == POOL_DEAD)
+                dead++;
+            else if (pools[i].state != POOL_DOWN)
+                continue;
+            else if (pools[i].retry <= now) {
+                if (!p)
+                    p = &pools[i];
+            } else if (pools[i].retry < next)
+                next = pools[i].retry;
+        }
+        if (dead == n_pools) {
+            applog(LOG_ERR, "...terminating workio thread");
+            tq_push(thr_info[work_thr_id].q, NULL );
+            break;
+        }
+        if (!p) {
+            struct timespec ts = { next, 0 };
+
+            pthread_cond_timedwait(&pool_cond, &pool_lock, &ts);
+            continue;
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        t = metrics_usec();
+        ok = stratum_connect(&p->ctx, p->ctx.url)
+                && stratum_subscribe(&p->ctx)
+                && (!opt_extranonce_subscribe || subscribe_extranonce(&p->ctx))
+                && stratum_authorize(&p->ctx, pool_user(p), pool_pass(p));
+        if (!ok)
+            stratum_disconnect(&p->ctx);
+
+        pthread_mutex_lock(&pool_lock);
+        if (ok) {
+            /* the handshake stands in for share latency until there is some */
+            p->latency = (metrics_usec() - t) * 1e-6;
+            p->accept = 1.;
+            p->results = 0;
+            p->failures = 0;
+            __atomic_store_n(&p->state, POOL_READY, __ATOMIC_RELEASE);
+        } else if (opt_retries >= 0 && ++p->failures > opt_retries) {
+            applog(LOG_ERR, "...giving up on %s", p->ctx.url);
+            p->state = POOL_DEAD;
+        } else {
+            applog(LOG_ERR, "...retry %s after %d seconds", p->ctx.url,
+                    opt_fail_pause);
+            p->retry = time(NULL) + opt_fail_pause;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL ;
+}
+
+/*
+ * pool_lock held: the ready pool to mine on, -1 if none. That is the
+ * pool asked for on the API, or else the first healthy one in the list,
+ * leaving out those recently found unhealthy; with no healthy pool, the
+ * one with the best score.
+ */
+static int pool_best(void) {
+    time_t now = time(NULL);
+    int i, best = -1;
+
+    if (pool_pref >= 0 && pools[pool_pref].state == POOL_READY
+            && pool_healthy(&pools[pool_pref]))
+        return pool_pref;
+    for (i = 0; i < n_pools; i++) {
+        if (pools[i].state != POOL_READY)
+            continue;
+        if (pool_healthy(&pools[i]) && (pools[i].hold <= now || i == pool_cur))
+            return i;
+        if (best < 0 || pool_score(&pools[i]) > pool_score(&pools[best]))
+            best = i;
+    }
+    return best;
+}
+
+/* stratum thread: mine on pool i from now on, -1 to wait for one */
+static void pool_switch(int i) {
+    struct pool *from = pool_cur >= 0 ? &pools[pool_cur] : NULL;
+    bool job = false;
+
+    if (from && from->state == POOL_READY && !pool_healthy(from)) {
+        applog(LOG_WARNING, "Pool %s unhealthy: %.0f%% accepted, %.2f s latency",
+                from->ctx.url, 100. * from->accept, from->latency);
+        /* another chance later, on fresh numbers */
+        from->hold = time(NULL) + POOL_HOLD;
+        from->accept = 1.;
+        from->results = 0;
+    }
+    __atomic_store_n(&pool_cur, i, __ATOMIC_RELEASE);
+    proxy_reset(i);
+
+    /* shares in flight to the old pool get no answer here */
+    pthread_mutex_lock(&stats_lock);
+    share_sent_count = 0;
+    pthread_mutex_unlock(&stats_lock);
+
+    if (i >= 0) {
+        struct stratum_ctx *sctx = &pools[i].ctx;
+
+        if (n_pools > 1)
+            applog(LOG_NOTICE, "Switching to %s", sctx->url);
+        status_set_pool(sctx->url);
+        pthread_mutex_lock(&sctx->work_lock);
+        job = jsonrpc_2 ? sctx->work.job_id != NULL : sctx->job.job_id != NULL;
+        pthread_mutex_unlock(&sctx->work_lock);
+    } else if (n_pools > 1)
+        applog(LOG_WARNING, "No pool to mine on");
+
+    /* a standby's job is new work whatever its id, see stratum_thread();
+     * without one the miners wait */
+    work_lock();
+    g_work_time = 0;
+    if (!job && g_work_seq)
+        work_publish();
+    pthread_mutex_unlock(&g_work_lock);
+    if (!job)
+        restart_threads();
+}
 
-    return ret;
+/* stratum thread: pool i lost its connection, back to the pool thread */
+static void pool_down(struct stratum_poll *poll, int i) {
+    struct pool *p = &pools[i];
+
+    stratum_poll_del(poll, &p->ctx);
+    stratum_disconnect(&p->ctx);
+    pthread_mutex_lock(&pool_lock);
+    __atomic_store_n(&p->state, POOL_DOWN, __ATOMIC_RELEASE);
+    p->retry = 0;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
 }
 
 static void *stratum_thread(void *userdata) {
     struct thr_info *mythr = userdata;
+    struct stratum_poll poll;
+    bool polled[POOL_MAX] = { false };
+    uint64_t recv_time = 0;
+    json_error_t err;
+    const char *method;
+    json_t *val;
     char *s;
+    int i;
 
-    stratum.url = tq_pop(mythr->q, NULL );
-    if (!stratum.url)
+    prof_thread(mythr->id, "stratum");
+    metrics_thread(mythr->id);
+    s = tq_pop(mythr->q, NULL );
+    if (!s)
+        goto out;
+    /* X-Stratum: the pool comes from the getwork server */
+    pthread_mutex_lock(&pool_lock);
+    if (!n_pools)
+        pool_add(s);
+    pthread_mutex_unlock(&pool_lock);
+    free(s);
+    applog(LOG_INFO, "Starting Stratum on %s", pools[0].ctx.url);
+    if (n_pools > 1)
+        applog(LOG_INFO, "Failover pools on standby: %d", n_pools - 1);
+    stratum_poll_init(&poll);
+
+    /* start the pool thread */
+    thr_info[opt_n_threads + 4].id = opt_n_threads + 4;
+    if (unlikely(pthread_create(&thr_info[opt_n_threads + 4].pth, NULL,
+            pool_thread, &thr_info[opt_n_threads + 4]))) {
+        applog(LOG_ERR, "pool thread create failed");
         goto out;
-    applog(LOG_INFO, "Starting Stratum on %s", stratum.url);
+    }
 
     while (1) {
-        int failures = 0;
-
-        while (!stratum.curl) {
-            pthread_mutex_lock(&g_work_lock);
-            g_work_time = 0;
-            pthread_mutex_unlock(&g_work_lock);
-            restart_threads();
-
-            if (!stratum_connect(&stratum, stratum.url)
-                    || !stratum_subscribe(&stratum)
-                    || (opt_extranonce_subscribe && !subscribe_extranonce(&stratum))
-                    || !stratum_authorize(&stratum, rpc_user, rpc_pass)) {
-                stratum_disconnect(&stratum);
-                if (opt_retries >= 0 && ++failures > opt_retries) {
-                    applog(LOG_ERR, "...terminating workio thread");
-                    tq_push(thr_info[work_thr_id].q, NULL );
-                    goto out;
-                }
-                applog(LOG_ERR, "...retry after %d seconds", opt_fail_pause);
-                sleep(opt_fail_pause);
+        struct stratum_ctx *sctx;
+        bool restart = false;
+        uint64_t now = metrics_usec();
+        int best;
+
+        /* take in the pools that came up, then let go of the silent ones */
+        pthread_mutex_lock(&pool_lock);
+        for (i = 0; i < n_pools; i++) {
+            sctx = &pools[i].ctx;
+            if (pools[i].state != POOL_READY || polled[i])
+                continue;
+            stratum_poll_add(&poll, sctx);
+            polled[i] = true;
+            pools[i].last_recv = now;
+            if (sctx->proxy_diff)
+                proxy_job(i, sctx->proxy_diff, false);
+            if (sctx->proxy_notify)
+                proxy_job(i, sctx->proxy_notify, true);
+            free(sctx->proxy_diff);
+            free(sctx->proxy_notify);
+            sctx->proxy_diff = sctx->proxy_notify = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+        for (i = 0; i < n_pools; i++) {
+            if (polled[i] && now - pools[i].last_recv > POOL_IDLE * 1000000ULL) {
+                applog(LOG_ERR, "Stratum connection to %s timed out",
+                        pools[i].ctx.url);
+                pool_down(&poll, i);
+                polled[i] = false;
             }
         }
 
-        if (jsonrpc_2) {
-            if (stratum.work.job_id
+        /* a healthy pool is left only for one before it in the list */
+        pthread_mutex_lock(&pool_lock);
+        best = pool_best();
+        pthread_mutex_unlock(&pool_lock);
+        if (best != pool_cur && (pool_cur < 0
+                || pools[pool_cur].state != POOL_READY
+                || pool_healthy(&pools[best]))) {
+            pool_switch(best);
+            recv_time = now;
+        }
+
+        sctx = pool_cur >= 0 ? &pools[pool_cur].ctx : NULL;
+        work_lock();
+        if (sctx && jsonrpc_2) {
+            if (sctx->work.job_id
                     && (!g_work_time
-                            || strcmp(stratum.work.job_id, g_work.job_id))) {
-                pthread_mutex_lock(&g_work_lock);
-                stratum_gen_work(&stratum, &g_work);
-                if (opt_algo.prepare_work) opt_algo.prepare_work(&stratum.job);
+                            || strcmp(sctx->work.job_id, g_work.job_id))) {
+                stratum_gen_work(sctx, &g_work);
+                if (opt_algo.prepare_work) opt_algo.prepare_work(&sctx->job);
+                g_work.pool = pool_cur;
                 time(&g_work_time);
-                pthread_mutex_unlock(&g_work_lock);
+                g_work_recv = recv_time;
+                g_work_clean = true;
+                work_publish();
                 applog(LOG_INFO, "Stratum detected new block");
-                restart_threads();
+                restart = true;
             }
-        } else {
-            if (stratum.job.job_id
+        } else if (sctx) {
+            if (sctx->job.job_id
                     && (!g_work_time
-                            || strcmp(stratum.job.job_id, g_work.job_id))) {
-                pthread_mutex_lock(&g_work_lock);
-                stratum_gen_work(&stratum, &g_work);
-                if (opt_algo.prepare_work) opt_algo.prepare_work(&stratum.job);
-                time(&g_work_time);
-                pthread_mutex_unlock(&g_work_lock);
-                if (stratum.job.clean) {
+                            || strcmp(sctx->job.job_id, g_work.job_id)
+                            || sctx->job.diff != g_work_diff)) {
+                bool new_job = !g_work_time || strcmp(sctx->job.job_id, g_work.job_id);
+                /* no work before: nothing to go on with either */
+                bool clean = sctx->job.clean || !g_work_time;
+
+                stratum_gen_work(sctx, &g_work);
+                if (opt_algo.prepare_work) opt_algo.prepare_work(&sctx->job);
+                g_work.pool = pool_cur;
+                g_work_diff = sctx->job.diff;
+                if (new_job)
+                    time(&g_work_time);
+                g_work_recv = recv_time;
+                g_work_clean = new_job && clean;
+                work_publish();
+                if (new_job && clean) {
                     applog(LOG_INFO, "Stratum detected new block");
-                    restart_threads();
+                    restart = true;
                 }
             }
         }
+        pthread_mutex_unlock(&g_work_lock);
+        if (restart)
+            restart_threads();
 
-        if (!stratum_socket_full(&stratum, 120)) {
-            applog(LOG_ERR, "Stratum connection timed out");
-            s = NULL;
-        } else
-            s = stratum_recv_line(&stratum);
+        sctx = stratum_poll_wait(&poll, POOL_TICK);
+        if (!sctx)
+            continue;
+        i = pool_of(sctx);
+        s = stratum_recv_line(sctx);
+        recv_time = metrics_usec();
         if (!s) {
-            stratum_disconnect(&stratum);
-            applog(LOG_ERR, "Stratum connection interrupted");
+            applog(LOG_ERR, "Stratum connection to %s interrupted", sctx->url);
+            pool_down(&poll, i);
+            polled[i] = false;
             continue;
         }
-        if (!stratum_handle_method(&stratum, s))
-            stratum_handle_response(s);
-        free(s);
+        pools[i].last_recv = recv_time;
+        /* parsed once, in place in the receive buffer */
+        val = JSON_LOADS(s, &err);
+        if (!val) {
+            applog(LOG_INFO, "JSON decode failed(%d): %s", err.line, err.text);
+            continue;
+        }
+        method = json_string_value(json_object_get(val, "method"));
+        if (stratum_handle_method_json(sctx, val)) {
+            /* proxy clients get jobs just as the pool sent them */
+            if (!strcmp(method, "mining.notify"))
+                proxy_job(i, s, true);
+            else if (!strcmp(method, "mining.set_difficulty"))
+                proxy_job(i, s, false);
+            else if (!strcmp(method, "mining.set_extranonce") && i == pool_cur)
+                proxy_reset(i);
+        } else if (!proxy_answer(val) && i == pool_cur)
+            /* the answers of a pool we left are not ours to count */
+            stratum_handle_response(val);
+        json_decref(val);
+        /* client.reconnect */
+        if (!sctx->curl) {
+            pool_down(&poll, i);
+            polled[i] = false;
+        }
     }
 
     out: return NULL ;
@@ -1616,9 +2963,10 @@ static void show_usage_and_exit(int status) {
 }
 
 static void parse_arg(int key, char *arg) {
-    char *p;
+    char *p, *ep;
     algorithm_t* algo;
     int v, i;
+    unsigned long long ul;
     double d;
 
     switch (key) {
@@ -1676,6 +3024,10 @@ static void parse_arg(int key, char *arg) {
     case 'p':
         free(rpc_pass);
         rpc_pass = strdup(arg);
+        if (n_pools) {
+            free(pools[n_pools - 1].pass);
+            pools[n_pools - 1].pass = strdup(arg);
+        }
         break;
     case 'P':
         opt_protocol = true;
@@ -1713,8 +3065,14 @@ static void parse_arg(int key, char *arg) {
     case 'u':
         free(rpc_user);
         rpc_user = strdup(arg);
+        if (n_pools) {
+            free(pools[n_pools - 1].user);
+            pools[n_pools - 1].user = strdup(arg);
+        }
         break;
     case 'o': /* --url */
+        n_urls++;
+        v = 0;  /* 1: user@ in the url, 2: user:pass@ */
         p = strstr(arg, "://");
         if (p) {
             if (strncasecmp(arg, "http://", 7)
@@ -1736,6 +3094,7 @@ static void parse_arg(int key, char *arg) {
             *p = '\0';
             ap = strstr(rpc_url, "://") + 3;
             sp = strchr(ap, ':');
+            v = sp ? 2 : 1;
             if (sp) {
                 free(rpc_userpass);
                 rpc_userpass = strdup(ap);
@@ -1751,6 +3110,17 @@ static void parse_arg(int key, char *arg) {
             memmove(ap, p + 1, strlen(p + 1) + 1);
         }
         have_stratum = !opt_benchmark && !strncasecmp(rpc_url, "stratum", 7);
+        if (!strncasecmp(rpc_url, "stratum", 7)) {
+            if (pool_add(rpc_url) < 0) {
+                fprintf(stderr, "At most %d pools\n", POOL_MAX);
+                show_usage_and_exit(1);
+            }
+            /* the user[:pass]@ of the url is this pool's */
+            if (v)
+                pools[n_pools - 1].user = strdup(rpc_user);
+            if (v == 2)
+                pools[n_pools - 1].pass = strdup(rpc_pass);
+        }
         break;
     case 'O': /* --userpass */
         p = strchr(arg, ':');
@@ -1763,6 +3133,12 @@ static void parse_arg(int key, char *arg) {
         strncpy(rpc_user, arg, p - arg);
         free(rpc_pass);
         rpc_pass = strdup(p + 1);
+        if (n_pools) {
+            free(pools[n_pools - 1].user);
+            pools[n_pools - 1].user = strdup(rpc_user);
+            free(pools[n_pools - 1].pass);
+            pools[n_pools - 1].pass = strdup(rpc_pass);
+        }
         break;
     case 'x': /* --proxy */
         if (!strncasecmp(arg, "socks4://", 9))
@@ -1790,6 +3166,50 @@ static void parse_arg(int key, char *arg) {
         want_stratum = false;
         have_stratum = false;
         break;
+    case 1024:
+        free(opt_bench_algos);
+        opt_bench_algos = strdup(arg);
+        opt_benchmark = true;
+        want_longpoll = false;
+        want_stratum = false;
+        have_stratum = false;
+        break;
+    case 1025:
+        free(opt_bench_threads);
+        opt_bench_threads = strdup(arg);
+        break;
+    case 1026:
+        free(opt_bench_kernels);
+        opt_bench_kernels = strdup(arg);
+        break;
+    case 1027:
+        v = atoi(arg);
+        if (v < 1 || v > 3600)    /* sanity check */
+            show_usage_and_exit(1);
+        opt_bench_time = v;
+        break;
+    case 1028:
+        v = atoi(arg);
+        if (v < 0 || v > 3600)    /* sanity check */
+            show_usage_and_exit(1);
+        opt_bench_warmup = v;
+        break;
+    case 1029:
+        if (!strcasecmp(arg, "csv"))
+            opt_bench_csv = true;
+        else if (!strcasecmp(arg, "json"))
+            opt_bench_csv = false;
+        else
+            show_usage_and_exit(1);
+        break;
+    case 1030:
+        free(opt_selftest);
+        opt_selftest = strdup(arg);
+        opt_benchmark = true;
+        want_longpoll = false;
+        want_stratum = false;
+        have_stratum = false;
+        break;
     case 1003:
         want_longpoll = false;
         break;
@@ -1821,12 +3241,25 @@ static void parse_arg(int key, char *arg) {
         use_syslog = true;
         break;
     case 1020:
-        v = atoi(arg);
-        if (v < -1)
-            v = -1;
-        if (v > (1<<num_cpus)-1)
-            v = -1;
-        opt_affinity = v;
+        ul = strtoull(arg, &ep, 0);
+        if (*ep || (num_cpus < 64 && ul > (1ULL << num_cpus) - 1))
+            ul = 0;
+        opt_affinity = ul;
+        break;
+    case 1023:
+        free(cpu_order);
+        cpu_order = calloc(CPU_LIST_MAX, sizeof(*cpu_order));
+        v = parse_cpu_list(arg, cpu_order, CPU_LIST_MAX);
+        /* ids, not a count: offline cpus and sparse masks leave holes */
+        for (i = 0; i < v; i++)
+            if (cpu_order[i] >= CPU_ID_LIMIT)
+                v = -1;
+        if (v <= 0) {
+            fprintf(stderr, "%s: invalid cpu list '%s'\n", PROGRAM_NAME, arg);
+            show_usage_and_exit(1);
+        }
+        cpu_order_len = v;
+        opt_cpu_list = true;
         break;
     case 1021:
         v = atoi(arg);
@@ -1834,6 +3267,27 @@ static void parse_arg(int key, char *arg) {
             show_usage_and_exit(1);
         opt_priority = v;
         break;
+    case 1022:
+        opt_hugepages = true;
+        break;
+    case 1031:
+        opt_profile = true;
+        break;
+    case 1032:
+        free(opt_api_bind);
+        opt_api_bind = strdup(arg);
+        break;
+    case 1033:
+        /* api_control() reads at most 255 bytes of the header */
+        if (!*arg || strlen(arg) > 255)
+            show_usage_and_exit(1);
+        free(opt_api_control);
+        opt_api_control = strdup(arg);
+        break;
+    case 1034:
+        free(opt_proxy_listen);
+        opt_proxy_listen = strdup(arg);
+        break;
     case 'V':
         show_version_and_exit();
     case 'h':
@@ -1866,6 +3320,24 @@ static void parse_config(void) {
                 break;
             parse_arg(options[i].val, s);
             free(s);
+        } else if (options[i].has_arg && json_is_array(val)) {
+            /* "url": [ ... ] for failover pools, as with repeated -o */
+            size_t k;
+
+            for (k = 0; k < json_array_size(val); k++) {
+                const char *v = json_string_value(json_array_get(val, k));
+                char *s;
+
+                if (!v) {
+                    applog(LOG_ERR, "JSON option %s invalid", options[i].name);
+                    continue;
+                }
+                s = strdup(v);
+                if (!s)
+                    break;
+                parse_arg(options[i].val, s);
+                free(s);
+            }
         } else if (!options[i].has_arg && json_is_true(val))
             parse_arg(options[i].val, "");
         else
@@ -1950,6 +3422,533 @@ static bool has_aes_ni()
 #endif
 }
 
+/*
+ * --bench-suite: time the scan loop of a list of algorithms, without a
+ * pool, over a sweep of thread counts and kernel variants. Each run has
+ * a warmup period that is not counted; the per-thread rates of the
+ * measured period and the memory the run added are written to stdout as
+ * JSON or CSV, progress goes to the log.
+ */
+static const struct {
+    const char *name;
+    int kernels;
+} bench_kernel_sets[] = {
+    { "auto",   KERNEL_ALL },
+    { "scalar", 0 },
+    { "4way",   KERNEL_4WAY | KERNEL_SHA | KERNEL_AES },
+    { "8way",   KERNEL_4WAY | KERNEL_8WAY | KERNEL_SHA | KERNEL_AES },
+    { "noaes",  KERNEL_ALL & ~KERNEL_AES },
+    { "nosha",  KERNEL_ALL & ~KERNEL_SHA },
+    { NULL, 0 }
+};
+
+enum { BENCH_WARMUP, BENCH_MEASURE, BENCH_STOP };
+static volatile int bench_phase;
+
+struct bench_thr {
+    int id;
+    pthread_t pth;
+    uint64_t hashes;
+    double secs;
+};
+
+static void *bench_thread(void *userdata) {
+    struct bench_thr *bt = userdata;
+    int thr_id = bt->id;
+    uint32_t pdata[48], target[8];
+    int i;
+
+    if (num_cpus > 1)
+        affine_to_cpu(thr_id, cpu_order[thr_id % cpu_order_len]);
+
+    algo_init_contexts(&opt_algo, &opt_scrypt_n);
+
+    for (i = 0; i < 48; i++)
+        pdata[i] = 0x9e3779b9U * (i + 1) + thr_id;
+    pdata[19] = 0;
+    pdata[20] = 0x80000000;
+    memset(pdata + 21, 0, 10 * sizeof(uint32_t));
+    pdata[31] = 0x00000280;
+    /* an all zero target never gets a share */
+    memset(target, 0, sizeof(target));
+
+    while (bench_phase != BENCH_STOP) {
+        uint64_t hashes_done = 0;
+        struct timeval tv_start, tv_end, diff;
+        int phase;
+
+        /* cleared before the phase is read, see bench_set_phase() */
+        work_restart[thr_id].restart = 0;
+        phase = bench_phase;
+        gettimeofday(&tv_start, NULL);
+        if (opt_algo.scanhash)
+            opt_algo.scanhash(thr_id, pdata, target, 0xfffffff0U, &hashes_done);
+        else
+            scanhash_generic(thr_id, pdata, target, 0xfffffff0U, &hashes_done);
+        gettimeofday(&tv_end, NULL);
+        if (phase == BENCH_MEASURE) {
+            timeval_subtract(&diff, &tv_end, &tv_start);
+            bt->hashes += hashes_done;
+            bt->secs += diff.tv_sec + diff.tv_usec * 1e-6;
+        }
+        if (++pdata[19] >= 0xf0000000U)
+            pdata[19] = 0;
+    }
+
+    if (opt_algo.free_contexts) opt_algo.free_contexts(&opt_scrypt_n);
+    return NULL;
+}
+
+static void bench_set_phase(int phase, int threads) {
+    int i;
+
+    bench_phase = phase;
+    for (i = 0; i < threads; i++)
+        work_restart[i].restart = 1;
+}
+
+/* resident set size in kB, -1 when unknown */
+static long bench_rss_kb(void) {
+    long rss = -1;
+#ifdef __linux__
+    long pages;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+            rss = -1;
+        else
+            rss *= sysconf(_SC_PAGESIZE) / 1024;
+        fclose(f);
+    }
+#endif
+    return rss;
+}
+
+static json_t *bench_run(const algorithm_t *algo, int kset, int threads) {
+    struct bench_thr *bt;
+    json_t *res, *rates;
+    double total = 0., mean, var = 0., rmin = 0., rmax = 0.;
+    long rss0, rss1;
+    int i;
+
+    bt = calloc(threads, sizeof(*bt));
+    if (!bt)
+        return NULL;
+
+    opt_algo = *algo;
+    opt_kernels = bench_kernel_sets[kset].kernels;
+    opt_scrypt_n = 1024;
+    if (algo->type == ALGO_PLUCK)
+        opt_scrypt_n = 128;
+    else if (algo->type == ALGO_SCRYPTJANE)
+        opt_scrypt_n = 1388361600;
+    if (algo->type == ALGO_CRYPTONIGHT)
+        aes_ni_supported = (opt_kernels & KERNEL_AES) && has_aes_ni();
+    if (algo->type == ALGO_SHA256D)
+        sha256d_calibrate();
+
+    rss0 = bench_rss_kb();
+    bench_phase = BENCH_WARMUP;
+    for (i = 0; i < threads; i++) {
+        bt[i].id = i;
+        work_restart[i].restart = 0;
+        if (unlikely(pthread_create(&bt[i].pth, NULL, bench_thread, &bt[i]))) {
+            applog(LOG_ERR, "bench thread %d create failed", i);
+            bench_set_phase(BENCH_STOP, i);
+            while (i--)
+                pthread_join(bt[i].pth, NULL);
+            free(bt);
+            return NULL;
+        }
+    }
+    sleep(opt_bench_warmup);
+    rss1 = bench_rss_kb();
+    bench_set_phase(BENCH_MEASURE, threads);
+    sleep(opt_bench_time);
+    bench_set_phase(BENCH_STOP, threads);
+    for (i = 0; i < threads; i++)
+        pthread_join(bt[i].pth, NULL);
+
+    rates = json_array();
+    for (i = 0; i < threads; i++) {
+        double rate = bt[i].secs > 0. ? bt[i].hashes / bt[i].secs : 0.;
+        json_array_append_new(rates, json_real(rate));
+        total += rate;
+        if (!i || rate < rmin)
+            rmin = rate;
+        if (!i || rate > rmax)
+            rmax = rate;
+    }
+    mean = total / threads;
+    for (i = 0; i < threads; i++) {
+        double rate = json_real_value(json_array_get(rates, i));
+        var += (rate - mean) * (rate - mean);
+    }
+    var /= threads;
+
+    res = json_object();
+    json_object_set_new(res, "algo", json_string(algo->name));
+    json_object_set_new(res, "kernels", json_string(bench_kernel_sets[kset].name));
+    json_object_set_new(res, "threads", json_integer(threads));
+    json_object_set_new(res, "hashrate", json_real(total));
+    json_object_set_new(res, "thread_mean", json_real(mean));
+    json_object_set_new(res, "thread_stddev", json_real(sqrt(var)));
+    json_object_set_new(res, "thread_min", json_real(rmin));
+    json_object_set_new(res, "thread_max", json_real(rmax));
+    json_object_set_new(res, "thread_hashrate", rates);
+    json_object_set_new(res, "mem_kb", json_integer(rss0 < 0 || rss1 < 0 ? -1 : rss1 - rss0));
+
+    applog(LOG_INFO, "bench %s, %s kernels, %d threads: %.2f H/s (stddev %.2f per thread)",
+        algo->name, bench_kernel_sets[kset].name, threads, total, sqrt(var));
+    free(bt);
+    return res;
+}
+
+static int bench_suite(void) {
+    int counts[CPU_LIST_MAX], nthreads = 0, max_threads = 1;
+    int ksets[ARRAY_SIZE(bench_kernel_sets)], nksets = 0;
+    json_t *doc, *results;
+    char *list, *name, *save;
+    int i, k;
+
+    /* thread counts */
+    if (opt_bench_threads) {
+        nthreads = parse_cpu_list(opt_bench_threads, counts, CPU_LIST_MAX);
+        for (i = 0; i < nthreads; i++)
+            if (counts[i] < 1)
+                nthreads = -1;
+        if (nthreads <= 0) {
+            fprintf(stderr, "%s: invalid thread counts '%s'\n", PROGRAM_NAME, opt_bench_threads);
+            return 1;
+        }
+    } else {
+        counts[nthreads++] = 1;
+        if (opt_n_threads > 1)
+            counts[nthreads++] = opt_n_threads;
+    }
+    for (i = 0; i < nthreads; i++)
+        if (counts[i] > max_threads)
+            max_threads = counts[i];
+
+    /* kernel variants */
+    list = strdup(opt_bench_kernels ? opt_bench_kernels : "auto");
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        for (k = 0; bench_kernel_sets[k].name; k++)
+            if (!strcasecmp(name, bench_kernel_sets[k].name))
+                break;
+        if (!bench_kernel_sets[k].name || nksets == ARRAY_SIZE(ksets)) {
+            fprintf(stderr, "%s: unknown kernel variant '%s'\n", PROGRAM_NAME, name);
+            free(list);
+            return 1;
+        }
+        ksets[nksets++] = k;
+    }
+    free(list);
+
+    /* algorithms, checked before anything runs */
+    list = strdup(opt_bench_algos);
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        algorithm_t *algo;
+        if (!strcasecmp(name, "all"))
+            continue;
+        for (algo = algos; algo->name; algo++)
+            if (!strcasecmp(name, algo->name))
+                break;
+        if (!algo->name) {
+            fprintf(stderr, "%s: unknown algorithm '%s'\n", PROGRAM_NAME, name);
+            free(list);
+            return 1;
+        }
+    }
+    free(list);
+
+    work_restart = calloc(max_threads, sizeof(*work_restart));
+    if (!work_restart)
+        return 1;
+
+    results = json_array();
+    if (opt_bench_csv) {
+        printf("algo,kernels,threads,hashrate,thread_mean,thread_stddev,thread_min,thread_max,mem_kb\n");
+        fflush(stdout);
+    }
+    list = strdup(opt_bench_algos);
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        bool all = !strcasecmp(name, "all");
+        algorithm_t *algo;
+
+        for (algo = algos; algo->name; algo++) {
+            if (!all && strcasecmp(name, algo->name))
+                continue;
+            for (k = 0; k < nksets; k++) {
+                for (i = 0; i < nthreads; i++) {
+                    json_t *res = bench_run(algo, ksets[k], counts[i]);
+                    if (!res)
+                        continue;
+                    if (opt_bench_csv) {
+                        printf("%s,%s,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%ld\n",
+                            algo->name, bench_kernel_sets[ksets[k]].name, counts[i],
+                            json_real_value(json_object_get(res, "hashrate")),
+                            json_real_value(json_object_get(res, "thread_mean")),
+                            json_real_value(json_object_get(res, "thread_stddev")),
+                            json_real_value(json_object_get(res, "thread_min")),
+                            json_real_value(json_object_get(res, "thread_max")),
+                            (long) json_integer_value(json_object_get(res, "mem_kb")));
+                        fflush(stdout);
+                    }
+                    json_array_append_new(results, res);
+                }
+            }
+        }
+    }
+    free(list);
+
+    if (!opt_bench_csv) {
+        char *s;
+        doc = json_object();
+        json_object_set_new(doc, "version", json_string(PACKAGE_VERSION));
+        json_object_set_new(doc, "cpus", json_integer(num_cpus));
+        json_object_set_new(doc, "warmup", json_integer(opt_bench_warmup));
+        json_object_set_new(doc, "time", json_integer(opt_bench_time));
+        json_object_set(doc, "results", results);
+        s = json_dumps(doc, JSON_INDENT(2) | JSON_PRESERVE_ORDER);
+        if (s)
+            printf("%s\n", s);
+        free(s);
+        json_decref(doc);
+    }
+    json_decref(results);
+    return 0;
+}
+
+/*
+ * --selftest: check every algorithm against its known answer and every
+ * kernel variant of its scan loop against the scalar one (opt_kernels 0)
+ * on random headers. The target is easy enough for a hit every 16 hashes
+ * or so; all variants have to report the same first hit, and find it
+ * exactly once when it sits right after the end of a range.
+ */
+#define SELFTEST_ROUNDS 4
+#define SELFTEST_RANGE  4096
+/* range lengths before a hit: none a multiple of a scanner's lane count
+ * (2, 3, 4, 8, 12, 16, 24), the last one past a whole 16-lane vector */
+static const uint32_t selftest_splits[] = { 1, 2, 5, 17 };
+
+/* where the scanner of algo takes its first nonce from and leaves a hit */
+static uint32_t *selftest_nonce(const algorithm_t *algo, uint32_t *pdata) {
+    if (algo->type == ALGO_LBRY)
+        return pdata + 27;
+    if (algo->type == ALGO_CRYPTONIGHT)
+        return (uint32_t *) (((char *) pdata) + 39);
+    return pdata + 19;
+}
+
+static int selftest_scan(const algorithm_t *algo, int kernels, uint32_t *pdata,
+        const uint32_t *target, uint32_t max_nonce) {
+    uint64_t hashes_done = 0;
+    int rc;
+
+    opt_kernels = kernels;
+    if (algo->type == ALGO_CRYPTONIGHT)
+        aes_ni_supported = (kernels & KERNEL_AES) && has_aes_ni();
+    /* some algos pick their kernel in init_contexts (x11 lanes) */
+    algo_init_contexts(algo, &opt_scrypt_n);
+    work_restart[0].restart = 0;
+    if (algo->scanhash)
+        rc = algo->scanhash(0, pdata, target, max_nonce, &hashes_done);
+    else
+        rc = scanhash_generic(0, pdata, target, max_nonce, &hashes_done);
+    if (algo->free_contexts) algo->free_contexts(&opt_scrypt_n);
+    return rc;
+}
+
+/* with the proxy on, our miners keep the extranonce2 prefix bytes 0 and
+ * roll the rest, least significant first, up to the end of its range */
+static bool selftest_xnonce2(void) {
+    unsigned char coinbase[64] = { 0 }, xnonce2[8];
+    struct stratum_job job = { 0 };
+    struct coinbase_tmpl *t;
+    struct work work = { { 0 } };
+    char *listen = opt_proxy_listen;
+    bool ok = true;
+    int size;
+    size_t i, bits;
+
+    opt_proxy_listen = (char *) "selftest";
+    job.coinbase = coinbase;
+    job.coinbase_size = sizeof(coinbase);
+    job.xnonce2 = coinbase + 40;
+    work.xnonce2 = xnonce2;
+    for (size = 1; ok && size <= 8; size++) {
+        t = coinbase_tmpl_new(&job, size, sha256d, sha256d);
+        if (!t) {
+            ok = false;
+            break;
+        }
+        t->xnonce2_skip = proxy_prefix_size(size);
+        work.xnonce2_len = size;
+        ok = work_set_xnonce2(&work, t, 0xa5);
+        for (i = 0; ok && i < (size_t) size; i++)
+            ok = xnonce2[i] == (i == t->xnonce2_skip ? 0xa5 : 0);
+        /* the last of a short range, and one well past its end */
+        bits = 8 * (size - t->xnonce2_skip);
+        if (ok && bits < 32)
+            ok = work_set_xnonce2(&work, t, (1U << bits) - 1)
+                    && !work_set_xnonce2(&work, t, (1U << bits) + 1);
+        free(t);
+    }
+    opt_proxy_listen = listen;
+    return ok;
+}
+
+static int selftest(void) {
+    uint32_t ref[48], pdata[48], target[8];
+    unsigned int seed = (unsigned int) time(NULL);
+    int failed = 0, tested = 0;
+    char *list, *name, *save;
+    int i, k, r;
+
+    work_restart = calloc(1, sizeof(*work_restart));
+    if (!work_restart)
+        return 1;
+    for (i = 0; i < 7; i++)
+        target[i] = 0xffffffff;
+    target[7] = 0x0fffffff;
+    srand(seed);
+    applog(LOG_INFO, "selftest seed %u", seed);
+
+    if (!proxy_selftest() || !selftest_xnonce2()) {
+        applog(LOG_ERR, "proxy: extranonce2 prefix layout broken");
+        failed++;
+    }
+
+    list = strdup(opt_selftest);
+    for (name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        bool all = !strcasecmp(name, "all"), found = false;
+        algorithm_t *algo;
+
+        for (algo = algos; algo->name; algo++) {
+            int fails = 0, known = -1;
+            bool split_done = false;
+
+            if (!all && strcasecmp(name, algo->name))
+                continue;
+            found = true;
+            tested++;
+            opt_algo = *algo;
+
+            /* known answer, with every kernel set */
+            for (k = 0; bench_kernel_sets[k].name; k++) {
+                opt_kernels = bench_kernel_sets[k].kernels;
+                known = check_hash_test(algo);
+                if (!known) {
+                    applog(LOG_ERR, "%s: known answer mismatch with %s kernels",
+                        algo->name, bench_kernel_sets[k].name);
+                    fails++;
+                }
+                if (known < 0)
+                    break;
+            }
+
+            /* scan loop differential */
+            opt_scrypt_n = 1024;
+            if (algo->type == ALGO_PLUCK)
+                opt_scrypt_n = 128;
+            else if (algo->type == ALGO_SCRYPTJANE)
+                opt_scrypt_n = 1388361600;
+            for (r = 0; r < SELFTEST_ROUNDS; r++) {
+                uint32_t first_nonce = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+                uint32_t hit;
+                int ref_rc;
+
+                for (i = 0; i < 48; i++)
+                    ref[i] = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+                if (algo->type == ALGO_LBRY) {
+                    ref[27] = first_nonce;
+                } else {
+                    /* 80 byte header, padded the way getwork sends it */
+                    ref[19] = first_nonce;
+                    ref[20] = 0x80000000;
+                    memset(ref + 21, 0, 10 * sizeof(uint32_t));
+                    ref[31] = 0x00000280;
+                }
+                if (algo->type == ALGO_CRYPTONIGHT)
+                    memcpy(((char *) ref) + 39, &first_nonce, 4);
+                /* N grows with nTime, keep it at the chain start */
+                if (algo->type == ALGO_SCRYPTJANE)
+                    ref[17] = swab32(opt_scrypt_n);
+
+                memcpy(pdata, ref, sizeof(pdata));
+                ref_rc = selftest_scan(algo, 0, ref, target, first_nonce + SELFTEST_RANGE);
+                if (!ref_rc) {
+                    applog(LOG_WARNING, "%s: no hit in %d nonces from %08x",
+                        algo->name, SELFTEST_RANGE, first_nonce);
+                    continue;
+                }
+                hit = *selftest_nonce(algo, ref);
+                /* pluck hands its nonce back byte swapped */
+                if (algo->type == ALGO_PLUCK)
+                    hit = swab32(hit);
+                for (k = 0; bench_kernel_sets[k].name; k++) {
+                    const int kernels = bench_kernel_sets[k].kernels;
+                    uint32_t out[48], split;
+                    int rc, j;
+
+                    if (kernels) {
+                        memcpy(out, pdata, sizeof(out));
+                        rc = selftest_scan(algo, kernels, out, target, first_nonce + SELFTEST_RANGE);
+                        if (rc != ref_rc || memcmp(out, ref, sizeof(out))) {
+                            applog(LOG_ERR, "%s: %s kernels differ from scalar on round %d",
+                                algo->name, bench_kernel_sets[k].name, r);
+                            fails++;
+                        }
+                    }
+
+                    /*
+                     * Nonce chunks are handed out back to back: a scan
+                     * ending just before the hit must not run into it, or
+                     * the share goes out twice, once from each chunk. One
+                     * round covers every lane alignment, the rest is slow.
+                     */
+                    for (j = 0; !split_done && j < ARRAY_SIZE(selftest_splits); j++) {
+                        split = selftest_splits[j];
+                        if (split > hit - first_nonce)
+                            break;
+                        memcpy(out, pdata, sizeof(out));
+                        *selftest_nonce(algo, out) = hit - split;
+                        rc = selftest_scan(algo, kernels, out, target, hit - 1);
+                        memcpy(out, pdata, sizeof(out));
+                        *selftest_nonce(algo, out) = hit;
+                        if (rc || !selftest_scan(algo, kernels, out, target, hit + split)
+                                || memcmp(out, ref, sizeof(out))) {
+                            applog(LOG_ERR, "%s: %s kernels scan past max_nonce on round %d",
+                                algo->name, bench_kernel_sets[k].name, r);
+                            fails++;
+                            break;
+                        }
+                    }
+                }
+                split_done = true;
+            }
+
+            applog(fails ? LOG_ERR : LOG_INFO, "%s: %s%s", algo->name,
+                fails ? "FAILED" : "ok", known < 0 ? " (no known answer)" : "");
+            if (fails)
+                failed++;
+        }
+        if (!found) {
+            fprintf(stderr, "%s: unknown algorithm '%s'\n", PROGRAM_NAME, name);
+            failed++;
+        }
+    }
+    free(list);
+    opt_kernels = KERNEL_ALL;
+
+    applog(failed ? LOG_ERR : LOG_INFO, "selftest: %d of %d algorithms failed",
+        failed, tested);
+    return failed ? 1 : 0;
+}
+
 int main(int argc, char *argv[]) {
 	struct thr_info *thr;
 	long flags;
@@ -1996,6 +3995,16 @@ int main(int argc, char *argv[]) {
 		fprintf(stderr, "%s: no URL supplied\n", argv[0]);
 		show_usage_and_exit(1);
 	}
+	if (opt_proxy_listen && (opt_benchmark || !have_stratum || jsonrpc_2)) {
+		fprintf(stderr, "%s: --proxy-listen needs a stratum pool, and no JSON-RPC 2.0\n",
+			argv[0]);
+		show_usage_and_exit(1);
+	}
+	if (!opt_benchmark && n_urls > 1 && (n_pools != n_urls || jsonrpc_2)) {
+		fprintf(stderr, "%s: failover needs stratum URLs, and no JSON-RPC 2.0\n",
+			argv[0]);
+		show_usage_and_exit(1);
+	}
 
 	if (!rpc_userpass) {
 		rpc_userpass = malloc(strlen(rpc_user) + strlen(rpc_pass) + 2);
@@ -2006,10 +4015,11 @@ int main(int argc, char *argv[]) {
 
 	pthread_mutex_init(&applog_lock, NULL );
 	pthread_mutex_init(&stats_lock, NULL );
+	pthread_mutex_init(&status_lock, NULL );
 	pthread_mutex_init(&g_work_lock, NULL );
 	pthread_mutex_init(&rpc2_job_lock, NULL );
-	pthread_mutex_init(&stratum.sock_lock, NULL );
-	pthread_mutex_init(&stratum.work_lock, NULL );
+	pthread_mutex_init(&pool_lock, NULL );
+	pthread_cond_init(&pool_cond, NULL );
 
 	flags = !opt_benchmark && strncmp(rpc_url, "https:", 6) ?
 			(CURL_GLOBAL_ALL & ~CURL_GLOBAL_SSL) : CURL_GLOBAL_ALL;
@@ -2055,22 +4065,48 @@ int main(int argc, char *argv[]) {
 		SetPriorityClass(GetCurrentProcess(), prio);
 	}
 #endif
-	if (opt_affinity != -1) {
+	if (opt_affinity) {
 		if (!opt_quiet)
-			applog(LOG_DEBUG, "Binding process to cpu mask %x", opt_affinity);
+			applog(LOG_DEBUG, "Binding process to cpu mask %" PRIx64, opt_affinity);
 		affine_to_cpu_mask(-1, opt_affinity);
 	}
 
+	if (!opt_cpu_list) {
+		cpu_order = calloc(num_cpus, sizeof(*cpu_order));
+		cpu_order_len = build_cpu_order(cpu_order, num_cpus);
+		if (!cpu_order_len) {
+			for (i = 0; i < num_cpus; i++)
+				cpu_order[i] = i;
+			cpu_order_len = num_cpus;
+		}
+	}
+
 #ifdef HAVE_SYSLOG_H
 	if (use_syslog)
 		openlog("cpuminer", LOG_PID, LOG_USER);
 #endif
 
+	if (opt_selftest)
+		return selftest();
+	if (opt_bench_algos)
+		return bench_suite();
+
 	work_restart = calloc(opt_n_threads, sizeof(*work_restart));
 	if (!work_restart)
 		return 1;
+	/* alone, before any thread can scan or restart */
+	if (opt_algo.type == ALGO_SHA256D)
+		sha256d_calibrate();
+
+	thr_work_seq = calloc(opt_n_threads, sizeof(*thr_work_seq));
+	if (!thr_work_seq)
+		return 1;
+
+	share_rings = calloc(opt_n_threads, sizeof(*share_rings));
+	if (!share_rings)
+		return 1;
 
-	thr_info = calloc(opt_n_threads + 3, sizeof(*thr));
+	thr_info = calloc(opt_n_threads + 6, sizeof(*thr));
 	if (!thr_info)
 		return 1;
 
@@ -2078,6 +4114,16 @@ int main(int argc, char *argv[]) {
 	if (!thr_hashrates)
 		return 1;
 
+	/* before any thread starts, see prof_init() */
+	prof_init(opt_n_threads + 6);
+
+	snprintf(g_status.algo, sizeof(g_status.algo), "%s", opt_algo.name);
+	g_status.start_time = time(NULL);
+	g_status.active_threads = opt_n_threads;
+	status_set_pool(rpc_url);
+	if (opt_api_bind)
+		metrics_init(opt_n_threads + 6);
+
 	/* init workio thread info */
 	work_thr_id = opt_n_threads;
 	thr = &thr_info[work_thr_id];
@@ -2126,6 +4172,30 @@ int main(int argc, char *argv[]) {
 			tq_push(thr_info[stratum_thr_id].q, strdup(rpc_url));
 	}
 
+	if (opt_proxy_listen) {
+		/* init proxy thread info */
+		thr = &thr_info[opt_n_threads + 5];
+		thr->id = opt_n_threads + 5;
+
+		/* start proxy thread */
+		if (unlikely(pthread_create(&thr->pth, NULL, proxy_thread, thr))) {
+			applog(LOG_ERR, "proxy thread create failed");
+			return 1;
+		}
+	}
+
+	if (opt_api_bind) {
+		/* init API thread info */
+		thr = &thr_info[opt_n_threads + 3];
+		thr->id = opt_n_threads + 3;
+
+		/* start API thread */
+		if (unlikely(pthread_create(&thr->pth, NULL, api_thread, thr))) {
+			applog(LOG_ERR, "API thread create failed");
+			return 1;
+		}
+	}
+
 	/* start mining threads */
 	for (i = 0; i < opt_n_threads; i++) {
 		thr = &thr_info[i];
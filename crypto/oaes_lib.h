@@ -54,6 +54,9 @@ extern "C" {
 #define OAES_VERSION "0.8.1"
 #define OAES_BLOCK_SIZE 16
 
+// size of the expanded key for a data_len bytes key (240 for AES-256)
+#define OAES_EXP_DATA_LEN(data_len) (((data_len) / 4 + 7) * 16)
+
 typedef void OAES_CTX;
 
 typedef enum
@@ -191,6 +194,11 @@ OAES_API OAES_RET oaes_key_import( OAES_CTX * ctx,
 OAES_API OAES_RET oaes_key_import_data( OAES_CTX * ctx,
 		const uint8_t * data, size_t data_len );
 
+// expand a raw key into caller memory of OAES_EXP_DATA_LEN(data_len) bytes,
+// without allocating a context
+OAES_API OAES_RET oaes_key_expand_data( const uint8_t * data, size_t data_len,
+		uint8_t * exp_data );
+
 // set c == NULL to get the required c_len
 OAES_API OAES_RET oaes_encrypt( OAES_CTX * ctx,
 		const uint8_t * m, size_t m_len, uint8_t * c, size_t * c_len );
@@ -45,6 +45,29 @@
  * @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
  */
 int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, const uint64_t nRows, const uint64_t nCols, const int64_t BLOCK_LEN)
+{
+    uint64_t *wholeMatrix = malloc(LYRA2_MATRIX_SIZE(nRows, nCols));
+    int ret;
+
+    if (wholeMatrix == NULL) {
+        return -1;
+    }
+    ret = LYRA2_mem(K, kLen, pwd, pwdlen, salt, saltlen, timeCost, nRows, nCols, BLOCK_LEN, wholeMatrix);
+    free(wholeMatrix);
+
+    return ret;
+}
+
+/**
+ * Same as LYRA2, but works in caller-owned memory so the matrix can be
+ * reused from one hash to the next (miners keep one per thread).
+ *
+ * @param wholeMatrix At least LYRA2_MATRIX_SIZE(nRows, nCols) bytes, 8-byte aligned;
+ *                    the contents on entry do not matter
+ *
+ * @return 0 if the key is generated correctly
+ */
+int LYRA2_mem(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, const uint64_t nRows, const uint64_t nCols, const int64_t BLOCK_LEN, uint64_t *wholeMatrix)
 {
 
     //============================= Basic variables ============================//
@@ -56,32 +79,15 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     int64_t window = 2; //Visitation window (used to define which rows can be revisited during Setup)
     int64_t gap = 1; //Modifier to the step, assuming the values 1 or -1
     int64_t i; //auxiliary iteration counter
+    uint64_t *ptrWord;
     //==========================================================================/
 
-    //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
+    //==================== Pointers to the Memory Matrix =======================//
+    //Rows are contiguous, so M[r] is computed instead of kept in a pointer table
 
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
-    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
-
-    i = (int64_t)ROW_LEN_BYTES * nRows;
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
-        return -1;
-    }
-    memset(wholeMatrix, 0, i);
 
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(sizeof(uint64_t*) * nRows);
-    if (memMatrix == NULL) {
-        return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-        memMatrix[i] = ptrWord;
-        ptrWord += ROW_LEN_INT64;
-    }
+#define memMatrix(r) (wholeMatrix + (r) * ROW_LEN_INT64)
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -91,6 +97,13 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     //First, we clean enough blocks for the password, salt, basil and padding
     int64_t nBlocksInput = ((saltlen + pwdlen + 6 * sizeof(uint64_t)) / BLOCK_LEN_BLAKE2_SAFE_BYTES) + 1;
 
+    //Everything the Setup phase absorbs must start out zeroed; the rest of
+    //the matrix is always written before it is read
+    i = nBlocksInput * BLOCK_LEN * sizeof(uint64_t);
+    if (i > (int64_t) LYRA2_MATRIX_SIZE(nRows, nCols))
+        i = LYRA2_MATRIX_SIZE(nRows, nCols);
+    memset(wholeMatrix, 0, i);
+
     byte *ptrByte = (byte*) wholeMatrix;
 
     //Prepends the password
@@ -139,14 +152,14 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     }
 
     //Initializes M[0] and M[1]
-    reducedSqueezeRow0(state, memMatrix[0], nCols); //The locally copied password is most likely overwritten here
+    reducedSqueezeRow0(state, memMatrix(0), nCols); //The locally copied password is most likely overwritten here
 
-    reducedDuplexRow1(state, memMatrix[0], memMatrix[1], nCols);
+    reducedDuplexRow1(state, memMatrix(0), memMatrix(1), nCols);
 
     do {
         //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
 
-        reducedDuplexRowSetup(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+        reducedDuplexRowSetup(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
 
         //updates the value of row* (deterministically picked during Setup))
         rowa = (rowa + step) & (window - 1);
@@ -178,7 +191,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
             //------------------------------------------------------------------------------------------
 
             //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-            reducedDuplexRow(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+            reducedDuplexRow(state, memMatrix(prev), memMatrix(rowa), memMatrix(row), nCols);
 
             //update prev: it now points to the last row ever computed
             prev = row;
@@ -194,14 +207,12 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //============================ Wrap-up Phase ===============================//
     //Absorbs the last block of the memory matrix
-    absorbBlock(state, memMatrix[rowa]);
+    absorbBlock(state, memMatrix(rowa));
 
     //Squeezes the key
     squeeze(state, K, (unsigned int) kLen);
 
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
+#undef memMatrix
 
     return 0;
 }
@@ -37,6 +37,10 @@ typedef unsigned char byte;
         #define BLOCK_LEN_BYTES (BLOCK_LEN_INT64 * 8)    //Block length, in bytes
 #endif
 
+//Bytes needed for the memory matrix of LYRA2_mem
+#define LYRA2_MATRIX_SIZE(nRows, nCols) ((size_t)(nRows) * (nCols) * BLOCK_LEN_BYTES)
+
 int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, const uint64_t nRows, const uint64_t nCols, const int64_t BLOCK_LEN);
+int LYRA2_mem(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, const uint64_t nRows, const uint64_t nCols, const int64_t BLOCK_LEN, uint64_t *wholeMatrix);
 
 #endif /* LYRA2_H_ */
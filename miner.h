@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
 #include <jansson.h>
 #include <curl/curl.h>
@@ -55,6 +56,10 @@ static inline void afree(void *p) {
 #endif
 }
 
+/* large scratchpads of the memory-hard algos, huge pages when available */
+void *scratchpad_alloc(size_t size, const char *name);
+void scratchpad_free(void *p, size_t size);
+
 
 #ifdef HAVE_SYSLOG_H
 #include <syslog.h>
@@ -179,6 +184,12 @@ void sha256_init(uint32_t *state);
 void sha256_transform(uint32_t *state, const uint32_t *block, int swap);
 void sha256(unsigned char *hash, const unsigned char *data, int len);
 void sha256d(unsigned char *hash, const unsigned char *data, int len);
+void sha256_midstate(uint32_t *state, const unsigned char *data, int blocks);
+void sha256_resume(unsigned char *hash, const uint32_t *midstate, int done,
+	const unsigned char *data, int len);
+void sha256d_resume(unsigned char *hash, const uint32_t *midstate, int done,
+	const unsigned char *data, int len);
+void sha256d_calibrate(void);
 void heavy(unsigned char *hash, const unsigned char *data, int len);
 
 #ifdef USE_ASM
@@ -194,6 +205,26 @@ int sha256_use_8way();
 void sha256_init_8way(uint32_t *state);
 void sha256_transform_8way(uint32_t *state, const uint32_t *block, int swap);
 #endif
+#if defined(__x86_64__) && defined(USE_AVX512) && defined(__GNUC__) && !defined(__clang__)
+#define HAVE_SHA256_16WAY 1
+int sha256_use_16way();
+void sha256_init_16way(uint32_t *state);
+void sha256_transform_16way(uint32_t *state, const uint32_t *block, int swap);
+#endif
+#endif
+
+/* lane-parallel blake256 (r14/r8) scanning, algorithm/blake256-mway.c */
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define HAVE_BLAKE256_4WAY 1
+int blake256_use_4way();
+int scanhash_blake256_4way(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
+	uint32_t max_nonce, uint64_t *hashes_done, int rounds);
+#endif
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_BLAKE256_8WAY 1
+int blake256_use_8way();
+int scanhash_blake256_8way(int thr_id, uint32_t *pdata, const uint32_t *ptarget,
+	uint32_t max_nonce, uint64_t *hashes_done, int rounds);
 #endif
 
 extern unsigned char *scrypt_buffer_alloc(int N);
@@ -201,6 +232,7 @@ extern unsigned char *scrypt_buffer_alloc(int N);
 extern algorithm_t algos[];
 
 extern void cryptonight_hash(void* output, const void* input, size_t input_len);
+extern void cryptonight_last_hash(void* output);
 
 struct thr_info {
 	int		id;
@@ -214,6 +246,7 @@ struct work_restart {
 };
 
 extern bool opt_debug;
+extern bool opt_hugepages;
 extern bool opt_protocol;
 extern bool opt_redirect;
 extern int opt_timeout;
@@ -233,6 +266,153 @@ extern struct work_restart *work_restart;
 extern bool jsonrpc_2;
 extern bool aes_ni_supported;
 
+/*
+ * Optional kernels the algorithms may pick at runtime.  The cpu checks
+ * still apply; clearing a bit only forces the next narrower variant
+ * (the benchmark suite uses this to compare them).
+ */
+#define KERNEL_4WAY	(1 << 0)	/* 3/4-lane SSE2/NEON */
+#define KERNEL_8WAY	(1 << 1)	/* 6/8-lane AVX2 */
+#define KERNEL_16WAY	(1 << 2)	/* 16-lane AVX-512 */
+#define KERNEL_SHA	(1 << 3)	/* SHA-NI, ARMv8 SHA2 */
+#define KERNEL_AES	(1 << 4)	/* AES-NI, VAES */
+#define KERNEL_ALL	0x1f
+extern int opt_kernels;
+
+/*
+ * --profile: time spent per stage, per thread. Each thread records into
+ * its own slot (histogram plus a ring of the latest samples) without
+ * locks; prof_dump() reads them on SIGUSR1 and at exit. Ticks are the
+ * cpu time stamp counter where there is one, nanoseconds otherwise.
+ */
+enum {
+	PROF_SCANHASH,
+	PROF_WORK_LOCK,		/* waiting for g_work_lock */
+	PROF_GEN_WORK,		/* stratum_gen_work() */
+	PROF_SUBMIT,
+	PROF_ALGO,		/* first stage of a chained algo */
+	PROF_STAGES = PROF_ALGO + 16
+};
+extern bool opt_profile;
+
+void prof_init(int threads);
+void prof_thread(int id, const char *name);
+void prof_algo_stages(const char *const names[], int n);
+void prof_record(int stage, uint64_t ticks);
+void prof_dump(void);
+
+static inline uint64_t prof_ticks(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#elif defined(__GNUC__) && defined(__aarch64__)
+	uint64_t v;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (v));
+	return v;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t prof_begin(void)
+{
+	return unlikely(opt_profile) ? prof_ticks() : 0;
+}
+
+static inline void prof_end(int stage, uint64_t start)
+{
+	if (unlikely(opt_profile))
+		prof_record(stage, prof_ticks() - start);
+}
+
+/* record the time since *t and restart it, for back to back stages */
+static inline void prof_lap(int stage, uint64_t *t)
+{
+	if (unlikely(opt_profile)) {
+		uint64_t now = prof_ticks();
+		prof_record(stage, now - *t);
+		*t = now;
+	}
+}
+
+/*
+ * --api-bind: what the API thread reports. miner_status_read() takes a
+ * consistent copy without any lock the miners or pool threads use.
+ */
+struct miner_status {
+	char algo[32];
+	time_t start_time;
+	char pool[256];
+	char job_id[64];
+	double diff;
+	time_t job_time;
+	unsigned long accepted;
+	unsigned long rejected;
+	double latency_last;	/* ms from finding a share to the pool's answer */
+	double latency_sum;
+	unsigned long latency_count;
+	int active_threads;
+	bool paused;
+};
+extern char *opt_api_bind;
+extern char *opt_api_control;
+extern int opt_n_threads;
+
+void miner_status_read(struct miner_status *st);
+double miner_thr_hashrate(int thr_id);
+void miner_pause(bool pause);
+bool miner_set_threads(int n);
+bool miner_switch_pool(const char *url);
+void *api_thread(void *userdata);
+
+/*
+ * GET /metrics: latency histograms and counters in Prometheus text
+ * format. Like --profile, each thread writes to its own shard without
+ * locks and the API thread sums them, times are in microseconds of
+ * metrics_usec(). Collected only with --api-bind.
+ */
+enum {
+	MET_RESTART,	/* clean job received to all active miners on it */
+	MET_SHARE,	/* share found to the pool's answer */
+	MET_SCAN,	/* one scanhash call */
+	MET_HISTS
+};
+
+void metrics_init(int threads);
+void metrics_thread(int id);
+void metrics_observe(int hist, uint64_t usec);
+void metrics_hashes(uint64_t hashes);
+
+static inline uint64_t metrics_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * --proxy-listen: a stratum server for the other miners of the host, on
+ * the pool session of this one, see proxy.c.
+ */
+extern char *opt_proxy_listen;
+
+struct sockaddr_in;
+bool api_parse_bind(const char *s, struct sockaddr_in *sin);
+
+int proxy_prefix_size(int xnonce2_size);
+void proxy_job(int pool, const char *line, bool notify);
+void proxy_reset(int pool);
+bool proxy_answer(json_t *val);
+void *proxy_thread(void *userdata);
+bool proxy_selftest(void);
+
+/* the pool mining on, for the proxy; xnonce1 is hex, to be freed */
+bool miner_pool_session(int *pool, char **xnonce1, int *xnonce2_size,
+	const char **user);
+bool miner_pool_send(int pool, char *lines);
+
 #define JSON_RPC_LONGPOLL	(1 << 0)
 #define JSON_RPC_QUIET_404	(1 << 1)
 #define JSON_RPC_IGNOREERR  (1 << 2)
@@ -243,6 +423,7 @@ extern void applog(int prio, const char *fmt, ...);
 extern json_t *json_rpc_call(CURL *curl, const char *url, const char *userpass,
 	const char *rpc_req, int *curl_err, int flags);
 extern char *bin2hex(const unsigned char *p, size_t len);
+extern char *bin2hex_buf(char *s, const unsigned char *p, size_t len);
 extern bool hex2bin(unsigned char *p, const char *hexstr, size_t len);
 extern int timeval_subtract(struct timeval *result, struct timeval *x,
 	struct timeval *y);
@@ -257,6 +438,13 @@ struct work {
     char *job_id;
     size_t xnonce2_len;
     unsigned char *xnonce2;
+
+    /* pow hash of the share, when the scanner already computed it */
+    bool hash_valid;
+    uint32_t hash[8];
+
+    uint64_t found;     /* metrics_usec() when the share was found */
+    int pool;           /* stratum: the pool the job came from */
 };
 
 struct stratum_job {
@@ -267,7 +455,7 @@ struct stratum_job {
 	unsigned char *coinbase;
 	unsigned char *xnonce2;
 	int merkle_count;
-	unsigned char **merkle;
+	unsigned char **merkle;	/* branches follow the pointers, one free() */
 	unsigned char version[4];
 	unsigned char nbits[4];
 	unsigned char ntime[4];
@@ -275,6 +463,32 @@ struct stratum_job {
 	double diff;
 };
 
+/* see coinbase_tmpl_new() */
+struct coinbase_tmpl {
+	size_t coinbase_size;
+	size_t xnonce2_off;
+	size_t xnonce2_size;
+	size_t xnonce2_skip;	/* leading bytes left 0, see proxy_prefix_size() */
+	int merkle_count;
+	unsigned char *coinbase;
+	unsigned char (*merkle)[32];
+	void (*gen_hash)(unsigned char *, const unsigned char *, int);
+	void (*gen_hash2)(unsigned char *, const unsigned char *, int);
+	/* sha256(d) of the coinbase, from the state after midstate_len bytes;
+	 * NULL for other coinbase hashes */
+	void (*resume)(unsigned char *, const uint32_t *, int,
+		const unsigned char *, int);
+	size_t midstate_len;
+	uint32_t midstate[8];
+};
+
+struct coinbase_tmpl *coinbase_tmpl_new(const struct stratum_job *job,
+	size_t xnonce2_size,
+	void (*gen_hash)(unsigned char *, const unsigned char *, int),
+	void (*gen_hash2)(unsigned char *, const unsigned char *, int));
+void coinbase_tmpl_merkle(const struct coinbase_tmpl *t,
+	const unsigned char *xnonce2, unsigned char *merkle_root);
+
 struct stratum_ctx {
 	char *url;
 
@@ -282,11 +496,17 @@ struct stratum_ctx {
 	char *curl_url;
 	char curl_err_str[CURL_ERROR_SIZE];
 	curl_socket_t sock;
-	size_t sockbuf_size;
+	unsigned int conn_id;	/* bumped by each stratum_connect() */
+	/* received bytes, lines are cut in place: [start, end) is unread,
+	 * and there's no newline in [start, scan) */
 	char *sockbuf;
+	size_t sockbuf_size;
+	size_t sockbuf_start, sockbuf_scan, sockbuf_end;
 	pthread_mutex_t sock_lock;
 
 	double next_diff;
+	/* --proxy-listen: the last job lines of the handshake */
+	char *proxy_diff, *proxy_notify;
 
 	char *session_id;
 	size_t xnonce1_size;
@@ -299,6 +519,7 @@ struct stratum_ctx {
 
 bool stratum_socket_full(struct stratum_ctx *sctx, int timeout);
 bool stratum_send_line(struct stratum_ctx *sctx, char *s);
+/* the line stays valid until the next call or the disconnect */
 char *stratum_recv_line(struct stratum_ctx *sctx);
 bool stratum_connect(struct stratum_ctx *sctx, const char *url);
 void stratum_disconnect(struct stratum_ctx *sctx);
@@ -306,6 +527,27 @@ bool stratum_subscribe(struct stratum_ctx *sctx);
 bool subscribe_extranonce(struct stratum_ctx *sctx);
 bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *pass);
 bool stratum_handle_method(struct stratum_ctx *sctx, const char *s);
+bool stratum_handle_method_json(struct stratum_ctx *sctx, json_t *val);
+
+/*
+ * Waits for input on several pool connections at once, with epoll where
+ * there is one and select() otherwise. Only the caller reads the contexts
+ * in the set; one being connected elsewhere stays out until it is ready.
+ */
+#define STRATUM_POLL_MAX 8
+
+struct stratum_poll {
+	int epfd;		/* -1: use select() */
+	int n, next;
+	struct stratum_ctx *ctx[STRATUM_POLL_MAX];
+	unsigned int conn_id[STRATUM_POLL_MAX];	/* connection in epfd */
+};
+
+void stratum_poll_init(struct stratum_poll *p);
+bool stratum_poll_add(struct stratum_poll *p, struct stratum_ctx *sctx);
+void stratum_poll_del(struct stratum_poll *p, struct stratum_ctx *sctx);
+/* timeout in milliseconds */
+struct stratum_ctx *stratum_poll_wait(struct stratum_poll *p, int timeout);
 
 extern bool rpc2_job_decode(const json_t *job, struct work *work);
 extern bool rpc2_login_decode(const json_t *val);
@@ -319,8 +561,13 @@ extern void *tq_pop(struct thread_q *tq, const struct timespec *abstime);
 extern void tq_freeze(struct thread_q *tq);
 extern void tq_thaw(struct thread_q *tq);
 
+/* multi-result scanners: queue a share and keep scanning, see cpu-miner.c */
+bool scan_found(int thr_id, const uint32_t *pdata, uint32_t nonce);
+
 void applog_hash(void *hash);
 void format_hashrate(double hashrate, char *output);
 void print_hash_tests(void);
+void algo_init_contexts(const algorithm_t *algo, int *n);
+int check_hash_test(const algorithm_t *algo);
 
 #endif /* __MINER_H__ */
@@ -0,0 +1,636 @@
+/*
+ * --proxy-listen: a stratum server for the other miners of the host,
+ * running on the pool session of this process.
+ *
+ * Each client gets the pool's extranonce1 followed by a prefix of its own,
+ * and the rest of extranonce2 to roll; prefix 0 stays with our own miner
+ * threads, see proxy_prefix_size(). Jobs and difficulty go out exactly as
+ * the pool sent them. The shares of a round of client input go up in one
+ * write, with ids of our own, and each answer goes back to the client that
+ * found the share.
+ */
+
+#include "cpuminer-config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#include <jansson.h>
+#include <curl/curl.h>
+#include "compat.h"
+#include "miner.h"
+
+#ifdef WIN32
+#define proxy_close(s) closesocket(s)
+typedef SOCKET proxy_socket_t;
+#else
+#define proxy_close(s) close(s)
+#define INVALID_SOCKET (-1)
+typedef int proxy_socket_t;
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#ifndef MSG_DONTWAIT
+#define MSG_DONTWAIT 0
+#endif
+
+#define PROXY_CLIENTS 512
+#define PROXY_LINE_MAX 1024	/* subscribe, authorize and submit are short */
+#define PROXY_PENDING 1024	/* shares waiting for the pool, a power of 2 */
+#define PROXY_ID_BASE 1000	/* above the ids of our own requests */
+#define PROXY_BATCH (64 * 512)
+
+struct proxy_client {
+	proxy_socket_t sock;	/* INVALID_SOCKET: a free slot */
+	unsigned int gen;	/* bumped each time the slot is freed */
+	unsigned int prefix;	/* 0 until subscribed */
+	bool authorized;
+	size_t len;
+	char buf[PROXY_LINE_MAX];
+};
+
+struct proxy_pending {
+	int id;			/* ours, 0: free */
+	int client;
+	unsigned int gen;
+	json_t *cid;		/* the client's */
+};
+
+/* all under proxy_lock */
+static pthread_mutex_t proxy_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct proxy_client *clients;
+static int n_clients;		/* slots in use are below */
+static struct proxy_pending pending[PROXY_PENDING];
+static int next_id = PROXY_ID_BASE;
+static unsigned int next_prefix;
+static int session_pool = -1;	/* the clients' pool */
+/* the last difficulty and job line of each pool, with the newline */
+static char *last_diff[STRATUM_POLL_MAX];
+static char *last_notify[STRATUM_POLL_MAX];
+
+/* the leading extranonce2 bytes that tell clients apart */
+static int prefix_bytes(int xnonce2_size)
+{
+	return xnonce2_size >= 4 ? 2 : xnonce2_size >= 2 ? 1 : 0;
+}
+
+/* with the proxy on, prefix_bytes(); our miners leave them 0 */
+int proxy_prefix_size(int xnonce2_size)
+{
+	if (!opt_proxy_listen)
+		return 0;
+	return prefix_bytes(xnonce2_size);
+}
+
+/*
+ * head, the k prefix bytes most significant first, then tail, in hex. The
+ * client's extranonce1 is the pool's with the prefix, and the pool's
+ * extranonce2 is the prefix with the client's: the coinbase is the same
+ * bytes either way. Returns the length like snprintf().
+ */
+static int prefix_cat(char *s, size_t size, const char *head, int k,
+	unsigned int prefix, const char *tail)
+{
+	return snprintf(s, size, "%s%0*x%s", head, 2 * k, prefix, tail);
+}
+
+/* the prefix to try after p, in 1 .. range - 1 */
+static unsigned int prefix_next(unsigned int p, unsigned int range)
+{
+	return p + 1 < range ? p + 1 : 1;
+}
+
+static void proxy_drop(int i)
+{
+	struct proxy_client *c = &clients[i];
+
+	if (c->sock == INVALID_SOCKET)
+		return;
+	proxy_close(c->sock);
+	c->sock = INVALID_SOCKET;
+	c->gen++;
+	c->prefix = 0;
+	c->authorized = false;
+	c->len = 0;
+	while (n_clients && clients[n_clients - 1].sock == INVALID_SOCKET)
+		n_clients--;
+}
+
+/* a client that can't take a line right away falls behind: drop it */
+static void proxy_send(int i, const char *s, size_t len)
+{
+	if (send(clients[i].sock, s, len, MSG_NOSIGNAL | MSG_DONTWAIT)
+			!= (ssize_t) len)
+		proxy_drop(i);
+}
+
+/* {"id": id, "result": result, "error": error}, stealing the last two */
+static void proxy_reply(int i, json_t *id, json_t *result, json_t *error)
+{
+	json_t *val = json_object();
+	char *s, *line;
+	size_t len;
+
+	json_object_set(val, "id", id ? id : json_null());
+	json_object_set_new(val, "result", result ? result : json_null());
+	json_object_set_new(val, "error", error ? error : json_null());
+	s = json_dumps(val, JSON_COMPACT);
+	json_decref(val);
+	if (!s)
+		return;
+	len = strlen(s);
+	line = realloc(s, len + 2);
+	if (!line) {
+		free(s);
+		return;
+	}
+	memcpy(line + len, "\n", 2);
+	proxy_send(i, line, len + 1);
+	free(line);
+}
+
+static void proxy_error(int i, json_t *id, int code, const char *msg)
+{
+	json_t *err = json_array();
+
+	json_array_append_new(err, json_integer(code));
+	json_array_append_new(err, json_string(msg));
+	json_array_append_new(err, json_null());
+	proxy_reply(i, id, NULL, err);
+}
+
+static void proxy_subscribe(int i, json_t *id)
+{
+	struct proxy_client *c = &clients[i];
+	json_t *res, *subs, *sub;
+	char *xnonce1, *xn1, sid[16];
+	const char *user;
+	int pool, xn2_size, k, j, tries;
+	unsigned int range;
+	size_t len;
+
+	if (!miner_pool_session(&pool, &xnonce1, &xn2_size, &user)) {
+		proxy_error(i, id, 20, "No pool");
+		return;
+	}
+	k = proxy_prefix_size(xn2_size);
+	if (!k || pool != session_pool) {
+		free(xnonce1);
+		proxy_error(i, id, 20, k ? "Pool changing" : "Extranonce2 too short");
+		return;
+	}
+
+	/* a prefix no other client holds, 0 is ours */
+	range = 1U << (8 * k);
+	for (tries = 0; !c->prefix && tries < (int) range; tries++) {
+		next_prefix = prefix_next(next_prefix, range);
+		for (j = 0; j < n_clients && clients[j].prefix != next_prefix; j++)
+			;
+		if (j == n_clients)
+			c->prefix = next_prefix;
+	}
+	if (!c->prefix) {
+		free(xnonce1);
+		proxy_error(i, id, 20, "No extranonce left");
+		return;
+	}
+
+	len = strlen(xnonce1) + 2 * k + 1;
+	xn1 = malloc(len);
+	if (!xn1) {
+		free(xnonce1);
+		proxy_error(i, id, 20, "Out of memory");
+		return;
+	}
+	prefix_cat(xn1, len, xnonce1, k, c->prefix, "");
+	free(xnonce1);
+	snprintf(sid, sizeof(sid), "%x", c->prefix);
+
+	subs = json_array();
+	sub = json_array();
+	json_array_append_new(sub, json_string("mining.set_difficulty"));
+	json_array_append_new(sub, json_string(sid));
+	json_array_append_new(subs, sub);
+	sub = json_array();
+	json_array_append_new(sub, json_string("mining.notify"));
+	json_array_append_new(sub, json_string(sid));
+	json_array_append_new(subs, sub);
+	res = json_array();
+	json_array_append_new(res, subs);
+	json_array_append_new(res, json_string(xn1));
+	json_array_append_new(res, json_integer(xn2_size - k));
+	free(xn1);
+	proxy_reply(i, id, res, NULL);
+}
+
+static void proxy_authorize(int i, json_t *id)
+{
+	unsigned int gen = clients[i].gen;
+
+	/* the pool only knows our user, anyone local may mine on it */
+	proxy_reply(i, id, json_true(), NULL);
+	if (clients[i].gen != gen)
+		return;
+	clients[i].authorized = true;
+	if (session_pool < 0)
+		return;
+	if (last_diff[session_pool])
+		proxy_send(i, last_diff[session_pool], strlen(last_diff[session_pool]));
+	if (clients[i].gen == gen && last_notify[session_pool])
+		proxy_send(i, last_notify[session_pool],
+			strlen(last_notify[session_pool]));
+}
+
+/* goes into a JSON string as it is */
+static bool proxy_plain(const char *s, bool hex)
+{
+	if (!s || !*s || strlen(s) > 128)
+		return false;
+	for (; *s; s++)
+		if (hex ? !isxdigit((unsigned char) *s)
+				: (*s == '"' || *s == '\\' || !isgraph((unsigned char) *s)))
+			return false;
+	return true;
+}
+
+/* queue the share for the pool in batch, answered in proxy_answer() */
+static void proxy_submit(int i, json_t *id, json_t *params, char *batch,
+	size_t *blen)
+{
+	struct proxy_client *c = &clients[i];
+	const char *job, *xn2, *ntime, *nonce, *user;
+	char *xnonce1, up[PROXY_LINE_MAX + 8];
+	struct proxy_pending *p;
+	int pool, xn2_size, k, n;
+
+	job = json_string_value(json_array_get(params, 1));
+	xn2 = json_string_value(json_array_get(params, 2));
+	ntime = json_string_value(json_array_get(params, 3));
+	nonce = json_string_value(json_array_get(params, 4));
+	if (!c->prefix || !c->authorized) {
+		proxy_error(i, id, 24, "Unauthorized worker");
+		return;
+	}
+	if (!miner_pool_session(&pool, &xnonce1, &xn2_size, &user)
+			|| pool != session_pool) {
+		proxy_error(i, id, 21, "Job not found");
+		return;
+	}
+	free(xnonce1);
+	k = proxy_prefix_size(xn2_size);
+	if (!proxy_plain(job, false) || !proxy_plain(xn2, true)
+			|| !proxy_plain(ntime, true) || !proxy_plain(nonce, true)
+			|| (int) strlen(xn2) != 2 * (xn2_size - k)
+			|| (*user && !proxy_plain(user, false))) {
+		proxy_error(i, id, 20, "Invalid share");
+		return;
+	}
+
+	/* xn2 came in a line, it fits */
+	prefix_cat(up, sizeof(up), "", k, c->prefix, xn2);
+	n = snprintf(batch + *blen, PROXY_BATCH - *blen,
+		"{\"method\": \"mining.submit\", \"params\": [\"%s\", \"%s\", \"%s\", \"%s\", \"%s\"], \"id\":%d}\n",
+		user, job, up, ntime, nonce, next_id);
+	if (n < 0 || (size_t) n >= PROXY_BATCH - *blen) {
+		batch[*blen] = '\0';
+		proxy_error(i, id, 20, "Busy");
+		return;
+	}
+	*blen += n;
+
+	/* a slot still taken is a share the pool never answered */
+	p = &pending[next_id & (PROXY_PENDING - 1)];
+	if (p->id)
+		json_decref(p->cid);
+	p->id = next_id;
+	p->client = i;
+	p->gen = c->gen;
+	p->cid = json_incref(id ? id : json_null());
+	next_id = next_id < INT_MAX - 1 ? next_id + 1 : PROXY_ID_BASE;
+}
+
+static void proxy_line(int i, char *line, char *batch, size_t *blen)
+{
+	json_t *val, *id;
+	json_error_t err;
+	const char *method;
+
+	if (opt_protocol)
+		applog(LOG_DEBUG, "proxy %d< %s", i, line);
+	val = JSON_LOADS(line, &err);
+	if (!val) {
+		proxy_drop(i);
+		return;
+	}
+	id = json_object_get(val, "id");
+	method = json_string_value(json_object_get(val, "method"));
+	if (!method) {
+		json_decref(val);	/* an answer, but we ask nothing */
+		return;
+	}
+	if (!strcmp(method, "mining.subscribe"))
+		proxy_subscribe(i, id);
+	else if (!strcmp(method, "mining.authorize"))
+		proxy_authorize(i, id);
+	else if (!strcmp(method, "mining.extranonce.subscribe"))
+		proxy_reply(i, id, json_true(), NULL);	/* the session never changes */
+	else if (!strcmp(method, "mining.submit"))
+		proxy_submit(i, id, json_object_get(val, "params"), batch, blen);
+	else
+		proxy_error(i, id, 20, "Unsupported method");
+	json_decref(val);
+}
+
+/*
+ * --selftest: the client's extranonce1 and extranonce2 and the pool's
+ * extranonce2 put the same bytes in the coinbase, with the prefix most
+ * significant first at the start of the pool's extranonce2, and 0 (our
+ * miners') never given out.
+ */
+bool proxy_selftest(void)
+{
+	static const char xnonce1[] = "f8002c90";
+	unsigned char pool_cb[32], client_cb[32];
+	/* extranonce2 is 8 bytes at most, the prefix as wide as %x prints */
+	char xn1[sizeof(xnonce1) + 8], xn2[2 * 8 + 1], up[2 * 8 + 8 + 1];
+	int size, k, j;
+	unsigned int prefix, range, value;
+
+	for (size = 1; size <= 8; size++) {
+		k = prefix_bytes(size);
+		if (size >= 2 && (k < 1 || k >= size))
+			return false;
+		range = 1U << (8 * k);
+		for (prefix = 1; k && prefix < range; prefix = prefix * 5 + 3) {
+			for (j = 0; j < size - k; j++)
+				sprintf(xn2 + 2 * j, "%02x", 0xa0 + j);
+			prefix_cat(xn1, sizeof(xn1), xnonce1, k, prefix, "");
+			prefix_cat(up, sizeof(up), "", k, prefix, xn2);
+			if ((int) strlen(up) != 2 * size
+					|| !hex2bin(client_cb, xn1, 4 + k)
+					|| !hex2bin(client_cb + 4 + k, xn2, size - k)
+					|| !hex2bin(pool_cb, xnonce1, 4)
+					|| !hex2bin(pool_cb + 4, up, size)
+					|| memcmp(client_cb, pool_cb, 4 + size))
+				return false;
+			for (value = 0, j = 0; j < k; j++)
+				value = value << 8 | pool_cb[4 + j];
+			if (value != prefix)
+				return false;
+		}
+	}
+
+	/* prefix_next() goes round all of the range but 0 */
+	for (prefix = 0, j = 0; j < 2 * 256; j++) {
+		prefix = prefix_next(prefix, 1U << 8);
+		if (!prefix || prefix >= 1U << 8 || (j < 255 && prefix != (unsigned int) j + 1))
+			return false;
+	}
+	return true;
+}
+
+/* stratum thread: a difficulty or job line of pool */
+void proxy_job(int pool, const char *line, bool notify)
+{
+	char **last = notify ? &last_notify[pool] : &last_diff[pool];
+	size_t len = strlen(line);
+	int i;
+
+	if (!opt_proxy_listen || pool < 0 || pool >= STRATUM_POLL_MAX)
+		return;
+	pthread_mutex_lock(&proxy_lock);
+	free(*last);
+	*last = malloc(len + 2);
+	if (*last) {
+		memcpy(*last, line, len);
+		memcpy(*last + len, "\n", 2);
+	}
+	if (clients && pool == session_pool && *last)
+		for (i = 0; i < n_clients; i++)
+			if (clients[i].sock != INVALID_SOCKET && clients[i].authorized)
+				proxy_send(i, *last, len + 1);
+	pthread_mutex_unlock(&proxy_lock);
+}
+
+/* stratum thread: the clients move to a new session on pool, -1 none */
+void proxy_reset(int pool)
+{
+	int i, n = 0;
+
+	if (!opt_proxy_listen)
+		return;
+	pthread_mutex_lock(&proxy_lock);
+	for (i = 0; clients && i < n_clients; i++) {
+		if (clients[i].sock != INVALID_SOCKET)
+			n++;
+		proxy_drop(i);
+	}
+	for (i = 0; i < PROXY_PENDING; i++) {
+		if (pending[i].id)
+			json_decref(pending[i].cid);
+		pending[i].id = 0;
+	}
+	session_pool = pool;
+	pthread_mutex_unlock(&proxy_lock);
+	if (n)
+		applog(LOG_NOTICE, "Proxy: pool session changed, %d clients to subscribe again", n);
+}
+
+/* stratum thread: true if val is the pool's answer to a client's share */
+bool proxy_answer(json_t *val)
+{
+	json_t *id = json_object_get(val, "id"), *res, *err;
+	struct proxy_pending *p;
+	int v;
+
+	if (!opt_proxy_listen || !json_is_integer(id)
+			|| (v = json_integer_value(id)) < PROXY_ID_BASE)
+		return false;
+	res = json_object_get(val, "result");
+	err = json_object_get(val, "error");
+	pthread_mutex_lock(&proxy_lock);
+	p = &pending[v & (PROXY_PENDING - 1)];
+	if (p->id == v) {
+		if (clients && clients[p->client].gen == p->gen
+				&& clients[p->client].sock != INVALID_SOCKET)
+			proxy_reply(p->client, p->cid,
+				res ? json_incref(res) : NULL,
+				err ? json_incref(err) : NULL);
+		json_decref(p->cid);
+		p->id = 0;
+	}
+	pthread_mutex_unlock(&proxy_lock);
+	if (opt_debug)
+		applog(LOG_DEBUG, "Proxy: share %d %s", v,
+			json_is_true(res) ? "accepted" : "rejected");
+	return true;
+}
+
+/* false if accept() failed, out of descriptors (EMFILE) most likely */
+static bool proxy_accept(proxy_socket_t sock)
+{
+	proxy_socket_t c = accept(sock, NULL, NULL);
+	int i;
+
+	if (c == INVALID_SOCKET)
+		return false;
+#ifndef WIN32
+	if (c >= FD_SETSIZE) {
+		proxy_close(c);
+		return true;
+	}
+#endif
+	for (i = 0; i < PROXY_CLIENTS && clients[i].sock != INVALID_SOCKET; i++)
+		;
+	if (i == PROXY_CLIENTS) {
+		applog(LOG_WARNING, "Proxy: %d clients already", PROXY_CLIENTS);
+		proxy_close(c);
+		return true;
+	}
+	clients[i].sock = c;
+	if (i >= n_clients)
+		n_clients = i + 1;
+	return true;
+}
+
+/* take in what client i sent, each line as it completes */
+static void proxy_read(int i, char *batch, size_t *blen)
+{
+	struct proxy_client *c = &clients[i];
+	unsigned int gen = c->gen;
+	char *nl, *line;
+	ssize_t n;
+
+	n = recv(c->sock, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+	if (n <= 0) {
+		proxy_drop(i);
+		return;
+	}
+	c->len += n;
+	c->buf[c->len] = '\0';
+	line = c->buf;
+	while (c->gen == gen && (nl = strchr(line, '\n'))) {
+		*nl = '\0';
+		if (nl > line && nl[-1] == '\r')
+			nl[-1] = '\0';
+		if (*line)
+			proxy_line(i, line, batch, blen);
+		line = nl + 1;
+	}
+	if (c->gen != gen)
+		return;
+	c->len -= line - c->buf;
+	memmove(c->buf, line, c->len + 1);
+	if (c->len == sizeof(c->buf) - 1)
+		proxy_drop(i);	/* no newline in sight */
+}
+
+void *proxy_thread(void *userdata)
+{
+	struct thr_info *mythr = userdata;
+	struct sockaddr_in sin;
+	proxy_socket_t sock;
+	static char batch[PROXY_BATCH];
+	time_t accept_pause = 0;
+	int one = 1, i;
+
+	prof_thread(mythr->id, "proxy");
+	metrics_thread(mythr->id);
+
+	if (!api_parse_bind(opt_proxy_listen, &sin)) {
+		applog(LOG_ERR, "Proxy: invalid --proxy-listen '%s'", opt_proxy_listen);
+		return NULL;
+	}
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET) {
+		applog(LOG_ERR, "Proxy: socket() failed");
+		return NULL;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *) &one,
+		sizeof(one));
+	if (bind(sock, (struct sockaddr *) &sin, sizeof(sin)) < 0
+			|| listen(sock, 64) < 0) {
+		applog(LOG_ERR, "Proxy: cannot listen on %s", opt_proxy_listen);
+		proxy_close(sock);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&proxy_lock);
+	clients = calloc(PROXY_CLIENTS, sizeof(*clients));
+	for (i = 0; clients && i < PROXY_CLIENTS; i++)
+		clients[i].sock = INVALID_SOCKET;
+	pthread_mutex_unlock(&proxy_lock);
+	if (!clients) {
+		applog(LOG_ERR, "Proxy: out of memory");
+		proxy_close(sock);
+		return NULL;
+	}
+	applog(LOG_INFO, "Proxy listening on %s:%d", inet_ntoa(sin.sin_addr),
+		ntohs(sin.sin_port));
+
+	while (1) {
+		struct timeval tv = { 1, 0 };
+		proxy_socket_t maxfd = sock;
+		size_t blen = 0;
+		int pool = -1;
+		fd_set rd;
+
+		/* after a failed accept() the pending connection stays, and so
+		 * does the readable listen socket: leave it for a second */
+		FD_ZERO(&rd);
+		if (time(NULL) >= accept_pause)
+			FD_SET(sock, &rd);
+		pthread_mutex_lock(&proxy_lock);
+		for (i = 0; i < n_clients; i++) {
+			if (clients[i].sock == INVALID_SOCKET)
+				continue;
+			FD_SET(clients[i].sock, &rd);
+			if (clients[i].sock > maxfd)
+				maxfd = clients[i].sock;
+		}
+		pthread_mutex_unlock(&proxy_lock);
+		if (select(maxfd + 1, &rd, NULL, NULL, &tv) <= 0)
+			continue;
+
+		/* a round of input, the shares in it go up together */
+		pthread_mutex_lock(&proxy_lock);
+		for (i = 0; i < n_clients; i++)
+			if (clients[i].sock != INVALID_SOCKET
+					&& FD_ISSET(clients[i].sock, &rd))
+				proxy_read(i, batch, &blen);
+		if (FD_ISSET(sock, &rd) && !proxy_accept(sock)) {
+			if (!accept_pause)
+				applog(LOG_WARNING, "Proxy: accept() failed, "
+					"pausing new clients");
+			accept_pause = time(NULL) + 1;
+		} else if (FD_ISSET(sock, &rd))
+			accept_pause = 0;
+		pool = session_pool;
+		pthread_mutex_unlock(&proxy_lock);
+
+		if (blen) {
+			batch[blen - 1] = '\0';	/* stratum_send_line() adds it */
+			if (!miner_pool_send(pool, batch))
+				applog(LOG_ERR, "Proxy: sending shares to the pool failed");
+		}
+	}
+
+	return NULL;
+}
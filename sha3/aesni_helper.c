@@ -0,0 +1,52 @@
+/*
+ * AES-NI / VAES runtime support for the AES based hash functions
+ * (ECHO, SHAvite-3, Groestl). This file is not meant to be compiled by
+ * itself; it is included by those implementations.
+ *
+ * The accelerated compression functions are built with target pragmas
+ * so the including file keeps the default compiler flags, and the
+ * portable table code stays the fallback. sph_aesni_level() tells which
+ * variant the running cpu can use; the cpu check is done once per file,
+ * clearing KERNEL_AES in opt_kernels falls back to the tables.
+ */
+
+#if defined(__GNUC__) && !defined(__clang__) && \
+	(defined(__x86_64__) || defined(__i386__))
+
+#define SPH_AESNI        1
+
+#define SPH_AESNI_NONE   0
+#define SPH_AESNI_AES    1   /* 128-bit AES-NI + SSSE3 */
+#define SPH_AESNI_VAES   2   /* 256-bit VAES + AVX2 */
+
+#include <immintrin.h>
+
+#include "miner.h"
+
+static int sph_aesni_cached = -1;
+
+static int
+sph_aesni_level(void)
+{
+	int level = sph_aesni_cached;
+
+	if (level < 0) {
+		level = SPH_AESNI_NONE;
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("aes")
+			&& __builtin_cpu_supports("ssse3")) {
+			level = SPH_AESNI_AES;
+			if (__builtin_cpu_supports("vaes")
+				&& __builtin_cpu_supports("avx2"))
+				level = SPH_AESNI_VAES;
+		}
+		sph_aesni_cached = level;
+	}
+	return (opt_kernels & KERNEL_AES) ? level : SPH_AESNI_NONE;
+}
+
+#else
+
+#define SPH_AESNI        0
+
+#endif
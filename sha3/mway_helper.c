@@ -0,0 +1,701 @@
+/*
+ * Lane-parallel X11 stage kernels.
+ *
+ * This file is included from sph_mway.c once per lane count, with
+ * MWAY_LANES and MWAY(name) defined, and is not meant to be compiled
+ * independently. Every vector element holds the same state word of a
+ * different lane; the code mirrors the sph_*512 reference
+ * implementations for a fixed 64-byte (80 for blake) message.
+ */
+
+typedef sph_u64 MWAY(v64) __attribute__ ((vector_size (MWAY_LANES * 8)));
+typedef sph_u32 MWAY(v32) __attribute__ ((vector_size (MWAY_LANES * 4)));
+
+#define V64          MWAY(v64)
+#define V32          MWAY(v32)
+#define ZERO64       ((V64){ 0 })
+#define ZERO32       ((V32){ 0 })
+#define SPLAT64(c)   (ZERO64 + (sph_u64)(c))
+#define SPLAT32(c)   (ZERO32 + (sph_u32)(c))
+#define ROL64(x, n)  (((x) << (n)) | ((x) >> (64 - (n))))
+#define ROR64(x, n)  (((x) >> (n)) | ((x) << (64 - (n))))
+#define ROL32(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* lane-major <-> word-sliced */
+#define GATHER(v, w, expr)   do { \
+		int l_; \
+		for (l_ = 0; l_ < MWAY_LANES; l_ ++) \
+			(v)[l_] = expr(l_, w); \
+	} while (0)
+
+#define H64LE(l, w)   sph_dec64le_aligned(hash[l] + (w))
+#define H32LE(l, w)   sph_dec32le_aligned((const unsigned char *)hash[l] + 4 * (w))
+#define H32BE(l, w)   sph_dec32be_aligned((const unsigned char *)hash[l] + 4 * (w))
+
+static void
+MWAY(store64le)(uint64_t hash[][8], const V64 *h)
+{
+	int w, l;
+
+	for (w = 0; w < 8; w ++)
+		for (l = 0; l < MWAY_LANES; l ++)
+			sph_enc64le_aligned(hash[l] + w, h[w][l]);
+}
+
+/* ---------------------------------------------------------------- */
+/* blake512, single 128-byte block holding the 80-byte header */
+
+#define MW_GB(a, b, c, d, i0, i1)   do { \
+		a += b + (M[i0] ^ mw_blake_cb[i1]); \
+		d = ROR64(d ^ a, 32); \
+		c += d; \
+		b = ROR64(b ^ c, 25); \
+		a += b + (M[i1] ^ mw_blake_cb[i0]); \
+		d = ROR64(d ^ a, 16); \
+		c += d; \
+		b = ROR64(b ^ c, 11); \
+	} while (0)
+
+static void
+MWAY(blake512_80)(uint64_t hash[][8], const void *const in[])
+{
+	V64 M[16], V[16];
+	int r, w, l;
+
+	for (w = 0; w < 10; w ++)
+		for (l = 0; l < MWAY_LANES; l ++)
+			M[w][l] = sph_dec64be((const unsigned char *)in[l] + 8 * w);
+	M[10] = SPLAT64(0x8000000000000000);
+	M[11] = ZERO64;
+	M[12] = ZERO64;
+	M[13] = SPLAT64(1);
+	M[14] = ZERO64;
+	M[15] = SPLAT64(640);
+
+	for (w = 0; w < 8; w ++)
+		V[w] = SPLAT64(mw_blake_iv[w]);
+	for (w = 0; w < 4; w ++)
+		V[8 + w] = SPLAT64(mw_blake_cb[w]);
+	V[12] = SPLAT64(640 ^ mw_blake_cb[4]);
+	V[13] = SPLAT64(640 ^ mw_blake_cb[5]);
+	V[14] = SPLAT64(mw_blake_cb[6]);
+	V[15] = SPLAT64(mw_blake_cb[7]);
+
+	for (r = 0; r < 16; r ++) {
+		const unsigned char *s = mw_blake_sigma[r];
+
+		MW_GB(V[0], V[4], V[ 8], V[12], s[ 0], s[ 1]);
+		MW_GB(V[1], V[5], V[ 9], V[13], s[ 2], s[ 3]);
+		MW_GB(V[2], V[6], V[10], V[14], s[ 4], s[ 5]);
+		MW_GB(V[3], V[7], V[11], V[15], s[ 6], s[ 7]);
+		MW_GB(V[0], V[5], V[10], V[15], s[ 8], s[ 9]);
+		MW_GB(V[1], V[6], V[11], V[12], s[10], s[11]);
+		MW_GB(V[2], V[7], V[ 8], V[13], s[12], s[13]);
+		MW_GB(V[3], V[4], V[ 9], V[14], s[14], s[15]);
+	}
+
+	for (w = 0; w < 8; w ++) {
+		V64 h = V[w] ^ V[w + 8] ^ mw_blake_iv[w];
+
+		for (l = 0; l < MWAY_LANES; l ++)
+			sph_enc64be_aligned(hash[l] + w, h[l]);
+	}
+}
+
+#undef MW_GB
+
+/* ---------------------------------------------------------------- */
+/* bmw512 */
+
+#define MW_SB0(x)   (((x) >> 1) ^ ((x) << 3) ^ ROL64(x,  4) ^ ROL64(x, 37))
+#define MW_SB1(x)   (((x) >> 1) ^ ((x) << 2) ^ ROL64(x, 13) ^ ROL64(x, 43))
+#define MW_SB2(x)   (((x) >> 2) ^ ((x) << 1) ^ ROL64(x, 19) ^ ROL64(x, 53))
+#define MW_SB3(x)   (((x) >> 2) ^ ((x) << 2) ^ ROL64(x, 28) ^ ROL64(x, 59))
+#define MW_SB4(x)   (((x) >> 1) ^ (x))
+#define MW_SB5(x)   (((x) >> 2) ^ (x))
+
+#define MW_MH(i)   (M[i] ^ H[i])
+
+#define MW_ELT(j)   (((ROL64(M[(j) & 15], ((j) & 15) + 1) \
+		+ ROL64(M[((j) + 3) & 15], (((j) + 3) & 15) + 1) \
+		- ROL64(M[((j) + 10) & 15], (((j) + 10) & 15) + 1)) \
+		+ (sph_u64)((j) + 16) * SPH_C64(0x0555555555555555)) \
+		^ H[((j) + 7) & 15])
+
+static void
+MWAY(bmw512_compress)(V64 *dh, const V64 *M, const V64 *H)
+{
+	V64 W[16], Q[32], xl, xh;
+	int i;
+
+	W[ 0] = MW_MH( 5) - MW_MH( 7) + MW_MH(10) + MW_MH(13) + MW_MH(14);
+	W[ 1] = MW_MH( 6) - MW_MH( 8) + MW_MH(11) + MW_MH(14) - MW_MH(15);
+	W[ 2] = MW_MH( 0) + MW_MH( 7) + MW_MH( 9) - MW_MH(12) + MW_MH(15);
+	W[ 3] = MW_MH( 0) - MW_MH( 1) + MW_MH( 8) - MW_MH(10) + MW_MH(13);
+	W[ 4] = MW_MH( 1) + MW_MH( 2) + MW_MH( 9) - MW_MH(11) - MW_MH(14);
+	W[ 5] = MW_MH( 3) - MW_MH( 2) + MW_MH(10) - MW_MH(12) + MW_MH(15);
+	W[ 6] = MW_MH( 4) - MW_MH( 0) - MW_MH( 3) - MW_MH(11) + MW_MH(13);
+	W[ 7] = MW_MH( 1) - MW_MH( 4) - MW_MH( 5) - MW_MH(12) - MW_MH(14);
+	W[ 8] = MW_MH( 2) - MW_MH( 5) - MW_MH( 6) + MW_MH(13) - MW_MH(15);
+	W[ 9] = MW_MH( 0) - MW_MH( 3) + MW_MH( 6) - MW_MH( 7) + MW_MH(14);
+	W[10] = MW_MH( 8) - MW_MH( 1) - MW_MH( 4) - MW_MH( 7) + MW_MH(15);
+	W[11] = MW_MH( 8) - MW_MH( 0) - MW_MH( 2) - MW_MH( 5) + MW_MH( 9);
+	W[12] = MW_MH( 1) + MW_MH( 3) - MW_MH( 6) - MW_MH( 9) + MW_MH(10);
+	W[13] = MW_MH( 2) + MW_MH( 4) + MW_MH( 7) + MW_MH(10) + MW_MH(11);
+	W[14] = MW_MH( 3) - MW_MH( 5) + MW_MH( 8) - MW_MH(11) - MW_MH(12);
+	W[15] = MW_MH(12) - MW_MH( 4) - MW_MH( 6) - MW_MH( 9) + MW_MH(13);
+
+	for (i = 0; i < 15; i += 5) {
+		Q[i + 0] = MW_SB0(W[i + 0]) + H[i + 1];
+		Q[i + 1] = MW_SB1(W[i + 1]) + H[i + 2];
+		Q[i + 2] = MW_SB2(W[i + 2]) + H[i + 3];
+		Q[i + 3] = MW_SB3(W[i + 3]) + H[i + 4];
+		Q[i + 4] = MW_SB4(W[i + 4]) + H[i + 5];
+	}
+	Q[15] = MW_SB0(W[15]) + H[0];
+
+	for (i = 16; i < 18; i ++)
+		Q[i] = MW_SB1(Q[i - 16]) + MW_SB2(Q[i - 15])
+			+ MW_SB3(Q[i - 14]) + MW_SB0(Q[i - 13])
+			+ MW_SB1(Q[i - 12]) + MW_SB2(Q[i - 11])
+			+ MW_SB3(Q[i - 10]) + MW_SB0(Q[i - 9])
+			+ MW_SB1(Q[i - 8]) + MW_SB2(Q[i - 7])
+			+ MW_SB3(Q[i - 6]) + MW_SB0(Q[i - 5])
+			+ MW_SB1(Q[i - 4]) + MW_SB2(Q[i - 3])
+			+ MW_SB3(Q[i - 2]) + MW_SB0(Q[i - 1])
+			+ MW_ELT(i - 16);
+	for (i = 18; i < 32; i ++)
+		Q[i] = Q[i - 16] + ROL64(Q[i - 15], 5)
+			+ Q[i - 14] + ROL64(Q[i - 13], 11)
+			+ Q[i - 12] + ROL64(Q[i - 11], 27)
+			+ Q[i - 10] + ROL64(Q[i - 9], 32)
+			+ Q[i - 8] + ROL64(Q[i - 7], 37)
+			+ Q[i - 6] + ROL64(Q[i - 5], 43)
+			+ Q[i - 4] + ROL64(Q[i - 3], 53)
+			+ MW_SB4(Q[i - 2]) + MW_SB5(Q[i - 1])
+			+ MW_ELT(i - 16);
+
+	xl = Q[16] ^ Q[17] ^ Q[18] ^ Q[19] ^ Q[20] ^ Q[21] ^ Q[22] ^ Q[23];
+	xh = xl ^ Q[24] ^ Q[25] ^ Q[26] ^ Q[27]
+		^ Q[28] ^ Q[29] ^ Q[30] ^ Q[31];
+	dh[ 0] = ((xh <<  5) ^ (Q[16] >>  5) ^ M[ 0]) + (xl ^ Q[24] ^ Q[ 0]);
+	dh[ 1] = ((xh >>  7) ^ (Q[17] <<  8) ^ M[ 1]) + (xl ^ Q[25] ^ Q[ 1]);
+	dh[ 2] = ((xh >>  5) ^ (Q[18] <<  5) ^ M[ 2]) + (xl ^ Q[26] ^ Q[ 2]);
+	dh[ 3] = ((xh >>  1) ^ (Q[19] <<  5) ^ M[ 3]) + (xl ^ Q[27] ^ Q[ 3]);
+	dh[ 4] = ((xh >>  3) ^  Q[20]        ^ M[ 4]) + (xl ^ Q[28] ^ Q[ 4]);
+	dh[ 5] = ((xh <<  6) ^ (Q[21] >>  6) ^ M[ 5]) + (xl ^ Q[29] ^ Q[ 5]);
+	dh[ 6] = ((xh >>  4) ^ (Q[22] <<  6) ^ M[ 6]) + (xl ^ Q[30] ^ Q[ 6]);
+	dh[ 7] = ((xh >> 11) ^ (Q[23] <<  2) ^ M[ 7]) + (xl ^ Q[31] ^ Q[ 7]);
+	dh[ 8] = ROL64(dh[4],  9) + (xh ^ Q[24] ^ M[ 8])
+		+ ((xl << 8) ^ Q[23] ^ Q[ 8]);
+	dh[ 9] = ROL64(dh[5], 10) + (xh ^ Q[25] ^ M[ 9])
+		+ ((xl >> 6) ^ Q[16] ^ Q[ 9]);
+	dh[10] = ROL64(dh[6], 11) + (xh ^ Q[26] ^ M[10])
+		+ ((xl << 6) ^ Q[17] ^ Q[10]);
+	dh[11] = ROL64(dh[7], 12) + (xh ^ Q[27] ^ M[11])
+		+ ((xl << 4) ^ Q[18] ^ Q[11]);
+	dh[12] = ROL64(dh[0], 13) + (xh ^ Q[28] ^ M[12])
+		+ ((xl >> 3) ^ Q[19] ^ Q[12]);
+	dh[13] = ROL64(dh[1], 14) + (xh ^ Q[29] ^ M[13])
+		+ ((xl >> 4) ^ Q[20] ^ Q[13]);
+	dh[14] = ROL64(dh[2], 15) + (xh ^ Q[30] ^ M[14])
+		+ ((xl >> 7) ^ Q[21] ^ Q[14]);
+	dh[15] = ROL64(dh[3], 16) + (xh ^ Q[31] ^ M[15])
+		+ ((xl >> 2) ^ Q[22] ^ Q[15]);
+}
+
+#undef MW_SB0
+#undef MW_SB1
+#undef MW_SB2
+#undef MW_SB3
+#undef MW_SB4
+#undef MW_SB5
+#undef MW_MH
+#undef MW_ELT
+
+static void
+MWAY(bmw512)(uint64_t hash[][8])
+{
+	V64 M[16], H[16], h1[16];
+	int w;
+
+	for (w = 0; w < 8; w ++)
+		GATHER(M[w], w, H64LE);
+	M[8] = SPLAT64(0x80);
+	for (w = 9; w < 15; w ++)
+		M[w] = ZERO64;
+	M[15] = SPLAT64(512);
+	for (w = 0; w < 16; w ++)
+		H[w] = SPLAT64(mw_bmw_iv[w]);
+	MWAY(bmw512_compress)(h1, M, H);
+
+	for (w = 0; w < 16; w ++)
+		H[w] = SPLAT64(SPH_C64(0xaaaaaaaaaaaaaaa0) + w);
+	MWAY(bmw512_compress)(M, h1, H);
+	MWAY(store64le)(hash, M + 8);
+}
+
+/* ---------------------------------------------------------------- */
+/* skein512 */
+
+#define MW_MIX(a, b, rc)   do { \
+		p[a] += p[b]; \
+		p[b] = ROL64(p[b], rc) ^ p[a]; \
+	} while (0)
+
+#define MW_ROUND4(r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, \
+		r10, r11, r12, r13, r14, r15)   do { \
+		MW_MIX(0, 1, r0); MW_MIX(2, 3, r1); \
+		MW_MIX(4, 5, r2); MW_MIX(6, 7, r3); \
+		MW_MIX(2, 1, r4); MW_MIX(4, 7, r5); \
+		MW_MIX(6, 5, r6); MW_MIX(0, 3, r7); \
+		MW_MIX(4, 1, r8); MW_MIX(6, 3, r9); \
+		MW_MIX(0, 5, r10); MW_MIX(2, 7, r11); \
+		MW_MIX(6, 1, r12); MW_MIX(0, 7, r13); \
+		MW_MIX(2, 5, r14); MW_MIX(4, 3, r15); \
+	} while (0)
+
+static void
+MWAY(skein512_ubi)(V64 *h, const V64 *m, sph_u64 t0, sph_u64 t1)
+{
+	V64 k[9], p[8];
+	sph_u64 t[3];
+	int s, i;
+
+	k[8] = SPLAT64(SPH_C64(0x1BD11BDAA9FC1A22));
+	for (i = 0; i < 8; i ++) {
+		k[i] = h[i];
+		k[8] ^= h[i];
+		p[i] = m[i];
+	}
+	t[0] = t0;
+	t[1] = t1;
+	t[2] = t0 ^ t1;
+
+	for (s = 0; s <= 18; s ++) {
+		for (i = 0; i < 8; i ++)
+			p[i] += k[(s + i) % 9];
+		p[5] += t[s % 3];
+		p[6] += t[(s + 1) % 3];
+		p[7] += (sph_u64)s;
+		if (s == 18)
+			break;
+		if (s & 1)
+			MW_ROUND4(39, 30, 34, 24, 13, 50, 10, 17,
+				25, 29, 39, 43, 8, 35, 56, 22);
+		else
+			MW_ROUND4(46, 36, 19, 37, 33, 27, 14, 42,
+				17, 49, 36, 39, 44, 9, 54, 56);
+	}
+
+	for (i = 0; i < 8; i ++)
+		h[i] = p[i] ^ m[i];
+}
+
+#undef MW_MIX
+#undef MW_ROUND4
+
+static void
+MWAY(skein512)(uint64_t hash[][8])
+{
+	V64 h[8], m[8];
+	int w;
+
+	for (w = 0; w < 8; w ++) {
+		h[w] = SPLAT64(mw_skein_iv[w]);
+		GATHER(m[w], w, H64LE);
+	}
+	MWAY(skein512_ubi)(h, m, 64, SPH_C64(0xF000000000000000));
+	for (w = 0; w < 8; w ++)
+		m[w] = ZERO64;
+	MWAY(skein512_ubi)(h, m, 8, SPH_C64(0xFF00000000000000));
+	MWAY(store64le)(hash, h);
+}
+
+/* ---------------------------------------------------------------- */
+/* jh512, h[2i] / h[2i+1] are the high / low halves of sph's hN */
+
+#define MW_SB(x0, x1, x2, x3, c)   do { \
+		V64 tmp; \
+		x3 = ~x3; \
+		x0 ^= (c) & ~x2; \
+		tmp = (c) ^ (x0 & x1); \
+		x0 ^= x2 & x3; \
+		x3 ^= ~x1 & x2; \
+		x1 ^= x0 & x2; \
+		x2 ^= x0 & ~x3; \
+		x0 ^= x1 | x3; \
+		x3 ^= x1 & x2; \
+		x1 ^= tmp & x0; \
+		x2 ^= tmp; \
+	} while (0)
+
+#define MW_LB(x0, x1, x2, x3, x4, x5, x6, x7)   do { \
+		x4 ^= x1; \
+		x5 ^= x2; \
+		x6 ^= x3 ^ x0; \
+		x7 ^= x0; \
+		x0 ^= x5; \
+		x1 ^= x6; \
+		x2 ^= x7 ^ x4; \
+		x3 ^= x4; \
+	} while (0)
+
+#define MW_WZ(x, c, n)   do { \
+		x = (((x) >> (n)) & (c)) | (((x) & (c)) << (n)); \
+	} while (0)
+
+static void
+MWAY(jh512_e8)(V64 *h)
+{
+	static const sph_u64 wmask[6] = {
+		SPH_C64(0x5555555555555555), SPH_C64(0x3333333333333333),
+		SPH_C64(0x0F0F0F0F0F0F0F0F), SPH_C64(0x00FF00FF00FF00FF),
+		SPH_C64(0x0000FFFF0000FFFF), SPH_C64(0x00000000FFFFFFFF)
+	};
+	int r, i;
+
+	for (r = 0; r < 42; r ++) {
+		const sph_u64 *c = mw_jh_c + 4 * r;
+		int ro = r % 7;
+
+		MW_SB(h[0], h[4], h[ 8], h[12], c[0]);
+		MW_SB(h[1], h[5], h[ 9], h[13], c[1]);
+		MW_SB(h[2], h[6], h[10], h[14], c[2]);
+		MW_SB(h[3], h[7], h[11], h[15], c[3]);
+		MW_LB(h[0], h[4], h[ 8], h[12], h[2], h[6], h[10], h[14]);
+		MW_LB(h[1], h[5], h[ 9], h[13], h[3], h[7], h[11], h[15]);
+		for (i = 2; i < 16; i += 4) {
+			if (ro < 6) {
+				MW_WZ(h[i], wmask[ro], 1 << ro);
+				MW_WZ(h[i + 1], wmask[ro], 1 << ro);
+			} else {
+				V64 t = h[i];
+				h[i] = h[i + 1];
+				h[i + 1] = t;
+			}
+		}
+	}
+}
+
+#undef MW_SB
+#undef MW_LB
+#undef MW_WZ
+
+static void
+MWAY(jh512)(uint64_t hash[][8])
+{
+	V64 h[16], m[8];
+	int w;
+
+	for (w = 0; w < 16; w ++)
+		h[w] = SPLAT64(mw_jh_iv[w]);
+	for (w = 0; w < 8; w ++) {
+		GATHER(m[w], w, H64LE);
+		h[w] ^= m[w];
+	}
+	MWAY(jh512_e8)(h);
+	for (w = 0; w < 8; w ++)
+		h[w + 8] ^= m[w];
+
+	/* padding block: 0x80, zeros, 512-bit length big-endian */
+	m[0] = SPLAT64(0x80);
+	for (w = 1; w < 7; w ++)
+		m[w] = ZERO64;
+	m[7] = SPLAT64(SPH_C64(0x0002000000000000));
+	for (w = 0; w < 8; w ++)
+		h[w] ^= m[w];
+	MWAY(jh512_e8)(h);
+	for (w = 0; w < 8; w ++)
+		h[w + 8] ^= m[w];
+	MWAY(store64le)(hash, h + 8);
+}
+
+/* ---------------------------------------------------------------- */
+/* keccak512, rate 72 bytes, single block */
+
+static void
+MWAY(keccak512)(uint64_t hash[][8])
+{
+	V64 A[25], B[25], C[5], D[5];
+	int r, x, y;
+
+	for (x = 0; x < 8; x ++)
+		GATHER(A[x], x, H64LE);
+	A[8] = SPLAT64(SPH_C64(0x8000000000000001));
+	for (x = 9; x < 25; x ++)
+		A[x] = ZERO64;
+
+	for (r = 0; r < 24; r ++) {
+		for (x = 0; x < 5; x ++)
+			C[x] = A[x] ^ A[x + 5] ^ A[x + 10] ^ A[x + 15] ^ A[x + 20];
+		for (x = 0; x < 5; x ++)
+			D[x] = C[(x + 4) % 5] ^ ROL64(C[(x + 1) % 5], 1);
+		for (y = 0; y < 25; y += 5)
+			for (x = 0; x < 5; x ++)
+				A[y + x] ^= D[x];
+
+		B[0] = A[0];
+		for (y = 0; y < 5; y ++)
+			for (x = 0; x < 5; x ++) {
+				int i = x + 5 * y;
+
+				if (i)
+					B[y + 5 * ((2 * x + 3 * y) % 5)] =
+						ROL64(A[i], mw_keccak_rot[i]);
+			}
+
+		for (y = 0; y < 25; y += 5)
+			for (x = 0; x < 5; x ++)
+				A[y + x] = B[y + x] ^ (~B[y + (x + 1) % 5]
+					& B[y + (x + 2) % 5]);
+		A[0] ^= mw_keccak_rc[r];
+	}
+	MWAY(store64le)(hash, A);
+}
+
+/* ---------------------------------------------------------------- */
+/* luffa512, five 256-bit sub-states, 32-byte blocks */
+
+#define MW_M2(d, s)   do { \
+		V32 tmp = s[7]; \
+		d[7] = s[6]; \
+		d[6] = s[5]; \
+		d[5] = s[4]; \
+		d[4] = s[3] ^ tmp; \
+		d[3] = s[2] ^ tmp; \
+		d[2] = s[1]; \
+		d[1] = s[0] ^ tmp; \
+		d[0] = tmp; \
+	} while (0)
+
+#define MW_XOR(d, s1, s2)   do { \
+		int i_; \
+		for (i_ = 0; i_ < 8; i_ ++) \
+			d[i_] = s1[i_] ^ s2[i_]; \
+	} while (0)
+
+#define MW_SUB_CRUMB(a0, a1, a2, a3)   do { \
+		V32 tmp = (a0); \
+		(a0) |= (a1); \
+		(a2) ^= (a3); \
+		(a1) = ~(a1); \
+		(a0) ^= (a3); \
+		(a3) &= tmp; \
+		(a1) ^= (a3); \
+		(a3) ^= (a2); \
+		(a2) &= (a0); \
+		(a0) = ~(a0); \
+		(a2) ^= (a1); \
+		(a1) |= (a3); \
+		tmp ^= (a1); \
+		(a3) ^= (a2); \
+		(a2) &= (a1); \
+		(a1) ^= (a0); \
+		(a0) = tmp; \
+	} while (0)
+
+#define MW_MIX_WORD(u, v)   do { \
+		(v) ^= (u); \
+		(u) = ROL32((u), 2) ^ (v); \
+		(v) = ROL32((v), 14) ^ (u); \
+		(u) = ROL32((u), 10) ^ (v); \
+		(v) = ROL32((v), 1); \
+	} while (0)
+
+static void
+MWAY(luffa512_round)(V32 V[5][8], const V32 *M)
+{
+	V32 a[8], b[8], m[8];
+	int i, j, r;
+
+	/* MI5 */
+	MW_XOR(a, V[0], V[1]);
+	MW_XOR(b, V[2], V[3]);
+	MW_XOR(a, a, b);
+	MW_XOR(a, a, V[4]);
+	MW_M2(a, a);
+	for (j = 0; j < 5; j ++)
+		MW_XOR(V[j], a, V[j]);
+	MW_M2(b, V[0]);
+	MW_XOR(b, b, V[1]);
+	MW_M2(V[1], V[1]);
+	MW_XOR(V[1], V[1], V[2]);
+	MW_M2(V[2], V[2]);
+	MW_XOR(V[2], V[2], V[3]);
+	MW_M2(V[3], V[3]);
+	MW_XOR(V[3], V[3], V[4]);
+	MW_M2(V[4], V[4]);
+	MW_XOR(V[4], V[4], V[0]);
+	MW_M2(V[0], b);
+	MW_XOR(V[0], V[0], V[4]);
+	MW_M2(V[4], V[4]);
+	MW_XOR(V[4], V[4], V[3]);
+	MW_M2(V[3], V[3]);
+	MW_XOR(V[3], V[3], V[2]);
+	MW_M2(V[2], V[2]);
+	MW_XOR(V[2], V[2], V[1]);
+	MW_M2(V[1], V[1]);
+	MW_XOR(V[1], V[1], b);
+	for (i = 0; i < 8; i ++)
+		m[i] = M[i];
+	for (j = 0; j < 5; j ++) {
+		if (j)
+			MW_M2(m, m);
+		MW_XOR(V[j], V[j], m);
+	}
+
+	/* P5 */
+	for (j = 1; j < 5; j ++)
+		for (i = 4; i < 8; i ++)
+			V[j][i] = ROL32(V[j][i], j);
+	for (j = 0; j < 5; j ++) {
+		V32 *v = V[j];
+
+		for (r = 0; r < 8; r ++) {
+			MW_SUB_CRUMB(v[0], v[1], v[2], v[3]);
+			MW_SUB_CRUMB(v[5], v[6], v[7], v[4]);
+			MW_MIX_WORD(v[0], v[4]);
+			MW_MIX_WORD(v[1], v[5]);
+			MW_MIX_WORD(v[2], v[6]);
+			MW_MIX_WORD(v[3], v[7]);
+			v[0] ^= mw_luffa_rc[j][0][r];
+			v[4] ^= mw_luffa_rc[j][1][r];
+		}
+	}
+}
+
+#undef MW_M2
+#undef MW_XOR
+#undef MW_SUB_CRUMB
+#undef MW_MIX_WORD
+
+static void
+MWAY(luffa512)(uint64_t hash[][8])
+{
+	V32 V[5][8], M[8];
+	int i, j, b, l;
+
+	for (j = 0; j < 5; j ++)
+		for (i = 0; i < 8; i ++)
+			V[j][i] = SPLAT32(mw_luffa_iv[j][i]);
+	for (b = 0; b < 2; b ++) {
+		for (i = 0; i < 8; i ++)
+			GATHER(M[i], 8 * b + i, H32BE);
+		MWAY(luffa512_round)(V, M);
+	}
+
+	/* closing: padding block, then two blank rounds for the output */
+	M[0] = SPLAT32(0x80000000);
+	for (i = 1; i < 8; i ++)
+		M[i] = ZERO32;
+	MWAY(luffa512_round)(V, M);
+	M[0] = ZERO32;
+	for (b = 0; b < 2; b ++) {
+		MWAY(luffa512_round)(V, M);
+		for (i = 0; i < 8; i ++) {
+			V32 h = V[0][i] ^ V[1][i] ^ V[2][i] ^ V[3][i] ^ V[4][i];
+
+			for (l = 0; l < MWAY_LANES; l ++)
+				sph_enc32be_aligned((unsigned char *)hash[l]
+					+ 32 * b + 4 * i, h[l]);
+		}
+	}
+}
+
+/* ---------------------------------------------------------------- */
+/* cubehash512 (CubeHash16/32) */
+
+#define MW_SWAP(a, b)   do { \
+		V32 t = a; \
+		a = b; \
+		b = t; \
+	} while (0)
+
+static void
+MWAY(cubehash512_rounds)(V32 *x, int rounds)
+{
+	int r, i;
+
+	for (r = 0; r < rounds; r ++) {
+		for (i = 0; i < 16; i ++)
+			x[i + 16] += x[i];
+		for (i = 0; i < 16; i ++)
+			x[i] = ROL32(x[i], 7);
+		for (i = 0; i < 8; i ++)
+			MW_SWAP(x[i], x[i + 8]);
+		for (i = 0; i < 16; i ++)
+			x[i] ^= x[i + 16];
+		for (i = 16; i < 32; i ++)
+			if (!(i & 2))
+				MW_SWAP(x[i], x[i + 2]);
+		for (i = 0; i < 16; i ++)
+			x[i + 16] += x[i];
+		for (i = 0; i < 16; i ++)
+			x[i] = ROL32(x[i], 11);
+		for (i = 0; i < 16; i ++)
+			if (!(i & 4))
+				MW_SWAP(x[i], x[i + 4]);
+		for (i = 0; i < 16; i ++)
+			x[i] ^= x[i + 16];
+		for (i = 16; i < 32; i += 2)
+			MW_SWAP(x[i], x[i + 1]);
+	}
+}
+
+#undef MW_SWAP
+
+static void
+MWAY(cubehash512)(uint64_t hash[][8])
+{
+	V32 x[32], m;
+	int i, b;
+
+	for (i = 0; i < 32; i ++)
+		x[i] = SPLAT32(mw_cubehash_iv[i]);
+	for (b = 0; b < 2; b ++) {
+		for (i = 0; i < 8; i ++) {
+			GATHER(m, 8 * b + i, H32LE);
+			x[i] ^= m;
+		}
+		MWAY(cubehash512_rounds)(x, 16);
+	}
+	x[0] ^= SPLAT32(0x80);
+	MWAY(cubehash512_rounds)(x, 16);
+	x[31] ^= SPLAT32(1);
+	MWAY(cubehash512_rounds)(x, 160);
+
+	for (i = 0; i < 16; i ++) {
+		int l;
+
+		for (l = 0; l < MWAY_LANES; l ++)
+			sph_enc32le_aligned((unsigned char *)hash[l] + 4 * i,
+				x[i][l]);
+	}
+}
+
+const mway_kernels MWAY(mway) = {
+	MWAY_LANES,
+	MWAY_NAME,
+	MWAY(blake512_80),
+	MWAY(bmw512),
+	MWAY(skein512),
+	MWAY(jh512),
+	MWAY(keccak512),
+	MWAY(luffa512),
+	MWAY(cubehash512)
+};
+
+#undef V64
+#undef V32
+#undef ZERO64
+#undef ZERO32
+#undef SPLAT64
+#undef SPLAT32
+#undef ROL64
+#undef ROR64
+#undef ROL32
+#undef GATHER
+#undef H64LE
+#undef H32LE
+#undef H32BE
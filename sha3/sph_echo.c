@@ -72,6 +72,7 @@ extern "C"{
 
 #define AES_BIG_ENDIAN   0
 #include "aes_helper.c"
+#include "aesni_helper.c"
 
 #if SPH_ECHO_64
 
@@ -719,11 +720,185 @@ echo_small_compress(sph_echo_small_context *sc)
 	COMPRESS_SMALL(sc);
 }
 
+#if SPH_AESNI
+
+/*
+ * AES-NI version of the ECHO-512 compression function. Each 128-bit
+ * word of the state is one xmm register: the two AES rounds are two
+ * aesenc, ShiftRows is register renaming and MixColumns is the byte
+ * wise GF(2^8) doubling below. The salt/counter K is kept in a vector
+ * and incremented on its low 32-bit word only, so the caller must make
+ * sure C0 cannot wrap during the 160 increments of one compression.
+ */
+
+#pragma GCC push_options
+#pragma GCC target("aes,ssse3")
+
+#define ECHO_X2(v)   _mm_xor_si128(_mm_add_epi8(v, v), \
+		_mm_and_si128(_mm_cmpgt_epi8(zero, v), m1b))
+
+#define ECHO_MIX(a, b, c, d)   do { \
+		__m128i ab = _mm_xor_si128(W[a], W[b]); \
+		__m128i bc = _mm_xor_si128(W[b], W[c]); \
+		__m128i cd = _mm_xor_si128(W[c], W[d]); \
+		__m128i abx = ECHO_X2(ab); \
+		__m128i bcx = ECHO_X2(bc); \
+		__m128i cdx = ECHO_X2(cd); \
+		__m128i na = _mm_xor_si128(abx, _mm_xor_si128(bc, W[d])); \
+		__m128i nb = _mm_xor_si128(bcx, _mm_xor_si128(W[a], cd)); \
+		__m128i nc = _mm_xor_si128(cdx, _mm_xor_si128(ab, W[d])); \
+		W[d] = _mm_xor_si128(_mm_xor_si128(abx, bcx), \
+			_mm_xor_si128(cdx, _mm_xor_si128(ab, W[c]))); \
+		W[a] = na; \
+		W[b] = nb; \
+		W[c] = nc; \
+	} while (0)
+
+static void
+echo_big_compress_aesni(sph_echo_big_context *sc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i m1b = _mm_set1_epi8(0x1B);
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i W[16], M[8], K, t;
+	int r, n;
+
+	for (n = 0; n < 8; n ++) {
+		W[n] = _mm_loadu_si128((const __m128i *)sc->u.Vs[n]);
+		M[n] = _mm_loadu_si128((const __m128i *)(sc->buf + 16 * n));
+		W[n + 8] = M[n];
+	}
+	K = _mm_set_epi32(sc->C3, sc->C2, sc->C1, sc->C0);
+	for (r = 0; r < 10; r ++) {
+		for (n = 0; n < 16; n ++) {
+			W[n] = _mm_aesenc_si128(_mm_aesenc_si128(W[n], K),
+				zero);
+			K = _mm_add_epi32(K, one);
+		}
+
+		t = W[1]; W[1] = W[5]; W[5] = W[9]; W[9] = W[13]; W[13] = t;
+		t = W[2]; W[2] = W[10]; W[10] = t;
+		t = W[6]; W[6] = W[14]; W[14] = t;
+		t = W[15]; W[15] = W[11]; W[11] = W[7]; W[7] = W[3]; W[3] = t;
+
+		ECHO_MIX(0, 1, 2, 3);
+		ECHO_MIX(4, 5, 6, 7);
+		ECHO_MIX(8, 9, 10, 11);
+		ECHO_MIX(12, 13, 14, 15);
+	}
+	for (n = 0; n < 8; n ++) {
+		t = _mm_loadu_si128((const __m128i *)sc->u.Vs[n]);
+		t = _mm_xor_si128(t, _mm_xor_si128(M[n],
+			_mm_xor_si128(W[n], W[n + 8])));
+		_mm_storeu_si128((__m128i *)sc->u.Vs[n], t);
+	}
+}
+
+#undef ECHO_X2
+#undef ECHO_MIX
+
+#pragma GCC pop_options
+
+/*
+ * VAES version: word n and word n + 8 share one ymm register, i.e.
+ * columns c and c + 2 of the 4x4 word matrix. MixColumns then works
+ * on both halves at once and ShiftRows becomes register renaming plus
+ * a lane swap for the words that change half.
+ */
+
+#pragma GCC push_options
+#pragma GCC target("avx2,vaes")
+
+#define ECHO_X2(v)   _mm256_xor_si256(_mm256_add_epi8(v, v), \
+		_mm256_and_si256(_mm256_cmpgt_epi8(zero, v), m1b))
+
+#define ECHO_SWAP(v)   _mm256_permute4x64_epi64(v, 0x4E)
+
+#define ECHO_MIX(a, b, c, d)   do { \
+		__m256i ab = _mm256_xor_si256(Y[a], Y[b]); \
+		__m256i bc = _mm256_xor_si256(Y[b], Y[c]); \
+		__m256i cd = _mm256_xor_si256(Y[c], Y[d]); \
+		__m256i abx = ECHO_X2(ab); \
+		__m256i bcx = ECHO_X2(bc); \
+		__m256i cdx = ECHO_X2(cd); \
+		__m256i na = _mm256_xor_si256(abx, _mm256_xor_si256(bc, Y[d])); \
+		__m256i nb = _mm256_xor_si256(bcx, _mm256_xor_si256(Y[a], cd)); \
+		__m256i nc = _mm256_xor_si256(cdx, _mm256_xor_si256(ab, Y[d])); \
+		Y[d] = _mm256_xor_si256(_mm256_xor_si256(abx, bcx), \
+			_mm256_xor_si256(cdx, _mm256_xor_si256(ab, Y[c]))); \
+		Y[a] = na; \
+		Y[b] = nb; \
+		Y[c] = nc; \
+	} while (0)
+
+static void
+echo_big_compress_vaes(sph_echo_big_context *sc)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i m1b = _mm256_set1_epi8(0x1B);
+	const __m256i one = _mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 1);
+	const __m256i eight = _mm256_set_epi32(0, 0, 0, 8, 0, 0, 0, 8);
+	__m256i Y[8], K, t;
+	__m128i V[8], M[8];
+	int r, n;
+
+	for (n = 0; n < 8; n ++) {
+		V[n] = _mm_loadu_si128((const __m128i *)sc->u.Vs[n]);
+		M[n] = _mm_loadu_si128((const __m128i *)(sc->buf + 16 * n));
+		Y[n] = _mm256_set_m128i(M[n], V[n]);
+	}
+	K = _mm256_set_epi32(sc->C3, sc->C2, sc->C1, sc->C0 + 8,
+		sc->C3, sc->C2, sc->C1, sc->C0);
+	for (r = 0; r < 10; r ++) {
+		for (n = 0; n < 8; n ++) {
+			Y[n] = _mm256_aesenc_epi128(
+				_mm256_aesenc_epi128(Y[n], K), zero);
+			K = _mm256_add_epi32(K, one);
+		}
+		K = _mm256_add_epi32(K, eight);
+
+		t = Y[1]; Y[1] = Y[5]; Y[5] = ECHO_SWAP(t);
+		Y[2] = ECHO_SWAP(Y[2]);
+		Y[6] = ECHO_SWAP(Y[6]);
+		t = Y[7]; Y[7] = Y[3]; Y[3] = ECHO_SWAP(t);
+
+		ECHO_MIX(0, 1, 2, 3);
+		ECHO_MIX(4, 5, 6, 7);
+	}
+	for (n = 0; n < 8; n ++) {
+		__m128i w = _mm_xor_si128(_mm256_castsi256_si128(Y[n]),
+			_mm256_extracti128_si256(Y[n], 1));
+
+		w = _mm_xor_si128(w, _mm_xor_si128(V[n], M[n]));
+		_mm_storeu_si128((__m128i *)sc->u.Vs[n], w);
+	}
+}
+
+#undef ECHO_X2
+#undef ECHO_SWAP
+#undef ECHO_MIX
+
+#pragma GCC pop_options
+
+#endif
+
 static void
 echo_big_compress(sph_echo_big_context *sc)
 {
 	DECL_STATE_BIG
 
+#if SPH_AESNI
+	if (sc->C0 <= 0xFFFFFFFF - 160) {
+		switch (sph_aesni_level()) {
+		case SPH_AESNI_VAES:
+			echo_big_compress_vaes(sc);
+			return;
+		case SPH_AESNI_AES:
+			echo_big_compress_aesni(sc);
+			return;
+		}
+	}
+#endif
 	COMPRESS_BIG(sc);
 }
 
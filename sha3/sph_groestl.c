@@ -63,6 +63,8 @@ extern "C"{
 #pragma warning (disable: 4146)
 #endif
 
+#include "aesni_helper.c"
+
 /*
  * The internal representation may use either big-endian or
  * little-endian. Using the platform default representation speeds up
@@ -2734,6 +2736,291 @@ static const sph_u32 T3dn[] = {
 
 #endif
 
+/*
+ * AES-NI versions of the Groestl-512 permutations.
+ *
+ * The 8x16 byte state is transposed so that each register holds one
+ * row. ShiftBytes is then a byte shuffle within a row, which is merged
+ * with the inverse of the AES ShiftRows so that a single aesenclast with
+ * a zero key computes SubBytes and ShiftBytes together. MixBytes works
+ * on whole rows with the circulant matrix (2,2,3,4,5,3,5,7) written as
+ * 2*U ^ 4*V ^ W, where U, V and W are XOR sums of rows.
+ *
+ * These need the in-memory state to be the column-major byte matrix,
+ * which is what the little-endian representation gives.
+ */
+
+#if SPH_AESNI && USE_LE
+#define GROESTL_AESNI   1
+#else
+#define GROESTL_AESNI   0
+#endif
+
+#if GROESTL_AESNI
+
+/* (ShiftBytes o inverse AES ShiftRows) for each row, P then Q */
+static const unsigned char groestl_aes_shuf[2][8][16] = { {
+	{  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3 },
+	{  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4 },
+	{  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5 },
+	{  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6 },
+	{  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7 },
+	{  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8 },
+	{  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9 },
+	{ 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14 }
+}, {
+	{  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4 },
+	{  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6 },
+	{  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8 },
+	{ 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14 },
+	{  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3 },
+	{  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5 },
+	{  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7 },
+	{  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9 }
+} };
+
+/*
+ * One round on the row array x[], written out in full so that the rows
+ * stay in registers. GX / GX2 are the XOR and the GF(2^8) doubling for
+ * the vector width in use, GSB applies SubBytes + ShiftBytes to a row.
+ */
+#define GROESTL_MB(i)   do { \
+		u = GX(a[i], GX(x[((i) + 2) & 7], \
+			GX(x[((i) + 5) & 7], x[((i) + 7) & 7]))); \
+		u = GX(u, GX2(GX(a[((i) + 3) & 7], a[((i) + 6) & 7]))); \
+		y[i] = GX(GX2(u), GX(x[((i) + 2) & 7], \
+			GX(a[((i) + 4) & 7], a[((i) + 6) & 7]))); \
+	} while (0)
+
+#define GROESTL_ROUND_BODY   do { \
+		GSB(0); GSB(1); GSB(2); GSB(3); \
+		GSB(4); GSB(5); GSB(6); GSB(7); \
+		a[0] = GX(x[0], x[1]); \
+		a[1] = GX(x[1], x[2]); \
+		a[2] = GX(x[2], x[3]); \
+		a[3] = GX(x[3], x[4]); \
+		a[4] = GX(x[4], x[5]); \
+		a[5] = GX(x[5], x[6]); \
+		a[6] = GX(x[6], x[7]); \
+		a[7] = GX(x[7], x[0]); \
+		GROESTL_MB(0); \
+		GROESTL_MB(1); \
+		GROESTL_MB(2); \
+		GROESTL_MB(3); \
+		GROESTL_MB(4); \
+		GROESTL_MB(5); \
+		GROESTL_MB(6); \
+		GROESTL_MB(7); \
+		x[0] = y[0]; x[1] = y[1]; x[2] = y[2]; x[3] = y[3]; \
+		x[4] = y[4]; x[5] = y[5]; x[6] = y[6]; x[7] = y[7]; \
+	} while (0)
+
+#pragma GCC push_options
+#pragma GCC target("aes,ssse3")
+
+/*
+ * 8x16 byte transpose between the column-major state in memory and
+ * row registers. The 16-bit transpose in the middle is an involution,
+ * so both directions share it.
+ */
+#define GROESTL_T16(x)   do { \
+		__m128i s0, s1, s2, s3, s4, s5, s6, s7; \
+		__m128i q0, q1, q2, q3, q4, q5, q6, q7; \
+		s0 = _mm_unpacklo_epi16(x[0], x[1]); \
+		s1 = _mm_unpackhi_epi16(x[0], x[1]); \
+		s2 = _mm_unpacklo_epi16(x[2], x[3]); \
+		s3 = _mm_unpackhi_epi16(x[2], x[3]); \
+		s4 = _mm_unpacklo_epi16(x[4], x[5]); \
+		s5 = _mm_unpackhi_epi16(x[4], x[5]); \
+		s6 = _mm_unpacklo_epi16(x[6], x[7]); \
+		s7 = _mm_unpackhi_epi16(x[6], x[7]); \
+		q0 = _mm_unpacklo_epi32(s0, s2); \
+		q1 = _mm_unpackhi_epi32(s0, s2); \
+		q2 = _mm_unpacklo_epi32(s1, s3); \
+		q3 = _mm_unpackhi_epi32(s1, s3); \
+		q4 = _mm_unpacklo_epi32(s4, s6); \
+		q5 = _mm_unpackhi_epi32(s4, s6); \
+		q6 = _mm_unpacklo_epi32(s5, s7); \
+		q7 = _mm_unpackhi_epi32(s5, s7); \
+		x[0] = _mm_unpacklo_epi64(q0, q4); \
+		x[1] = _mm_unpackhi_epi64(q0, q4); \
+		x[2] = _mm_unpacklo_epi64(q1, q5); \
+		x[3] = _mm_unpackhi_epi64(q1, q5); \
+		x[4] = _mm_unpacklo_epi64(q2, q6); \
+		x[5] = _mm_unpackhi_epi64(q2, q6); \
+		x[6] = _mm_unpacklo_epi64(q3, q7); \
+		x[7] = _mm_unpackhi_epi64(q3, q7); \
+	} while (0)
+
+static inline void
+groestl_aes_load(__m128i x[8], const void *src)
+{
+	const __m128i ilv = _mm_set_epi8(15, 7, 14, 6, 13, 5, 12, 4,
+		11, 3, 10, 2, 9, 1, 8, 0);
+	int i;
+
+	for (i = 0; i < 8; i ++)
+		x[i] = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *)src + i), ilv);
+	GROESTL_T16(x);
+}
+
+static inline void
+groestl_aes_store(void *dst, __m128i x[8])
+{
+	const __m128i dlv = _mm_set_epi8(15, 13, 11, 9, 7, 5, 3, 1,
+		14, 12, 10, 8, 6, 4, 2, 0);
+	int i;
+
+	GROESTL_T16(x);
+	for (i = 0; i < 8; i ++)
+		_mm_storeu_si128((__m128i *)dst + i,
+			_mm_shuffle_epi8(x[i], dlv));
+}
+
+#define GX(p, q)   _mm_xor_si128(p, q)
+#define GX2(v)     _mm_xor_si128(_mm_add_epi8(v, v), \
+		_mm_and_si128(_mm_cmpgt_epi8(zero, v), m1b))
+#define GSB(i)     (x[i] = _mm_aesenclast_si128( \
+		_mm_shuffle_epi8(x[i], shuf[i]), zero))
+
+static inline void
+groestl_aes_perm(__m128i x[8], int q)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i m1b = _mm_set1_epi8(0x1B);
+	const __m128i ones = _mm_set1_epi8(-1);
+	const __m128i cols = _mm_set_epi8(
+		(char)0xF0, (char)0xE0, (char)0xD0, (char)0xC0,
+		(char)0xB0, (char)0xA0, (char)0x90, (char)0x80,
+		0x70, 0x60, 0x50, 0x40, 0x30, 0x20, 0x10, 0x00);
+	const __m128i *shuf = (const __m128i *)groestl_aes_shuf[q];
+	__m128i a[8], y[8], u;
+	int r;
+
+	for (r = 0; r < 14; r ++) {
+		__m128i rc = _mm_xor_si128(cols, _mm_set1_epi8(r));
+
+		if (q) {
+			x[0] = GX(x[0], ones);
+			x[1] = GX(x[1], ones);
+			x[2] = GX(x[2], ones);
+			x[3] = GX(x[3], ones);
+			x[4] = GX(x[4], ones);
+			x[5] = GX(x[5], ones);
+			x[6] = GX(x[6], ones);
+			x[7] = GX(x[7], GX(rc, ones));
+		} else {
+			x[0] = GX(x[0], rc);
+		}
+		GROESTL_ROUND_BODY;
+	}
+}
+
+static void
+groestl_big_compress_aesni(void *H, const unsigned char *buf)
+{
+	__m128i h[8], g[8], m[8];
+	int i;
+
+	groestl_aes_load(h, H);
+	groestl_aes_load(m, buf);
+	for (i = 0; i < 8; i ++)
+		g[i] = _mm_xor_si128(h[i], m[i]);
+	groestl_aes_perm(g, 0);
+	groestl_aes_perm(m, 1);
+	for (i = 0; i < 8; i ++)
+		h[i] = _mm_xor_si128(h[i], _mm_xor_si128(g[i], m[i]));
+	groestl_aes_store(H, h);
+}
+
+static void
+groestl_big_final_aesni(void *H)
+{
+	__m128i h[8], x[8];
+	int i;
+
+	groestl_aes_load(h, H);
+	for (i = 0; i < 8; i ++)
+		x[i] = h[i];
+	groestl_aes_perm(x, 0);
+	for (i = 0; i < 8; i ++)
+		h[i] = _mm_xor_si128(h[i], x[i]);
+	groestl_aes_store(H, h);
+}
+
+#undef GX
+#undef GX2
+#undef GSB
+
+#pragma GCC pop_options
+
+/*
+ * VAES version of the compression function: P runs in the low lane
+ * and Q in the high lane of the same ymm rows.
+ */
+
+#pragma GCC push_options
+#pragma GCC target("avx2,vaes")
+
+#define GX(p, q)   _mm256_xor_si256(p, q)
+#define GX2(v)     _mm256_xor_si256(_mm256_add_epi8(v, v), \
+		_mm256_and_si256(_mm256_cmpgt_epi8(zero, v), m1b))
+#define GSB(i)     (x[i] = _mm256_aesenclast_epi128( \
+		_mm256_shuffle_epi8(x[i], shuf[i]), zero))
+
+static void
+groestl_big_compress_vaes(void *H, const unsigned char *buf)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i m1b = _mm256_set1_epi8(0x1B);
+	const __m128i cols = _mm_set_epi8(
+		(char)0xF0, (char)0xE0, (char)0xD0, (char)0xC0,
+		(char)0xB0, (char)0xA0, (char)0x90, (char)0x80,
+		0x70, 0x60, 0x50, 0x40, 0x30, 0x20, 0x10, 0x00);
+	const __m128i ones = _mm_set1_epi8(-1);
+	const __m256i qc = _mm256_set_m128i(ones, _mm_setzero_si128());
+	__m128i h[8], m[8];
+	__m256i x[8], shuf[8], a[8], y[8], u;
+	int i, r;
+
+	groestl_aes_load(h, H);
+	groestl_aes_load(m, buf);
+	for (i = 0; i < 8; i ++) {
+		x[i] = _mm256_set_m128i(m[i], _mm_xor_si128(h[i], m[i]));
+		shuf[i] = _mm256_set_m128i(
+			_mm_loadu_si128((const __m128i *)groestl_aes_shuf[1][i]),
+			_mm_loadu_si128((const __m128i *)groestl_aes_shuf[0][i]));
+	}
+	for (r = 0; r < 14; r ++) {
+		__m128i rc = _mm_xor_si128(cols, _mm_set1_epi8(r));
+
+		x[0] = GX(x[0], _mm256_set_m128i(ones, rc));
+		x[1] = GX(x[1], qc);
+		x[2] = GX(x[2], qc);
+		x[3] = GX(x[3], qc);
+		x[4] = GX(x[4], qc);
+		x[5] = GX(x[5], qc);
+		x[6] = GX(x[6], qc);
+		x[7] = GX(x[7], _mm256_set_m128i(_mm_xor_si128(rc, ones),
+			_mm_setzero_si128()));
+		GROESTL_ROUND_BODY;
+	}
+	for (i = 0; i < 8; i ++)
+		h[i] = _mm_xor_si128(h[i],
+			_mm_xor_si128(_mm256_castsi256_si128(x[i]),
+			_mm256_extracti128_si256(x[i], 1)));
+	groestl_aes_store(H, h);
+}
+
+#undef GX
+#undef GX2
+#undef GSB
+
+#pragma GCC pop_options
+
+#endif
+
 static void
 groestl_small_init(sph_groestl_small_context *sc, unsigned out_size)
 {
@@ -2929,7 +3216,21 @@ groestl_big_core(sph_groestl_big_context *sc, const void *data, size_t len)
 		data = (const unsigned char *)data + clen;
 		len -= clen;
 		if (ptr == sizeof sc->buf) {
+#if GROESTL_AESNI
+			switch (sph_aesni_level()) {
+			case SPH_AESNI_VAES:
+				groestl_big_compress_vaes(H, buf);
+				break;
+			case SPH_AESNI_AES:
+				groestl_big_compress_aesni(H, buf);
+				break;
+			default:
+				COMPRESS_BIG;
+				break;
+			}
+#else
 			COMPRESS_BIG;
+#endif
 #if SPH_64
 			sc->count ++;
 #else
@@ -2990,6 +3291,11 @@ groestl_big_close(sph_groestl_big_context *sc,
 #endif
 	groestl_big_core(sc, pad, pad_len);
 	READ_STATE_BIG(sc);
+#if GROESTL_AESNI
+	if (sph_aesni_level() != SPH_AESNI_NONE)
+		groestl_big_final_aesni(H);
+	else
+#endif
 	FINAL_BIG;
 #if SPH_GROESTL_64
 	for (u = 0; u < 8; u ++)
@@ -0,0 +1,55 @@
+/*
+ * Lane-parallel ("multi-way") versions of the 64-byte chaining stages
+ * used by the X11 family.
+ *
+ * Each kernel hashes MWAY lanes at once; lanes are kept lane-major
+ * (one 64-byte hash per lane) so the scalar sph functions can be mixed
+ * in between vector stages without any reshuffling by the caller.
+ * Results are bit-exact with the corresponding sph_*512 functions.
+ */
+
+#ifndef SPH_MWAY_H__
+#define SPH_MWAY_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define MWAY_MAX_LANES 8
+
+/* 8-way kernels are built for AVX2 with a target pragma (gcc only) */
+#if defined(__GNUC__) && !defined(__clang__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define MWAY_HAVE_8WAY 1
+#endif
+
+typedef struct {
+	int lanes;
+	const char *name;
+	/* blake512 over an 80-byte block header per lane */
+	void (*blake512_80)(uint64_t hash[][8], const void *const in[]);
+	/* 64-byte in, 64-byte out, in place */
+	void (*bmw512)(uint64_t hash[][8]);
+	void (*skein512)(uint64_t hash[][8]);
+	void (*jh512)(uint64_t hash[][8]);
+	void (*keccak512)(uint64_t hash[][8]);
+	void (*luffa512)(uint64_t hash[][8]);
+	void (*cubehash512)(uint64_t hash[][8]);
+} mway_kernels;
+
+extern const mway_kernels mway_4way;
+#ifdef MWAY_HAVE_8WAY
+extern const mway_kernels mway_8way;
+#endif
+
+/* widest kernel set usable on this cpu with at most max_lanes lanes,
+ * NULL for the scalar path */
+const mway_kernels *mway_select(int max_lanes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -63,6 +63,7 @@ extern "C"{
 
 #define AES_BIG_ENDIAN   0
 #include "aes_helper.c"
+#include "aesni_helper.c"
 
 static const sph_u32 IV224[] = {
 	C32(0x6774F31C), C32(0x990AE210), C32(0xC87D4274), C32(0xC9546371),
@@ -1475,6 +1476,120 @@ c512(sph_shavite_big_context *sc, const void *msg)
 
 #endif
 
+#if SPH_AESNI
+
+/*
+ * AES-NI version of c512(). With the little-endian word order used
+ * above, one 128-bit lane of the state or of the key schedule is one
+ * xmm register and AES_ROUND_NOKEY is aesenc with a zero key, so a key
+ * addition followed by an unkeyed round folds into a single aesenc.
+ */
+
+#pragma GCC push_options
+#pragma GCC target("aes,ssse3")
+
+static void
+c512_aesni(sph_shavite_big_context *sc, const void *msg)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i rk[112];
+	__m128i p0, p1, p2, p3, x, t;
+	int u, r, s;
+
+	for (u = 0; u < 8; u ++)
+		rk[u] = _mm_loadu_si128((const __m128i *)msg + u);
+	u = 8;
+	for (;;) {
+		for (s = 0; s < 4; s ++) {
+			x = _mm_shuffle_epi32(rk[u - 8], 0x39);
+			x = _mm_aesenc_si128(x, zero);
+			rk[u] = _mm_xor_si128(x, rk[u - 1]);
+			if (u == 8) {
+				rk[u] = _mm_xor_si128(rk[u],
+					_mm_set_epi32(~sc->count3, sc->count2,
+					sc->count1, sc->count0));
+			} else if (u == 110) {
+				rk[u] = _mm_xor_si128(rk[u],
+					_mm_set_epi32(~sc->count2, sc->count3,
+					sc->count0, sc->count1));
+			}
+			u ++;
+
+			x = _mm_shuffle_epi32(rk[u - 8], 0x39);
+			x = _mm_aesenc_si128(x, zero);
+			rk[u] = _mm_xor_si128(x, rk[u - 1]);
+			if (u == 41) {
+				rk[u] = _mm_xor_si128(rk[u],
+					_mm_set_epi32(~sc->count0, sc->count1,
+					sc->count2, sc->count3));
+			} else if (u == 79) {
+				rk[u] = _mm_xor_si128(rk[u],
+					_mm_set_epi32(~sc->count1, sc->count0,
+					sc->count3, sc->count2));
+			}
+			u ++;
+		}
+		if (u == 112)
+			break;
+		for (s = 0; s < 8; s ++) {
+			rk[u] = _mm_xor_si128(rk[u - 8],
+				_mm_alignr_epi8(rk[u - 1], rk[u - 2], 4));
+			u ++;
+		}
+	}
+
+	p0 = _mm_loadu_si128((const __m128i *)sc->h + 0);
+	p1 = _mm_loadu_si128((const __m128i *)sc->h + 1);
+	p2 = _mm_loadu_si128((const __m128i *)sc->h + 2);
+	p3 = _mm_loadu_si128((const __m128i *)sc->h + 3);
+	u = 0;
+	for (r = 0; r < 14; r ++) {
+		x = _mm_xor_si128(p1, rk[u]);
+		x = _mm_aesenc_si128(x, rk[u + 1]);
+		x = _mm_aesenc_si128(x, rk[u + 2]);
+		x = _mm_aesenc_si128(x, rk[u + 3]);
+		x = _mm_aesenc_si128(x, zero);
+		p0 = _mm_xor_si128(p0, x);
+		x = _mm_xor_si128(p3, rk[u + 4]);
+		x = _mm_aesenc_si128(x, rk[u + 5]);
+		x = _mm_aesenc_si128(x, rk[u + 6]);
+		x = _mm_aesenc_si128(x, rk[u + 7]);
+		x = _mm_aesenc_si128(x, zero);
+		p2 = _mm_xor_si128(p2, x);
+		u += 8;
+
+		t = p3;
+		p3 = p2;
+		p2 = p1;
+		p1 = p0;
+		p0 = t;
+	}
+	t = _mm_loadu_si128((const __m128i *)sc->h + 0);
+	_mm_storeu_si128((__m128i *)sc->h + 0, _mm_xor_si128(t, p0));
+	t = _mm_loadu_si128((const __m128i *)sc->h + 1);
+	_mm_storeu_si128((__m128i *)sc->h + 1, _mm_xor_si128(t, p1));
+	t = _mm_loadu_si128((const __m128i *)sc->h + 2);
+	_mm_storeu_si128((__m128i *)sc->h + 2, _mm_xor_si128(t, p2));
+	t = _mm_loadu_si128((const __m128i *)sc->h + 3);
+	_mm_storeu_si128((__m128i *)sc->h + 3, _mm_xor_si128(t, p3));
+}
+
+#pragma GCC pop_options
+
+#endif
+
+static void
+shavite_big_compress(sph_shavite_big_context *sc, const void *msg)
+{
+#if SPH_AESNI
+	if (sph_aesni_level() != SPH_AESNI_NONE) {
+		c512_aesni(sc, msg);
+		return;
+	}
+#endif
+	c512(sc, msg);
+}
+
 static void
 shavite_small_init(sph_shavite_small_context *sc, const sph_u32 *iv)
 {
@@ -1590,7 +1705,7 @@ shavite_big_core(sph_shavite_big_context *sc, const void *data, size_t len)
 					}
 				}
 			}
-			c512(sc, buf);
+			shavite_big_compress(sc, buf);
 			ptr = 0;
 		}
 	}
@@ -1624,7 +1739,7 @@ shavite_big_close(sph_shavite_big_context *sc,
 	} else {
 		buf[ptr ++] = z;
 		memset(buf + ptr, 0, 128 - ptr);
-		c512(sc, buf);
+		shavite_big_compress(sc, buf);
 		memset(buf, 0, 110);
 		sc->count0 = sc->count1 = sc->count2 = sc->count3 = 0;
 	}
@@ -1634,7 +1749,7 @@ shavite_big_close(sph_shavite_big_context *sc,
 	sph_enc32le(buf + 122, count3);
 	buf[126] = out_size_w32 << 5;
 	buf[127] = out_size_w32 >> 3;
-	c512(sc, buf);
+	shavite_big_compress(sc, buf);
 	for (u = 0; u < out_size_w32; u ++)
 		sph_enc32le((unsigned char *)dst + (u << 2), sc->h[u]);
 }
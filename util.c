@@ -27,10 +27,19 @@
 #include <mstcpip.h>
 #else
 #include <errno.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "compat.h"
 #include "miner.h"
 #include "elist.h"
@@ -446,44 +455,78 @@ err_out:
 	return NULL;
 }
 
+static const char hex_digits[] = "0123456789abcdef";
+
+/* value + 1 of each hex digit, 0 for anything else */
+static const unsigned char hex_values[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/* hex of p[0..len-1] in s[0..2*len], returns the end of s (its '\0') */
+char *bin2hex_buf(char *s, const unsigned char *p, size_t len)
+{
+#ifdef __SSE2__
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i alpha = _mm_set1_epi8('a' - '0' - 10);
+
+	for (; len >= 16; len -= 16, p += 16, s += 32) {
+		__m128i v = _mm_loadu_si128((const __m128i *) p);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+		__m128i lo = _mm_and_si128(v, mask);
+
+		hi = _mm_add_epi8(_mm_add_epi8(hi, zero),
+			_mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, zero),
+			_mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha));
+		_mm_storeu_si128((__m128i *) s, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (s + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+#endif
+	for (; len; len--, p++) {
+		*s++ = hex_digits[*p >> 4];
+		*s++ = hex_digits[*p & 0x0f];
+	}
+	*s = '\0';
+	return s;
+}
+
 char *bin2hex(const unsigned char *p, size_t len)
 {
-	int i;
 	char *s = malloc((len * 2) + 1);
 	if (!s)
 		return NULL;
 
-	for (i = 0; i < len; i++)
-		sprintf(s + (i * 2), "%02x", (unsigned int) p[i]);
-
+	bin2hex_buf(s, p, len);
 	return s;
 }
 
 bool hex2bin(unsigned char *p, const char *hexstr, size_t len)
 {
-	char hex_byte[3];
-	char *ep;
+	const unsigned char *h = (const unsigned char *) hexstr;
 
-	hex_byte[2] = '\0';
+	while (*h && len) {
+		unsigned char hi = hex_values[h[0]], lo;
 
-	while (*hexstr && len) {
-		if (!hexstr[1]) {
+		if (!h[1]) {
 			applog(LOG_ERR, "hex2bin str truncated");
 			return false;
 		}
-		hex_byte[0] = hexstr[0];
-		hex_byte[1] = hexstr[1];
-		*p = (unsigned char) strtol(hex_byte, &ep, 16);
-		if (*ep) {
-			applog(LOG_ERR, "hex2bin failed on '%s'", hex_byte);
+		lo = hex_values[h[1]];
+		if (!hi || !lo) {
+			applog(LOG_ERR, "hex2bin failed on '%.2s'", (const char *) h);
 			return false;
 		}
-		p++;
-		hexstr += 2;
+		*p++ = ((hi - 1) << 4) | (lo - 1);
+		h += 2;
 		len--;
 	}
 
-	return (len == 0 && *hexstr == 0) ? true : false;
+	return (len == 0 && *h == 0) ? true : false;
 }
 
 /* Subtract the `struct timeval' values X and Y,
@@ -620,7 +663,8 @@ bool stratum_send_line(struct stratum_ctx *sctx, char *s)
 		applog(LOG_DEBUG, "> %s", s);
 
 	pthread_mutex_lock(&sctx->sock_lock);
-	ret = send_line(sctx->sock, s);
+	if (sctx->curl)
+		ret = send_line(sctx->sock, s);
 	pthread_mutex_unlock(&sctx->sock_lock);
 
 	return ret;
@@ -640,84 +684,230 @@ static bool socket_full(curl_socket_t sock, int timeout)
 	return false;
 }
 
-bool stratum_socket_full(struct stratum_ctx *sctx, int timeout)
+#define RBUFSIZE 2048
+#define RBUFMAX (1 << 20)	/* longest line we take from a pool */
+
+/* end of the first complete line in sockbuf, or NULL */
+static char *stratum_buffered_line(struct stratum_ctx *sctx)
 {
-	return strlen(sctx->sockbuf) || socket_full(sctx->sock, timeout);
-}
+	char *nl = memchr(sctx->sockbuf + sctx->sockbuf_scan, '\n',
+		sctx->sockbuf_end - sctx->sockbuf_scan);
 
-#define RBUFSIZE 2048
-#define RECVSIZE (RBUFSIZE - 4)
+	if (!nl)
+		sctx->sockbuf_scan = sctx->sockbuf_end;
+	return nl;
+}
 
-static void stratum_buffer_append(struct stratum_ctx *sctx, const char *s)
+/* append what the socket has to sockbuf, false on EOF or error */
+static bool stratum_fill(struct stratum_ctx *sctx)
 {
-	size_t old, new;
+	ssize_t n;
+
+	if (sctx->sockbuf_start == sctx->sockbuf_end)
+		sctx->sockbuf_start = sctx->sockbuf_scan = sctx->sockbuf_end = 0;
+	if (sctx->sockbuf_size - sctx->sockbuf_end < RBUFSIZE / 2) {
+		/* move the partial line down, once per buffer rather than per line */
+		if (sctx->sockbuf_start) {
+			memmove(sctx->sockbuf, sctx->sockbuf + sctx->sockbuf_start,
+				sctx->sockbuf_end - sctx->sockbuf_start);
+			sctx->sockbuf_scan -= sctx->sockbuf_start;
+			sctx->sockbuf_end -= sctx->sockbuf_start;
+			sctx->sockbuf_start = 0;
+		}
+		if (sctx->sockbuf_size - sctx->sockbuf_end < RBUFSIZE / 2) {
+			char *buf;
 
-	old = strlen(sctx->sockbuf);
-	new = old + strlen(s) + 1;
-	if (new >= sctx->sockbuf_size) {
-		sctx->sockbuf_size = new + (RBUFSIZE - (new % RBUFSIZE));
-		sctx->sockbuf = realloc(sctx->sockbuf, sctx->sockbuf_size);
+			if (sctx->sockbuf_size >= RBUFMAX) {
+				applog(LOG_ERR, "stratum line too long");
+				return false;
+			}
+			buf = realloc(sctx->sockbuf, sctx->sockbuf_size * 2);
+			if (!buf)
+				return false;
+			sctx->sockbuf = buf;
+			sctx->sockbuf_size *= 2;
+		}
 	}
-	strcpy(sctx->sockbuf + old, s);
+
+	n = recv(sctx->sock, sctx->sockbuf + sctx->sockbuf_end,
+		sctx->sockbuf_size - sctx->sockbuf_end, 0);
+	if (!n)
+		return false;
+	if (n < 0)
+		return socket_blocks();
+	sctx->sockbuf_end += n;
+	return true;
+}
+
+bool stratum_socket_full(struct stratum_ctx *sctx, int timeout)
+{
+	return stratum_buffered_line(sctx) || socket_full(sctx->sock, timeout);
 }
 
 char *stratum_recv_line(struct stratum_ctx *sctx)
 {
-	ssize_t len, buflen;
-	char *tok, *sret = NULL;
+	time_t rstart = time(NULL);
+	char *line, *nl;
 
-	if (!strstr(sctx->sockbuf, "\n")) {
-		bool ret = true;
-		time_t rstart;
+	do {
+		while (!(nl = stratum_buffered_line(sctx))) {
+			int left = 60 - (int) (time(NULL) - rstart);
 
-		time(&rstart);
-		if (!socket_full(sctx->sock, 60)) {
-			applog(LOG_ERR, "stratum_recv_line timed out");
-			goto out;
-		}
-		do {
-			char s[RBUFSIZE];
-			ssize_t n;
-
-			memset(s, 0, RBUFSIZE);
-			n = recv(sctx->sock, s, RECVSIZE, 0);
-			if (!n) {
-				ret = false;
-				break;
+			if (left <= 0 || !socket_full(sctx->sock, left)) {
+				applog(LOG_ERR, "stratum_recv_line timed out");
+				return NULL;
+			}
+			if (!stratum_fill(sctx)) {
+				applog(LOG_ERR, "stratum_recv_line failed");
+				return NULL;
 			}
-			if (n < 0) {
-				if (!socket_blocks() || !socket_full(sctx->sock, 1)) {
-					ret = false;
-					break;
-				}
-			} else
-				stratum_buffer_append(sctx, s);
-		} while (time(NULL) - rstart < 60 && !strstr(sctx->sockbuf, "\n"));
-
-		if (!ret) {
-			applog(LOG_ERR, "stratum_recv_line failed");
-			goto out;
 		}
-	}
+		line = sctx->sockbuf + sctx->sockbuf_start;
+		sctx->sockbuf_start = sctx->sockbuf_scan = nl + 1 - sctx->sockbuf;
+		*nl = '\0';
+		if (nl > line && nl[-1] == '\r')
+			nl[-1] = '\0';
+	} while (!*line);
 
-	buflen = strlen(sctx->sockbuf);
-	tok = strtok(sctx->sockbuf, "\n");
-	if (!tok) {
-		applog(LOG_ERR, "stratum_recv_line failed to parse a newline-terminated string");
-		goto out;
+	if (opt_protocol)
+		applog(LOG_DEBUG, "< %s", line);
+	return line;
+}
+
+void stratum_poll_init(struct stratum_poll *p)
+{
+	memset(p, 0, sizeof(*p));
+#ifdef HAVE_SYS_EPOLL_H
+	p->epfd = epoll_create(STRATUM_POLL_MAX);
+#else
+	p->epfd = -1;
+#endif
+}
+
+bool stratum_poll_add(struct stratum_poll *p, struct stratum_ctx *sctx)
+{
+	if (p->n == STRATUM_POLL_MAX)
+		return false;
+	p->conn_id[p->n] = sctx->conn_id - 1;	/* not registered yet */
+	p->ctx[p->n++] = sctx;
+	return true;
+}
+
+void stratum_poll_del(struct stratum_poll *p, struct stratum_ctx *sctx)
+{
+	int i;
+
+	for (i = 0; i < p->n && p->ctx[i] != sctx; i++)
+		;
+	if (i == p->n)
+		return;
+#ifdef HAVE_SYS_EPOLL_H
+	if (p->epfd >= 0 && sctx->curl && p->conn_id[i] == sctx->conn_id) {
+		struct epoll_event e;	/* for kernels before 2.6.9 */
+		epoll_ctl(p->epfd, EPOLL_CTL_DEL, sctx->sock, &e);
+	}
+#endif
+	/* the last one moves here, and registers again with its new index */
+	p->n--;
+	if (i < p->n) {
+		p->ctx[i] = p->ctx[p->n];
+		p->conn_id[i] = p->ctx[i]->conn_id - 1;
 	}
-	sret = strdup(tok);
-	len = strlen(sret);
+	if (p->next > p->n)
+		p->next = 0;
+}
 
-	if (buflen > len + 1)
-		memmove(sctx->sockbuf, sctx->sockbuf + len + 1, buflen - len + 1);
-	else
-		sctx->sockbuf[0] = '\0';
+/* index of a connected context with input (or EOF), -1 on timeout ms */
+static int stratum_poll_ready(struct stratum_poll *p, int timeout)
+{
+	int i;
 
-out:
-	if (sret && opt_protocol)
-		applog(LOG_DEBUG, "< %s", sret);
-	return sret;
+#ifdef HAVE_SYS_EPOLL_H
+	if (p->epfd >= 0) {
+		struct epoll_event ev[STRATUM_POLL_MAX];
+		int n, k;
+
+		/* register the sockets of new connections, a closed one has
+		 * left the set by itself */
+		for (i = 0; i < p->n; i++) {
+			struct stratum_ctx *sctx = p->ctx[i];
+			struct epoll_event e;
+
+			if (!sctx->curl || p->conn_id[i] == sctx->conn_id)
+				continue;
+			e.events = EPOLLIN;
+			e.data.u32 = i;
+			if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, sctx->sock, &e)
+					&& errno == EEXIST)
+				epoll_ctl(p->epfd, EPOLL_CTL_MOD, sctx->sock, &e);
+			p->conn_id[i] = sctx->conn_id;
+		}
+		n = epoll_wait(p->epfd, ev, STRATUM_POLL_MAX, timeout);
+		for (k = 0; k < n; k++) {
+			i = ev[k].data.u32;
+			if (p->ctx[i]->curl)
+				return i;
+		}
+		return -1;
+	}
+#endif
+	{
+		struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+		curl_socket_t maxfd = 0;
+		bool any = false;
+		fd_set rd;
+
+		FD_ZERO(&rd);
+		for (i = 0; i < p->n; i++) {
+			if (!p->ctx[i]->curl)
+				continue;
+			FD_SET(p->ctx[i]->sock, &rd);
+			if (p->ctx[i]->sock > maxfd)
+				maxfd = p->ctx[i]->sock;
+			any = true;
+		}
+		if (!any) {
+			/* nothing connected yet, still wait like epoll does */
+			select(0, NULL, NULL, NULL, &tv);
+			return -1;
+		}
+		if (select(maxfd + 1, &rd, NULL, NULL, &tv) <= 0)
+			return -1;
+		for (i = 0; i < p->n; i++)
+			if (p->ctx[i]->curl && FD_ISSET(p->ctx[i]->sock, &rd))
+				return i;
+		return -1;
+	}
+}
+
+/*
+ * A connected context with a complete line to stratum_recv_line(), or
+ * whose connection is gone, so stratum_recv_line() fails. NULL after
+ * timeout milliseconds without either.
+ */
+struct stratum_ctx *stratum_poll_wait(struct stratum_poll *p, int timeout)
+{
+	uint64_t deadline = metrics_usec() + (uint64_t) timeout * 1000;
+	int i, k;
+
+	for (;;) {
+		int64_t left;
+
+		/* buffered lines first, the contexts in turn */
+		for (k = 0; k < p->n; k++) {
+			i = (p->next + k) % p->n;
+			if (p->ctx[i]->curl && stratum_buffered_line(p->ctx[i])) {
+				p->next = i + 1;
+				return p->ctx[i];
+			}
+		}
+		left = (int64_t) (deadline - metrics_usec()) / 1000;
+		i = stratum_poll_ready(p, left > 0 ? (int) left : 0);
+		if (i < 0)
+			return NULL;
+		if (!stratum_fill(p->ctx[i]))
+			return p->ctx[i];
+	}
 }
 
 #if LIBCURL_VERSION_NUM >= 0x071101
@@ -746,10 +936,11 @@ bool stratum_connect(struct stratum_ctx *sctx, const char *url)
 	}
 	curl = sctx->curl;
 	if (!sctx->sockbuf) {
-		sctx->sockbuf = calloc(RBUFSIZE, 1);
+		sctx->sockbuf = malloc(RBUFSIZE);
 		sctx->sockbuf_size = RBUFSIZE;
 	}
-	sctx->sockbuf[0] = '\0';
+	sctx->sockbuf_start = sctx->sockbuf_scan = sctx->sockbuf_end = 0;
+	sctx->conn_id++;
 	pthread_mutex_unlock(&sctx->sock_lock);
 
 	if (url != sctx->url) {
@@ -804,7 +995,7 @@ void stratum_disconnect(struct stratum_ctx *sctx)
 	if (sctx->curl) {
 		curl_easy_cleanup(sctx->curl);
 		sctx->curl = NULL;
-		sctx->sockbuf[0] = '\0';
+		sctx->sockbuf_start = sctx->sockbuf_scan = sctx->sockbuf_end = 0;
 	}
 	pthread_mutex_unlock(&sctx->sock_lock);
 }
@@ -857,7 +1048,7 @@ start:
 		goto out;
 	}
 
-	if (!socket_full(sctx->sock, 30)) {
+	if (!stratum_socket_full(sctx, 30)) {
 		applog(LOG_ERR, "stratum_subscribe timed out");
 		goto out;
 	}
@@ -867,7 +1058,6 @@ start:
 		goto out;
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -948,7 +1138,7 @@ bool subscribe_extranonce(struct stratum_ctx *sctx)
 		goto out;
 
 	while (1) {
-		if (!socket_full(sctx->sock, 2)) {
+		if (!stratum_socket_full(sctx, 2)) {
 			applog(LOG_DEBUG, "Timed out waiting for response extranonce.subscribe");
 			/* some pool doesnt send anything, so this is normal */
 			ret = true;
@@ -959,11 +1149,9 @@ bool subscribe_extranonce(struct stratum_ctx *sctx)
 			goto out;
 		if (!stratum_handle_method(sctx, sret))
 			break;
-		free(sret);
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1014,11 +1202,9 @@ bool stratum_authorize(struct stratum_ctx *sctx, const char *user, const char *p
 			goto out;
 		if (!stratum_handle_method(sctx, sret))
 			break;
-		free(sret);
 	}
 
 	val = JSON_LOADS(sret, &err);
-	free(sret);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
 		goto out;
@@ -1093,18 +1279,18 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 		applog(LOG_ERR, "Stratum notify: invalid parameters");
 		goto out;
 	}
-	merkle = malloc(merkle_count * sizeof(char *));
+	/* the branch pointers and the branches in one block */
+	merkle = malloc(merkle_count * (sizeof(char *) + 32) + 1);
+	if (unlikely(!merkle))
+		goto out;
 	for (i = 0; i < merkle_count; i++) {
 		const char *s = json_string_value(json_array_get(merkle_arr, i));
-		if (!s || strlen(s) != 64) {
-			while (i--)
-				free(merkle[i]);
+		merkle[i] = (unsigned char *) (merkle + merkle_count) + 32 * i;
+		if (!s || strlen(s) != 64 || !hex2bin(merkle[i], s, 32)) {
 			free(merkle);
 			applog(LOG_ERR, "Stratum notify: invalid Merkle branch");
 			goto out;
 		}
-		merkle[i] = malloc(32);
-		hex2bin(merkle[i], s, 32);
 	}
 
 	pthread_mutex_lock(&sctx->work_lock);
@@ -1127,8 +1313,6 @@ static bool stratum_notify(struct stratum_ctx *sctx, json_t *params)
 	if (has_claimtrie)
 		hex2bin(sctx->job.claimtrie, claimtrie, 32);
 
-	for (i = 0; i < sctx->job.merkle_count; i++)
-		free(sctx->job.merkle[i]);
 	free(sctx->job.merkle);
 	sctx->job.merkle = merkle;
 	sctx->job.merkle_count = merkle_count;
@@ -1148,6 +1332,81 @@ out:
 	return ret;
 }
 
+/*
+ * Job-level copy of a coinbase and its merkle branch from which merkle
+ * roots are built for any extranonce2. When the coinbase is hashed with
+ * sha256 or sha256d, the whole blocks in front of extranonce2 are hashed
+ * once here, and each root only costs the coinbase tail and the branch.
+ */
+struct coinbase_tmpl *coinbase_tmpl_new(const struct stratum_job *job,
+	size_t xnonce2_size,
+	void (*gen_hash)(unsigned char *, const unsigned char *, int),
+	void (*gen_hash2)(unsigned char *, const unsigned char *, int))
+{
+	struct coinbase_tmpl *t;
+	size_t size;
+	int i;
+
+	if (!job->coinbase || !xnonce2_size)
+		return NULL;
+	size = sizeof(*t) + job->merkle_count * 32 + job->coinbase_size;
+	t = calloc(1, size);
+	if (unlikely(!t))
+		return NULL;
+	t->coinbase_size = job->coinbase_size;
+	t->xnonce2_off = job->xnonce2 - job->coinbase;
+	t->xnonce2_size = xnonce2_size;
+	t->gen_hash = gen_hash;
+	t->gen_hash2 = gen_hash2;
+	t->merkle_count = job->merkle_count;
+	t->merkle = (unsigned char (*)[32]) (t + 1);
+	for (i = 0; i < t->merkle_count; i++)
+		memcpy(t->merkle[i], job->merkle[i], 32);
+	t->coinbase = (unsigned char *) (t->merkle + t->merkle_count);
+	memcpy(t->coinbase, job->coinbase, t->coinbase_size);
+
+	if (gen_hash == sha256d)
+		t->resume = sha256d_resume;
+	else if (gen_hash == sha256)
+		t->resume = sha256_resume;
+	if (t->resume) {
+		t->midstate_len = t->xnonce2_off & ~(size_t) 63;
+		sha256_midstate(t->midstate, t->coinbase, t->midstate_len / 64);
+	}
+	return t;
+}
+
+/* merkle root (in merkle_root[0..31], 64 bytes of room) for xnonce2 */
+void coinbase_tmpl_merkle(const struct coinbase_tmpl *t,
+	const unsigned char *xnonce2, unsigned char *merkle_root)
+{
+	unsigned char buf[1024], *tail;
+	size_t tail_len = t->coinbase_size - t->midstate_len;
+	int i;
+
+	tail = tail_len > sizeof(buf) ? malloc(tail_len) : buf;
+	if (unlikely(!tail)) {
+		applog(LOG_ERR, "coinbase_tmpl_merkle OOM");
+		memset(merkle_root, 0, 32);
+		return;
+	}
+	memcpy(tail, t->coinbase + t->midstate_len, tail_len);
+	memcpy(tail + t->xnonce2_off - t->midstate_len, xnonce2, t->xnonce2_size);
+
+	if (t->resume)
+		t->resume(merkle_root, t->midstate, (int) t->midstate_len,
+			tail, (int) tail_len);
+	else
+		t->gen_hash(merkle_root, tail, (int) tail_len);
+	if (tail != buf)
+		free(tail);
+
+	for (i = 0; i < t->merkle_count; i++) {
+		memcpy(merkle_root + 32, t->merkle[i], 32);
+		t->gen_hash2(merkle_root, merkle_root, 64);
+	}
+}
+
 static bool stratum_set_difficulty(struct stratum_ctx *sctx, json_t *params)
 {
 	double diff;
@@ -1280,16 +1539,37 @@ static bool stratum_show_message(struct stratum_ctx *sctx, json_t *id, json_t *p
 
 bool stratum_handle_method(struct stratum_ctx *sctx, const char *s)
 {
-	json_t *val, *id, *params;
 	json_error_t err;
-	const char *method;
-	bool ret = false;
+	json_t *val;
+	bool ret;
 
 	val = JSON_LOADS(s, &err);
 	if (!val) {
 		applog(LOG_ERR, "JSON decode failed(%d): %s", err.line, err.text);
-		goto out;
+		return false;
+	}
+	ret = stratum_handle_method_json(sctx, val);
+	/* the handshake's job lines, for the proxy clients to start on */
+	if (ret && opt_proxy_listen) {
+		const char *method = json_string_value(json_object_get(val, "method"));
+		char **line = !strcmp(method, "mining.notify") ? &sctx->proxy_notify
+			: !strcmp(method, "mining.set_difficulty") ? &sctx->proxy_diff
+			: NULL;
+		if (line) {
+			free(*line);
+			*line = strdup(s);
+		}
 	}
+	json_decref(val);
+	return ret;
+}
+
+/* false if val is not a method call we know, e.g. a response */
+bool stratum_handle_method_json(struct stratum_ctx *sctx, json_t *val)
+{
+	json_t *id, *params;
+	const char *method;
+	bool ret = false;
 
 	method = json_string_value(json_object_get(val, "method"));
 	if (!method)
@@ -1330,9 +1610,6 @@ bool stratum_handle_method(struct stratum_ctx *sctx, const char *s)
     }
 
 out:
-	if (val)
-		json_decref(val);
-
 	return ret;
 }
 
@@ -1449,6 +1726,99 @@ out:
 	return rval;
 }
 
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* buffers below this stay on regular pages */
+#define HUGEPAGE_MIN (HUGEPAGE_SIZE / 2)
+
+static const char *scratchpad_backing[] = {
+	"heap", "4K pages", "transparent huge pages", "huge pages"
+};
+
+#ifndef WIN32
+static size_t scratchpad_len(size_t size)
+{
+	size_t align = size >= HUGEPAGE_MIN ? HUGEPAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+	return (size + align - 1) & ~(align - 1);
+}
+#endif
+
+/*
+ * Allocate a scratchpad for the memory-hard algos. With --hugepages,
+ * explicit huge pages (vm.nr_hugepages) are tried first; otherwise, or
+ * when none are reserved, a 2M aligned anonymous mapping is flagged for
+ * transparent huge pages. The result is always at least 64 byte aligned.
+ */
+void *scratchpad_alloc(size_t size, const char *name)
+{
+	void *p = NULL;
+	int backing = 0;
+#ifndef WIN32
+	size_t len = scratchpad_len(size);
+
+#ifdef MAP_HUGETLB
+	if (opt_hugepages && len >= HUGEPAGE_SIZE) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED)
+			p = NULL;
+		else
+			backing = 3;
+	}
+#endif
+	if (!p && len >= HUGEPAGE_SIZE) {
+		/* over-map, then trim so the buffer starts on a 2M boundary */
+		uint8_t *m = mmap(NULL, len + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m != MAP_FAILED) {
+			uint8_t *a = (uint8_t *) (((uintptr_t) m + HUGEPAGE_SIZE - 1) & ~(uintptr_t) (HUGEPAGE_SIZE - 1));
+			if (a > m)
+				munmap(m, a - m);
+			munmap(a + len, (m + HUGEPAGE_SIZE) - a);
+			p = a;
+			backing = 1;
+#ifdef MADV_HUGEPAGE
+			if (!madvise(p, len, MADV_HUGEPAGE))
+				backing = 2;
+#endif
+		}
+	}
+	if (!p && len < HUGEPAGE_SIZE) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			p = NULL;
+		else
+			backing = 1;
+	}
+#else
+	p = _aligned_malloc(size, 64);
+#endif
+	if (p) {
+		/* fault it in now: the pages land on the (pinned) caller's node
+		 * and the first hashes don't pay for the page faults */
+		memset(p, 0, size);
+		if (opt_hugepages || opt_debug)
+			applog(LOG_INFO, "%s: %lu KiB scratchpad on %s",
+				name, (unsigned long) (size >> 10), scratchpad_backing[backing]);
+	} else
+		applog(LOG_ERR, "%s: unable to allocate a %lu KiB scratchpad",
+			name, (unsigned long) (size >> 10));
+	return p;
+}
+
+/* size must be the one given to scratchpad_alloc() */
+void scratchpad_free(void *p, size_t size)
+{
+	if (!p)
+		return;
+#ifndef WIN32
+	munmap(p, scratchpad_len(size));
+#else
+	_aligned_free(p);
+#endif
+}
+
 /* sprintf can be used in applog */
 static char* format_hash(char* buf, uint8_t *hash)
 {
@@ -1469,6 +1839,180 @@ void applog_hash(void *hash)
 #define printpfx(n,h) \
 	printf("%11s: %s\n", n, format_hash(s, (uint8_t*) h))
 
+/*
+ * Merkle roots of a pool job with a large coinbase, built the way
+ * stratum_gen_work does it and with the coinbase template. Only what is
+ * in front of extranonce2 (coinb1) can be skipped, outputs in coinb2 are
+ * hashed either way.
+ */
+static void print_merkle_bench(void)
+{
+	const int xn1_size = 4, xn2_size = 4, coinb1_size = 2000;
+	const int coinb2_size = 2000, branch = 12, loops = 2000;
+	unsigned char root[64], ref[64], *merkle[12];
+	struct stratum_job job = { 0 };
+	struct coinbase_tmpl *t;
+	struct timeval tv_start, tv_end, diff;
+	double us_full, us_tmpl;
+	int i, k, bad = 0;
+
+	job.coinbase_size = coinb1_size + xn1_size + xn2_size + coinb2_size;
+	job.coinbase = malloc(job.coinbase_size);
+	for (i = 0; i < (int) job.coinbase_size; i++)
+		job.coinbase[i] = (unsigned char) (i * 7 + 1);
+	job.xnonce2 = job.coinbase + coinb1_size + xn1_size;
+	job.merkle_count = branch;
+	job.merkle = merkle;
+	for (i = 0; i < branch; i++) {
+		merkle[i] = malloc(32);
+		memset(merkle[i], i, 32);
+	}
+	t = coinbase_tmpl_new(&job, xn2_size, sha256d, sha256d);
+
+	gettimeofday(&tv_start, NULL);
+	for (k = 0; k < loops; k++) {
+		memcpy(job.xnonce2, &k, xn2_size);
+		sha256d(ref, job.coinbase, (int) job.coinbase_size);
+		for (i = 0; i < branch; i++) {
+			memcpy(ref + 32, merkle[i], 32);
+			sha256d(ref, ref, 64);
+		}
+	}
+	gettimeofday(&tv_end, NULL);
+	timeval_subtract(&diff, &tv_end, &tv_start);
+	us_full = (diff.tv_sec * 1e6 + diff.tv_usec) / loops;
+
+	gettimeofday(&tv_start, NULL);
+	for (k = 0; k < loops; k++)
+		coinbase_tmpl_merkle(t, (unsigned char *) &k, root);
+	gettimeofday(&tv_end, NULL);
+	timeval_subtract(&diff, &tv_end, &tv_start);
+	us_tmpl = (diff.tv_sec * 1e6 + diff.tv_usec) / loops;
+
+	/* same roots? */
+	for (k = 0; k < 16; k++) {
+		memcpy(job.xnonce2, &k, xn2_size);
+		sha256d(ref, job.coinbase, (int) job.coinbase_size);
+		for (i = 0; i < branch; i++) {
+			memcpy(ref + 32, merkle[i], 32);
+			sha256d(ref, ref, 64);
+		}
+		coinbase_tmpl_merkle(t, (unsigned char *) &k, root);
+		bad += !!memcmp(root, ref, 32);
+	}
+
+	printf("MERKLE ROOT, coinb1 %d + coinb2 %d bytes, %d branches:\n\n",
+		coinb1_size, coinb2_size, branch);
+	printf("%11s: %.2f us\n", "full", us_full);
+	printf("%11s: %.2f us%s\n", "midstate", us_tmpl, bad ? " MISMATCH" : "");
+	printf("\n");
+
+	free(t);
+	for (i = 0; i < branch; i++)
+		free(merkle[i]);
+	free(job.coinbase);
+}
+
+/* block header hashed by --cputest and --selftest */
+static const char hash_test_header[] = "700000005d385ba114d079970b29a9418fd0549e7d68a95c7f168621a314201000000000578586d149fd07b22f3a8a347c516de7052f034d2b76ff68e0d6ecff9b77a45489e3fd511732011df0731000";
+
+/* known answers for hash_test_header, checked by --selftest */
+static const struct {
+	const char *algo;
+	const char *hash;
+} hash_test_vectors[] = {
+	{ "scrypt",       "eda5ef80dfc08e2a932ac84cde1a27e2be5b77033797ff1235a9d7df5ef3a3f2" },
+	{ "scrypt-jane",  "c93ce3bdf0a9362883662ff5adfbca7e04f6fc0846729f377c5b11f9bce0191f" },
+	{ "dscrypt",      "25c3208eec754b936736d5377726d52d38ac5dee3b4f7345d204123d5bc87a29" },
+	{ "argon2",       "b9a1083170912d20253350974a7dbaff695df7b51fd1b1d634afdf1a4f1aa87f" },
+	{ "yescrypt",     "b6c1929b22477a27d5c471ade0b23bbcec9083860c1d8393fe108af17101e994" },
+	{ "sha256d",      "bcceb5652946f21cabb50f9d794e6a84b030cbd2b2ab24cc38cdca5b21132949" },
+	{ "blake",        "3f814f1b90ca9e5f87a3dfa775786f153b196c9e24618a76a9367f4949e7c969" },
+	{ "blakecoin",    "a04e04c503d4db10542909031590c13ad4c269d5915e754c40eb4a758a994b98" },
+	{ "vanilla",      "a04e04c503d4db10542909031590c13ad4c269d5915e754c40eb4a758a994b98" },
+	{ "decred",       "3f814f1b90ca9e5f87a3dfa775786f153b196c9e24618a76a9367f4949e7c969" },
+	{ "fresh",        "4ab91c4f488278645315225f63ee86db2e7db211c023d26304135470b6750c46" },
+	{ "lbry",         "e1bb76b55ba9570e13a563c6a15297e5a077e5b6481f67ecfcafffa1950fd88c" },
+	{ "hmq1725",      "7d975cb488dcf078499193b3caac5f27670670151e9e0b269305ca689fb2e046" },
+	{ "heavy",        "0687e6536fab70421a7c73f6f49a24fd5cc01cd448d378e9db2fa43bf1f2aae4" },
+	{ "keccak",       "de96b224d0cbb2632c16b9ce311dfbabc10d155c2f4f9883eb345e991e82ac9b" },
+	{ "twe",          "3bb0d398b54d5b3e70c04a6ac0e6465ab1191c1943c402a38fe821296c2d7e5f" },
+	{ "shavite3",     "93a2d00f47b0efae3846220d87f7c9f18e64442c043b850f32556527dd0a300a" },
+	{ "skein",        "c5286459ea4716b77ab979a1bc0198c996adb57d15fb848d99f7a85e83c7eee4" },
+	{ "skein2",       "1190002c81a1db2784ac8f49325538509d84aabcc02f6c08e7e5691403c9c3d1" },
+	{ "s3",           "81e66133f781c179c2c955f7d3d09407eac080e6f423c64704ab9957818cbb0c" },
+	{ "nist5",        "ca0edfc00512c126043532378752f9d69921b8ee61c0fdc0b66303e66a3573bb" },
+	{ "quark",        "cf63d08172a51b859e339a9cbcc2e1318cd08eda796eaf48733386f000000000" },
+	{ "qubit",        "c2674acc5050985aec4527ffb1faf548bace4c503d0220ef7601c5f2182c9f63" },
+	{ "pentablake",   "fa10373872f60649efbf18bfba6bd46cef2ff319c7a568d1179c37e0ec4d383e" },
+	{ "axiom",        "0eb5c1dc59c87ca81ac4dadb2f8c3845ad61ab6b383924000ade984b6b3bc36f" },
+	{ "timetravel",   "6c03b913978913d0ceeaa2669601fc2f63a92cdf2405dfbd027a8e43d389f6e5" },
+	{ "timetravel10", "82877bdc91ee7b3aaa52cddaadabbd8b18b811cc1645ed7dd92c5c8fdccab325" },
+	{ "sib",          "5923ca4a975a1726f7e4c59006603b128369732e951804f2740ce75f140425bd" },
+	{ "veltor",       "ab6ad267b5b47531072bb94658b99280cef68a8c67a0cfa8df08f94783dc2bf2" },
+	{ "x11",          "ff2ca7dfd56dd50d25e77bfef267b82ade47f74f931b416aef35c70096d9d7b3" },
+	{ "x13",          "919044ef2ce56c49a3933d2297f7a990d1eb2defd1e3d9779428ab58b2249227" },
+	{ "x14",          "123d785cd8a76cb07fc2367deda34788ef19a32447f021b136091d221d01b7a6" },
+	{ "x15",          "b753dc8c47d994ed12bde28553498de76127ccc20d906bfcb018ce00f50e137c" },
+	{ "xevan",        "9569d8347d836a14e6f37bdfa504e86c7cd800052666599fcae3beb334a16596" },
+	{ "lyra2re",      "811dd58dfe6bde0939d37061ef5300059dc4f3349574e2b1c753c13ea28768ff" },
+	{ "lyra2rev2",    "51663fc746ff81c4570490be865ecffaf52ab645999f78e0d66539c407241a73" },
+	{ "xzc",          "d90f36a425ae9004528f5e6d9eeeb8fd9cf76beb5d2cf5c13de74cfb9eb66da6" },
+	{ "groestl",      "96cd33ed0d05c964ddd57196a4c7c9b27a5006cbc98395dbc002e75f75858280" },
+	{ "myr-groestl",  "968d784d5fcdb97c21db3bfb0aa78e28535702336dc8d0f83976585bdc2d13f9" },
+	{ "myr-groestl2", "968d784d5fcdb97c21db3bfb0aa78e28535702336dc8d0f83976585bdc2d13f9" },
+	{ "pluck",        "e70197e8af17f0e72ca62a0fe04df0500dd3e687492d6b6e2b78df2f3d52fe95" },
+	{ "whirlcoin",    "40d97c3e903a4244a44ce305dc4c7b253770bd3907e3c98b3479d1318503f6bc" },
+	{ "whirlpoolx",   "f8b9e94f65df723fc4892451e22e72803c2aef9386a39e7802123c8860c36293" },
+	{ NULL, NULL }
+};
+
+/* init_contexts of algo, and for xzc the fixed coinbase it needs to hash
+ * a bare header (bench, selftest and the hash tests) */
+void algo_init_contexts(const algorithm_t *algo, int *n)
+{
+	if (algo->init_contexts)
+		algo->init_contexts(n);
+	if (algo->type == ALGO_XZC) {
+		unsigned char coinbase[128] = { 0 };
+		struct stratum_job job = { 0 };
+
+		hex2bin(coinbase, "0000000000000000000000000000000000000000000000000000000000000000000000ffffffff2703200000062f503253482f043d61105408", 57);
+		job.coinbase = coinbase;
+		algo->prepare_work(&job);
+	}
+}
+
+/* 1 if the algo hashes hash_test_header to its known answer, 0 if not,
+ * -1 when there is nothing to compare to */
+int check_hash_test(const algorithm_t *algo)
+{
+	unsigned char buf[128] = { 0 };
+	unsigned char hash[128] = { 0 }, expected[32];
+	int i, n = 1024, rc;
+
+	for (i = 0; hash_test_vectors[i].algo; i++)
+		if (!strcmp(hash_test_vectors[i].algo, algo->name))
+			break;
+	if (!hash_test_vectors[i].algo || (!algo->simplehash && algo->type != ALGO_SHA256D))
+		return -1;
+	hex2bin(expected, hash_test_vectors[i].hash, 32);
+	hex2bin(buf, hash_test_header, 80);
+
+	if (algo->type == ALGO_SCRYPTJANE)
+		n = 1388361600;
+	algo_init_contexts(algo, &n);
+	if (algo->simplehash)
+		algo->simplehash(hash, buf);
+	else
+		sha256d(hash, buf, 80);
+	rc = !memcmp(hash, expected, 32);
+	if (!rc)
+		applog(LOG_ERR, "%s: got %s", algo->name, format_hash((char *) buf, hash));
+	if (algo->free_contexts) algo->free_contexts(&n);
+	return rc;
+}
+
 void print_hash_tests(void)
 {
 	unsigned char *scratchbuf = NULL;
@@ -1480,7 +2024,7 @@ void print_hash_tests(void)
 
 	printf("CPU HASH ON EMPTY BUFFER RESULTS:\n\n");
 
-	hex2bin(buf, "700000005d385ba114d079970b29a9418fd0549e7d68a95c7f168621a314201000000000578586d149fd07b22f3a8a347c516de7052f034d2b76ff68e0d6ecff9b77a45489e3fd511732011df0731000", 80);
+	hex2bin(buf, hash_test_header, 80);
 
 	//buf[0] = 1; buf[64] = 2; // for endian tests
 
@@ -1489,14 +2033,7 @@ void print_hash_tests(void)
 		if (algo->type == ALGO_SCRYPTJANE) {
 			n = 1388361600;
 		}
-		if (algo->init_contexts) algo->init_contexts(&n);
-		if (algo->type == ALGO_XZC) {
-			char coinbase[128] = { 0 };
-			struct stratum_job job = { 0 };
-			hex2bin(coinbase, "0000000000000000000000000000000000000000000000000000000000000000000000ffffffff2703200000062f503253482f043d61105408", 57);
-			job.coinbase = coinbase;
-			algo->prepare_work(&job);
-		}
+		algo_init_contexts(algo, &n);
 		if (algo->simplehash) {
 			algo->simplehash(hash, buf);
 			printpfx(algo->name, hash);
@@ -1506,5 +2043,228 @@ void print_hash_tests(void)
 
 	printf("\n");
 
+	print_merkle_bench();
+
 	free(scratchbuf);
 }
+
+/* see prof_record() */
+#define PROF_RING	1024	/* latest samples kept per thread, power of 2 */
+#define PROF_BUCKETS	64	/* log2 of the ticks */
+
+struct prof_hist {
+	uint64_t count, sum, min, max;
+	uint64_t bucket[PROF_BUCKETS];
+};
+
+struct prof_slot {
+	const char *name;
+	int id;
+	struct prof_hist hist[PROF_STAGES];
+	uint32_t head;
+	struct {
+		uint32_t stage;
+		uint64_t ticks;
+	} ring[PROF_RING];
+};
+
+static const char *prof_names[PROF_STAGES] = {
+	"scanhash", "work_lock", "gen_work", "submit"
+};
+static struct prof_slot **prof_slots;
+static int prof_nslots;
+static uint64_t prof_ticks0;
+static struct timeval prof_tv0;
+static THREADLOCAL struct prof_slot *prof_self;
+
+/* only the owning thread writes a slot, prof_dump() may see it torn */
+void prof_record(int stage, uint64_t ticks)
+{
+	struct prof_slot *p = prof_self;
+	struct prof_hist *h;
+	uint32_t i;
+
+	if (unlikely(!p))
+		return;
+	h = &p->hist[stage];
+	if (!h->count || ticks < h->min)
+		h->min = ticks;
+	if (ticks > h->max)
+		h->max = ticks;
+	h->count++;
+	h->sum += ticks;
+	h->bucket[ticks ? 63 - __builtin_clzll(ticks) : 0]++;
+
+	i = p->head & (PROF_RING - 1);
+	p->ring[i].stage = stage;
+	p->ring[i].ticks = ticks;
+	__atomic_store_n(&p->head, p->head + 1, __ATOMIC_RELEASE);
+}
+
+/* the calling thread records into slot id from now on */
+void prof_thread(int id, const char *name)
+{
+	if (!opt_profile || id < 0 || id >= prof_nslots)
+		return;
+	prof_slots[id]->name = name;
+	prof_slots[id]->id = id;
+	prof_self = prof_slots[id];
+}
+
+/* names of the PROF_ALGO + i stages, set once by the algo */
+void prof_algo_stages(const char *const names[], int n)
+{
+	int i;
+
+	for (i = 0; i < n && PROF_ALGO + i < PROF_STAGES; i++)
+		prof_names[PROF_ALGO + i] = names[i];
+}
+
+static int prof_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+static void prof_format(char *buf, double us)
+{
+	if (us >= 1e6)
+		sprintf(buf, "%.2fs", us * 1e-6);
+	else if (us >= 1e3)
+		sprintf(buf, "%.2fms", us * 1e-3);
+	else
+		sprintf(buf, "%.2fus", us);
+}
+
+void prof_dump(void)
+{
+	uint64_t *recent;
+	struct timeval tv, diff;
+	double elapsed, per_us;
+	int i, st;
+
+	if (!prof_slots)
+		return;
+	gettimeofday(&tv, NULL);
+	timeval_subtract(&diff, &tv, &prof_tv0);
+	elapsed = diff.tv_sec * 1e6 + diff.tv_usec;
+	if (elapsed < 1.)
+		return;
+	per_us = (prof_ticks() - prof_ticks0) / elapsed;
+	recent = malloc(PROF_RING * sizeof(*recent));
+	if (!recent)
+		return;
+
+	applog(LOG_INFO, "profile over %.1fs, %.1f ticks/us", elapsed * 1e-6, per_us);
+	for (i = 0; i < prof_nslots; i++) {
+		struct prof_slot *p = prof_slots[i];
+		uint32_t head = __atomic_load_n(&p->head, __ATOMIC_ACQUIRE);
+		uint32_t n = head < PROF_RING ? head : PROF_RING;
+
+		if (!p->name)
+			continue;
+		for (st = 0; st < PROF_STAGES; st++) {
+			const struct prof_hist *h = &p->hist[st];
+			char mean[16], p50[16], p99[16], max[16], hist[512];
+			uint32_t k, m = 0;
+			int b, len = 0;
+
+			if (!h->count)
+				continue;
+			for (k = 0; k < n; k++)
+				if (p->ring[k].stage == (uint32_t) st)
+					recent[m++] = p->ring[k].ticks;
+			qsort(recent, m, sizeof(*recent), prof_cmp);
+
+			prof_format(mean, h->sum / per_us / h->count);
+			prof_format(max, h->max / per_us);
+			strcpy(p50, "-");
+			strcpy(p99, "-");
+			if (m) {
+				prof_format(p50, recent[m / 2] / per_us);
+				prof_format(p99, recent[m * 99 / 100] / per_us);
+			}
+			applog(LOG_INFO, "%s %d: %-10s %8" PRIu64 " calls, %5.1f%%, mean %s, p50 %s, p99 %s, max %s",
+				p->name, p->id, prof_names[st] ? prof_names[st] : "?",
+				h->count, 100. * h->sum / per_us / elapsed,
+				mean, p50, p99, max);
+
+			/* log2 histogram, upper bound of each bucket */
+			hist[0] = '\0';
+			for (b = 0; b < PROF_BUCKETS && len < (int) sizeof(hist) - 40; b++) {
+				char bound[16];
+				if (!h->bucket[b])
+					continue;
+				prof_format(bound, (double) (1ULL << b) * 2. / per_us);
+				len += sprintf(hist + len, " <%s:%" PRIu64, bound, h->bucket[b]);
+			}
+			applog(LOG_INFO, "%s %d: %-10s%s", p->name, p->id, "", hist);
+		}
+	}
+	free(recent);
+}
+
+#ifndef WIN32
+static void *prof_signal_thread(void *arg)
+{
+	sigset_t *set = arg;
+	int sig;
+
+	while (!sigwait(set, &sig)) {
+		if (sig == SIGUSR1) {
+			prof_dump();
+			continue;
+		}
+		applog(LOG_INFO, "%s received, exiting",
+			sig == SIGINT ? "SIGINT" : "SIGTERM");
+		exit(0);
+	}
+	return NULL;
+}
+#endif
+
+/*
+ * Allocate the slots, to be called before the other threads start: they
+ * inherit a signal mask with SIGUSR1/SIGINT/SIGTERM blocked, so those
+ * are taken by a thread of ours that can safely dump and exit.
+ */
+void prof_init(int threads)
+{
+	int i;
+
+	if (!opt_profile)
+		return;
+	prof_slots = calloc(threads, sizeof(*prof_slots));
+	if (!prof_slots) {
+		opt_profile = false;
+		return;
+	}
+	for (i = 0; i < threads; i++) {
+		prof_slots[i] = calloc(1, sizeof(**prof_slots));
+		if (!prof_slots[i]) {
+			opt_profile = false;
+			return;
+		}
+	}
+	prof_nslots = threads;
+	gettimeofday(&prof_tv0, NULL);
+	prof_ticks0 = prof_ticks();
+	atexit(prof_dump);
+
+#ifndef WIN32
+	{
+		static sigset_t set;
+		pthread_t pth;
+
+		sigemptyset(&set);
+		sigaddset(&set, SIGUSR1);
+		sigaddset(&set, SIGINT);
+		sigaddset(&set, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
+		if (pthread_create(&pth, NULL, prof_signal_thread, &set)) {
+			applog(LOG_ERR, "profile signal thread create failed");
+			pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+		}
+	}
+#endif
+}